@@ -133,5 +133,26 @@ end";
             Assert.That(diagnostics[0].Position.LineNumber, Is.EqualTo(13));
             Assert.That(diagnostics[0].Position.Column, Is.EqualTo(3));
         }
+
+        [Test]
+        public void Parallel_ImpureFunction()
+        {
+            var source = @"private int Logged(int x)
+begin
+  Print(x)
+  return x
+end
+
+private int Main()
+begin
+  return Parallel.Sum(Logged, 0, 10)
+end";
+            (var _, var diagnostics) = CompileStringWithDiagnostics(source);
+
+            Assert.That(diagnostics, Has.Exactly(1).Items);
+            Assert.That(diagnostics[0].Diagnostic, Is.EqualTo(DiagnosticCode.FunctionNotPure));
+            Assert.That(diagnostics[0].AssociatedToken, Is.EqualTo("Logged"));
+            Assert.That(diagnostics[0].Position.LineNumber, Is.EqualTo(9));
+        }
     }
 }
@@ -904,5 +904,64 @@ PushLocal   a
 Return";
             VerifyDisassembly(func, program, funcDis);
         }
+
+        [Test]
+        public void Array_CreateAndAccess()
+        {
+            var source = @"private int Main()
+begin
+  int[] a Array.NewInt(3)
+  Array.Set(a, 0, 5)
+  return Array.Get(a, 0)
+end";
+            var program = CompileStringWithoutDiagnostics(source);
+
+            var mainDis = @"
+Int main() [1 locals]
+PushConst   $literal_3
+NewArray    IntArray
+PopLocal    a
+PushLocal   a
+PushConst   $literal_0
+PushConst   $literal_5
+StoreElement
+PushLocal   a
+PushConst   $literal_0
+LoadElement
+Return";
+            VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, mainDis);
+        }
+
+        [Test]
+        public void Parallel_SumAndCount()
+        {
+            var source = @"private int Square(int x)
+begin
+  return *(x, x)
+end
+
+private bool IsEven(int x)
+begin
+  return ==(%(x, 2), 0)
+end
+
+private int Main()
+begin
+  return +(Parallel.Sum(Square, 0, 10), Parallel.Count(IsEven, 1, 10))
+end";
+            var program = CompileStringWithoutDiagnostics(source);
+
+            var mainDis = @"
+Int main() [0 locals]
+PushConst   $literal_0
+PushConst   $literal_10
+CallParallel square
+PushConst   $literal_1
+PushConst   $literal_10
+CallParallel iseven
+CallI2      Plus
+Return";
+            VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, mainDis);
+        }
     }
 }
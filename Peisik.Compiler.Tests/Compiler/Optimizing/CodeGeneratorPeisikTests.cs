@@ -9,7 +9,7 @@ namespace Polsys.Peisik.Tests.Compiler.Optimizing
 {
     class CodeGeneratorPeisikTests : CompilerTestBase
     {
-        private CompiledProgram CompileSingleFunction(string source)
+        private CompiledProgram CompileSingleFunction(string source, Optimization optimizationLevel = Optimization.None)
         {
             var syntax = ParseStringWithoutDiagnostics(source);
             var compiler = new OptimizingCompiler(new List<ModuleSyntax>() { syntax }, Optimization.None);
@@ -17,7 +17,7 @@ namespace Polsys.Peisik.Tests.Compiler.Optimizing
             function.Compile();
             var codeGen = new CodeGeneratorPeisik();
 
-            codeGen.CompileFunction(function, Optimization.None);
+            codeGen.CompileFunction(function, optimizationLevel);
             return codeGen.GetProgram();
         }
 
@@ -593,6 +593,58 @@ Return";
             VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, disasm);
         }
 
+        [Test]
+        public void InstructionFusion_ImmediateOperands()
+        {
+            var source = @"
+private int Main()
+begin
+  int a 3
+  a = -(a, 1)
+  a = *(2, a)
+  a = -(1, a)
+  return a
+end";
+            var program = CompileSingleFunction(source, Optimization.InstructionFusion);
+
+            // Minus is not commutative, so a constant left operand is pushed
+            var disasm = @"Int main() [1 locals]
+PushImm     3
+PopLocal    a$1
+PushLocal   a$1
+MinusImm    1
+PopLocal    a$1
+PushLocal   a$1
+MultiplyImm 2
+PopLocal    a$1
+PushImm     1
+PushLocal   a$1
+CallI2      Minus
+PopLocal    a$1
+PushLocal   a$1
+Return";
+            VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, disasm);
+            Assert.That(program.Constants, Is.Empty);
+        }
+
+        [Test]
+        public void InstructionFusion_LargeConstantsUseConstantTable()
+        {
+            var source = @"
+private real Main()
+begin
+  return +(40000, 1.5)
+end";
+            var program = CompileSingleFunction(source, Optimization.InstructionFusion);
+
+            var disasm = @"Real main() [0 locals]
+PushConst   $literal_40000
+PushConst   $literal_1.5r
+CallI2      Plus
+Return";
+            VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, disasm);
+        }
+
         [Test]
         public void VoidReturning()
         {
@@ -670,6 +722,69 @@ Return";
             VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, dis);
         }
 
+        [Test]
+        public void While_RealisticLoop_InstructionFusion()
+        {
+            var source = @"
+private int Main()
+begin
+  int i 0
+  while <(i, 5)
+  begin
+    i = +(i, 1)
+    print(i)
+  end
+  return i
+end";
+            var program = CompileSingleFunction(source, Optimization.InstructionFusion);
+
+            var dis = @"
+Int main() [1 locals]
+PushImm     0
+PopLocal    i$1
+PushLocal   i$1
+PushImm     5
+JumpIfNotLess +7
+PushLocal   i$1
+PlusImm     1
+PopLocal    i$1
+PushLocal   i$1
+CallI1      Print
+Jump        -8
+PushLocal   i$1
+Return";
+            VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, dis);
+        }
+
+        [Test]
+        public void If_NotEqual_InstructionFusion()
+        {
+            var source = @"
+private int Main()
+begin
+  int a 1
+  if !=(a, 2)
+  begin
+    a = 3
+  end
+  return a
+end";
+            var program = CompileSingleFunction(source, Optimization.InstructionFusion);
+
+            var dis = @"
+Int main() [1 locals]
+PushImm     1
+PopLocal    a$1
+PushLocal   a$1
+PushImm     2
+JumpIfEqual +3
+PushImm     3
+PopLocal    a$1
+PushLocal   a$1
+Return";
+            VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, dis);
+        }
+
         [Test]
         public void While_EmptyLoop_Folded()
         {
@@ -692,6 +807,97 @@ CallI2      Equal
 JumpFalse   +2
 Jump        -5
 PushConst   $literal_true
+Return";
+            VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, dis);
+        }
+
+        [Test]
+        public void Array_ElementAccess()
+        {
+            var source = @"
+private real Main()
+begin
+  real[] a Array.NewReal(4)
+  Array.Set(a, 1, 2)
+  Array.Fill(a, 0.5)
+  return +(Array.Get(a, 1), Array.Sum(a))
+end";
+            var program = CompileSingleFunction(source);
+
+            var dis = @"
+Real main() [1 locals]
+PushConst   $literal_4
+NewArray    RealArray
+PopLocal    a$1
+PushLocal   a$1
+PushConst   $literal_1
+PushConst   $literal_2r
+StoreElement
+PushLocal   a$1
+PushConst   $literal_0.5r
+CallI2      ArrayFill
+PushLocal   a$1
+PushConst   $literal_1
+LoadElement
+PushLocal   a$1
+CallI1      ArraySum
+CallI2      Plus
+Return";
+            VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, dis);
+        }
+
+        [Test]
+        public void Array_DiscardedResultIsPopped()
+        {
+            var source = @"
+private void Main()
+begin
+  int[] a Array.NewInt(4)
+  Array.Length(a)
+end";
+            var program = CompileSingleFunction(source);
+
+            var dis = @"
+Void main() [1 locals]
+PushConst   $literal_4
+NewArray    IntArray
+PopLocal    a$1
+PushLocal   a$1
+CallI1      ArrayLength
+PopDiscard
+Return";
+            VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, dis);
+        }
+
+        [Test]
+        public void Parallel_DiscardedResultIsPopped()
+        {
+            var source = @"
+private real Inverse(int x)
+begin
+  return /(1.0, x)
+end
+
+private void Main()
+begin
+  int n 5
+  real sum Parallel.Sum(Inverse, 1, n)
+  Parallel.Sum(Inverse, 1, n)
+end";
+            var program = CompileOptimizedWithoutDiagnostics(source, Optimization.None);
+
+            var dis = @"
+Void main() [2 locals]
+PushConst   $literal_5
+PopLocal    n$1
+PushConst   $literal_1
+PushLocal   n$1
+CallParallel inverse
+PopLocal    sum$2
+PushConst   $literal_1
+PushLocal   n$1
+CallParallel inverse
+PopDiscard
 Return";
             VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, dis);
         }
@@ -423,5 +423,116 @@ end";
             Assert.That(diagnostics[0].AssociatedToken, Is.EqualTo("Int"));
             Assert.That(diagnostics[0].Expected, Is.EqualTo("Bool"));
         }
+
+        [Test]
+        public void Array_ArithmeticNotAllowed()
+        {
+            var source = @"
+public void Main()
+begin
+  int[] a Array.NewInt(2)
+  int b +(a, 1)
+end";
+            (var _, var diagnostics) = CompileOptimizedWithDiagnostics(source, Optimization.None);
+
+            Assert.That(diagnostics, Has.Exactly(1).Items);
+            Assert.That(diagnostics[0].Diagnostic, Is.EqualTo(DiagnosticCode.WrongType));
+            Assert.That(diagnostics[0].AssociatedToken, Is.EqualTo("IntArray"));
+        }
+
+        [Test]
+        public void Array_WrongElementType()
+        {
+            var source = @"
+public void Main()
+begin
+  int[] a Array.NewInt(2)
+  Array.Set(a, 0, 1.5)
+end";
+            (var _, var diagnostics) = CompileOptimizedWithDiagnostics(source, Optimization.None);
+
+            Assert.That(diagnostics, Has.Exactly(1).Items);
+            Assert.That(diagnostics[0].Diagnostic, Is.EqualTo(DiagnosticCode.WrongType));
+            Assert.That(diagnostics[0].AssociatedToken, Is.EqualTo("Real"));
+            Assert.That(diagnostics[0].Expected, Is.EqualTo("Int"));
+        }
+
+        [Test]
+        public void Array_NotAnArray()
+        {
+            var source = @"
+public int Main()
+begin
+  return Array.Sum(1)
+end";
+            (var _, var diagnostics) = CompileOptimizedWithDiagnostics(source, Optimization.None);
+
+            Assert.That(diagnostics, Has.Exactly(1).Items);
+            Assert.That(diagnostics[0].Diagnostic, Is.EqualTo(DiagnosticCode.WrongType));
+            Assert.That(diagnostics[0].Expected, Is.EqualTo("IntArray|RealArray"));
+        }
+
+        [Test]
+        public void Parallel_ImpureFunction()
+        {
+            var source = @"
+private int Checked(int x)
+begin
+  if <(x, 0)
+  begin
+    FailFast()
+  end
+  return x
+end
+
+private int Indirect(int x)
+begin
+  return Checked(x)
+end
+
+public int Main()
+begin
+  return Parallel.Sum(Indirect, 0, 10)
+end";
+            (var _, var diagnostics) = CompileOptimizedWithDiagnostics(source, Optimization.None);
+
+            Assert.That(diagnostics, Has.Exactly(1).Items);
+            Assert.That(diagnostics[0].Diagnostic, Is.EqualTo(DiagnosticCode.FunctionNotPure));
+            Assert.That(diagnostics[0].AssociatedToken, Is.EqualTo("Indirect"));
+        }
+
+        [Test]
+        public void Parallel_WrongSignature()
+        {
+            var source = @"
+private bool Positive(real x)
+begin
+  return >(x, 0)
+end
+
+public int Main()
+begin
+  return Parallel.Count(Positive, 0, 10)
+end";
+            (var _, var diagnostics) = CompileOptimizedWithDiagnostics(source, Optimization.None);
+
+            Assert.That(diagnostics, Has.Exactly(1).Items);
+            Assert.That(diagnostics[0].Diagnostic, Is.EqualTo(DiagnosticCode.InvalidParallelFunction));
+            Assert.That(diagnostics[0].AssociatedToken, Is.EqualTo("Positive"));
+        }
+
+        [Test]
+        public void Parallel_NotAFunctionName()
+        {
+            var source = @"
+public int Main()
+begin
+  return Parallel.Sum(1, 0, 10)
+end";
+            (var _, var diagnostics) = CompileOptimizedWithDiagnostics(source, Optimization.None);
+
+            Assert.That(diagnostics, Has.Exactly(1).Items);
+            Assert.That(diagnostics[0].Diagnostic, Is.EqualTo(DiagnosticCode.ExpectedFunctionName));
+        }
     }
 }
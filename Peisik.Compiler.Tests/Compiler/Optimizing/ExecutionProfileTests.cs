@@ -0,0 +1,203 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using NUnit.Framework;
+using Polsys.Peisik.Compiler;
+using Polsys.Peisik.Compiler.Optimizing;
+using Polsys.Peisik.Parser;
+
+namespace Polsys.Peisik.Tests.Compiler.Optimizing
+{
+    class ExecutionProfileTests : CompilerTestBase
+    {
+        private (CompiledProgram program, List<CompilationDiagnostic> diagnostics)
+            CompileWithProfile(string source, string profile, Optimization optimizationLevel)
+        {
+            var syntax = ParseStringWithoutDiagnostics(source);
+            var compiler = new OptimizingCompiler(new List<ModuleSyntax>() { syntax }, optimizationLevel,
+                ExecutionProfile.Parse(new StringReader(profile)));
+            return compiler.Compile();
+        }
+
+        [Test]
+        public void Parse_RejectsOtherFiles()
+        {
+            Assert.That(() => ExecutionProfile.Parse(new StringReader("function 0 1")),
+                Throws.TypeOf<FormatException>());
+        }
+
+        [Test]
+        public void Parse_RejectsInvalidRecord()
+        {
+            var profile = @"peisik-profile 1
+function 0 1
+branch 0 5 -1";
+            Assert.That(() => ExecutionProfile.Parse(new StringReader(profile)),
+                Throws.TypeOf<FormatException>());
+        }
+
+        [Test]
+        public void HotCall_IsInlined()
+        {
+            var source = @"
+private int Square(int x)
+begin
+  return *(x, x)
+end
+
+public int Main()
+begin
+  int i 0
+  int sum 0
+  while <(i, 100)
+  begin
+    sum = +(sum, Square(i))
+    i = +(i, 1)
+  end
+  return sum
+end";
+            var profile = @"peisik-profile 1
+function 0 100
+function 1 1
+call 1 9 0 100
+branch 1 7 1 100
+types 0 2 3 100 Int,Int";
+            (var program, var diagnostics) = CompileWithProfile(source, profile, Optimization.None);
+
+            Assert.That(diagnostics, Is.Empty);
+            var disasm = @"Int main() [2 locals]
+PushConst   $literal_0
+PopLocal    i$1
+PushConst   $literal_0
+PopLocal    sum$2
+PushLocal   i$1
+PushConst   $literal_100
+CallI2      Less
+JumpFalse   +12
+PushLocal   sum$2
+PushLocal   i$1
+PushLocal   i$1
+CallI2      Multiply
+CallI2      Plus
+PopLocal    sum$2
+PushLocal   i$1
+PushConst   $literal_1
+CallI2      Plus
+PopLocal    i$1
+Jump        -14
+PushLocal   sum$2
+Return";
+            VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, disasm);
+        }
+
+        [Test]
+        public void ColdCall_IsNotInlined()
+        {
+            var source = @"
+private int Square(int x)
+begin
+  return *(x, x)
+end
+
+public int Main()
+begin
+  return Square(3)
+end";
+            var profile = @"peisik-profile 1
+function 1 1
+call 1 1 0 0";
+            (var program, var diagnostics) = CompileWithProfile(source, profile, Optimization.None);
+
+            Assert.That(diagnostics, Is.Empty);
+            var disasm = @"Int main() [0 locals]
+PushConst   $literal_3
+Call        square
+Return";
+            VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, disasm);
+        }
+
+        [Test]
+        public void ColdElse_IsMovedOutOfLine()
+        {
+            var source = @"
+private int Main()
+begin
+  int result 0
+  if ==(result, 0)
+  begin
+    result = 1
+  end
+  else
+  begin
+    result = 2
+  end
+  return result
+end";
+            var profile = @"peisik-profile 1
+function 0 1
+branch 0 5 0 1";
+            (var program, var diagnostics) = CompileWithProfile(source, profile, Optimization.None);
+
+            // The hot path falls through to the return without a jump over the 'else' block
+            Assert.That(diagnostics, Is.Empty);
+            var disasm = @"Int main() [1 locals]
+PushConst   $literal_0
+PopLocal    result$1
+PushLocal   result$1
+PushConst   $literal_0
+CallI2      Equal
+JumpFalse   +5
+PushConst   $literal_1
+PopLocal    result$1
+PushLocal   result$1
+Return
+PushConst   $literal_2
+PopLocal    result$1
+Jump        -4";
+            VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, disasm);
+        }
+
+        [Test]
+        public void MismatchingProfile_IsIgnoredWithWarning()
+        {
+            var source = @"
+private int Main()
+begin
+  int result 0
+  if ==(result, 0)
+  begin
+    result = 1
+  end
+  else
+  begin
+    result = 2
+  end
+  return result
+end";
+            var profile = @"peisik-profile 1
+function 0 1
+branch 0 5 0 1
+branch 0 9 0 1";
+            (var program, var diagnostics) = CompileWithProfile(source, profile, Optimization.None);
+
+            Assert.That(diagnostics, Has.Exactly(1).Items);
+            Assert.That(diagnostics[0].Diagnostic, Is.EqualTo(DiagnosticCode.ProfileDoesNotMatch));
+            Assert.That(diagnostics[0].IsError, Is.False);
+            var disasm = @"Int main() [1 locals]
+PushConst   $literal_0
+PopLocal    result$1
+PushLocal   result$1
+PushConst   $literal_0
+CallI2      Equal
+JumpFalse   +4
+PushConst   $literal_1
+PopLocal    result$1
+Jump        +3
+PushConst   $literal_2
+PopLocal    result$1
+PushLocal   result$1
+Return";
+            VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, disasm);
+        }
+    }
+}
@@ -228,7 +228,7 @@ end";
             var program = CompileOptimizedWithoutDiagnostics(source, Optimization.Full);
             
             var disasm = @"Void main() [0 locals]
-PushConst   $literal_5
+PushImm     5
 CallI1      Print
 Return";
             VerifyDisassembly(program.Functions[program.MainFunctionIndex], program, disasm);
@@ -235,6 +235,64 @@ namespace Polsys.Peisik.Tests.Compiler.Optimizing
             Assert.That(stackSize, Is.EqualTo(0));
         }
 
+        [Test]
+        public void AssignRegisters_ProfileWeightDecidesSpill()
+        {
+            var local1 = new LocalVariable(PrimitiveType.Int, "")
+            {
+                IntervalStart = 1,
+                IntervalEnd = 5,
+                ProfileWeight = 1000
+            };
+            var local2 = new LocalVariable(PrimitiveType.Bool, "")
+            {
+                IntervalStart = 2,
+                IntervalEnd = 4,
+                ProfileWeight = 10
+            };
+            var locals = new List<LocalVariable>()
+            {
+                local1,
+                local2
+            };
+
+            RegisterAllocator<TrivialRegisterBackend>.AssignRegisters(locals, out var stackSize);
+
+            // The longer interval keeps the register because it is accessed more often
+            Assert.That(local1.StorageLocation, Is.EqualTo(-1));
+            Assert.That(local2.StorageLocation, Is.EqualTo(0));
+            Assert.That(stackSize, Is.EqualTo(1));
+        }
+
+        [Test]
+        public void OrderLocationsByWeight_HotLocalGetsLowestLocation()
+        {
+            var parameter = new LocalVariable(PrimitiveType.Int, "")
+            {
+                IsParameter = true,
+                StorageLocation = 0,
+                ProfileWeight = 1
+            };
+            var cold = new LocalVariable(PrimitiveType.Int, "")
+            {
+                StorageLocation = 1,
+                ProfileWeight = 10
+            };
+            var hot = new LocalVariable(PrimitiveType.Real, "")
+            {
+                StorageLocation = 2,
+                ProfileWeight = 1000
+            };
+
+            RegisterAllocator<PeisikRegisterBackend>.OrderLocationsByWeight(
+                new List<LocalVariable>() { parameter, cold, hot });
+
+            // The parameter location is fixed
+            Assert.That(parameter.StorageLocation, Is.EqualTo(0));
+            Assert.That(hot.StorageLocation, Is.EqualTo(1));
+            Assert.That(cold.StorageLocation, Is.EqualTo(2));
+        }
+
         /// <summary>
         /// A system with a single register.
         /// </summary>
@@ -166,6 +166,17 @@ END";
             Assert.That(diagnostics[0].Diagnostic, Is.EqualTo(DiagnosticCode.VoidMayOnlyBeUsedForReturn));
         }
 
+        [Test]
+        public void ConstantDeclaration_Array_Fails()
+        {
+            (var module, var diagnostics) = ParseStringWithDiagnostics("public int[] C 1");
+
+            Assert.That(module, Is.Null);
+            Assert.That(diagnostics, Has.Exactly(1).Items);
+            Assert.That(diagnostics[0].Diagnostic, Is.EqualTo(DiagnosticCode.ArrayMayNotBeConstant));
+            Assert.That(diagnostics[0].AssociatedToken, Is.EqualTo("C"));
+        }
+
         [Test]
         public void ConstantDeclaration_WithComment()
         {
@@ -288,6 +299,20 @@ end";
             Assert.That(module.Functions[0].CodeBlock, Is.Not.Null);
         }
 
+        [Test]
+        public void Function_ArrayTypes()
+        {
+            var source = @"public real[] Scale(int[] a, real[] b)
+begin
+end";
+
+            var module = ParseStringWithoutDiagnostics(source);
+
+            Assert.That(module.Functions[0].ReturnType, Is.EqualTo(PrimitiveType.RealArray));
+            Assert.That(module.Functions[0].Parameters[0].Type, Is.EqualTo(PrimitiveType.IntArray));
+            Assert.That(module.Functions[0].Parameters[1].Type, Is.EqualTo(PrimitiveType.RealArray));
+        }
+
         [Test]
         public void Function_VoidParam()
         {
@@ -49,6 +49,8 @@ namespace Polsys.Peisik
             switch (Diagnostic)
             {
                 // Parser errors
+                case DiagnosticCode.ArrayMayNotBeConstant:
+                    return $"The constant '{AssociatedToken}' may not be an array. Arrays are created with Array.NewInt and Array.NewReal.";
                 case DiagnosticCode.ExpectedBegin:
                     return $"Expected 'begin', but received '{AssociatedToken}'.";
                 case DiagnosticCode.ExpectedEndOfLine:
@@ -83,6 +85,13 @@ namespace Polsys.Peisik
                 case DiagnosticCode.ModuleAlreadyImported:
                     return $"The module '{AssociatedToken}' is already imported.";
                 // Compiler errors
+                case DiagnosticCode.ExpectedFunctionName:
+                    return $"Expected the name of a function as the first parameter.";
+                case DiagnosticCode.FunctionNotPure:
+                    return $"The function '{AssociatedToken}' is not pure and may not be called in parallel. "
+                        + "Pure functions do not print, fail fast, use arrays or Parallel, or call functions that do.";
+                case DiagnosticCode.InvalidParallelFunction:
+                    return $"The function '{AssociatedToken}' must take one Int parameter and return {Expected} to be called in parallel.";
                 case DiagnosticCode.MainMayNotHaveParameters:
                     return $"The main function may not have parameters.";
                 case DiagnosticCode.MayNotAssignToConst:
@@ -104,6 +113,8 @@ namespace Polsys.Peisik
                 case DiagnosticCode.WrongType:
                     return $"Expected {Expected}, but received {AssociatedToken}.";
                 // Compiler warnings
+                case DiagnosticCode.ProfileDoesNotMatch:
+                    return $"The execution profile does not match the function {AssociatedToken}, which is compiled without it.";
                 case DiagnosticCode.UnreachableCode:
                     return $"This line of code is unreachable.";
                 default:
@@ -118,6 +129,7 @@ namespace Polsys.Peisik
         // These could and maybe should be organized more categorically
         Unspecified,
         // Parser errors
+        ArrayMayNotBeConstant,
         ExpectedBegin,
         ExpectedEndOfLine,
         ExpectedEndOfParameterList,
@@ -136,6 +148,9 @@ namespace Polsys.Peisik
         // Parser warnings
         ModuleAlreadyImported,
         // Compiler errors
+        ExpectedFunctionName,
+        FunctionNotPure,
+        InvalidParallelFunction,
         MainMayNotHaveParameters,
         MayNotAssignToConst,
         NameIsPrivate,
@@ -147,6 +162,7 @@ namespace Polsys.Peisik
         TooManyParameters,
         WrongType,
         // Compiler warnings
+        ProfileDoesNotMatch,
         UnreachableCode,
     }
 }
@@ -24,31 +24,40 @@ namespace Polsys.Peisik.Compiler
             sb.Append(function.Locals.Count);
             sb.AppendLine(" locals]");
 
+            // The opcode column is padded to 12 characters, with a space after the longer names
             foreach (var op in function.Bytecode)
             {
                 if (IsParameterAddress(op.Opcode))
                 {
                     // Append sign even to positive offsets, since they are relative
                     if (op.Parameter > 0)
-                        sb.AppendLine($"{op.Opcode,-12}+{op.Parameter}");
+                        sb.AppendLine($"{op.Opcode,-11} +{op.Parameter}");
                     else
-                        sb.AppendLine($"{op.Opcode,-12}{op.Parameter}");
+                        sb.AppendLine($"{op.Opcode,-11} {op.Parameter}");
                 }
                 else if (IsParameterConstant(op.Opcode))
                 {
-                    sb.AppendLine($"{op.Opcode,-12}{parent.Constants[op.Parameter].FullName}");
+                    sb.AppendLine($"{op.Opcode,-11} {parent.Constants[op.Parameter].FullName}");
                 }
                 else if (IsParameterFunction(op.Opcode))
                 {
-                    sb.AppendLine($"{op.Opcode,-12}{parent.Functions[op.Parameter].FullName}");
+                    sb.AppendLine($"{op.Opcode,-11} {parent.Functions[op.Parameter].FullName}");
                 }
                 else if (IsParameterInternalFunction(op.Opcode))
                 {
-                    sb.AppendLine($"{op.Opcode,-12}{(InternalFunction)op.Parameter}");
+                    sb.AppendLine($"{op.Opcode,-11} {(InternalFunction)op.Parameter}");
                 }
                 else if (IsParameterLocal(op.Opcode))
                 {
-                    sb.AppendLine($"{op.Opcode,-12}{GetLocalName(function, op.Parameter)}");
+                    sb.AppendLine($"{op.Opcode,-11} {GetLocalName(function, op.Parameter)}");
+                }
+                else if (IsParameterImmediate(op.Opcode))
+                {
+                    sb.AppendLine($"{op.Opcode,-11} {op.Parameter}");
+                }
+                else if (op.Opcode == Opcode.NewArray)
+                {
+                    sb.AppendLine($"{op.Opcode,-11} {(PrimitiveType)op.Parameter}");
                 }
                 else
                 {
@@ -65,6 +74,12 @@ namespace Polsys.Peisik.Compiler
             {
                 case Opcode.Jump:
                 case Opcode.JumpFalse:
+                case Opcode.JumpIfNotLess:
+                case Opcode.JumpIfNotLessEqual:
+                case Opcode.JumpIfNotGreater:
+                case Opcode.JumpIfNotGreaterEqual:
+                case Opcode.JumpIfNotEqual:
+                case Opcode.JumpIfEqual:
                     return true;
                 default:
                     return false;
@@ -84,7 +99,7 @@ namespace Polsys.Peisik.Compiler
 
         private static bool IsParameterFunction(Opcode opcode)
         {
-            if (opcode == Opcode.Call)
+            if (opcode == Opcode.Call || opcode == Opcode.CallParallel)
                 return true;
             else
                 return false;
@@ -110,6 +125,20 @@ namespace Polsys.Peisik.Compiler
             }
         }
 
+        private static bool IsParameterImmediate(Opcode opcode)
+        {
+            switch (opcode)
+            {
+                case Opcode.PushImm:
+                case Opcode.PlusImm:
+                case Opcode.MinusImm:
+                case Opcode.MultiplyImm:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
         private static string GetLocalName(CompiledFunction function, short index)
         {
             return function.Locals[index].name;
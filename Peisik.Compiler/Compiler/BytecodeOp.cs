@@ -37,7 +37,21 @@
         CallI4,
         CallI5,
         CallI6,
-        CallI7
+        CallI7,
+        PushImm,
+        PlusImm,
+        MinusImm,
+        MultiplyImm,
+        JumpIfNotLess,
+        JumpIfNotLessEqual,
+        JumpIfNotGreater,
+        JumpIfNotGreaterEqual,
+        JumpIfNotEqual,
+        JumpIfEqual,
+        NewArray,
+        LoadElement,
+        StoreElement,
+        CallParallel
     }
 
     internal enum InternalFunction : short
@@ -76,6 +90,20 @@
         MathRound,
         MathSin,
         MathSqrt,
-        MathTan
+        MathTan,
+        // Array module
+        ArrayAdd,
+        ArrayDot,
+        ArrayFill,
+        ArrayGet,
+        ArrayLength,
+        ArrayMultiply,
+        ArrayNewInt,
+        ArrayNewReal,
+        ArraySet,
+        ArraySum,
+        // Parallel module
+        ParallelCount,
+        ParallelSum
     }
 }
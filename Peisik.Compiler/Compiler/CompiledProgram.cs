@@ -7,7 +7,10 @@ namespace Polsys.Peisik.Compiler
 {
     internal class CompiledProgram
     {
-        public int BytecodeVersion { get { return 6; } }
+        public int BytecodeVersion { get { return 9; } }
+
+        // Set in the version field if the bytecode is stored in the compact encoding
+        public const int CompactEncodingFlag = 0x10000;
 
         public List<CompiledConstant> Constants { get; private set; }
 
@@ -22,10 +25,15 @@ namespace Polsys.Peisik.Compiler
         }
 
         public void Serialize(BinaryWriter writer)
+        {
+            Serialize(writer, false);
+        }
+
+        public void Serialize(BinaryWriter writer, bool compact)
         {
             // Header
             writer.Write(new char[] { 'P', 'E', 'I', 'S' }, 0, 4);
-            writer.Write(BytecodeVersion);
+            writer.Write(compact ? BytecodeVersion | CompactEncodingFlag : BytecodeVersion);
             writer.Write(MainFunctionIndex);
 
             // Constants - each entry is 16-byte aligned
@@ -73,13 +81,52 @@ namespace Polsys.Peisik.Compiler
                     writer.Write((short)0);
 
                 // Bytecode
-                writer.Write(f.Bytecode.Count);
-                foreach (var op in f.Bytecode)
+                if (compact)
+                {
+                    // The size is in bytes, and the code is padded to 4 bytes
+                    var code = EncodeCompact(f.Bytecode);
+                    writer.Write(code.Count);
+                    writer.Write(code.ToArray());
+                    for (var i = code.Count; i % 4 != 0; i++)
+                        writer.Write((byte)0);
+                }
+                else
+                {
+                    writer.Write(f.Bytecode.Count);
+                    foreach (var op in f.Bytecode)
+                    {
+                        writer.Write((short)op.Opcode);
+                        writer.Write(op.Parameter);
+                    }
+                }
+            }
+        }
+
+        private static List<byte> EncodeCompact(List<BytecodeOp> bytecode)
+        {
+            // 1-byte opcode followed by the parameter as a signed LEB128 number,
+            // except for the instructions that have no parameter
+            var result = new List<byte>();
+            foreach (var op in bytecode)
+            {
+                result.Add((byte)op.Opcode);
+                if (op.Opcode == Opcode.Return || op.Opcode == Opcode.PopDiscard ||
+                    op.Opcode == Opcode.LoadElement || op.Opcode == Opcode.StoreElement)
+                    continue;
+
+                int value = op.Parameter;
+                while (true)
                 {
-                    writer.Write((short)op.Opcode);
-                    writer.Write(op.Parameter);
+                    var b = (byte)(value & 0x7F);
+                    value >>= 7;
+
+                    var done = (value == 0 && (b & 0x40) == 0) || (value == -1 && (b & 0x40) != 0);
+                    result.Add(done ? b : (byte)(b | 0x80));
+                    if (done)
+                        break;
                 }
             }
+            return result;
         }
     }
 }
@@ -40,6 +40,18 @@ namespace Polsys.Peisik.Compiler
                 { "math.sin", new InternalFunctionDefinition(InternalFunction.MathSin, 1, 1, ParameterConstraint.AnyNumericType, InternalReturnType.Real) },
                 { "math.sqrt", new InternalFunctionDefinition(InternalFunction.MathSqrt, 1, 1, ParameterConstraint.AnyNumericType, InternalReturnType.Real) },
                 { "math.tan", new InternalFunctionDefinition(InternalFunction.MathTan, 1, 1, ParameterConstraint.AnyNumericType, InternalReturnType.Real) },
+                { "array.add", new InternalFunctionDefinition(InternalFunction.ArrayAdd, 2, 2, ParameterConstraint.Array, InternalReturnType.Void) },
+                { "array.dot", new InternalFunctionDefinition(InternalFunction.ArrayDot, 2, 2, ParameterConstraint.Array, InternalReturnType.ElementType) },
+                { "array.fill", new InternalFunctionDefinition(InternalFunction.ArrayFill, 2, 2, ParameterConstraint.ArrayAndElement, InternalReturnType.Void) },
+                { "array.get", new InternalFunctionDefinition(InternalFunction.ArrayGet, 2, 2, ParameterConstraint.ArrayAndIndex, InternalReturnType.ElementType) },
+                { "array.length", new InternalFunctionDefinition(InternalFunction.ArrayLength, 1, 1, ParameterConstraint.Array, InternalReturnType.Int) },
+                { "array.multiply", new InternalFunctionDefinition(InternalFunction.ArrayMultiply, 2, 2, ParameterConstraint.Array, InternalReturnType.Void) },
+                { "array.newint", new InternalFunctionDefinition(InternalFunction.ArrayNewInt, 1, 1, ParameterConstraint.Int, InternalReturnType.IntArray) },
+                { "array.newreal", new InternalFunctionDefinition(InternalFunction.ArrayNewReal, 1, 1, ParameterConstraint.Int, InternalReturnType.RealArray) },
+                { "array.set", new InternalFunctionDefinition(InternalFunction.ArraySet, 3, 3, ParameterConstraint.ArrayIndexAndElement, InternalReturnType.Void) },
+                { "array.sum", new InternalFunctionDefinition(InternalFunction.ArraySum, 1, 1, ParameterConstraint.Array, InternalReturnType.ElementType) },
+                { "parallel.count", new InternalFunctionDefinition(InternalFunction.ParallelCount, 3, 3, ParameterConstraint.FunctionAndRange, InternalReturnType.Int) },
+                { "parallel.sum", new InternalFunctionDefinition(InternalFunction.ParallelSum, 3, 3, ParameterConstraint.FunctionAndRange, InternalReturnType.FunctionResult) },
         };
     }
 
@@ -60,6 +72,41 @@ namespace Polsys.Peisik.Compiler
             ParamConstraint = paramConstraint;
             ReturnType = returnType;
         }
+
+        /// <summary>
+        /// True if the function is in the Array module.
+        /// </summary>
+        public bool IsArrayFunction => Index >= InternalFunction.ArrayAdd && Index <= InternalFunction.ArraySum;
+
+        /// <summary>
+        /// True if the first parameter must be an array and the others are typed by it.
+        /// </summary>
+        public bool HasArrayParameters => ParamConstraint == ParameterConstraint.Array
+            || ParamConstraint == ParameterConstraint.ArrayAndElement
+            || ParamConstraint == ParameterConstraint.ArrayAndIndex
+            || ParamConstraint == ParameterConstraint.ArrayIndexAndElement;
+
+        /// <summary>
+        /// Gets the type required of a parameter after the first one when <see cref="HasArrayParameters"/> is true.
+        /// </summary>
+        /// <param name="index">The index of the parameter, at least 1.</param>
+        /// <param name="arrayType">The type of the first parameter.</param>
+        public PrimitiveType GetArrayParameterType(int index, PrimitiveType arrayType)
+        {
+            switch (ParamConstraint)
+            {
+                case ParameterConstraint.Array:
+                    return arrayType;
+                case ParameterConstraint.ArrayAndElement:
+                    return arrayType.GetElementType();
+                case ParameterConstraint.ArrayAndIndex:
+                    return PrimitiveType.Int;
+                case ParameterConstraint.ArrayIndexAndElement:
+                    return index == 1 ? PrimitiveType.Int : arrayType.GetElementType();
+                default:
+                    return PrimitiveType.NoType;
+            }
+        }
     }
 
     internal enum ParameterConstraint
@@ -83,7 +130,27 @@ namespace Polsys.Peisik.Compiler
         /// <summary>
         /// The parameters must be integers.
         /// </summary>
-        Int
+        Int,
+        /// <summary>
+        /// The parameters must be arrays of the same type.
+        /// </summary>
+        Array,
+        /// <summary>
+        /// An array followed by a value of its element type.
+        /// </summary>
+        ArrayAndElement,
+        /// <summary>
+        /// An array followed by an integer index.
+        /// </summary>
+        ArrayAndIndex,
+        /// <summary>
+        /// An array followed by an integer index and a value of its element type.
+        /// </summary>
+        ArrayIndexAndElement,
+        /// <summary>
+        /// The name of a pure function followed by the integer start and end of a range.
+        /// </summary>
+        FunctionAndRange
     }
 
     internal enum InternalReturnType
@@ -96,6 +163,16 @@ namespace Polsys.Peisik.Compiler
         /// <summary>
         /// Real if there are real parameters.
         /// </summary>
-        RealOrInt
+        RealOrInt,
+        /// <summary>
+        /// The element type of the array parameter.
+        /// </summary>
+        ElementType,
+        IntArray,
+        RealArray,
+        /// <summary>
+        /// The return type of the function parameter.
+        /// </summary>
+        FunctionResult
     }
 }
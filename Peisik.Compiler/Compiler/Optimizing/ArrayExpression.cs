@@ -0,0 +1,71 @@
+﻿using System;
+using System.Collections.Generic;
+
+namespace Polsys.Peisik.Compiler.Optimizing
+{
+    /// <summary>
+    /// Represents a call to a function of the Array module.
+    /// These have side effects or depend on the array contents, so they are never folded away.
+    /// </summary>
+    internal class ArrayExpression : Expression
+    {
+        public List<Expression> Parameters { get; private set; }
+        public bool DiscardResult { get; private set; }
+
+        public InternalFunction InternalFunctionId => _internalFunction.Index;
+        private InternalFunctionDefinition _internalFunction;
+
+        public ArrayExpression(InternalFunctionDefinition func, List<Expression> parameters, bool discardResult)
+        {
+            Parameters = parameters;
+            DiscardResult = discardResult;
+            _internalFunction = func;
+
+            switch (func.ReturnType)
+            {
+                case InternalReturnType.ElementType:
+                    Type = parameters[0].Type.GetElementType();
+                    break;
+                case InternalReturnType.Int:
+                    Type = PrimitiveType.Int;
+                    break;
+                case InternalReturnType.IntArray:
+                    Type = PrimitiveType.IntArray;
+                    break;
+                case InternalReturnType.RealArray:
+                    Type = PrimitiveType.RealArray;
+                    break;
+                case InternalReturnType.Void:
+                    Type = PrimitiveType.Void;
+                    break;
+                default:
+                    throw new NotImplementedException("Unimplemented InternalReturnType");
+            }
+        }
+
+        public override Expression Fold(OptimizingCompiler compiler)
+        {
+            // CODE SMELL: Immutability violation
+            for (var i = 0; i < Parameters.Count; i++)
+                Parameters[i] = Parameters[i].Fold(compiler);
+
+            return this;
+        }
+
+        internal override Expression ReplaceCalls(Func<FunctionCallExpression, Expression> replace)
+        {
+            for (var i = 0; i < Parameters.Count; i++)
+                Parameters[i] = Parameters[i].ReplaceCalls(replace);
+
+            return this;
+        }
+
+        protected override void SetStore(LocalVariable newStore, OptimizingCompiler compiler, TokenPosition position = default)
+        {
+            if (DiscardResult && newStore != null)
+                throw new InvalidOperationException("Cannot set Store when DiscardResult is true");
+
+            base.SetStore(newStore, compiler, position);
+        }
+    }
+}
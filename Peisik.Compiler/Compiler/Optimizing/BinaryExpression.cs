@@ -11,6 +11,7 @@ namespace Polsys.Peisik.Compiler.Optimizing
         public Expression Right { get; private set; }
 
         public InternalFunction InternalFunctionId => _internalFunction.Index;
+        internal InternalFunctionDefinition InternalFunctionDefinition => _internalFunction;
         private InternalFunctionDefinition _internalFunction;
 
         public BinaryExpression(InternalFunctionDefinition func, Expression left, Expression right)
@@ -56,6 +57,13 @@ namespace Polsys.Peisik.Compiler.Optimizing
             return this;
         }
 
+        internal override Expression ReplaceCalls(Func<FunctionCallExpression, Expression> replace)
+        {
+            Left = Left.ReplaceCalls(replace);
+            Right = Right.ReplaceCalls(replace);
+            return this;
+        }
+
         private Expression FoldTwoConstants(ConstantExpression leftConst,
             ConstantExpression rightConst, OptimizingCompiler compiler)
         {
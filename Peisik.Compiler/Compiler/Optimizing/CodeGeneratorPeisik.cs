@@ -14,6 +14,20 @@ namespace Polsys.Peisik.Compiler.Optimizing
         Dictionary<string, short> _constants = new Dictionary<string, short>();
         Dictionary<string, short> _functionIndices = new Dictionary<string, short>();
 
+        bool _fuseInstructions;
+
+        /// <summary>
+        /// The 'else' blocks that are emitted after the rest of the function, see <see cref="CompileIf"/>.
+        /// </summary>
+        List<(Expression block, int jumpPosition, Opcode jumpOpcode, int returnPosition)> _coldBlocks =
+            new List<(Expression, int, Opcode, int)>();
+        bool _compilingColdBlocks;
+
+        /// <summary>
+        /// An 'else' block is moved out of line if the 'then' block was run this many times more often.
+        /// </summary>
+        const long ColdBranchRatio = 4;
+
         public CodeGeneratorPeisik()
         {
         }
@@ -52,6 +66,8 @@ namespace Polsys.Peisik.Compiler.Optimizing
                 _program.MainFunctionIndex = functionIndex;
             }
 
+            _fuseInstructions = optimizationLevel.HasFlag(Optimization.InstructionFusion);
+
             // Remove redundant locals
             FoldSingleUseLocals(function);
 
@@ -92,8 +108,9 @@ namespace Polsys.Peisik.Compiler.Optimizing
                 }
             }
 
-            // Then compile the code
+            // Then compile the code, followed by the blocks moved out of line
             CompileExpression(function.ExpressionTree, function, compiled);
+            CompileColdBlocks(function, compiled);
             _program.Functions.Add(compiled);
         }
 
@@ -110,11 +127,11 @@ namespace Polsys.Peisik.Compiler.Optimizing
         {
             switch (expression)
             {
+                case ArrayExpression array:
+                    CompileArray(array, function, compiled);
+                    break;
                 case BinaryExpression binary:
-                    CompileExpression(binary.Left, function, compiled);
-                    CompileExpression(binary.Right, function, compiled);
-                    compiled.Bytecode.Add(new BytecodeOp(Opcode.CallI2, (short)binary.InternalFunctionId));
-                    EmitStore(binary.Store, compiled);
+                    CompileBinary(binary, function, compiled);
                     break;
                 case ConstantExpression c:
                     EmitPush(c, compiled);
@@ -133,6 +150,14 @@ namespace Polsys.Peisik.Compiler.Optimizing
                     EmitPush(load.Local, compiled);
                     EmitStore(load.Store, compiled);
                     break;
+                case ParallelExpression parallel:
+                    CompileExpression(parallel.From, function, compiled);
+                    CompileExpression(parallel.To, function, compiled);
+                    compiled.Bytecode.Add(new BytecodeOp(Opcode.CallParallel, GetFunctionIndex(parallel.Callee.FullName)));
+                    if (parallel.DiscardResult)
+                        compiled.Bytecode.Add(new BytecodeOp(Opcode.PopDiscard, 0));
+                    EmitStore(parallel.Store, compiled);
+                    break;
                 case PrintExpression print:
                     CompilePrint(print, function, compiled);
                     break;
@@ -158,6 +183,65 @@ namespace Polsys.Peisik.Compiler.Optimizing
             }
         }
 
+        private void CompileBinary(BinaryExpression binary, Function function, CompiledFunction compiled)
+        {
+            var immediateOp = _fuseInstructions ? GetImmediateOpcode(binary.InternalFunctionId) : Opcode.Invalid;
+
+            if (immediateOp != Opcode.Invalid && TryGetImmediate(binary.Right, out var right))
+            {
+                // The constant is passed as the instruction parameter
+                CompileExpression(binary.Left, function, compiled);
+                compiled.Bytecode.Add(new BytecodeOp(immediateOp, right));
+            }
+            else if (immediateOp != Opcode.Invalid && immediateOp != Opcode.MinusImm
+                && TryGetImmediate(binary.Left, out var left))
+            {
+                // Plus and Multiply are commutative, and evaluating the constant later has no visible effect
+                CompileExpression(binary.Right, function, compiled);
+                compiled.Bytecode.Add(new BytecodeOp(immediateOp, left));
+            }
+            else
+            {
+                CompileExpression(binary.Left, function, compiled);
+                CompileExpression(binary.Right, function, compiled);
+                compiled.Bytecode.Add(new BytecodeOp(Opcode.CallI2, (short)binary.InternalFunctionId));
+            }
+            EmitStore(binary.Store, compiled);
+        }
+
+        private void CompileArray(ArrayExpression array, Function function, CompiledFunction compiled)
+        {
+            foreach (var param in array.Parameters)
+            {
+                CompileExpression(param, function, compiled);
+            }
+
+            // Element access and array creation have their own instructions
+            switch (array.InternalFunctionId)
+            {
+                case InternalFunction.ArrayGet:
+                    compiled.Bytecode.Add(new BytecodeOp(Opcode.LoadElement, 0));
+                    break;
+                case InternalFunction.ArrayNewInt:
+                case InternalFunction.ArrayNewReal:
+                    compiled.Bytecode.Add(new BytecodeOp(Opcode.NewArray, (short)array.Type));
+                    break;
+                case InternalFunction.ArraySet:
+                    compiled.Bytecode.Add(new BytecodeOp(Opcode.StoreElement, 0));
+                    break;
+                default:
+                    var opcode = (Opcode)((int)Opcode.CallI0 + array.Parameters.Count);
+                    compiled.Bytecode.Add(new BytecodeOp(opcode, (short)array.InternalFunctionId));
+                    break;
+            }
+
+            if (array.DiscardResult && array.Type != PrimitiveType.Void)
+            {
+                compiled.Bytecode.Add(new BytecodeOp(Opcode.PopDiscard, 0));
+            }
+            EmitStore(array.Store, compiled);
+        }
+
         private void CompileCall(FunctionCallExpression call, Function function, CompiledFunction compiled)
         {
             // Load each parameter onto the execution stack
@@ -179,10 +263,48 @@ namespace Polsys.Peisik.Compiler.Optimizing
             EmitStore(call.Store, compiled);
         }
 
+        /// <summary>
+        /// Emits the code for a condition that is followed by a jump taken if the condition is false.
+        /// Returns the opcode of that jump.
+        /// </summary>
+        private Opcode CompileCondition(Expression condition, Function function, CompiledFunction compiled)
+        {
+            // A comparison can be fused with the jump
+            if (_fuseInstructions && condition is BinaryExpression binary && binary.Store == null)
+            {
+                var jumpOp = GetFusedJumpOpcode(binary.InternalFunctionId);
+                if (jumpOp != Opcode.Invalid)
+                {
+                    CompileExpression(binary.Left, function, compiled);
+                    CompileExpression(binary.Right, function, compiled);
+                    return jumpOp;
+                }
+            }
+
+            CompileExpression(condition, function, compiled);
+            return Opcode.JumpFalse;
+        }
+
         private void CompileIf(IfExpression cond, Function function, CompiledFunction compiled)
         {
             // Emit the condition check
-            CompileExpression(cond.Condition, function, compiled);
+            var elseJumpOpcode = CompileCondition(cond.Condition, function, compiled);
+
+            if (IsElseCold(cond))
+            {
+                // The 'else' block is emitted after the function and jumps back,
+                // so that the hot path falls through without the jump over the 'else' block
+                // The jump position is fixed up once the block is emitted
+                var coldBlockIndex = _coldBlocks.Count;
+                var coldJumpPosition = compiled.Bytecode.Count;
+                _coldBlocks.Add((cond.ElseExpression, coldJumpPosition, elseJumpOpcode, -1));
+                compiled.Bytecode.Add(new BytecodeOp(Opcode.Invalid, 0));
+                CompileExpression(cond.ThenExpression, function, compiled);
+
+                // The 'then' block may have added blocks of its own
+                _coldBlocks[coldBlockIndex] = (cond.ElseExpression, coldJumpPosition, elseJumpOpcode, compiled.Bytecode.Count);
+                return;
+            }
 
             // If false, jump to the 'else' block
             // As we don't know the length of the 'then' block yet, keep a reference for a later fixup
@@ -212,7 +334,34 @@ namespace Polsys.Peisik.Compiler.Optimizing
                 // +1 comes from the fact that the jump instruction itself is counted
                 compiled.Bytecode[endJumpPosition] = new BytecodeOp(Opcode.Jump, (short)(elseLength + 1));
             }
-            compiled.Bytecode[elseJumpPosition] = new BytecodeOp(Opcode.JumpFalse, (short)(thenLength + 1));
+            compiled.Bytecode[elseJumpPosition] = new BytecodeOp(elseJumpOpcode, (short)(thenLength + 1));
+        }
+
+        /// <summary>
+        /// Returns true if the execution profile shows that the 'then' block is hot and the 'else' block is not.
+        /// </summary>
+        private bool IsElseCold(IfExpression cond)
+        {
+            if (_compilingColdBlocks || cond.ElseExpression == null || !cond.BranchCounts.HasValue)
+                return false;
+
+            (var falseCount, var trueCount) = cond.BranchCounts.Value;
+            return trueCount > 0 && trueCount >= ColdBranchRatio * falseCount;
+        }
+
+        private void CompileColdBlocks(Function function, CompiledFunction compiled)
+        {
+            // The 'if' statements in the cold blocks are laid out normally
+            _compilingColdBlocks = true;
+            foreach ((var block, var jumpPosition, var jumpOpcode, var returnPosition) in _coldBlocks)
+            {
+                compiled.Bytecode[jumpPosition] = new BytecodeOp(jumpOpcode, (short)(compiled.Bytecode.Count - jumpPosition));
+                CompileExpression(block, function, compiled);
+                if (!block.GetGuaranteesReturn())
+                    compiled.Bytecode.Add(new BytecodeOp(Opcode.Jump, (short)(returnPosition - compiled.Bytecode.Count)));
+            }
+            _coldBlocks.Clear();
+            _compilingColdBlocks = false;
         }
 
         private void CompilePrint(PrintExpression print, Function function, CompiledFunction compiled)
@@ -245,7 +394,7 @@ namespace Polsys.Peisik.Compiler.Optimizing
         {
             // Emit the condition check
             var startPosition = compiled.Bytecode.Count;
-            CompileExpression(loop.Condition, function, compiled);
+            var exitJumpOpcode = CompileCondition(loop.Condition, function, compiled);
 
             // If the condition is false, jump to the end
             // We just don't know the jump target yet
@@ -261,7 +410,7 @@ namespace Polsys.Peisik.Compiler.Optimizing
             compiled.Bytecode.Add(new BytecodeOp(Opcode.Jump, (short)(1 - bodyLength - conditionLength)));
 
             // Fix up the exit jump
-            compiled.Bytecode[exitJumpPosition] = new BytecodeOp(Opcode.JumpFalse, (short)(bodyLength + 1));
+            compiled.Bytecode[exitJumpPosition] = new BytecodeOp(exitJumpOpcode, (short)(bodyLength + 1));
         }
 
         private void EmitStore(LocalVariable target, CompiledFunction compiled)
@@ -280,10 +429,73 @@ namespace Polsys.Peisik.Compiler.Optimizing
 
         private void EmitPush(ConstantExpression constant, CompiledFunction compiled)
         {
+            // Small integers need no constant table entry
+            if (_fuseInstructions && TryGetImmediate(constant.Value, out var immediate))
+            {
+                compiled.Bytecode.Add(new BytecodeOp(Opcode.PushImm, immediate));
+                return;
+            }
+
             // Ensure that the constant exists in the constant table, then load it
             var constantIndex = GetConstant(constant.Value);
             compiled.Bytecode.Add(new BytecodeOp(Opcode.PushConst, constantIndex));
         }
+
+        /// <summary>
+        /// Returns true if the value is an integer that fits in an instruction parameter.
+        /// </summary>
+        private static bool TryGetImmediate(object value, out short immediate)
+        {
+            if (value is long l && l >= short.MinValue && l <= short.MaxValue)
+            {
+                immediate = (short)l;
+                return true;
+            }
+
+            immediate = 0;
+            return false;
+        }
+
+        /// <summary>
+        /// Returns true if the expression is an integer constant that fits in an instruction parameter
+        /// and is not stored in a local.
+        /// </summary>
+        private static bool TryGetImmediate(Expression expression, out short immediate)
+        {
+            if (expression is ConstantExpression constant && constant.Store == null)
+                return TryGetImmediate(constant.Value, out immediate);
+
+            immediate = 0;
+            return false;
+        }
+
+        private static Opcode GetImmediateOpcode(InternalFunction function)
+        {
+            switch (function)
+            {
+                case InternalFunction.Plus: return Opcode.PlusImm;
+                case InternalFunction.Minus: return Opcode.MinusImm;
+                case InternalFunction.Multiply: return Opcode.MultiplyImm;
+                default: return Opcode.Invalid;
+            }
+        }
+
+        /// <summary>
+        /// Returns the compare-and-branch opcode that jumps if the comparison is false.
+        /// </summary>
+        private static Opcode GetFusedJumpOpcode(InternalFunction function)
+        {
+            switch (function)
+            {
+                case InternalFunction.Less: return Opcode.JumpIfNotLess;
+                case InternalFunction.LessEqual: return Opcode.JumpIfNotLessEqual;
+                case InternalFunction.Greater: return Opcode.JumpIfNotGreater;
+                case InternalFunction.GreaterEqual: return Opcode.JumpIfNotGreaterEqual;
+                case InternalFunction.Equal: return Opcode.JumpIfNotEqual;
+                case InternalFunction.NotEqual: return Opcode.JumpIfEqual;
+                default: return Opcode.Invalid;
+            }
+        }
         
         private short GetConstant(object value)
         {
@@ -0,0 +1,221 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+
+namespace Polsys.Peisik.Compiler.Optimizing
+{
+    /// <summary>
+    /// An execution profile written by the interpreter with 'peisik --writeprofile',
+    /// used for profile-guided optimization.
+    /// </summary>
+    /// <remarks>
+    /// The profile refers to functions by their index and to call and branch sites by their instruction index
+    /// in the program that was profiled. These are mapped back to the expression tree by compiling the same
+    /// source the same way: the code generator numbers the functions in the order they are referenced,
+    /// emits one conditional jump per 'if' and 'while', and emits the calls in evaluation order.
+    /// Therefore the profile must come from a program compiled from the same source with the same
+    /// optimization level, but without a profile.
+    /// </remarks>
+    internal class ExecutionProfile
+    {
+        private Dictionary<int, long> _functionCalls = new Dictionary<int, long>();
+        private Dictionary<int, SortedList<int, long>> _callSites = new Dictionary<int, SortedList<int, long>>();
+        private Dictionary<int, SortedList<int, (long taken, long notTaken)>> _branchSites =
+            new Dictionary<int, SortedList<int, (long taken, long notTaken)>>();
+
+        /// <summary>
+        /// Gets the total number of function calls in the profile.
+        /// </summary>
+        public long TotalCallCount { get; private set; }
+
+        /// <summary>
+        /// Reads a profile.
+        /// Records of unknown kinds are ignored.
+        /// </summary>
+        /// <exception cref="FormatException">The profile is malformed.</exception>
+        public static ExecutionProfile Parse(TextReader reader)
+        {
+            var profile = new ExecutionProfile();
+
+            var header = reader.ReadLine();
+            if (header != "peisik-profile 1")
+                throw new FormatException("The file is not a supported Peisik profile.");
+
+            var lineNumber = 1;
+            string line;
+            while ((line = reader.ReadLine()) != null)
+            {
+                lineNumber++;
+                var fields = line.Split(new[] { ' ' }, StringSplitOptions.RemoveEmptyEntries);
+                if (fields.Length == 0)
+                    continue;
+
+                try
+                {
+                    switch (fields[0])
+                    {
+                        case "function":
+                            profile._functionCalls[ParseInt(fields[1])] = ParseLong(fields[2]);
+                            profile.TotalCallCount += ParseLong(fields[2]);
+                            break;
+                        case "call":
+                            GetSites(profile._callSites, ParseInt(fields[1]))
+                                .Add(ParseInt(fields[2]), ParseLong(fields[4]));
+                            break;
+                        case "branch":
+                            GetSites(profile._branchSites, ParseInt(fields[1]))
+                                .Add(ParseInt(fields[2]), (ParseLong(fields[3]), ParseLong(fields[4])));
+                            break;
+                        default:
+                            // For example the operand types of internal calls, which the compiler knows statically
+                            break;
+                    }
+                }
+                catch (Exception e) when (e is IndexOutOfRangeException || e is FormatException
+                    || e is OverflowException || e is ArgumentException)
+                {
+                    throw new FormatException($"Invalid profile record on line {lineNumber}: '{line}'.");
+                }
+            }
+
+            return profile;
+        }
+
+        /// <summary>
+        /// Annotates the functions and their call and branch sites with the profile counts.
+        /// The functions must be given in the order they are passed to the code generator.
+        /// Functions whose sites do not match the profile are left without annotations and a warning is logged.
+        /// </summary>
+        internal void Annotate(IEnumerable<Function> functions, OptimizingCompiler compiler)
+        {
+            // Replicate the function numbering of the code generator
+            var indices = new Dictionary<string, int>();
+            var sites = new List<(Function function, List<Expression> branches, List<FunctionCallExpression> calls)>();
+            foreach (var function in functions)
+            {
+                AssignIndex(indices, function.FullName);
+
+                var branches = new List<Expression>();
+                var calls = new List<FunctionCallExpression>();
+                CollectSites(function.ExpressionTree, branches, calls);
+                foreach (var call in calls)
+                    AssignIndex(indices, call.Callee.FullName);
+
+                sites.Add((function, branches, calls));
+            }
+
+            foreach ((var function, var branches, var calls) in sites)
+            {
+                var index = indices[function.FullName];
+                _branchSites.TryGetValue(index, out var branchCounts);
+                _callSites.TryGetValue(index, out var callCounts);
+
+                // The interpreter lists every site of each executed function
+                var executed = _functionCalls.ContainsKey(index);
+                if (executed && ((branchCounts?.Count ?? 0) != branches.Count || (callCounts?.Count ?? 0) != calls.Count))
+                {
+                    compiler.LogWarning(DiagnosticCode.ProfileDoesNotMatch, default, function.FullName);
+                    continue;
+                }
+
+                function.ProfileCallCount = executed ? _functionCalls[index] : 0;
+                for (var i = 0; i < branches.Count; i++)
+                {
+                    // The jump is taken when the condition is false
+                    var counts = executed ? branchCounts.Values[i] : (0, 0);
+                    if (branches[i] is IfExpression conditional)
+                        conditional.BranchCounts = (counts.taken, counts.notTaken);
+                    else
+                        ((WhileExpression)branches[i]).BranchCounts = (counts.taken, counts.notTaken);
+                }
+                for (var i = 0; i < calls.Count; i++)
+                {
+                    calls[i].ProfileCount = executed ? callCounts.Values[i] : 0;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Lists the conditional statements and function calls in the order their code is emitted.
+        /// </summary>
+        private static void CollectSites(Expression node, List<Expression> branches, List<FunctionCallExpression> calls)
+        {
+            switch (node)
+            {
+                case ArrayExpression array:
+                    foreach (var param in array.Parameters)
+                        CollectSites(param, branches, calls);
+                    break;
+                case BinaryExpression binary:
+                    CollectSites(binary.Left, branches, calls);
+                    CollectSites(binary.Right, branches, calls);
+                    break;
+                case FunctionCallExpression call:
+                    foreach (var param in call.Parameters)
+                        CollectSites(param, branches, calls);
+                    calls.Add(call);
+                    break;
+                case IfExpression conditional:
+                    // The jump follows the condition, which cannot contain conditional statements
+                    branches.Add(conditional);
+                    CollectSites(conditional.Condition, branches, calls);
+                    CollectSites(conditional.ThenExpression, branches, calls);
+                    CollectSites(conditional.ElseExpression, branches, calls);
+                    break;
+                case ParallelExpression parallel:
+                    CollectSites(parallel.From, branches, calls);
+                    CollectSites(parallel.To, branches, calls);
+                    break;
+                case PrintExpression print:
+                    foreach (var expr in print.Expressions)
+                        CollectSites(expr, branches, calls);
+                    break;
+                case ReturnExpression ret:
+                    CollectSites(ret.Value, branches, calls);
+                    break;
+                case SequenceExpression sequence:
+                    foreach (var expr in sequence.Expressions)
+                        CollectSites(expr, branches, calls);
+                    break;
+                case UnaryExpression unary:
+                    CollectSites(unary.Expression, branches, calls);
+                    break;
+                case WhileExpression loop:
+                    branches.Add(loop);
+                    CollectSites(loop.Condition, branches, calls);
+                    CollectSites(loop.Body, branches, calls);
+                    break;
+                default:
+                    // Constants, local loads and FailFast contain no sites
+                    break;
+            }
+        }
+
+        private static void AssignIndex(Dictionary<string, int> indices, string fullName)
+        {
+            if (!indices.ContainsKey(fullName))
+                indices.Add(fullName, indices.Count);
+        }
+
+        private static SortedList<int, T> GetSites<T>(Dictionary<int, SortedList<int, T>> sites, int functionIndex)
+        {
+            if (!sites.TryGetValue(functionIndex, out var result))
+            {
+                result = new SortedList<int, T>();
+                sites.Add(functionIndex, result);
+            }
+            return result;
+        }
+
+        private static int ParseInt(string value)
+        {
+            return int.Parse(value, NumberStyles.None, CultureInfo.InvariantCulture);
+        }
+
+        private static long ParseLong(string value)
+        {
+            return long.Parse(value, NumberStyles.None, CultureInfo.InvariantCulture);
+        }
+    }
+}
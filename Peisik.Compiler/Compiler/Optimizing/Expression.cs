@@ -78,6 +78,16 @@ namespace Polsys.Peisik.Compiler.Optimizing
             return null;
         }
 
+        /// <summary>
+        /// Replaces each function call in this expression, innermost first, with the result of
+        /// <paramref name="replace"/>, which may be the call itself.
+        /// </summary>
+        /// <returns>The resulting expression, which may be the same as this one.</returns>
+        internal virtual Expression ReplaceCalls(Func<FunctionCallExpression, Expression> replace)
+        {
+            return this;
+        }
+
         public static Expression FromSyntax(SyntaxNode syntax, Function function,
             OptimizingCompiler compiler, LocalVariableContext localContext)
         {
@@ -124,7 +134,7 @@ namespace Polsys.Peisik.Compiler.Optimizing
                 {
                     // The function is an internal one
                     // This logic is quite complicated
-                    return MakeInternalCall(function, compiler, localContext, call, internalFunc);
+                    return MakeInternalCall(function, compiler, localContext, call, internalFunc, discardResult);
                 }
                 else if (compiler.TryGetFunction(call.FunctionName, function.ModulePrefix, out var callee))
                 {
@@ -237,12 +247,17 @@ namespace Polsys.Peisik.Compiler.Optimizing
         }
 
         private static Expression MakeInternalCall(Function function, OptimizingCompiler compiler,
-            LocalVariableContext localContext, FunctionCallSyntax call, InternalFunctionDefinition internalFunc)
+            LocalVariableContext localContext, FunctionCallSyntax call, InternalFunctionDefinition internalFunc,
+            bool discardResult)
         {
             // Check parameter count
             AssertFunctionCallParameterCount(compiler, call, call.Parameters.Count,
                 internalFunc.MinParameters, internalFunc.MaxParameters);
 
+            // The first parameter of the Parallel functions is not an expression
+            if (internalFunc.ParamConstraint == ParameterConstraint.FunctionAndRange)
+                return MakeParallelCall(function, compiler, localContext, call, internalFunc, discardResult);
+
             // Check parameter types
             var parameters = new List<Expression>();
             var firstType = PrimitiveType.NoType;
@@ -283,7 +298,12 @@ namespace Polsys.Peisik.Compiler.Optimizing
                         }
                         break;
                     case ParameterConstraint.SameType:
-                        if (paramExpr.Type != firstType)
+                        if (paramExpr.Type.IsArray())
+                        {
+                            compiler.LogError(DiagnosticCode.WrongType, call.Parameters[i].Position,
+                                paramExpr.Type.ToString(), "Bool|Int|Real");
+                        }
+                        else if (paramExpr.Type != firstType)
                         {
                             compiler.LogError(DiagnosticCode.ParamsMustBeSameType, call.Parameters[i].Position,
                                 paramExpr.Type.ToString(), firstType.ToString());
@@ -296,6 +316,36 @@ namespace Polsys.Peisik.Compiler.Optimizing
                                 paramExpr.Type.ToString(), "Bool|Int|Real");
                         }
                         break;
+                    case ParameterConstraint.Array:
+                    case ParameterConstraint.ArrayAndElement:
+                    case ParameterConstraint.ArrayAndIndex:
+                    case ParameterConstraint.ArrayIndexAndElement:
+                        if (i == 0)
+                        {
+                            if (!paramExpr.Type.IsArray())
+                            {
+                                compiler.LogError(DiagnosticCode.WrongType, call.Parameters[i].Position,
+                                    paramExpr.Type.ToString(), "IntArray|RealArray");
+                            }
+                            break;
+                        }
+
+                        var expectedType = internalFunc.GetArrayParameterType(i, firstType);
+                        if (paramExpr.Type != expectedType)
+                        {
+                            // Int LITERALS may be stored in real arrays
+                            if (paramExpr.Type == PrimitiveType.Int && expectedType == PrimitiveType.Real &&
+                                call.Parameters[i] is LiteralSyntax literal)
+                            {
+                                parameters[i] = new ConstantExpression(Convert.ToDouble(literal.Value), compiler);
+                            }
+                            else
+                            {
+                                compiler.LogError(DiagnosticCode.WrongType, call.Parameters[i].Position,
+                                    paramExpr.Type.ToString(), expectedType.ToString());
+                            }
+                        }
+                        break;
                     default:
                         throw new NotImplementedException("Unimplemented ParameterConstraint");
                 }
@@ -311,6 +361,11 @@ namespace Polsys.Peisik.Compiler.Optimizing
             {
                 return new FailFastExpression();
             }
+            else if (internalFunc.IsArrayFunction)
+            {
+                // The array functions may have side effects, so they need a node that is never folded away
+                return new ArrayExpression(internalFunc, parameters, discardResult);
+            }
             else if (parameters.Count == 1)
             {
                 return new UnaryExpression(internalFunc, parameters[0]);
@@ -325,6 +380,42 @@ namespace Polsys.Peisik.Compiler.Optimizing
             }
         }
 
+        private static Expression MakeParallelCall(Function function, OptimizingCompiler compiler,
+            LocalVariableContext localContext, FunctionCallSyntax call, InternalFunctionDefinition internalFunc,
+            bool discardResult)
+        {
+            var name = call.Parameters[0] as IdentifierSyntax;
+            if (name == null)
+                compiler.LogError(DiagnosticCode.ExpectedFunctionName, call.Parameters[0].Position);
+            if (!compiler.TryGetFunction(name.Name, function.ModulePrefix, out var callee))
+                compiler.LogError(DiagnosticCode.NameNotFound, name.Position, name.Name);
+
+            // The callee must take an index and return a summable or countable result
+            var isSum = internalFunc.Index == InternalFunction.ParallelSum;
+            var resultType = callee.ResultValue.Type;
+            var validResult = isSum
+                ? resultType == PrimitiveType.Int || resultType == PrimitiveType.Real
+                : resultType == PrimitiveType.Bool;
+            if (!validResult || callee.ParameterTypes.Count != 1 || callee.ParameterTypes[0] != PrimitiveType.Int)
+                compiler.LogError(DiagnosticCode.InvalidParallelFunction, name.Position, name.Name, isSum ? "Int|Real" : "Bool");
+
+            // Purity is checked once all the functions are compiled
+            compiler.AddParallelFunction(callee, name);
+
+            var range = new Expression[2];
+            for (var i = 0; i < 2; i++)
+            {
+                range[i] = FromSyntax(call.Parameters[i + 1], function, compiler, localContext);
+                if (range[i].Type != PrimitiveType.Int)
+                {
+                    compiler.LogError(DiagnosticCode.WrongType, call.Parameters[i + 1].Position,
+                        range[i].Type.ToString(), "Int");
+                }
+            }
+
+            return new ParallelExpression(internalFunc.Index, callee, range[0], range[1], discardResult);
+        }
+
         private static void AssertFunctionCallParameterCount(OptimizingCompiler compiler, FunctionCallSyntax call, int paramCount, int minParams, int maxParams)
         {
             if (paramCount < minParams)
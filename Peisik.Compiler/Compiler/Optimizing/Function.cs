@@ -19,6 +19,11 @@ namespace Polsys.Peisik.Compiler.Optimizing
 
         public SideEffect SideEffects;
 
+        /// <summary>
+        /// The number of times this function was called in the execution profile, or null if there is no profile.
+        /// </summary>
+        internal long? ProfileCallCount;
+
         internal List<LocalVariable> Locals = new List<LocalVariable>();
 
         public LocalVariable ResultValue { get; internal set; }
@@ -13,6 +13,11 @@ namespace Polsys.Peisik.Compiler.Optimizing
         public List<Expression> Parameters { get; private set; }
         public bool DiscardResult { get; private set; }
 
+        /// <summary>
+        /// The number of times this call was executed in the execution profile, or null if there is no profile.
+        /// </summary>
+        internal long? ProfileCount;
+
         public FunctionCallExpression(Function callee, List<Expression> parameters,
             bool discardResult, OptimizingCompiler compiler)
         {
@@ -31,6 +36,15 @@ namespace Polsys.Peisik.Compiler.Optimizing
             return this;
         }
 
+        internal override Expression ReplaceCalls(Func<FunctionCallExpression, Expression> replace)
+        {
+            // CODE SMELL: Immutability violation
+            for (var i = 0; i < Parameters.Count; i++)
+                Parameters[i] = Parameters[i].ReplaceCalls(replace);
+
+            return replace(this);
+        }
+
         protected override void SetStore(LocalVariable newStore, OptimizingCompiler compiler, TokenPosition position = default)
         {
             if (DiscardResult && newStore != null)
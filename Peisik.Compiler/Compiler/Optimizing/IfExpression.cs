@@ -11,6 +11,12 @@ namespace Polsys.Peisik.Compiler.Optimizing
         public Expression ThenExpression { get; private set; }
         public Expression ElseExpression { get; private set; }
 
+        /// <summary>
+        /// How many times the condition was false and true in the execution profile,
+        /// or null if there is no profile.
+        /// </summary>
+        internal (long falseCount, long trueCount)? BranchCounts;
+
         public IfExpression(Expression condition, Expression thenExpr, Expression elseExpr)
         {
             Condition = condition;
@@ -35,6 +41,14 @@ namespace Polsys.Peisik.Compiler.Optimizing
             return new IfExpression(condition, ThenExpression.Fold(compiler), ElseExpression.Fold(compiler));
         }
 
+        internal override Expression ReplaceCalls(Func<FunctionCallExpression, Expression> replace)
+        {
+            Condition = Condition.ReplaceCalls(replace);
+            ThenExpression = ThenExpression?.ReplaceCalls(replace);
+            ElseExpression = ElseExpression?.ReplaceCalls(replace);
+            return this;
+        }
+
         public override bool GetGuaranteesReturn()
         {
             // Both the 'then' and 'else' blocks must return
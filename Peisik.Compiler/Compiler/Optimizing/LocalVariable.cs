@@ -62,6 +62,14 @@
         /// </summary>
         internal int IntervalEnd = -1;
 
+        /// <summary>
+        /// The estimated number of loads and stores of this variable in the execution profile.
+        /// </summary>
+        /// <remarks>
+        /// Zero if there is no profile. Used by the register allocator to keep the hot variables in registers.
+        /// </remarks>
+        internal long ProfileWeight;
+
         public override string ToString()
         {
             return Name + "#" + Version.ToString();
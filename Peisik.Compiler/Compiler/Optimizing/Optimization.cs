@@ -23,8 +23,13 @@ namespace Polsys.Peisik.Compiler.Optimizing
         /// </summary>
         RegisterAllocation = 2,
         /// <summary>
+        /// On the bytecode backend, small integer constants, arithmetic with a constant operand
+        /// and conditions that compare two values should use the shorter fused instructions.
+        /// </summary>
+        InstructionFusion = 4,
+        /// <summary>
         /// All available optimizations should be performed.
         /// </summary>
-        Full = ConstantFolding | RegisterAllocation
+        Full = ConstantFolding | RegisterAllocation | InstructionFusion
     }
 }
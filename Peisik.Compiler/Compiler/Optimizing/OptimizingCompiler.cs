@@ -13,7 +13,10 @@ namespace Polsys.Peisik.Compiler.Optimizing
     {
         private List<ModuleSyntax> _modules;
         private Optimization _optimizationLevel;
+        private ExecutionProfile _profile;
         internal List<CompilationDiagnostic> _diagnostics;
+        // The functions called by Parallel, which must be pure, and the positions of their names
+        private List<(Function function, IdentifierSyntax name)> _parallelFunctions;
 
         /// <summary>
         /// If onlyVisibleTo is empty, the constant is public.
@@ -26,11 +29,32 @@ namespace Polsys.Peisik.Compiler.Optimizing
         /// </summary>
         private Dictionary<string, (Function function, string onlyVisibleTo)> _functions;
 
+        /// <summary>
+        /// Hot call sites account for at least one in this many calls in the execution profile.
+        /// </summary>
+        private const long HotCallShare = 1000;
+
+        /// <summary>
+        /// The maximum number of expression nodes in the returned expression of an inlined function.
+        /// </summary>
+        private const int MaxInlinedSize = 8;
+
         public OptimizingCompiler(List<ModuleSyntax> modules, Optimization optimizationLevel)
+            : this(modules, optimizationLevel, null)
+        {
+        }
+
+        /// <summary>
+        /// Creates a compiler that uses an execution profile of the program for inlining,
+        /// branch layout and register allocation. The profile may be null.
+        /// </summary>
+        public OptimizingCompiler(List<ModuleSyntax> modules, Optimization optimizationLevel, ExecutionProfile profile)
         {
             _modules = modules;
+            _profile = profile;
             _optimizationLevel = optimizationLevel;
             _diagnostics = new List<CompilationDiagnostic>();
+            _parallelFunctions = new List<(Function, IdentifierSyntax)>();
 
             _constants = new Dictionary<string, (object, string)>();
             _functions = new Dictionary<string, (Function function, string onlyVisibleTo)>();
@@ -98,6 +122,12 @@ namespace Polsys.Peisik.Compiler.Optimizing
                 // Run desired optimizations
                 // - inlining
                 // - optimizations that are run after inlining
+                if (_profile != null)
+                {
+                    // Before any transformation, since the profile is matched against the untransformed code
+                    _profile.Annotate(GetFunctionsInOrder(), this);
+                    InlineHotCalls();
+                }
 
                 // Generate code
                 var codeGen = new CodeGeneratorPeisik();
@@ -106,7 +136,11 @@ namespace Polsys.Peisik.Compiler.Optimizing
                     codeGen.CompileFunction(function, _optimizationLevel);
                 }
 
-                return (codeGen.GetProgram(), _diagnostics);
+                // Purity is determined from the generated code, the same way as in the interpreter
+                var program = codeGen.GetProgram();
+                CheckParallelFunctionsArePure(program);
+
+                return (program, _diagnostics);
 
             }
             catch (CompilerException)
@@ -116,6 +150,134 @@ namespace Polsys.Peisik.Compiler.Optimizing
             }
         }
 
+        internal void AddParallelFunction(Function function, IdentifierSyntax name)
+        {
+            _parallelFunctions.Add((function, name));
+        }
+
+        private void CheckParallelFunctionsArePure(CompiledProgram program)
+        {
+            var pure = PurityAnalysis.FindPureFunctions(program);
+            foreach ((var function, var name) in _parallelFunctions)
+            {
+                var index = program.Functions.FindIndex(f => f.FullName == function.FullName);
+                if (!pure[index])
+                    LogError(DiagnosticCode.FunctionNotPure, name.Position, name.Name);
+            }
+        }
+
+        private IEnumerable<Function> GetFunctionsInOrder()
+        {
+            foreach ((var function, _) in _functions.Values)
+                yield return function;
+        }
+
+        /// <summary>
+        /// Replaces the hot calls to functions that only return a simple expression of their parameters
+        /// with that expression. The parameters must be constants or locals so that they can be duplicated.
+        /// </summary>
+        private void InlineHotCalls()
+        {
+            var threshold = Math.Max(1, _profile.TotalCallCount / HotCallShare);
+            foreach ((var function, _) in _functions.Values)
+            {
+                function.ExpressionTree = function.ExpressionTree.ReplaceCalls(call =>
+                {
+                    if ((call.ProfileCount ?? 0) < threshold || call.DiscardResult || call.Callee == function)
+                        return call;
+
+                    var body = GetInlinableBody(call.Callee);
+                    if (body == null || !call.Parameters.TrueForAll(IsDuplicable))
+                        return call;
+
+                    // The parameter loads are replaced by the arguments
+                    var arguments = new Dictionary<LocalVariable, Expression>();
+                    var parameterIndex = 0;
+                    foreach (var local in call.Callee.Locals)
+                    {
+                        if (local.IsParameter)
+                            arguments.Add(local, call.Parameters[parameterIndex++]);
+                    }
+
+                    var inlined = CloneWithArguments(body, arguments);
+                    foreach (var argument in call.Parameters)
+                    {
+                        if (argument is LocalLoadExpression load)
+                            load.Local.UseCount--;
+                    }
+                    if (_optimizationLevel.HasFlag(Optimization.ConstantFolding))
+                        inlined = inlined.Fold(this);
+
+                    // The store is transferred, so the assignment count does not change
+                    inlined.Store = call.Store;
+                    return inlined;
+                });
+            }
+        }
+
+        /// <summary>
+        /// Returns the returned expression if the function consists of a single return statement
+        /// whose value is a small expression of constants, parameters and internal functions.
+        /// Otherwise returns null.
+        /// </summary>
+        private static Expression GetInlinableBody(Function function)
+        {
+            var tree = function.ExpressionTree;
+            if (tree is SequenceExpression sequence && sequence.Expressions.Count == 1)
+                tree = sequence.Expressions[0];
+
+            var size = 0;
+            if (tree is ReturnExpression ret && ret.Value != null && IsInlinable(ret.Value, ref size))
+                return ret.Value;
+            return null;
+        }
+
+        private static bool IsInlinable(Expression expression, ref int size)
+        {
+            if (expression.Store != null || ++size > MaxInlinedSize)
+                return false;
+
+            switch (expression)
+            {
+                case BinaryExpression binary:
+                    return IsInlinable(binary.Left, ref size) && IsInlinable(binary.Right, ref size);
+                case ConstantExpression _:
+                    return true;
+                case LocalLoadExpression load:
+                    return load.Local.IsParameter;
+                case UnaryExpression unary:
+                    return IsInlinable(unary.Expression, ref size);
+                default:
+                    return false;
+            }
+        }
+
+        private static bool IsDuplicable(Expression argument)
+        {
+            return argument.Store == null && (argument is ConstantExpression || argument is LocalLoadExpression);
+        }
+
+        private Expression CloneWithArguments(Expression expression, Dictionary<LocalVariable, Expression> arguments)
+        {
+            switch (expression)
+            {
+                case BinaryExpression binary:
+                    return new BinaryExpression(binary.InternalFunctionDefinition,
+                        CloneWithArguments(binary.Left, arguments), CloneWithArguments(binary.Right, arguments));
+                case ConstantExpression constant:
+                    return new ConstantExpression(constant.Value, this);
+                case LocalLoadExpression load:
+                    var argument = arguments[load.Local];
+                    if (argument is ConstantExpression constantArgument)
+                        return new ConstantExpression(constantArgument.Value, this);
+                    return new LocalLoadExpression(((LocalLoadExpression)argument).Local, this);
+                case UnaryExpression unary:
+                    return new UnaryExpression(unary.InternalFunctionDefinition, CloneWithArguments(unary.Expression, arguments));
+                default:
+                    throw new NotImplementedException($"Cannot inline expression {expression}");
+            }
+        }
+
         internal void AddConstant(string name, string moduleName, Visibility visibility, object value)
         {
             var nameInLower = name.ToLowerInvariant();
@@ -0,0 +1,60 @@
+﻿using System;
+using System.Collections.Generic;
+
+namespace Polsys.Peisik.Compiler.Optimizing
+{
+    /// <summary>
+    /// Represents a call to Parallel.Sum or Parallel.Count, which calls a pure function
+    /// with each value in the range [From, To) and sums the results or counts the true results.
+    /// </summary>
+    internal class ParallelExpression : Expression
+    {
+        public Function Callee { get; private set; }
+        public Expression From { get; private set; }
+        public Expression To { get; private set; }
+        public bool DiscardResult { get; private set; }
+
+        public InternalFunction InternalFunctionId { get; private set; }
+
+        public ParallelExpression(InternalFunction internalFunction, Function callee,
+            Expression from, Expression to, bool discardResult)
+        {
+            InternalFunctionId = internalFunction;
+            Callee = callee;
+            From = from;
+            To = to;
+            DiscardResult = discardResult;
+
+            if (internalFunction == InternalFunction.ParallelSum)
+                Type = callee.ResultValue.Type;
+            else
+                Type = PrimitiveType.Int;
+        }
+
+        public override Expression Fold(OptimizingCompiler compiler)
+        {
+            // The call itself is not folded, since the point is to run it in parallel
+            // CODE SMELL: Immutability violation
+            From = From.Fold(compiler);
+            To = To.Fold(compiler);
+
+            return this;
+        }
+
+        internal override Expression ReplaceCalls(Func<FunctionCallExpression, Expression> replace)
+        {
+            From = From.ReplaceCalls(replace);
+            To = To.ReplaceCalls(replace);
+
+            return this;
+        }
+
+        protected override void SetStore(LocalVariable newStore, OptimizingCompiler compiler, TokenPosition position = default)
+        {
+            if (DiscardResult && newStore != null)
+                throw new InvalidOperationException("Cannot set Store when DiscardResult is true");
+
+            base.SetStore(newStore, compiler, position);
+        }
+    }
+}
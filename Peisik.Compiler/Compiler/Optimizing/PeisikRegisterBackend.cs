@@ -8,9 +8,8 @@ namespace Polsys.Peisik.Compiler.Optimizing
     /// </summary>
     internal class PeisikRegisterBackend : RegisterBackend
     {
-        private List<int> _freeBools = new List<int>();
-        private List<int> _freeInts = new List<int>();
-        private List<int> _freeReals = new List<int>();
+        // The interpreter types each local slot, so slots are only reused for locals of the same type
+        private Dictionary<PrimitiveType, List<int>> _freeSlots = new Dictionary<PrimitiveType, List<int>>();
 
         private Dictionary<int, PrimitiveType> _liveTypes = new Dictionary<int, PrimitiveType>();
         private int _nextSlotIndex = 0;
@@ -21,50 +20,21 @@ namespace Polsys.Peisik.Compiler.Optimizing
             // to all be alive before any other intervals.
             // We also always set onStack to false, because there is no separate stack.
             // All stack slots are considered registers.
+            if (type == PrimitiveType.NoType || type == PrimitiveType.Void)
+                throw new ArgumentOutOfRangeException("Unknown parameter type");
 
             // Try to get a free location
             // If there are no free slots, create a new one
             var slot = -1;
-            switch (type)
+            if (_freeSlots.TryGetValue(type, out var free) && free.Count > 0)
             {
-                case PrimitiveType.Bool:
-                    if (_freeBools.Count > 0)
-                    {
-                        slot = _freeBools[_freeBools.Count - 1];
-                        _freeBools.RemoveAt(_freeBools.Count - 1);
-                    }
-                    else
-                    {
-                        slot = _nextSlotIndex;
-                        _nextSlotIndex++;
-                    }
-                    break;
-                case PrimitiveType.Int:
-                    if (_freeInts.Count > 0)
-                    {
-                        slot = _freeInts[_freeInts.Count - 1];
-                        _freeInts.RemoveAt(_freeInts.Count - 1);
-                    }
-                    else
-                    {
-                        slot = _nextSlotIndex;
-                        _nextSlotIndex++;
-                    }
-                    break;
-                case PrimitiveType.Real:
-                    if (_freeReals.Count > 0)
-                    {
-                        slot = _freeReals[_freeReals.Count - 1];
-                        _freeReals.RemoveAt(_freeReals.Count - 1);
-                    }
-                    else
-                    {
-                        slot = _nextSlotIndex;
-                        _nextSlotIndex++;
-                    }
-                    break;
-                default:
-                    throw new ArgumentOutOfRangeException("Unknown parameter type");
+                slot = free[free.Count - 1];
+                free.RemoveAt(free.Count - 1);
+            }
+            else
+            {
+                slot = _nextSlotIndex;
+                _nextSlotIndex++;
             }
 
             _liveTypes.Add(slot, type);
@@ -72,23 +42,22 @@ namespace Polsys.Peisik.Compiler.Optimizing
             return slot;
         }
 
+        /// <summary>
+        /// Local slots below 64 are encoded in a single byte in compact bytecode.
+        /// </summary>
+        public override bool PrefersLowLocations => true;
+
         public override void ReturnLocation(int location)
         {
             var type = _liveTypes[location];
             _liveTypes.Remove(location);
 
-            switch (type)
+            if (!_freeSlots.TryGetValue(type, out var free))
             {
-                case PrimitiveType.Bool:
-                    _freeBools.Add(location);
-                    break;
-                case PrimitiveType.Int:
-                    _freeInts.Add(location);
-                    break;
-                case PrimitiveType.Real:
-                    _freeReals.Add(location);
-                    break;
+                free = new List<int>();
+                _freeSlots.Add(type, free);
             }
+            free.Add(location);
         }
     }
 }
@@ -1,4 +1,5 @@
-﻿using System.Collections.Generic;
+﻿using System;
+using System.Collections.Generic;
 
 namespace Polsys.Peisik.Compiler.Optimizing
 {
@@ -23,5 +24,13 @@ namespace Polsys.Peisik.Compiler.Optimizing
 
             return this;
         }
+
+        internal override Expression ReplaceCalls(Func<FunctionCallExpression, Expression> replace)
+        {
+            for (var i = 0; i < Expressions.Count; i++)
+                Expressions[i] = Expressions[i].ReplaceCalls(replace);
+
+            return this;
+        }
     }
 }
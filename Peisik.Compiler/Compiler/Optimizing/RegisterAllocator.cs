@@ -20,7 +20,11 @@ namespace Polsys.Peisik.Compiler.Optimizing
         public static int Allocate(Function function)
         {
             ComputeIntervals(function);
+            if (function.ProfileCallCount.HasValue)
+                ComputeWeights(function);
             AssignRegisters(function.Locals, out var stackSize);
+            if (new Backend().PrefersLowLocations)
+                OrderLocationsByWeight(function.Locals);
             return stackSize;
         }
 
@@ -75,9 +79,9 @@ namespace Polsys.Peisik.Compiler.Optimizing
                     {
                         if (!active[i].OnStack)
                         {
-                            if (active[i].IntervalEnd > interval.IntervalEnd)
+                            if (ShouldSpillFirst(active[i], interval))
                             {
-                                // Spill the longer interval and give this its location
+                                // Spill the other interval and give this its location
                                 interval.StorageLocation = active[i].StorageLocation;
                                 active[i].StorageLocation = location;
                                 break;
@@ -106,6 +110,111 @@ namespace Polsys.Peisik.Compiler.Optimizing
             stackSize = Math.Max(maxLocation + 1, 0);
         }
 
+        /// <summary>
+        /// Returns true if the first variable should be spilled rather than the second.
+        /// The variable accessed less often in the profile is spilled, or without a profile the longer interval.
+        /// </summary>
+        private static bool ShouldSpillFirst(LocalVariable first, LocalVariable second)
+        {
+            if (first.ProfileWeight != second.ProfileWeight)
+                return first.ProfileWeight < second.ProfileWeight;
+            return first.IntervalEnd > second.IntervalEnd;
+        }
+
+        /// <summary>
+        /// Renumbers the locations that are not shared with parameters so that the most accessed
+        /// variables get the lowest locations. The order is unchanged if there are no profile weights.
+        /// </summary>
+        internal static void OrderLocationsByWeight(List<LocalVariable> locals)
+        {
+            var parameterLocations = new HashSet<int>(locals.Where(local => local.IsParameter)
+                .Select(local => local.StorageLocation));
+            var weights = new Dictionary<int, long>();
+            foreach (var local in locals)
+            {
+                if (local.StorageLocation < 0 || parameterLocations.Contains(local.StorageLocation))
+                    continue;
+                weights.TryGetValue(local.StorageLocation, out var weight);
+                weights[local.StorageLocation] = weight + local.ProfileWeight;
+            }
+
+            // OrderBy is stable, so equal weights keep their order
+            var locations = weights.Keys.OrderBy(location => location).ToList();
+            var byWeight = locations.OrderByDescending(location => weights[location]).ToList();
+            var newLocations = new Dictionary<int, int>();
+            for (var i = 0; i < locations.Count; i++)
+                newLocations.Add(byWeight[i], locations[i]);
+
+            foreach (var local in locals)
+            {
+                if (newLocations.TryGetValue(local.StorageLocation, out var location))
+                    local.StorageLocation = location;
+            }
+        }
+
+        /// <summary>
+        /// Estimates how many times each local of the function is loaded or stored
+        /// from the profile counts of the function and its conditional statements.
+        /// </summary>
+        internal static void ComputeWeights(Function function)
+        {
+            VisitTreeNodeForWeights(function.ExpressionTree, function.ProfileCallCount ?? 0);
+        }
+
+        private static void VisitTreeNodeForWeights(Expression node, long frequency)
+        {
+            if (node?.Store != null)
+                node.Store.ProfileWeight += frequency;
+
+            switch (node)
+            {
+                case ArrayExpression array:
+                    foreach (var expr in array.Parameters)
+                        VisitTreeNodeForWeights(expr, frequency);
+                    break;
+                case BinaryExpression binary:
+                    VisitTreeNodeForWeights(binary.Left, frequency);
+                    VisitTreeNodeForWeights(binary.Right, frequency);
+                    break;
+                case FunctionCallExpression call:
+                    foreach (var expr in call.Parameters)
+                        VisitTreeNodeForWeights(expr, frequency);
+                    break;
+                case IfExpression condition:
+                    VisitTreeNodeForWeights(condition.Condition, frequency);
+                    VisitTreeNodeForWeights(condition.ThenExpression, condition.BranchCounts?.trueCount ?? frequency);
+                    VisitTreeNodeForWeights(condition.ElseExpression, condition.BranchCounts?.falseCount ?? frequency);
+                    break;
+                case LocalLoadExpression load:
+                    load.Local.ProfileWeight += frequency;
+                    break;
+                case ParallelExpression parallel:
+                    VisitTreeNodeForWeights(parallel.From, frequency);
+                    VisitTreeNodeForWeights(parallel.To, frequency);
+                    break;
+                case PrintExpression print:
+                    foreach (var expr in print.Expressions)
+                        VisitTreeNodeForWeights(expr, frequency);
+                    break;
+                case ReturnExpression ret:
+                    VisitTreeNodeForWeights(ret.Value, frequency);
+                    break;
+                case SequenceExpression sequence:
+                    foreach (var expr in sequence.Expressions)
+                        VisitTreeNodeForWeights(expr, frequency);
+                    break;
+                case UnaryExpression unary:
+                    VisitTreeNodeForWeights(unary.Expression, frequency);
+                    break;
+                case WhileExpression loop:
+                    // The condition is evaluated once more than the body is run
+                    var counts = loop.BranchCounts;
+                    VisitTreeNodeForWeights(loop.Condition, counts.HasValue ? counts.Value.falseCount + counts.Value.trueCount : frequency);
+                    VisitTreeNodeForWeights(loop.Body, counts?.trueCount ?? frequency);
+                    break;
+            }
+        }
+
         /// <summary>
         /// Computes live intervals for local variables of the function.
         /// </summary>
@@ -123,6 +232,13 @@ namespace Polsys.Peisik.Compiler.Optimizing
             {
                 case null:
                     return currentPosition;
+                case ArrayExpression array:
+                    foreach (var expr in array.Parameters)
+                    {
+                        currentPosition = VisitTreeNode(expr, currentPosition);
+                    }
+                    SetLiveness(array.Store, currentPosition);
+                    return currentPosition + 1;
                 case BinaryExpression binary:
                     currentPosition = VisitTreeNode(binary.Left, currentPosition);
                     currentPosition = VisitTreeNode(binary.Right, currentPosition);
@@ -149,6 +265,11 @@ namespace Polsys.Peisik.Compiler.Optimizing
                     SetLiveness(load.Local, currentPosition);
                     SetLiveness(load.Store, currentPosition);
                     return currentPosition + 1;
+                case ParallelExpression parallel:
+                    currentPosition = VisitTreeNode(parallel.From, currentPosition);
+                    currentPosition = VisitTreeNode(parallel.To, currentPosition);
+                    SetLiveness(parallel.Store, currentPosition);
+                    return currentPosition + 1;
                 case PrintExpression print:
                     foreach (var expr in print.Expressions)
                     {
@@ -22,5 +22,11 @@
         /// Returns the specified storage location to the unused pool.
         /// </summary>
         public abstract void ReturnLocation(int location);
+
+        /// <summary>
+        /// If true, the locations are interchangeable but the lower ones are cheaper to access,
+        /// so the allocator gives them to the variables accessed most often in the execution profile.
+        /// </summary>
+        public virtual bool PrefersLowLocations => false;
     }
 }
@@ -1,4 +1,6 @@
-﻿namespace Polsys.Peisik.Compiler.Optimizing
+﻿using System;
+
+namespace Polsys.Peisik.Compiler.Optimizing
 {
     /// <summary>
     /// Represents a point where the function will return to its caller.
@@ -27,6 +29,12 @@
                 return this;
         }
 
+        internal override Expression ReplaceCalls(Func<FunctionCallExpression, Expression> replace)
+        {
+            Value = Value?.ReplaceCalls(replace);
+            return this;
+        }
+
         public override bool GetGuaranteesReturn()
         {
             return true;
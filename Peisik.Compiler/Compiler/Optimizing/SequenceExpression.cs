@@ -55,6 +55,14 @@ namespace Polsys.Peisik.Compiler.Optimizing
             return new SequenceExpression(newList);
         }
 
+        internal override Expression ReplaceCalls(Func<FunctionCallExpression, Expression> replace)
+        {
+            for (var i = 0; i < Expressions.Count; i++)
+                Expressions[i] = Expressions[i].ReplaceCalls(replace);
+
+            return this;
+        }
+
         public override void FoldSingleUseLocals()
         {
             // Fold local assignments where the local is only used once.
@@ -1,4 +1,6 @@
-﻿namespace Polsys.Peisik.Compiler.Optimizing
+﻿using System;
+
+namespace Polsys.Peisik.Compiler.Optimizing
 {
     /// <summary>
     /// Represents an internal function call with a single parameter.
@@ -8,6 +10,7 @@
         public Expression Expression { get; private set; }
 
         public InternalFunction InternalFunctionId => _internalFunction.Index;
+        internal InternalFunctionDefinition InternalFunctionDefinition => _internalFunction;
         private InternalFunctionDefinition _internalFunction;
 
         public UnaryExpression(InternalFunctionDefinition func, Expression parameter)
@@ -70,5 +73,11 @@
             // Could not fold, but the inner expression might be simplified now
             return new UnaryExpression(_internalFunction, folded);
         }
+
+        internal override Expression ReplaceCalls(Func<FunctionCallExpression, Expression> replace)
+        {
+            Expression = Expression.ReplaceCalls(replace);
+            return this;
+        }
     }
 }
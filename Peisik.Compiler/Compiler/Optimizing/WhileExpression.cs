@@ -10,6 +10,12 @@ namespace Polsys.Peisik.Compiler.Optimizing
         public Expression Condition { get; private set; }
         public Expression Body { get; private set; }
 
+        /// <summary>
+        /// How many times the condition was false and true in the execution profile,
+        /// or null if there is no profile.
+        /// </summary>
+        internal (long falseCount, long trueCount)? BranchCounts;
+
         public WhileExpression(Expression condition, Expression loop)
         {
             Condition = condition;
@@ -30,5 +36,12 @@ namespace Polsys.Peisik.Compiler.Optimizing
             
             return new WhileExpression(Condition.Fold(compiler), Body.Fold(compiler));
         }
+
+        internal override Expression ReplaceCalls(Func<FunctionCallExpression, Expression> replace)
+        {
+            Condition = Condition.ReplaceCalls(replace);
+            Body = Body?.ReplaceCalls(replace);
+            return this;
+        }
     }
 }
@@ -0,0 +1,75 @@
+﻿using System.Collections.Generic;
+
+namespace Polsys.Peisik.Compiler
+{
+    /// <summary>
+    /// Determines which compiled functions are pure, with the same rules as the interpreter.
+    /// </summary>
+    internal static class PurityAnalysis
+    {
+        /// <summary>
+        /// Returns true if calling the internal function has no side effects and does not read arrays.
+        /// </summary>
+        public static bool IsInternalFunctionPure(InternalFunction function)
+        {
+            if (function == InternalFunction.Print || function == InternalFunction.FailFast)
+                return false;
+            return function > InternalFunction.Invalid && function <= InternalFunction.MathTan;
+        }
+
+        /// <summary>
+        /// Finds the functions whose result only depends on the parameters and whose calls have no side effects.
+        /// A function is pure if it does not call impure internal functions, does not access arrays,
+        /// does not use Parallel and only calls pure functions. Recursion does not make a function impure.
+        /// </summary>
+        /// <returns>An array indexed by function table index.</returns>
+        public static bool[] FindPureFunctions(CompiledProgram program)
+        {
+            var functions = program.Functions;
+            var pure = new bool[functions.Count];
+
+            // First rule out the functions that have side effects themselves
+            for (var i = 0; i < functions.Count; i++)
+            {
+                pure[i] = true;
+                foreach (var op in functions[i].Bytecode)
+                {
+                    var internalCall = op.Opcode >= Opcode.CallI0 && op.Opcode <= Opcode.CallI7;
+                    // Arrays are mutable, and parallel calls would nest thread pools
+                    var impureOp = op.Opcode == Opcode.NewArray || op.Opcode == Opcode.LoadElement
+                        || op.Opcode == Opcode.StoreElement || op.Opcode == Opcode.CallParallel;
+
+                    if ((internalCall && !IsInternalFunctionPure((InternalFunction)op.Parameter)) || impureOp)
+                    {
+                        pure[i] = false;
+                        break;
+                    }
+                }
+            }
+
+            // Then propagate impurity to the callers until nothing changes
+            var changed = true;
+            while (changed)
+            {
+                changed = false;
+                for (var i = 0; i < functions.Count; i++)
+                {
+                    if (!pure[i])
+                        continue;
+
+                    foreach (var op in functions[i].Bytecode)
+                    {
+                        if (op.Opcode == Opcode.Call && !pure[op.Parameter])
+                        {
+                            pure[i] = false;
+                            changed = true;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            return pure;
+        }
+    }
+}
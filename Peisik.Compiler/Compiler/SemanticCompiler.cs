@@ -17,6 +17,8 @@ namespace Polsys.Peisik.Compiler
         private Dictionary<string, CompiledFunction> _functions;
         private List<CompilationDiagnostic> _diagnostics;
         private CompiledProgram _program;
+        // The functions called by Parallel, which must be pure, and the positions of their names
+        private List<(CompiledFunction function, IdentifierSyntax name)> _parallelFunctions;
 
         public SemanticCompiler(List<ModuleSyntax> modules)
         {
@@ -40,6 +42,7 @@ namespace Polsys.Peisik.Compiler
             _program = new CompiledProgram();
             _constants = new Dictionary<string, CompiledConstant>();
             _functions = new Dictionary<string, CompiledFunction>();
+            _parallelFunctions = new List<(CompiledFunction, IdentifierSyntax)>();
 
             try
             {
@@ -87,6 +90,14 @@ namespace Polsys.Peisik.Compiler
                     LogError(DiagnosticCode.NoMainFunction, _modules[0].Position);
                 }
 
+                // Purity can only be determined once all the functions are compiled
+                var pure = PurityAnalysis.FindPureFunctions(_program);
+                foreach ((var parallelFunction, var name) in _parallelFunctions)
+                {
+                    if (!pure[parallelFunction.FunctionTableIndex])
+                        LogError(DiagnosticCode.FunctionNotPure, name.Position, name.Name);
+                }
+
                 return (_program, _diagnostics);
             }
             catch (CompilerException)
@@ -346,14 +357,23 @@ namespace Polsys.Peisik.Compiler
                     }
                 case FunctionCallSyntax call:
                     {
-                        if (InternalFunctions.Functions.ContainsKey(call.FunctionName.ToLowerInvariant()))
+                        if (InternalFunctions.Functions.TryGetValue(call.FunctionName.ToLowerInvariant(), out var definition))
                         {
+                            // The first parameter of the Parallel functions is not an expression
+                            if (definition.ParamConstraint == ParameterConstraint.FunctionAndRange)
+                                return EmitParallelCall(call, function, target, expectedType, definition);
+
                             // Compile the parameter expressions (left to right) and store their types
-                            // The expectedType check cannot be used here because of function overloading
+                            // The expectedType check cannot be used here because of function overloading,
+                            // except that the array functions know the other types from the array
                             var paramTypes = new List<PrimitiveType>();
                             foreach (var param in call.Parameters)
                             {
-                                paramTypes.Add(CompileExpression(param, function, target, PrimitiveType.NoType));
+                                var paramType = PrimitiveType.NoType;
+                                if (definition.HasArrayParameters && paramTypes.Count > 0 && paramTypes[0].IsArray())
+                                    paramType = definition.GetArrayParameterType(paramTypes.Count, paramTypes[0]);
+
+                                paramTypes.Add(CompileExpression(param, function, target, paramType));
                             }
 
                             return EmitInternalCall(call, function, target, expectedType, paramTypes);
@@ -426,6 +446,16 @@ namespace Polsys.Peisik.Compiler
                     case ParameterConstraint.SameType:
                         paramTypeInfo = AssertSameType(paramTypes, call.Parameters[0].Position);
                         break;
+                    case ParameterConstraint.Array:
+                    case ParameterConstraint.ArrayAndElement:
+                    case ParameterConstraint.ArrayAndIndex:
+                    case ParameterConstraint.ArrayIndexAndElement:
+                        // The other parameters were checked when they were compiled
+                        paramTypeInfo = paramTypes[0];
+                        if (!paramTypeInfo.IsArray())
+                            LogError(DiagnosticCode.WrongType, call.Parameters[0].Position,
+                                paramTypeInfo.ToString(), "IntArray|RealArray");
+                        break;
                     default:
                         throw new NotImplementedException();
                 }
@@ -450,6 +480,15 @@ namespace Polsys.Peisik.Compiler
                     case InternalReturnType.Void:
                         returnType = PrimitiveType.Void;
                         break;
+                    case InternalReturnType.ElementType:
+                        returnType = paramTypeInfo.GetElementType();
+                        break;
+                    case InternalReturnType.IntArray:
+                        returnType = PrimitiveType.IntArray;
+                        break;
+                    case InternalReturnType.RealArray:
+                        returnType = PrimitiveType.RealArray;
+                        break;
                     default:
                         throw new NotImplementedException();
                 }
@@ -461,8 +500,23 @@ namespace Polsys.Peisik.Compiler
                 if (paramTypes.Count > 7)
                     LogError(DiagnosticCode.TooManyParameters, call.Position);
 
-                // Emit the call
-                target.Add(new BytecodeOp((Opcode)((short)Opcode.CallI0 + paramTypes.Count), (short)calledFunction.Index));
+                // Emit the call, or the instruction for the array functions that have one
+                switch (calledFunction.Index)
+                {
+                    case InternalFunction.ArrayGet:
+                        target.Add(new BytecodeOp(Opcode.LoadElement, 0));
+                        break;
+                    case InternalFunction.ArrayNewInt:
+                    case InternalFunction.ArrayNewReal:
+                        target.Add(new BytecodeOp(Opcode.NewArray, (short)returnType));
+                        break;
+                    case InternalFunction.ArraySet:
+                        target.Add(new BytecodeOp(Opcode.StoreElement, 0));
+                        break;
+                    default:
+                        target.Add(new BytecodeOp((Opcode)((short)Opcode.CallI0 + paramTypes.Count), (short)calledFunction.Index));
+                        break;
+                }
                 return returnType;
             }
             else
@@ -472,6 +526,44 @@ namespace Polsys.Peisik.Compiler
             }
         }
 
+        private PrimitiveType EmitParallelCall(FunctionCallSyntax call, CompiledFunction function,
+            List<BytecodeOp> target, PrimitiveType expectedType, InternalFunctionDefinition definition)
+        {
+            AssertParameterCount(call.Parameters.Count, definition.MinParameters, definition.MaxParameters, call.Position);
+
+            var name = call.Parameters[0] as IdentifierSyntax;
+            if (name == null)
+                LogError(DiagnosticCode.ExpectedFunctionName, call.Parameters[0].Position);
+
+            var index = (short)GetFunction(name.Name, function.ModuleName, name.Position);
+            var calledFunction = _program.Functions[index];
+            _parallelFunctions.Add((calledFunction, name));
+
+            // The function is called with each value in the range and the results are summed or counted
+            var returnType = PrimitiveType.Int;
+            var expectedResult = "Bool";
+            if (definition.Index == InternalFunction.ParallelSum)
+            {
+                returnType = calledFunction.ReturnType;
+                expectedResult = "Int|Real";
+            }
+            var validResult = definition.Index == InternalFunction.ParallelSum
+                ? calledFunction.ReturnType == PrimitiveType.Int || calledFunction.ReturnType == PrimitiveType.Real
+                : calledFunction.ReturnType == PrimitiveType.Bool;
+            if (!validResult || calledFunction.ParameterTypes.Count != 1 || calledFunction.ParameterTypes[0] != PrimitiveType.Int)
+                LogError(DiagnosticCode.InvalidParallelFunction, name.Position, name.Name, expectedResult);
+
+            if (expectedType != PrimitiveType.NoType && returnType != expectedType)
+                LogError(DiagnosticCode.WrongType, call.Position, returnType.ToString(), expectedType.ToString());
+
+            // The range is [start, end)
+            CompileExpression(call.Parameters[1], function, target, PrimitiveType.Int);
+            CompileExpression(call.Parameters[2], function, target, PrimitiveType.Int);
+            target.Add(new BytecodeOp(Opcode.CallParallel, index));
+
+            return returnType;
+        }
+
         private void AssertParameterCount(int count, int expected, TokenPosition position)
         {
             AssertParameterCount(count, expected, expected, position);
@@ -509,6 +601,8 @@ namespace Polsys.Peisik.Compiler
         private PrimitiveType AssertSameType(List<PrimitiveType> paramList, TokenPosition firstParamPos)
         {
             var firstType = paramList[0];
+            if (firstType.IsArray())
+                LogError(DiagnosticCode.WrongType, firstParamPos, firstType.ToString(), "Bool|Int|Real");
 
             foreach (var type in paramList)
             {
@@ -48,7 +48,7 @@ namespace Polsys.Peisik.Parser
         };
         private readonly List<string> _languageNamespaces = new List<string>()
         {
-            "math"
+            "array", "math", "parallel"
         };
         private const string SingleCharTokens = "(),";
 
@@ -338,6 +338,10 @@ namespace Polsys.Peisik.Parser
                     case PrimitiveType.Void:
                         LogError(DiagnosticCode.VoidMayOnlyBeUsedForReturn, firstToken, firstPosition);
                         break;
+                    case PrimitiveType.IntArray:
+                    case PrimitiveType.RealArray:
+                        LogError(DiagnosticCode.ArrayMayNotBeConstant, name, namePosition);
+                        break;
                     default:
                         throw new NotImplementedException();
                 }
@@ -626,8 +630,12 @@ namespace Polsys.Peisik.Parser
                     return PrimitiveType.Bool;
                 case KeywordInt:
                     return PrimitiveType.Int;
+                case KeywordInt + "[]":
+                    return PrimitiveType.IntArray;
                 case KeywordReal:
                     return PrimitiveType.Real;
+                case KeywordReal + "[]":
+                    return PrimitiveType.RealArray;
                 case KeywordVoid:
                     return PrimitiveType.Void;
                 default:
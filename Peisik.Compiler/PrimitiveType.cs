@@ -6,6 +6,35 @@
         Void,
         Int,
         Real,
-        Bool
+        Bool,
+        IntArray,
+        RealArray
+    }
+
+    internal static class PrimitiveTypeExtensions
+    {
+        /// <summary>
+        /// Returns true if the type is an array type.
+        /// </summary>
+        public static bool IsArray(this PrimitiveType type)
+        {
+            return type == PrimitiveType.IntArray || type == PrimitiveType.RealArray;
+        }
+
+        /// <summary>
+        /// Returns the element type of an array type, or NoType for other types.
+        /// </summary>
+        public static PrimitiveType GetElementType(this PrimitiveType type)
+        {
+            switch (type)
+            {
+                case PrimitiveType.IntArray:
+                    return PrimitiveType.Int;
+                case PrimitiveType.RealArray:
+                    return PrimitiveType.Real;
+                default:
+                    return PrimitiveType.NoType;
+            }
+        }
     }
 }
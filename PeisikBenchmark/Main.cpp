@@ -0,0 +1,289 @@
+#include "pch.h"
+#include "Interpreter.h"
+#include "PeisikException.h"
+#include "Peephole.h"
+#include "Program.h"
+#include "Report.h"
+#include "Statistics.h"
+
+using namespace Peisik::Benchmark;
+
+// The modules run by default, in the same order as Perf.cmd.
+static const char* DefaultModules[] = {
+    "Warmup", "BuiltinTest", "MonteCarloPi", "Trig", "Swap", "Fibonacci",
+    "FermatPrimality", "BellardPi", "Binomial", "Sum_NoTail", "Sum_Tail"
+};
+
+// A stream buffer that discards everything, used to silence program output while timing.
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int ch) override
+    {
+        return ch;
+    }
+};
+
+// Redirects std::cout for the lifetime of this object.
+class OutputRedirect
+{
+public:
+    OutputRedirect(std::streambuf* target)
+        : m_original(std::cout.rdbuf(target))
+    {
+    }
+
+    ~OutputRedirect()
+    {
+        std::cout.rdbuf(m_original);
+    }
+
+private:
+    std::streambuf* m_original;
+};
+
+// Returns the file name without directories and the extension.
+static std::string GetModuleName(const std::string& path)
+{
+    auto nameStart = path.find_last_of("/\\");
+    auto name = (nameStart == std::string::npos) ? path : path.substr(nameStart + 1);
+    auto extensionStart = name.rfind('.');
+    if (extensionStart != std::string::npos && extensionStart > 0)
+        name = name.substr(0, extensionStart);
+    return name;
+}
+
+void PrintHelp()
+{
+    std::cout << "The Peisik benchmark runner" << std::endl;
+    std::cout << "Usage: peisikbench [modules] [parameters]" << std::endl;
+    std::cout << "If no modules are specified, the standard performance suite is run." << std::endl;
+    std::cout << "Possible parameters:" << std::endl;
+    std::cout << " --compare FILE   Compare the medians against a baseline written with --json." << std::endl;
+    std::cout << "                  Exits with code 1 if any module regressed." << std::endl;
+    std::cout << " --help           Show this help." << std::endl;
+    std::cout << " --json FILE      Write the results as JSON to FILE." << std::endl;
+    std::cout << " --nopeephole     Do not simplify the bytecode when loading, like peisik --nopeephole." << std::endl;
+    std::cout << " --runs N         Number of timed runs per module (default: 10)." << std::endl;
+    std::cout << " --threshold PCT  Allowed slowdown in percent for --compare (default: 5)." << std::endl;
+    std::cout << " --verbose        Print the program output of the first run." << std::endl;
+    std::cout << " --warmup N       Number of untimed warmup runs per module (default: 2)." << std::endl;
+}
+
+// Runs the module the specified number of times and collects the results.
+static ModuleResult RunModule(const Peisik::Program& program, const std::string& name,
+    int warmupRuns, int timedRuns, bool verbose)
+{
+    ModuleResult result;
+    result.name = name;
+    result.instructions = 0;
+
+    NullBuffer nullBuffer;
+    std::vector<double> samples;
+    samples.reserve(timedRuns);
+
+    for (int run = 0; run < warmupRuns + timedRuns; run++)
+    {
+        // The first run is captured for verbose output, the rest go to the bit bucket
+        std::stringstream capture;
+        bool failed = false;
+        uint64_t instructions = 0;
+        std::chrono::high_resolution_clock::duration elapsed;
+        {
+            OutputRedirect redirect((run == 0) ? static_cast<std::streambuf*>(capture.rdbuf()) : &nullBuffer);
+
+            Peisik::Interpreter interpreter(program);
+            auto start = std::chrono::high_resolution_clock::now();
+            interpreter.Execute();
+            auto end = std::chrono::high_resolution_clock::now();
+
+            elapsed = end - start;
+            failed = interpreter.HasFailed();
+            instructions = interpreter.GetExecutedOpCount();
+        }
+
+        if (run == 0 && verbose)
+            std::cout << capture.str();
+        if (failed)
+            throw Peisik::ApplicationException("The program called FailFast.");
+
+        if (run >= warmupRuns)
+        {
+            samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / 1e9);
+            result.instructions = instructions;
+        }
+    }
+
+    result.time = Summarize(samples);
+    result.instructionsPerSecond = result.time.median > 0 ? result.instructions / result.time.median : 0;
+    return result;
+}
+
+static void PrintResultHeader()
+{
+    std::cout << std::left << std::setw(20) << "Module"
+        << std::right << std::setw(12) << "Median (s)"
+        << std::setw(12) << "p95 (s)"
+        << std::setw(12) << "Stddev (s)"
+        << std::setw(14) << "Instructions"
+        << std::setw(12) << "MIPS" << std::endl;
+}
+
+static void PrintResult(const ModuleResult& result)
+{
+    auto oldPrecision = std::cout.precision();
+    std::cout << std::left << std::setw(20) << result.name << std::right << std::fixed
+        << std::setprecision(4) << std::setw(12) << result.time.median
+        << std::setw(12) << result.time.p95
+        << std::setw(12) << result.time.stddev
+        << std::setw(14) << result.instructions
+        << std::setprecision(1) << std::setw(12) << result.instructionsPerSecond / 1e6 << std::endl;
+    std::cout.unsetf(std::ios_base::floatfield);
+    std::cout.precision(oldPrecision);
+}
+
+// Parses a non-negative numeric parameter value, or returns false.
+static bool TryParseCount(const std::string& value, double& result)
+{
+    char* end = nullptr;
+    result = std::strtod(value.c_str(), &end);
+    return !value.empty() && *end == '\0' && result >= 0;
+}
+
+int main(int argc, char **argv)
+{
+    // Parse the command line
+
+    std::vector<std::string> modules;
+    std::string jsonPath;
+    std::string baselinePath;
+    double warmupRuns = 2;
+    double timedRuns = 10;
+    double threshold = 5;
+    bool verbose = false;
+    bool peephole = true;
+    bool showHelp = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        bool hasValue = (i + 1 < argc);
+
+        if (arg == "--help")
+        {
+            showHelp = true;
+        }
+        else if (arg == "--verbose")
+        {
+            verbose = true;
+        }
+        else if (arg == "--nopeephole")
+        {
+            peephole = false;
+        }
+        else if (arg == "--json" && hasValue)
+        {
+            jsonPath = argv[++i];
+        }
+        else if (arg == "--compare" && hasValue)
+        {
+            baselinePath = argv[++i];
+        }
+        else if ((arg == "--warmup" && hasValue && TryParseCount(argv[i + 1], warmupRuns)) ||
+            (arg == "--runs" && hasValue && TryParseCount(argv[i + 1], timedRuns)) ||
+            (arg == "--threshold" && hasValue && TryParseCount(argv[i + 1], threshold)))
+        {
+            i++;
+        }
+        else if (arg.find("--") == 0)
+        {
+            std::cout << "Unknown or incomplete parameter: " << arg << std::endl;
+            showHelp = true;
+        }
+        else
+        {
+            modules.push_back(arg);
+        }
+    }
+
+    if (showHelp || timedRuns < 1)
+    {
+        PrintHelp();
+        return 0;
+    }
+
+    if (modules.empty())
+        modules.assign(std::begin(DefaultModules), std::end(DefaultModules));
+
+    // Load and run each module
+    std::vector<ModuleResult> results;
+    PrintResultHeader();
+    for (auto modulePath : modules)
+    {
+        // If the module name does not have an extension, add it
+        if (modulePath.find(".") == std::string::npos)
+        {
+            modulePath += ".cpeisik";
+        }
+
+        std::ifstream stream(modulePath, std::ifstream::binary);
+        if (stream.fail())
+        {
+            std::cout << "Could not open the module " << modulePath << std::endl;
+            return -1;
+        }
+
+        try
+        {
+            // Load the program the same way the interpreter does, so that the results are comparable
+            auto program = Peisik::DeserializeProgram(stream);
+            if (peephole)
+                Peisik::OptimizePeephole(program);
+            auto result = RunModule(program, GetModuleName(modulePath),
+                static_cast<int>(warmupRuns), static_cast<int>(timedRuns), verbose);
+
+            PrintResult(result);
+            results.push_back(result);
+        }
+        catch (std::exception& e)
+        {
+            std::cout << "Error in " << modulePath << ": " << e.what() << std::endl;
+            return -1;
+        }
+    }
+
+    if (!jsonPath.empty())
+    {
+        std::ofstream json(jsonPath);
+        if (json.fail())
+        {
+            std::cout << "Could not write the results to " << jsonPath << std::endl;
+            return -1;
+        }
+        WriteJsonReport(json, results, static_cast<int>(warmupRuns), static_cast<int>(timedRuns));
+    }
+
+    if (!baselinePath.empty())
+    {
+        std::ifstream baselineStream(baselinePath);
+        if (baselineStream.fail())
+        {
+            std::cout << "Could not open the baseline " << baselinePath << std::endl;
+            return -1;
+        }
+
+        try
+        {
+            auto baseline = ReadJsonBaseline(baselineStream);
+            if (CompareToBaseline(results, baseline, threshold) > 0)
+                return 1;
+        }
+        catch (std::exception& e)
+        {
+            std::cout << "Error: " << e.what() << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
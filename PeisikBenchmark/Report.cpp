@@ -0,0 +1,268 @@
+#include "pch.h"
+#include "Report.h"
+
+using namespace Peisik::Benchmark;
+
+/*
+ * JSON output
+ */
+
+static std::string EscapeJson(const std::string& value)
+{
+    std::string result;
+    for (auto ch : value)
+    {
+        if (ch == '"' || ch == '\\')
+            result += '\\';
+        result += ch;
+    }
+    return result;
+}
+
+void Peisik::Benchmark::WriteJsonReport(std::ostream& stream, const std::vector<ModuleResult>& results,
+    int warmupRuns, int timedRuns)
+{
+    stream << std::setprecision(9);
+    stream << "{" << std::endl;
+    stream << "  \"warmupRuns\": " << warmupRuns << "," << std::endl;
+    stream << "  \"timedRuns\": " << timedRuns << "," << std::endl;
+    stream << "  \"modules\": [" << std::endl;
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        auto& result = results[i];
+        stream << "    {" << std::endl;
+        stream << "      \"name\": \"" << EscapeJson(result.name) << "\"," << std::endl;
+        stream << "      \"median\": " << result.time.median << "," << std::endl;
+        stream << "      \"p95\": " << result.time.p95 << "," << std::endl;
+        stream << "      \"mean\": " << result.time.mean << "," << std::endl;
+        stream << "      \"stddev\": " << result.time.stddev << "," << std::endl;
+        stream << "      \"min\": " << result.time.min << "," << std::endl;
+        stream << "      \"max\": " << result.time.max << "," << std::endl;
+        stream << "      \"instructions\": " << result.instructions << "," << std::endl;
+        stream << "      \"instructionsPerSecond\": " << result.instructionsPerSecond << std::endl;
+        stream << "    }" << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+
+    stream << "  ]" << std::endl;
+    stream << "}" << std::endl;
+}
+
+
+/*
+ * JSON input
+ */
+
+namespace
+{
+    // A minimal JSON reader that understands just enough to read back our own reports.
+    // Unknown members are skipped, so the report format may be extended freely.
+    class JsonReader
+    {
+    public:
+        JsonReader(std::istream& stream)
+            : m_text(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()), m_position(0)
+        {
+        }
+
+        // Expects the given character, skipping whitespace before it.
+        void Expect(char ch)
+        {
+            if (Peek() != ch)
+                throw std::runtime_error(std::string("Malformed baseline: expected '") + ch + "'.");
+            m_position++;
+        }
+
+        // Consumes the character if it is the next one.
+        bool TryConsume(char ch)
+        {
+            if (Peek() != ch)
+                return false;
+            m_position++;
+            return true;
+        }
+
+        // Returns the next non-whitespace character without consuming it.
+        char Peek()
+        {
+            while (m_position < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_position])))
+                m_position++;
+            if (m_position >= m_text.size())
+                throw std::runtime_error("Malformed baseline: unexpected end of file.");
+            return m_text[m_position];
+        }
+
+        std::string ReadString()
+        {
+            Expect('"');
+            std::string result;
+            while (m_position < m_text.size() && m_text[m_position] != '"')
+            {
+                if (m_text[m_position] == '\\')
+                    m_position++;
+                if (m_position < m_text.size())
+                    result += m_text[m_position++];
+            }
+            Expect('"');
+            return result;
+        }
+
+        double ReadNumber()
+        {
+            Peek();
+            const char* start = m_text.c_str() + m_position;
+            char* end = nullptr;
+            double value = std::strtod(start, &end);
+            if (end == start)
+                throw std::runtime_error("Malformed baseline: expected a number.");
+            m_position += end - start;
+            return value;
+        }
+
+        // Skips over any value, including nested objects and arrays.
+        void SkipValue()
+        {
+            char ch = Peek();
+            if (ch == '"')
+            {
+                ReadString();
+            }
+            else if (ch == '{' || ch == '[')
+            {
+                char close = (ch == '{') ? '}' : ']';
+                m_position++;
+                if (TryConsume(close))
+                    return;
+                do
+                {
+                    if (close == '}')
+                    {
+                        ReadString();
+                        Expect(':');
+                    }
+                    SkipValue();
+                } while (TryConsume(','));
+                Expect(close);
+            }
+            else if (std::isalpha(static_cast<unsigned char>(ch)))
+            {
+                // true, false or null
+                while (m_position < m_text.size() && std::isalpha(static_cast<unsigned char>(m_text[m_position])))
+                    m_position++;
+            }
+            else
+            {
+                ReadNumber();
+            }
+        }
+
+    private:
+        std::string m_text;
+        size_t m_position;
+    };
+}
+
+std::map<std::string, double> Peisik::Benchmark::ReadJsonBaseline(std::istream& stream)
+{
+    std::map<std::string, double> result;
+    JsonReader reader(stream);
+
+    reader.Expect('{');
+    if (reader.TryConsume('}'))
+        return result;
+    do
+    {
+        auto key = reader.ReadString();
+        reader.Expect(':');
+        if (key != "modules")
+        {
+            reader.SkipValue();
+            continue;
+        }
+
+        // Each module is an object with at least the name and median members
+        reader.Expect('[');
+        if (reader.TryConsume(']'))
+            continue;
+        do
+        {
+            std::string name;
+            double median = -1;
+
+            reader.Expect('{');
+            if (!reader.TryConsume('}'))
+            {
+                do
+                {
+                    auto member = reader.ReadString();
+                    reader.Expect(':');
+                    if (member == "name")
+                        name = reader.ReadString();
+                    else if (member == "median")
+                        median = reader.ReadNumber();
+                    else
+                        reader.SkipValue();
+                } while (reader.TryConsume(','));
+                reader.Expect('}');
+            }
+
+            if (name.empty() || median < 0)
+                throw std::runtime_error("Malformed baseline: module entry without name or median.");
+            result[name] = median;
+        } while (reader.TryConsume(','));
+        reader.Expect(']');
+    } while (reader.TryConsume(','));
+    reader.Expect('}');
+
+    return result;
+}
+
+
+/*
+ * Comparison
+ */
+
+// Differences below this are considered noise regardless of the relative change.
+static const double NoiseFloorSeconds = 0.001;
+
+int Peisik::Benchmark::CompareToBaseline(const std::vector<ModuleResult>& results,
+    const std::map<std::string, double>& baseline, double thresholdPercent)
+{
+    int regressions = 0;
+    auto oldPrecision = std::cout.precision();
+
+    std::cout << "-- Comparison against baseline (threshold " << thresholdPercent << " %)" << std::endl;
+    std::cout << std::left << std::setw(20) << "Module"
+        << std::right << std::setw(14) << "Baseline (s)"
+        << std::setw(14) << "Current (s)"
+        << std::setw(10) << "Change" << "  Status" << std::endl;
+
+    for (auto& result : results)
+    {
+        std::cout << std::left << std::setw(20) << result.name << std::right << std::fixed;
+
+        auto baselineEntry = baseline.find(result.name);
+        if (baselineEntry == baseline.end())
+        {
+            std::cout << std::setw(14) << "-" << std::setw(14) << std::setprecision(4) << result.time.median
+                << std::setw(10) << "-" << "  no baseline" << std::endl;
+            std::cout.unsetf(std::ios_base::floatfield);
+            continue;
+        }
+
+        double base = baselineEntry->second;
+        double change = base > 0 ? (result.time.median - base) / base * 100.0 : 0.0;
+        bool regressed = change > thresholdPercent && result.time.median - base > NoiseFloorSeconds;
+        if (regressed)
+            regressions++;
+
+        std::cout << std::setw(14) << std::setprecision(4) << base
+            << std::setw(14) << result.time.median
+            << std::setw(9) << std::setprecision(1) << std::showpos << change << std::noshowpos << "%"
+            << "  " << (regressed ? "REGRESSED" : "ok") << std::endl;
+        std::cout.unsetf(std::ios_base::floatfield);
+    }
+    std::cout.precision(oldPrecision);
+
+    return regressions;
+}
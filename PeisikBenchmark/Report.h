@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "Statistics.h"
+
+namespace Peisik
+{
+    namespace Benchmark
+    {
+        // The measured results of a single module.
+        struct ModuleResult
+        {
+            std::string name;
+            SampleSummary time;
+            uint64_t instructions;
+            double instructionsPerSecond;
+        };
+
+        // Writes the results as a JSON document.
+        void WriteJsonReport(std::ostream& stream, const std::vector<ModuleResult>& results,
+            int warmupRuns, int timedRuns);
+
+        // Reads the median execution times from a JSON document written by WriteJsonReport.
+        // The result maps module names to their median times in seconds.
+        // If the document is malformed, an exception is thrown.
+        std::map<std::string, double> ReadJsonBaseline(std::istream& stream);
+
+        // Prints a comparison table against the baseline medians.
+        // Returns the number of modules that regressed by more than thresholdPercent.
+        // Differences of less than a millisecond are not counted as regressions.
+        int CompareToBaseline(const std::vector<ModuleResult>& results,
+            const std::map<std::string, double>& baseline, double thresholdPercent);
+    }
+}
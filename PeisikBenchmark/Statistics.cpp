@@ -0,0 +1,48 @@
+#include "pch.h"
+#include "Statistics.h"
+
+using namespace Peisik::Benchmark;
+
+// Returns the sample at the given percentile using linear interpolation between closest ranks.
+// The samples must be sorted.
+static double Percentile(const std::vector<double>& sorted, double percentile)
+{
+    if (sorted.size() == 1)
+        return sorted[0];
+
+    double rank = percentile / 100.0 * (sorted.size() - 1);
+    size_t lower = static_cast<size_t>(rank);
+    if (lower + 1 >= sorted.size())
+        return sorted.back();
+
+    double fraction = rank - lower;
+    return sorted[lower] + fraction * (sorted[lower + 1] - sorted[lower]);
+}
+
+SampleSummary Peisik::Benchmark::Summarize(std::vector<double> samples)
+{
+    if (samples.empty())
+        throw std::invalid_argument("Cannot summarize an empty sample set.");
+
+    std::sort(samples.begin(), samples.end());
+
+    SampleSummary result;
+    result.count = samples.size();
+    result.min = samples.front();
+    result.max = samples.back();
+    result.median = Percentile(samples, 50);
+    result.p95 = Percentile(samples, 95);
+
+    double sum = 0;
+    for (auto sample : samples)
+        sum += sample;
+    result.mean = sum / samples.size();
+
+    // Sample standard deviation (Bessel's correction), zero for a single sample
+    double squares = 0;
+    for (auto sample : samples)
+        squares += (sample - result.mean) * (sample - result.mean);
+    result.stddev = samples.size() > 1 ? std::sqrt(squares / (samples.size() - 1)) : 0.0;
+
+    return result;
+}
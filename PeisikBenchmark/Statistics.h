@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace Peisik
+{
+    namespace Benchmark
+    {
+        // Summary statistics over a set of timing samples.
+        // All values are in seconds.
+        struct SampleSummary
+        {
+            size_t count;
+            double min;
+            double max;
+            double mean;
+            double median;
+            double p95;
+            double stddev;
+        };
+
+        // Computes the summary statistics for the given samples.
+        // If the sample vector is empty, an exception is thrown.
+        SampleSummary Summarize(std::vector<double> samples);
+    }
+}
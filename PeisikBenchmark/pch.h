@@ -0,0 +1,13 @@
+#pragma once
+
+// The precompiled header for the benchmark runner.
+// Includes everything the interpreter uses, plus some extras.
+
+#include "../PeisikInterpreter/pch.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <streambuf>
@@ -12,29 +12,56 @@ namespace PeisikEndToEndTests
     class EndToEndTestBase
     {
         protected string CompileAndRun(string source, string targetFileName, string arguments)
+        {
+            return CompileAndRun(source, targetFileName, arguments, false);
+        }
+
+        protected string CompileAndRun(string source, string targetFileName, string arguments, bool compactEncoding)
+        {
+            Compile(source, targetFileName, compactEncoding);
+            return Run(arguments + " " + targetFileName, out _);
+        }
+
+        protected void Compile(string source, string targetFileName, bool compactEncoding)
         {
             var program = CompileStringWithoutDiagnostics(source);
-            var path = Path.GetDirectoryName(Assembly.GetExecutingAssembly().Location);
 
-            using (var writer = new BinaryWriter(new FileStream(Path.Combine(path, targetFileName), FileMode.Create)))
+            using (var writer = new BinaryWriter(new FileStream(Path.Combine(OutputDirectory, targetFileName), FileMode.Create)))
             {
-                program.Serialize(writer);
+                program.Serialize(writer, compactEncoding);
             }
+        }
+
+        /// <summary>
+        /// Runs the interpreter with the specified command line and returns its output.
+        /// </summary>
+        protected string Run(string arguments, out int exitCode)
+        {
+            var process = StartInterpreter(arguments);
+            var output = process.StandardOutput.ReadToEnd();
+            process.WaitForExit();
+            exitCode = process.ExitCode;
+            return output;
+        }
 
+        /// <summary>
+        /// Starts the interpreter without waiting for it, for example to run a server in the background.
+        /// </summary>
+        protected Process StartInterpreter(string arguments)
+        {
             var startInfo = new ProcessStartInfo() {
-                Arguments = arguments + " " + targetFileName,
-                FileName = Path.Combine(path, "peisik.exe"),
+                Arguments = arguments,
+                FileName = Path.Combine(OutputDirectory, "peisik.exe"),
                 RedirectStandardOutput = true,
                 UseShellExecute = false,
-                WorkingDirectory = path
+                WorkingDirectory = OutputDirectory
             };
 
-            var process = Process.Start(startInfo);
-            var output = process.StandardOutput.ReadToEnd();
-            process.WaitForExit();
-            return output;
+            return Process.Start(startInfo);
         }
 
+        protected string OutputDirectory => Path.GetDirectoryName(Assembly.GetExecutingAssembly().Location);
+
         private CompiledProgram CompileStringWithoutDiagnostics(string source)
         {
             using (var reader = new StringReader(source))
@@ -4,6 +4,7 @@ set __Files=Warmup BuiltinTest MonteCarloPi Trig Swap Fibonacci FermatPrimality
 set __Countops=
 set __Optimize=-O
 
+if "%1" == "bench" goto Bench
 if "%1" == "compare" goto Compare
 if "%1" == "countops" goto CountOps
 if "%1" == "diff" goto Diff
@@ -13,6 +14,21 @@ goto Usage
 
 
 
+:Bench
+echo.
+echo Compiling...
+echo.
+peisikc %__Files% %__Optimize%
+echo.
+echo.
+echo Benchmarking...
+echo.
+peisikbench %__Files% %2 %3 %4 %5 %6 %7 %8 %9
+
+goto :eof
+
+
+
 :CountOps
 set __Countops=--countops
 
@@ -70,6 +86,9 @@ goto :eof
 :Usage
 echo Usage: perf (option)
 echo Possible options:
+echo   bench    Compiles the test suite with optimization and runs it through
+echo            the benchmark runner. Further parameters such as
+echo            "--json base.json" or "--compare base.json" are passed on.
 echo   compare  Compiles and runs the test suite with and without optimization,
 echo            collecting timings.
 echo   countops Compiles and runs the test suite with and without optimization,
@@ -1,4 +1,5 @@
-﻿using NUnit.Framework;
+﻿using System.IO;
+using NUnit.Framework;
 
 namespace PeisikEndToEndTests
 {
@@ -33,6 +34,56 @@ end";
             Assert.That(output.Trim(), Is.EqualTo(expected));
         }
 
+        [Test]
+        public void ConstantFolding()
+        {
+            var source = @"public int Main()
+begin
+  return +(*(2, 3), 4)
+end";
+            var output = CompileAndRun(source, "ConstantFolding.cpeisik", "");
+            Assert.That(output.Trim(), Is.EqualTo("10"));
+
+            // The internal calls are folded into a single PushConst when loading
+            var stats = CompileAndRun(source, "ConstantFolding_stats.cpeisik", "--dumpstats");
+            Assert.That(stats, Does.Contain("Total code size: 2"));
+            var unoptimizedStats = CompileAndRun(source, "ConstantFolding_nopeephole.cpeisik", "--dumpstats --nopeephole");
+            Assert.That(unoptimizedStats, Does.Contain("Total code size: 6"));
+        }
+
+        [Test]
+        public void SsaOptimizer_HoistsLoopInvariant()
+        {
+            var source = @"private int CountDivisors(int n, int zero)
+begin
+  int d 1
+  int count 0
+  while <=(d, Math.Sqrt(n))
+  begin
+    if ==(%(n, d), 0)
+    begin
+      count = +(count, 1)
+    end
+    d = +(d, 1)
+  end
+  # Never executed, so the division must not be hoisted
+  while <(d, 0)
+  begin
+    count = //(count, zero)
+    d = +(d, 1)
+  end
+  return count
+end
+
+public int Main()
+begin
+  return CountDivisors(10000, 0)
+end";
+            var output = CompileAndRun(source, "SsaOptimizer.cpeisik", "--optimize --verbose");
+            Assert.That(output, Does.Contain("hoisted 1 expressions"));
+            Assert.That(output.Trim(), Does.EndWith("13"));
+        }
+
         [Test]
         public void FunctionCallNoParams()
         {
@@ -220,5 +271,714 @@ end";
 
             Assert.That(output.Trim(), Is.EqualTo("45"));
         }
+
+        [Test]
+        public void While_ArithmeticSum_FusedInstructions()
+        {
+            var source = @"
+private int Main()
+begin
+  int i 0
+  int sum 0
+  while <(i, 10)
+  begin
+    sum = +(sum, i)
+    i = +(i, 1)
+  end
+  return sum
+end";
+            var output = CompileAndRun(source, "FusedArithmeticSum.cpeisik", "--countops");
+
+            // The loop condition and the increment are fused when loading
+            Assert.That(output.Trim(), Does.StartWith("45"));
+            Assert.That(output, Does.Match(@"\nJumpIfNotLess +11\s"));
+            Assert.That(output, Does.Match(@"\nPlusImm +10\s"));
+        }
+
+        [Test]
+        public void CompactEncoding_SameResultsAndStackTrace()
+        {
+            var source = @"
+private void Check(int sum)
+begin
+  if ==(sum, 45)
+  begin
+    FailFast()
+  end
+end
+
+private void Main()
+begin
+  int i 0
+  int sum 0
+  while <(i, 10)
+  begin
+    sum = +(sum, i)
+    i = +(i, 1)
+  end
+  Check(sum)
+end";
+            var wide = CompileAndRun(source, "CompactEncoding_wide.cpeisik", "");
+            Assert.That(wide, Does.Contain("FailFast"));
+
+            // Stored compact, and then also executed compact with instruction indices in the stack trace
+            var stored = CompileAndRun(source, "CompactEncoding_stored.cpeisik", "", true);
+            Assert.That(stored, Is.EqualTo(wide));
+            var executed = CompileAndRun(source, "CompactEncoding_executed.cpeisik", "--compact", true);
+            Assert.That(executed, Is.EqualTo(wide));
+        }
+
+        [Test]
+        public void LazyDecoding_SameResultsAndStackTrace()
+        {
+            var source = @"
+private int Square(int x)
+begin
+  return *(x, x)
+end
+
+private int NeverCalled()
+begin
+  return Square(3)
+end
+
+private void Check(int sum)
+begin
+  if ==(sum, 285)
+  begin
+    FailFast()
+  end
+end
+
+private void Main()
+begin
+  int i 0
+  int sum 0
+  while <(i, 10)
+  begin
+    sum = +(sum, Square(i))
+    i = +(i, 1)
+  end
+  Check(sum)
+end";
+            var eager = CompileAndRun(source, "LazyDecoding_eager.cpeisik", "");
+            Assert.That(eager, Does.Contain("FailFast"));
+
+            var lazy = CompileAndRun(source, "LazyDecoding_lazy.cpeisik", "--lazy");
+            Assert.That(lazy, Is.EqualTo(eager));
+            var predecoded = CompileAndRun(source, "LazyDecoding_predecoded.cpeisik", "--predecode --compact");
+            Assert.That(predecoded, Is.EqualTo(eager));
+        }
+
+        [Test]
+        public void BinaryTrace_KeepsLastInstructions()
+        {
+            var source = @"private int Main()
+begin
+  int i 0
+  while <(i, 1000)
+  begin
+    i = +(i, 1)
+  end
+  return i
+end";
+            var output = CompileAndRun(source, "BinaryTrace.cpeisik", "--bintrace --tracesize 100");
+
+            Assert.That(output.Trim(), Does.StartWith("1000"));
+            Assert.That(output, Does.Match(@"-- Wrote the last 128 of \d+ instructions to BinaryTrace.cpeisik.trace"));
+        }
+
+        [Test]
+        public void Workers_TimeSlicedProgramGivesSameOutput()
+        {
+            var source = @"private int Sum(int n)
+begin
+  int i 0
+  int total 0
+  while <(i, n)
+  begin
+    total = +(total, i)
+    i = +(i, 1)
+  end
+  Print(total)
+  return total
+end
+
+private int Main()
+begin
+  return +(Sum(100), Sum(1000))
+end";
+            var serial = CompileAndRun(source, "Workers_serial.cpeisik", "");
+            Assert.That(serial.Trim(), Does.StartWith("4950"));
+            Assert.That(serial.Trim(), Does.EndWith("504450"));
+
+            // Many short time slices, so the program is resumed a lot
+            var sliced = CompileAndRun(source, "Workers_sliced.cpeisik", "--workers 2 --timeslice 10 --verbose");
+            Assert.That(sliced, Does.Contain(serial));
+            Assert.That(sliced, Does.Match(@"-- Scheduler ran \d{3,} time slices on 2 workers"));
+        }
+
+        [Test]
+        public void While_InfiniteLoop_InstructionBudget()
+        {
+            var source = @"private void Main()
+begin
+  int i 0
+  while true
+  begin
+    i = +(i, 1)
+  end
+end";
+            var output = CompileAndRun(source, "InfiniteLoop.cpeisik", "--maxops 1000");
+
+            var result = output.Trim();
+            Assert.That(result, Does.StartWith("Error: Execution budget exceeded: instruction limit of 1000"));
+            Assert.That(result, Does.Contain("reached in function 0"));
+        }
+
+        [Test]
+        public void InfiniteRecursion_CallDepthBudget()
+        {
+            var source = @"private int Main()
+begin
+  return Recurse(0)
+end
+
+private int Recurse(int depth)
+begin
+  return +(Recurse(+(depth, 1)), 1)
+end";
+            var output = CompileAndRun(source, "InfiniteRecursion.cpeisik", "--maxdepth 100");
+
+            var result = output.Trim();
+            Assert.That(result, Does.StartWith("Error: Execution budget exceeded: call depth limit of 100"));
+            Assert.That(result, Does.Contain("call depth 100"));
+        }
+
+        [Test]
+        public void MemoryStatistics_DeepRecursion()
+        {
+            var source = @"private int Main()
+begin
+  return Recurse(0)
+end
+
+private int Recurse(int depth)
+begin
+  if ==(depth, 1000)
+  begin
+    return 0
+  end
+  return +(Recurse(+(depth, 1)), 1)
+end";
+            var output = CompileAndRun(source, "MemoryStatistics.cpeisik", "--memstats");
+
+            var lines = output.Trim().Split('\n');
+            Assert.That(lines[0].Trim(), Is.EqualTo("1000"));
+            // Main and 1001 Recurse frames
+            Assert.That(output, Does.Match(@"Peak frame depth +1002"));
+            Assert.That(output, Does.Match(@"Operand stacks +\d+ +[1-9]\d{5,} +\d+"));
+        }
+
+        [Test]
+        public void Memoize_Fibonacci()
+        {
+            var source = @"private int Fib(int n)
+begin
+  if <(n, 2)
+  begin
+    return n
+  end
+  return +(Fib(-(n, 1)), Fib(-(n, 2)))
+end
+
+private int Main()
+begin
+  return Fib(30)
+end";
+            var output = CompileAndRun(source, "MemoizedFibonacci.cpeisik", "--memoize --countops");
+
+            var lines = output.Trim().Split('\n');
+            Assert.That(lines[0].Trim(), Is.EqualTo("832040"));
+            // Both functions are pure, and each Fib(n) is computed only once
+            Assert.That(output, Does.Contain("-- Memoized functions: 2"));
+            Assert.That(output, Does.Match(@"\n0 +28 +31 +0"));
+        }
+
+        [Test]
+        public void Inline_SquareInLoop()
+        {
+            var source = @"private int Square(int x)
+begin
+  return *(x, x)
+end
+
+private int Main()
+begin
+  int i 0
+  int sum 0
+  while <(i, 10)
+  begin
+    sum = +(sum, Square(i))
+    i = +(i, 1)
+  end
+  return sum
+end";
+            var output = CompileAndRun(source, "InlineSquare.cpeisik", "--inline 8 --verbose");
+
+            Assert.That(output, Does.Contain("Inlined 1 call sites"));
+            Assert.That(output.Trim(), Does.EndWith("285"));
+        }
+
+        [Test]
+        public void Arrays_BulkOperationsAndCollection()
+        {
+            var source = @"private real Churn(int rounds)
+begin
+  real total 0.0
+  while >(rounds, 0)
+  begin
+    real[] t Array.NewReal(1000)
+    Array.Fill(t, 0.5)
+    total = +(total, Array.Sum(t))
+    rounds = -(rounds, 1)
+  end
+  return total
+end
+
+private void Main()
+begin
+  int[] a Array.NewInt(10)
+  int i 0
+  while <(i, 10)
+  begin
+    Array.Set(a, i, *(i, i))
+    i = +(i, 1)
+  end
+  Print(Array.Sum(a), Array.Dot(a, a), Array.Get(a, 3))
+  Array.Add(a, a)
+  Print(Array.Get(a, 9))
+  Print(Churn(5000))
+  Print(Array.Get(a, 10))
+end";
+            var output = CompileAndRun(source, "Arrays.cpeisik", "");
+
+            var lines = output.Trim().Split('\n');
+            Assert.That(lines[0].Trim(), Is.EqualTo("285 15333 9"));
+            Assert.That(lines[1].Trim(), Is.EqualTo("162"));
+            Assert.That(lines[2].Trim(), Is.EqualTo("2.5e+06"));
+            Assert.That(output, Does.Contain("Array index out of range."));
+        }
+
+        [Test]
+        public void Parallel_SumAndCount()
+        {
+            var source = @"private real Inverse(int x)
+begin
+  return /(1.0, +(x, 1))
+end
+
+private bool IsPrime(int n)
+begin
+  if <(n, 2)
+  begin
+    return false
+  end
+  int d 2
+  while <=(*(d, d), n)
+  begin
+    if ==(%(n, d), 0)
+    begin
+      return false
+    end
+    d = +(d, 1)
+  end
+  return true
+end
+
+private void Main()
+begin
+  Print(Parallel.Count(IsPrime, 0, 10000), Parallel.Count(IsPrime, 5, 5))
+  Print(Parallel.Sum(Inverse, 0, 1000))
+end";
+            var output = CompileAndRun(source, "Parallel.cpeisik", "--parallel 4");
+
+            var lines = output.Trim().Split('\n');
+            Assert.That(lines[0].Trim(), Is.EqualTo("1229 0"));
+            Assert.That(lines[1].Trim(), Is.EqualTo("7.48547"));
+        }
+
+        [Test]
+        public void Parallel_InstructionBudgetIsShared()
+        {
+            var source = @"private int Work(int x)
+begin
+  int i 0
+  int total 0
+  while <(i, 1000)
+  begin
+    total = +(total, %(*(x, i), 7))
+    i = +(i, 1)
+  end
+  return total
+end
+
+private void Main()
+begin
+  Print(Parallel.Sum(Work, 0, 256))
+end";
+            // Each chunk would fit in the budget, but all of them together do not
+            var output = CompileAndRun(source, "ParallelBudget.cpeisik", "--parallel 4 --maxops 100000");
+
+            var result = output.Trim();
+            Assert.That(result, Does.StartWith("Error: Execution budget exceeded: instruction limit of 100000"));
+            Assert.That(result, Does.Match(@"\(1\d{5} instructions executed"));
+        }
+
+        [Test]
+        public void ForkJoin_IndependentRecursiveCalls()
+        {
+            var source = @"private int Fib(int n)
+begin
+  if <(n, 2)
+  begin
+    return n
+  end
+  return +(Fib(-(n, 1)), Fib(-(n, 2)))
+end
+
+private real Harmonic(int from, int to)
+begin
+  if ==(from, to)
+  begin
+    return /(1.0, from)
+  end
+  int middle //(+(from, to), 2)
+  return +(Harmonic(from, middle), Harmonic(+(middle, 1), to))
+end
+
+private void Main()
+begin
+  Print(Fib(20), Harmonic(1, 1000))
+end";
+            var output = CompileAndRun(source, "ForkJoin.cpeisik", "--forkjoin 8 --parallel 4");
+
+            Assert.That(output.Trim(), Is.EqualTo("6765 7.48547"));
+        }
+
+        [Test]
+        [Platform(Exclude = "Win")]
+        public void Server_SameOutputAndExitCodeAsLocalRun()
+        {
+            var source = @"private int Sum(int n)
+begin
+  int i 0
+  int total 0
+  while <(i, n)
+  begin
+    total = +(total, i)
+    i = +(i, 1)
+  end
+  return total
+end
+
+private void Main()
+begin
+  Print(Sum(100), Sum(1000))
+end";
+            var errorSource = @"private int Get(int[] a, int i)
+begin
+  return Array.Get(a, i)
+end
+
+private void Main()
+begin
+  int[] a Array.NewInt(10)
+  Print(Get(a, 9))
+  Print(Get(a, 10))
+end";
+            Compile(source, "Server.cpeisik", false);
+            Compile(errorSource, "Server_error.cpeisik", false);
+            var localError = Run("Server_error.cpeisik", out var localExitCode);
+            Assert.That(localError, Does.Contain("Error: Array index out of range."));
+            Assert.That(localExitCode, Is.Not.EqualTo(0));
+
+            var socketPath = Path.Combine(Path.GetTempPath(), Path.GetRandomFileName());
+            var server = StartInterpreter("--serve " + socketPath);
+            try
+            {
+                Assert.That(server.StandardOutput.ReadLine(), Does.StartWith("-- Serving on " + socketPath));
+
+                // The second request runs the cached program
+                for (int i = 0; i < 2; i++)
+                {
+                    var output = Run("--connect " + socketPath + " Server.cpeisik", out var exitCode);
+                    Assert.That(output.Trim(), Is.EqualTo("4950 499500"));
+                    Assert.That(exitCode, Is.EqualTo(0));
+                }
+
+                var remoteError = Run("--connect " + socketPath + " Server_error.cpeisik", out var remoteExitCode);
+                Assert.That(remoteError, Is.EqualTo(localError));
+                Assert.That(remoteExitCode, Is.EqualTo(localExitCode));
+            }
+            finally
+            {
+                server.Kill();
+                server.WaitForExit();
+                File.Delete(socketPath);
+            }
+        }
+
+        [Test]
+        public void Layout_SameResultsWithWideAndCompactCode()
+        {
+            var source = @"private int Square(int x)
+begin
+  return *(x, x)
+end
+
+private int Fib(int n)
+begin
+  if <(n, 2)
+  begin
+    return n
+  end
+  return +(Fib(-(n, 1)), Fib(-(n, 2)))
+end
+
+private real Average(int count)
+begin
+  int i 0
+  int sum 0
+  while <(i, count)
+  begin
+    sum = +(sum, Square(i))
+    i = +(i, 1)
+  end
+  return /(sum, count)
+end
+
+private int NeverCalled()
+begin
+  return Square(Fib(3))
+end
+
+private void Main()
+begin
+  Print(Fib(15), Average(100))
+  Print(Square(12))
+end";
+            var plain = CompileAndRun(source, "Layout_plain.cpeisik", "");
+            var lines = plain.Trim().Split('\n');
+            Assert.That(lines[0].Trim(), Is.EqualTo("610 3283.5"));
+            Assert.That(lines[1].Trim(), Is.EqualTo("144"));
+
+            // The function never called goes last
+            var wide = CompileAndRun(source, "Layout_wide.cpeisik", "--layout --verbose");
+            Assert.That(wide, Does.Contain("Laid out 4 hot and 1 cold functions"));
+            Assert.That(wide, Does.EndWith(plain));
+            var compact = CompileAndRun(source, "Layout_compact.cpeisik", "--layout --compact --verbose", true);
+            Assert.That(compact, Does.Contain("Laid out 4 hot and 1 cold functions"));
+            Assert.That(compact, Does.EndWith(plain));
+        }
+
+        [Test]
+        public void BlockLayout_ProfiledBranchIsInvertedAndLoopRotated()
+        {
+            var source = @"private int IsNegative(int x)
+begin
+  if <(x, 0)
+  begin
+    return 1
+  end
+  return 0
+end
+
+private int CountNegative(int count, int x)
+begin
+  int i 0
+  int negative 0
+  while <(i, count)
+  begin
+    negative = +(negative, IsNegative(-(x, i)))
+    i = +(i, 1)
+  end
+  return negative
+end
+
+private void Main()
+begin
+  Print(CountNegative(1000, 5000), CountNegative(3, 1))
+end";
+            var plain = CompileAndRun(source, "BlockLayout_int.cpeisik", "");
+            Assert.That(plain.Trim(), Is.EqualTo("0 1"));
+
+            // Without a profile the branch direction is not known
+            File.Delete(Path.Combine(OutputDirectory, "BlockLayout_int.cpeisik.profile"));
+            var estimated = Run("--layout --verbose BlockLayout_int.cpeisik", out _);
+            Assert.That(estimated, Does.Contain("Block layout inverted 0 branches, rotated 1 loops and moved 0 cold blocks"));
+            Assert.That(estimated, Does.EndWith(plain));
+
+            var recording = Run("--writeprofile BlockLayout_int.cpeisik", out _);
+            Assert.That(recording, Does.Contain("-- Wrote the profile to BlockLayout_int.cpeisik.profile"));
+            var profiled = Run("--layout --verbose BlockLayout_int.cpeisik", out _);
+            Assert.That(profiled, Does.Contain("Block layout inverted 1 branches, rotated 1 loops and moved 0 cold blocks"));
+            Assert.That(profiled, Does.Contain("using the profile"));
+            Assert.That(profiled, Does.EndWith(plain));
+        }
+
+        [Test]
+        public void BlockLayout_RealComparisonIsNotInverted()
+        {
+            // The comparison is usually false, but its opposite would also be false for NaN
+            var source = @"private int IsNegative(real x)
+begin
+  if <(x, 0.0)
+  begin
+    return 1
+  end
+  return 0
+end
+
+private int CountNegative(int count, real x)
+begin
+  int i 0
+  int negative 0
+  while <(i, count)
+  begin
+    negative = +(negative, IsNegative(-(x, i)))
+    i = +(i, 1)
+  end
+  return negative
+end
+
+private void Main()
+begin
+  real notANumber -(Math.Exp(1000.0), Math.Exp(1000.0))
+  Print(CountNegative(1000, 5000.0), CountNegative(3, notANumber))
+  Print(IsNegative(notANumber), IsNegative(-1.0))
+end";
+            var plain = CompileAndRun(source, "BlockLayout_real.cpeisik", "");
+            var lines = plain.Trim().Split('\n');
+            Assert.That(lines[0].Trim(), Is.EqualTo("0 0"));
+            Assert.That(lines[1].Trim(), Is.EqualTo("0 1"));
+
+            Run("--writeprofile BlockLayout_real.cpeisik", out _);
+            var profiled = Run("--layout --verbose BlockLayout_real.cpeisik", out _);
+            Assert.That(profiled, Does.Contain("Block layout inverted 0 branches, rotated 1 loops and moved 0 cold blocks"));
+            Assert.That(profiled, Does.EndWith(plain));
+        }
+
+        [Test]
+        public void BlockLayout_FailFastBlockIsCold()
+        {
+            var source = @"private int Check(int x)
+begin
+  if >(x, 3)
+  begin
+    FailFast()
+  end
+  return x
+end
+
+private void Main()
+begin
+  Print(Check(1))
+  Print(Check(5))
+end";
+            var plain = CompileAndRun(source, "BlockLayout_failfast.cpeisik", "");
+            Assert.That(plain.Trim(), Does.StartWith("1"));
+            Assert.That(plain, Does.Contain("FailFast"));
+
+            // The instruction indices in the stack trace change with the layout
+            File.Delete(Path.Combine(OutputDirectory, "BlockLayout_failfast.cpeisik.profile"));
+            var laidOut = Run("--layout --verbose BlockLayout_failfast.cpeisik", out _);
+            Assert.That(laidOut, Does.Contain("moved 1 cold blocks"));
+            Assert.That(laidOut, Does.Contain(plain.Substring(0, plain.IndexOf("Stack trace:"))));
+            Assert.That(laidOut, Does.Match(@"Stack trace:\r?\nFunction 0, instruction \d+\r?\nFunction 1, instruction \d+"));
+        }
+
+        private const string SnapshotSource = @"private int Collatz(int n)
+begin
+  if ==(n, 1)
+  begin
+    return 0
+  end
+  if ==(%(n, 2), 0)
+  begin
+    return +(1, Collatz(//(n, 2)))
+  end
+  return +(1, Collatz(+(*(3, n), 1)))
+end
+
+private void Main()
+begin
+  int[] steps Array.NewInt(10)
+  int round 0
+  int n 1
+  int longest 0
+  int length 0
+  while <(round, 10)
+  begin
+    n = 1
+    longest = 0
+    while <(n, 300)
+    begin
+      length = Collatz(+(n, *(round, 300)))
+      if >(length, longest)
+      begin
+        longest = length
+      end
+      n = +(n, 1)
+    end
+    Array.Set(steps, round, longest)
+    Print(round, longest, Array.Sum(steps))
+    round = +(round, 1)
+  end
+end";
+
+        [Test]
+        public void Snapshot_StopAtBudgetAndRestore()
+        {
+            var uninterrupted = CompileAndRun(SnapshotSource, "Snapshot.cpeisik", "--countops");
+            var expectedLines = uninterrupted.Trim().Split('\n');
+            Assert.That(expectedLines[9].Trim(), Is.EqualTo("9 216 1764"));
+
+            // The program stops in the middle with the snapshot written, and the rest of the output comes after restoring
+            var stopped = Run("--snapshot Snapshot.snap --maxops 1000000 Snapshot.cpeisik", out var exitCode);
+            Assert.That(exitCode, Is.EqualTo(0));
+            Assert.That(stopped, Does.Contain("-- Stopped at the instruction limit of 1000000"));
+            Assert.That(stopped, Does.Contain("-- Wrote the snapshot to Snapshot.snap"));
+            var restored = Run("--restore Snapshot.snap --countops Snapshot.cpeisik", out exitCode);
+            Assert.That(exitCode, Is.EqualTo(0));
+
+            var stoppedLines = stopped.Trim().Split('\n');
+            var restoredLines = restored.Trim().Split('\n');
+            Assert.That(stoppedLines.Length, Is.GreaterThan(2));
+            Assert.That(stoppedLines.Length + restoredLines.Length - 2, Is.EqualTo(expectedLines.Length));
+            for (int i = 0; i < stoppedLines.Length - 2; i++)
+                Assert.That(stoppedLines[i], Is.EqualTo(expectedLines[i]));
+            for (int i = 0; i < restoredLines.Length; i++)
+                Assert.That(restoredLines[i], Is.EqualTo(expectedLines[stoppedLines.Length - 2 + i]));
+        }
+
+        [Test]
+        public void Snapshot_DifferentProgramIsRejected()
+        {
+            Compile(SnapshotSource, "Snapshot_taken.cpeisik", false);
+            var stopped = Run("--snapshot Snapshot_taken.snap --maxops 1000000 Snapshot_taken.cpeisik", out _);
+            Assert.That(stopped, Does.Contain("-- Wrote the snapshot to Snapshot_taken.snap"));
+
+            // Different load options
+            var compact = Run("--restore Snapshot_taken.snap --compact Snapshot_taken.cpeisik", out var exitCode);
+            Assert.That(compact.Trim(), Is.EqualTo("Interpreter error: The snapshot was taken of a different program or with different load options."));
+            Assert.That(exitCode, Is.Not.EqualTo(0));
+
+            // A different module
+            Compile(SnapshotSource.Replace("<(n, 300)", "<(n, 301)"), "Snapshot_other.cpeisik", false);
+            var other = Run("--restore Snapshot_taken.snap Snapshot_other.cpeisik", out exitCode);
+            Assert.That(other.Trim(), Is.EqualTo("Interpreter error: The snapshot was taken of a different program or with different load options."));
+            Assert.That(exitCode, Is.Not.EqualTo(0));
+        }
     }
 }
@@ -14,16 +14,22 @@ namespace Polsys.PeisikFrontend
         static void Main(string[] args)
         {
             // Parse the command line arguments
+            var compact = false;
             var disassembly = false;
             var legacyCompiler = false;
             var optimize = false;
+            var profileUse = false;
             var timing = false;
             var showHelp = args.Length == 0;
             var modules = new List<string>();
             foreach (var arg in args)
             {
                 var argInLower = arg.ToLowerInvariant();
-                if (argInLower == "--disasm")
+                if (argInLower == "--compact")
+                {
+                    compact = true;
+                }
+                else if (argInLower == "--disasm")
                 {
                     disassembly = true;
                 }
@@ -39,6 +45,10 @@ namespace Polsys.PeisikFrontend
                 {
                     optimize = true;
                 }
+                else if (argInLower == "--profile-use")
+                {
+                    profileUse = true;
+                }
                 else if (argInLower == "--timing")
                 {
                     timing = true;
@@ -54,12 +64,15 @@ namespace Polsys.PeisikFrontend
                 Console.WriteLine("The Peisik compiler");
                 Console.WriteLine("Usage: peisikc [modules] [parameters]");
                 Console.WriteLine("Possible parameters:");
-                Console.WriteLine(" --disasm   Print bytecode disassembly for each module.");
-                Console.WriteLine(" --help     Show this help.");
-                Console.WriteLine(" --legacy   Use the legacy non-optimizing compiler.");
-                Console.WriteLine(" --optimize Optimize code. (No effect when used with --legacy.)");
+                Console.WriteLine(" --compact     Store the bytecode in the compact encoding.");
+                Console.WriteLine(" --disasm      Print bytecode disassembly for each module.");
+                Console.WriteLine(" --help        Show this help.");
+                Console.WriteLine(" --legacy      Use the legacy non-optimizing compiler.");
+                Console.WriteLine(" --optimize    Optimize code. (No effect when used with --legacy.)");
                 Console.WriteLine("  -o");
-                Console.WriteLine(" --timing   Print compilation times.");
+                Console.WriteLine(" --profile-use Inline calls and lay out branches using MODULE.cpeisik.profile,");
+                Console.WriteLine("               written by 'peisik --writeprofile' for a build without this flag.");
+                Console.WriteLine(" --timing      Print compilation times.");
                 return;
             }
 
@@ -73,7 +86,7 @@ namespace Polsys.PeisikFrontend
                     moduleNameWithExt = moduleName + ".peisik";
 
                 var moduleTime = Stopwatch.StartNew();
-                var module = CompileModule(moduleNameWithExt, legacyCompiler, optimize);
+                var module = CompileModule(moduleNameWithExt, legacyCompiler, optimize, profileUse, compact);
                 moduleTime.Stop();
                 if (timing)
                 {
@@ -96,7 +109,8 @@ namespace Polsys.PeisikFrontend
             }
         }
 
-        private static CompiledProgram CompileModule(string filename, bool legacyCompiler, bool optimize)
+        private static CompiledProgram CompileModule(string filename, bool legacyCompiler, bool optimize,
+            bool profileUse, bool compact)
         {
             // The [optimized] tag not only makes the mode clear,
             // but shows up in diffs between non-optimized and optimized disassembly.
@@ -139,14 +153,23 @@ namespace Polsys.PeisikFrontend
                     var finalModules = new List<ModuleSyntax>(modules.Count + 1);
                     finalModules.Add(mainModule);
                     finalModules.AddRange(modules.Values);
-                    CompiledProgram program = legacyCompiler ? CompileLegacy(finalModules) : CompileOptimized(finalModules, optimize);
+                    // The profile of the previous build is read before the output is replaced
+                    var outputPath = Path.GetFileNameWithoutExtension(filename) + ".cpeisik";
+                    ExecutionProfile profile = null;
+                    if (profileUse && !legacyCompiler)
+                    {
+                        profile = LoadProfile(outputPath + ".profile");
+                        if (profile == null)
+                            return null;
+                    }
+
+                    CompiledProgram program = legacyCompiler ? CompileLegacy(finalModules) : CompileOptimized(finalModules, optimize, profile);
                     if (program == null)
                         return null;
 
-                    var outputPath = Path.GetFileNameWithoutExtension(filename) + ".cpeisik";
                     using (var writer = new BinaryWriter(new FileStream(outputPath, FileMode.Create)))
                     {
-                        program.Serialize(writer);
+                        program.Serialize(writer, compact);
                     }
                     return program;
                 }
@@ -167,10 +190,26 @@ namespace Polsys.PeisikFrontend
             return program;
         }
 
-        private static CompiledProgram CompileOptimized(List<ModuleSyntax> finalModules, bool optimize)
+        private static ExecutionProfile LoadProfile(string path)
+        {
+            try
+            {
+                using (var reader = new StreamReader(path))
+                {
+                    return ExecutionProfile.Parse(reader);
+                }
+            }
+            catch (FormatException e)
+            {
+                Console.WriteLine($"{path}: {e.Message}");
+                return null;
+            }
+        }
+
+        private static CompiledProgram CompileOptimized(List<ModuleSyntax> finalModules, bool optimize, ExecutionProfile profile)
         {
             var optimizations = optimize ? Optimization.Full : Optimization.None;
-            var compiler = new OptimizingCompiler(finalModules, optimizations);
+            var compiler = new OptimizingCompiler(finalModules, optimizations, profile);
             (var program, var compilerDiags) = compiler.Compile();
 
             PrintDiagnostics(compilerDiags);
@@ -0,0 +1,96 @@
+#include "pch.h"
+#include "ArrayHeap.h"
+#include "PeisikException.h"
+
+using namespace Peisik;
+
+PArray::PArray(PrimitiveType type, size_t length)
+    : m_type(type), m_marked(false)
+{
+    if (type == PrimitiveType::IntArray)
+        m_ints.resize(length);
+    else if (type == PrimitiveType::RealArray)
+        m_reals.resize(length);
+    else
+        throw InterpreterException("Trying to create an array of a non-array type.");
+}
+
+void PArray::CheckIndex(int64_t index) const
+{
+    if (index < 0 || static_cast<uint64_t>(index) >= GetLength())
+        throw ApplicationException("Array index out of range.");
+}
+
+PObject PArray::GetElement(int64_t index) const
+{
+    CheckIndex(index);
+    if (m_type == PrimitiveType::IntArray)
+        return ObjectFromInt(m_ints[static_cast<size_t>(index)]);
+    else
+        return ObjectFromReal(m_reals[static_cast<size_t>(index)]);
+}
+
+void PArray::SetElement(int64_t index, const PObject& value)
+{
+    CheckIndex(index);
+    if (m_type == PrimitiveType::IntArray)
+        m_ints[static_cast<size_t>(index)] = value.GetIntValue();
+    else
+        m_reals[static_cast<size_t>(index)] = value.GetRealValueForAnyNumeric();
+}
+
+PArray& Peisik::GetArray(const PObject& object)
+{
+    auto array = object.GetArrayValue();
+    if (array == nullptr)
+        throw InterpreterException("Trying to use an array that has not been created.");
+    return *array;
+}
+
+ArrayHeap::ArrayHeap()
+    : m_liveBytes(0), m_allocatedSinceCollection(0), m_collectionThreshold(MinCollectionBytes),
+    m_collectionCount(0)
+{
+}
+
+PArray* ArrayHeap::Allocate(PrimitiveType type, int64_t length)
+{
+    if (length < 0)
+        throw ApplicationException("Array length must not be negative.");
+    if (static_cast<uint64_t>(length) > PArray::IntStorage().max_size())
+        throw ApplicationException("Array length is too large.");
+
+    m_arrays.emplace_back(new PArray(type, static_cast<size_t>(length)));
+    auto bytes = sizeof(PArray) + m_arrays.back()->GetSizeInBytes();
+    m_liveBytes += bytes;
+    m_allocatedSinceCollection += bytes;
+    return m_arrays.back().get();
+}
+
+void ArrayHeap::Sweep()
+{
+    size_t kept = 0;
+    m_liveBytes = 0;
+    for (auto& array : m_arrays)
+    {
+        if (!array->m_marked)
+            continue;
+
+        array->m_marked = false;
+        m_liveBytes += sizeof(PArray) + array->GetSizeInBytes();
+        m_arrays[kept++] = std::move(array);
+    }
+    m_arrays.resize(kept);
+
+    m_allocatedSinceCollection = 0;
+    m_collectionThreshold = std::max(static_cast<size_t>(MinCollectionBytes), m_liveBytes);
+    m_collectionCount++;
+}
+
+void ArrayHeap::Clear()
+{
+    m_arrays.clear();
+    m_liveBytes = 0;
+    m_allocatedSinceCollection = 0;
+    m_collectionThreshold = MinCollectionBytes;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "MemoryStatistics.h"
+#include "PObject.h"
+
+namespace Peisik
+{
+    // An int[] or real[] array. The elements are stored contiguously, so that the bulk operations
+    // in InternalFunctions can process them with vector instructions.
+    class PArray
+    {
+    public:
+        typedef std::vector<int64_t, CountingAllocator<int64_t, MemoryCategory::Arrays>> IntStorage;
+        typedef std::vector<double, CountingAllocator<double, MemoryCategory::Arrays>> RealStorage;
+
+        // Creates a zero-filled array. The type must be an array type.
+        PArray(PrimitiveType type, size_t length);
+
+        PArray(const PArray&) = delete;
+        PArray& operator=(const PArray&) = delete;
+
+        // Gets the array type, IntArray or RealArray.
+        PrimitiveType GetType() const
+        {
+            return m_type;
+        }
+
+        size_t GetLength() const
+        {
+            return m_type == PrimitiveType::IntArray ? m_ints.size() : m_reals.size();
+        }
+
+        // Gets the memory used by the elements.
+        size_t GetSizeInBytes() const
+        {
+            return m_ints.capacity() * sizeof(int64_t) + m_reals.capacity() * sizeof(double);
+        }
+
+        // Gets the element at the index.
+        // If the index is out of range, an ApplicationException is thrown.
+        PObject GetElement(int64_t index) const;
+
+        // Sets the element at the index. An int value is converted for a real array.
+        // If the index is out of range, an ApplicationException is thrown.
+        void SetElement(int64_t index, const PObject& value);
+
+        // Gets the elements of an int array. Empty for a real array.
+        IntStorage& GetInts()
+        {
+            return m_ints;
+        }
+
+        // Gets the elements of a real array. Empty for an int array.
+        RealStorage& GetReals()
+        {
+            return m_reals;
+        }
+
+    private:
+        friend class ArrayHeap;
+
+        void CheckIndex(int64_t index) const;
+
+        PrimitiveType m_type;
+        IntStorage m_ints;
+        RealStorage m_reals;
+        bool m_marked;
+    };
+
+    // Gets the array referenced by the object.
+    // If the object is not an array or the array has not been created, an exception is thrown.
+    PArray& GetArray(const PObject& object);
+
+    // Owns the arrays created by one interpreter and frees the unreachable ones.
+    //
+    // The collector is a simple mark and sweep: the interpreter marks every object it can reach,
+    // that is the locals and operand stacks of all frames, and then the heap frees the arrays that
+    // were not marked. Arrays do not contain references, so marking does not need to recurse.
+    // Collections are triggered by allocation, when the memory allocated since the previous
+    // collection exceeds both MinCollectionBytes and the memory that survived it.
+    class ArrayHeap
+    {
+    public:
+        static const size_t MinCollectionBytes = 1 << 20;
+
+        ArrayHeap();
+
+        ArrayHeap(const ArrayHeap&) = delete;
+        ArrayHeap& operator=(const ArrayHeap&) = delete;
+
+        // Creates a zero-filled array of the array type.
+        // If the length is negative, an ApplicationException is thrown.
+        PArray* Allocate(PrimitiveType type, int64_t length);
+
+        // Returns true if the caller should collect garbage before the next allocation.
+        bool ShouldCollect() const
+        {
+            return m_allocatedSinceCollection >= m_collectionThreshold;
+        }
+
+        // Marks the object as reachable, if it is an array.
+        void Mark(const PObject& object)
+        {
+            if (IsArrayType(object.GetType()) && object.GetArrayValue() != nullptr)
+                object.GetArrayValue()->m_marked = true;
+        }
+
+        // Frees the arrays that were not marked since the previous sweep and clears the marks.
+        void Sweep();
+
+        // Frees every array.
+        void Clear();
+
+        // Gets the number of arrays currently allocated.
+        size_t GetArrayCount() const
+        {
+            return m_arrays.size();
+        }
+
+        // Gets the number of collections so far.
+        uint64_t GetCollectionCount() const
+        {
+            return m_collectionCount;
+        }
+
+    private:
+        std::vector<std::unique_ptr<PArray>> m_arrays;
+        size_t m_liveBytes;
+        size_t m_allocatedSinceCollection;
+        size_t m_collectionThreshold;
+        uint64_t m_collectionCount;
+    };
+}
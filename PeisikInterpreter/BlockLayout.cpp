@@ -0,0 +1,471 @@
+#include "pch.h"
+#include "BlockLayout.h"
+#include "PeisikException.h"
+
+using namespace Peisik;
+
+// The longest loop test that is copied to the end of the loop body
+static const size_t MaxRotatedTestLength = 8;
+
+struct Block
+{
+    // The instructions of the block, [start, end)
+    size_t start;
+    size_t end;
+    // The block run after the last instruction if it does not jump, or -1
+    int fallthrough;
+    // The block jumped to by the last instruction, or -1
+    int target;
+    bool cold;
+    // True if the conditional jump at the end can be replaced with one jumping on the opposite condition
+    bool invertible;
+};
+
+static bool IsConditionalJump(Opcode op)
+{
+    return IsJumpOpcode(op) && op != Opcode::Jump;
+}
+
+// Returns the comparison that is true exactly when the comparison is false, or Invalid if there is none
+static InternalFunction InvertComparison(InternalFunction function, bool intOperands)
+{
+    switch (function)
+    {
+    case InternalFunction::Equal: return InternalFunction::NotEqual;
+    case InternalFunction::NotEqual: return InternalFunction::Equal;
+    default:
+        break;
+    }
+
+    // A comparison of reals is false both ways if one of them is NaN
+    if (!intOperands)
+        return InternalFunction::Invalid;
+    switch (function)
+    {
+    case InternalFunction::Less: return InternalFunction::GreaterEqual;
+    case InternalFunction::LessEqual: return InternalFunction::Greater;
+    case InternalFunction::Greater: return InternalFunction::LessEqual;
+    case InternalFunction::GreaterEqual: return InternalFunction::Less;
+    default:
+        return InternalFunction::Invalid;
+    }
+}
+
+// Returns true if the two values on top of the stack before the instruction at the index are known to be
+// integers. The block is simulated from its start with the types of the locals and constants, and anything
+// less obvious is unknown.
+static bool AreOperandsInt(const Program& program, const Function& function, const std::vector<BytecodeOp>& code,
+    size_t start, size_t index)
+{
+    // The values pushed in the block, anything below them is unknown
+    std::vector<PrimitiveType> stack;
+    auto pop = [&stack]()
+    {
+        if (stack.empty())
+            return PrimitiveType::NoType;
+        auto type = stack.back();
+        stack.pop_back();
+        return type;
+    };
+
+    for (auto i = start; i < index; i++)
+    {
+        auto& op = code[i];
+        switch (op.op)
+        {
+        case Opcode::PushLocal:
+            if (op.param < 0 || static_cast<size_t>(op.param) >= function.GetLocalTypes().size())
+                return false;
+            stack.push_back(function.GetLocalTypes()[op.param]);
+            break;
+        case Opcode::PushConst:
+            if (op.param < 0 || op.param >= program.GetConstantCount())
+                return false;
+            stack.push_back(program.GetConstant(op.param).GetType());
+            break;
+        case Opcode::PushImm:
+            stack.push_back(PrimitiveType::Int);
+            break;
+        case Opcode::PlusImm:
+        case Opcode::MinusImm:
+        case Opcode::MultiplyImm:
+            // The type of the result is that of the operand
+            break;
+        case Opcode::PopLocal:
+        case Opcode::PopDiscard:
+            pop();
+            break;
+        case Opcode::CallI2:
+        {
+            auto right = pop();
+            auto left = pop();
+            auto internalFunction = static_cast<InternalFunction>(op.param);
+            bool intArithmetic = (internalFunction == InternalFunction::Plus || internalFunction == InternalFunction::Minus ||
+                internalFunction == InternalFunction::Multiply) && left == PrimitiveType::Int && right == PrimitiveType::Int;
+            bool intResult = internalFunction == InternalFunction::FloorDivide || internalFunction == InternalFunction::Mod;
+            stack.push_back(intArithmetic || intResult ? PrimitiveType::Int : PrimitiveType::NoType);
+            break;
+        }
+        default:
+            stack.clear();
+            break;
+        }
+    }
+
+    return pop() == PrimitiveType::Int && pop() == PrimitiveType::Int;
+}
+
+// Copies the instructions of the block except the last one to the output. If invert is set, the comparison
+// before a JumpFalse at the end is replaced with its opposite. Returns the last instruction, inverted if asked.
+static BytecodeOp CopyBlock(const Program& program, const Function& function, const std::vector<BytecodeOp>& code,
+    const Block& block, bool invert, std::vector<BytecodeOp>& output)
+{
+    output.insert(output.end(), code.begin() + block.start, code.begin() + block.end - 1);
+    auto last = code[block.end - 1];
+    if (!invert)
+        return last;
+
+    auto& compare = last.op == Opcode::JumpFalse ? output.back() : last;
+    auto compareIndex = last.op == Opcode::JumpFalse ? block.end - 2 : block.end - 1;
+    auto intOperands = AreOperandsInt(program, function, code, block.start, compareIndex);
+    if (last.op == Opcode::JumpFalse)
+    {
+        auto inverted = InvertComparison(static_cast<InternalFunction>(compare.param), intOperands);
+        compare.param = static_cast<short>(inverted);
+    }
+    else
+    {
+        compare.op = GetFusedJumpOpcode(InvertComparison(GetFusedFunction(compare.op), intOperands));
+    }
+    return last;
+}
+
+// Returns true if the conditional jump at the end of the block can be inverted exactly
+static bool IsInvertible(const Program& program, const Function& function, const std::vector<BytecodeOp>& code,
+    const Block& block)
+{
+    auto& last = code[block.end - 1];
+    if (last.op == Opcode::JumpFalse)
+    {
+        if (block.end - block.start < 2 || code[block.end - 2].op != Opcode::CallI2)
+            return false;
+        auto intOperands = AreOperandsInt(program, function, code, block.start, block.end - 2);
+        return InvertComparison(static_cast<InternalFunction>(code[block.end - 2].param), intOperands) != InternalFunction::Invalid;
+    }
+    if (GetFusedFunction(last.op) == InternalFunction::Invalid)
+        return false;
+    auto intOperands = AreOperandsInt(program, function, code, block.start, block.end - 1);
+    return InvertComparison(GetFusedFunction(last.op), intOperands) != InternalFunction::Invalid;
+}
+
+// Marks the blocks that always end in FailFast, directly or through other such blocks, as cold
+static void FindStaticColdBlocks(const std::vector<BytecodeOp>& code, std::vector<Block>& blocks)
+{
+    for (auto& block : blocks)
+    {
+        for (auto i = block.start; i < block.end; i++)
+        {
+            if (code[i].op >= Opcode::CallI0 && code[i].op <= Opcode::CallI7 &&
+                static_cast<InternalFunction>(code[i].param) == InternalFunction::FailFast)
+            {
+                block.cold = true;
+            }
+        }
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto& block : blocks)
+        {
+            if (block.cold || (block.fallthrough < 0 && block.target < 0))
+                continue;
+            if ((block.fallthrough < 0 || blocks[block.fallthrough].cold) && (block.target < 0 || blocks[block.target].cold))
+            {
+                block.cold = true;
+                changed = true;
+            }
+        }
+    }
+}
+
+// Marks the blocks not reached in the profile as cold
+static void FindProfiledColdBlocks(const std::vector<BytecodeOp>& code, const std::map<uint32_t, BranchCounts>& counts,
+    std::vector<Block>& blocks)
+{
+    for (auto& block : blocks)
+        block.cold = true;
+
+    std::vector<int> worklist(1, 0);
+    while (!worklist.empty())
+    {
+        auto& block = blocks[worklist.back()];
+        worklist.pop_back();
+        if (!block.cold)
+            continue;
+        block.cold = false;
+
+        auto last = static_cast<uint32_t>(block.end - 1);
+        bool conditional = IsConditionalJump(code[last].op);
+        if (block.target >= 0 && (!conditional || counts.at(last).taken > 0))
+            worklist.push_back(block.target);
+        if (block.fallthrough >= 0 && (!conditional || counts.at(last).notTaken > 0))
+            worklist.push_back(block.fallthrough);
+    }
+}
+
+static bool ReorderFunction(Program& program, Function& function, const std::map<uint32_t, BranchCounts>* counts,
+    BlockLayoutStatistics& statistics)
+{
+    auto& code = function.GetBytecode();
+    if (code.empty())
+        return false;
+
+    // The code must not run past its end, since the last block would no longer be last
+    auto& lastOp = code.back();
+    if (lastOp.op != Opcode::Return && lastOp.op != Opcode::Jump)
+        return false;
+
+    // Split the code into basic blocks
+    std::vector<bool> leaders(code.size() + 1, false);
+    leaders[0] = true;
+    size_t conditionalCount = 0;
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        auto& op = code[i];
+        if (IsJumpOpcode(op.op))
+        {
+            auto target = static_cast<int64_t>(i) + op.param;
+            if (target < 0 || target >= static_cast<int64_t>(code.size()))
+                return false;
+            leaders[static_cast<size_t>(target)] = true;
+            if (IsConditionalJump(op.op))
+                conditionalCount++;
+        }
+        if (IsJumpOpcode(op.op) || op.op == Opcode::Return)
+            leaders[i + 1] = true;
+    }
+
+    std::vector<Block> blocks;
+    std::vector<int> blockAt(code.size(), -1);
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        if (leaders[i])
+        {
+            Block block = { i, i, -1, -1, false, false };
+            blocks.push_back(block);
+        }
+        blockAt[i] = static_cast<int>(blocks.size() - 1);
+        blocks.back().end = i + 1;
+    }
+    for (auto& block : blocks)
+    {
+        auto& last = code[block.end - 1];
+        if (IsJumpOpcode(last.op))
+            block.target = blockAt[static_cast<size_t>(static_cast<int64_t>(block.end - 1) + last.param)];
+        if (last.op != Opcode::Jump && last.op != Opcode::Return)
+            block.fallthrough = blockAt[block.end];
+        if (IsConditionalJump(last.op))
+            block.invertible = IsInvertible(program, function, code, block);
+    }
+
+    // A profile of different code is not used
+    if (counts != nullptr)
+    {
+        bool matches = counts->size() == conditionalCount;
+        for (auto& site : *counts)
+            matches = matches && site.first < code.size() && IsConditionalJump(code[site.first].op);
+        if (!matches)
+            counts = nullptr;
+    }
+    if (counts != nullptr)
+        FindProfiledColdBlocks(code, *counts, blocks);
+    else
+        FindStaticColdBlocks(code, blocks);
+    if (blocks[0].cold)
+    {
+        for (auto& block : blocks)
+            block.cold = false;
+    }
+
+    // A loop is rotated at the jump back to a short test at its start
+    std::vector<bool> rotated(blocks.size(), false);
+    for (size_t b = 0; b < blocks.size(); b++)
+    {
+        auto& block = blocks[b];
+        if (code[block.end - 1].op != Opcode::Jump || block.cold)
+            continue;
+        auto& test = blocks[block.target];
+        rotated[b] = block.target < static_cast<int>(b) && IsConditionalJump(code[test.end - 1].op) && test.invertible &&
+            test.end - test.start <= MaxRotatedTestLength && test.fallthrough != block.target;
+    }
+
+    // Lay out the blocks in chains, each block followed by its hotter successor.
+    // The hot blocks are chained first in the code order, starting from the entry, and then the cold ones.
+    std::vector<int> order;
+    std::vector<bool> placed(blocks.size(), false);
+    std::vector<bool> inverted(blocks.size(), false);
+    auto canFollow = [&](int successor, int b)
+    {
+        return successor >= 0 && !placed[successor] && (blocks[b].cold || !blocks[successor].cold);
+    };
+    auto chooseSuccessor = [&](int b) -> int
+    {
+        auto& block = blocks[b];
+        auto& last = code[block.end - 1];
+        if (last.op == Opcode::Jump)
+        {
+            // A rotated loop falls through from the copied test to the loop exit
+            auto next = rotated[b] ? blocks[block.target].target : block.target;
+            return canFollow(next, b) ? next : -1;
+        }
+        if (!IsConditionalJump(last.op))
+            return canFollow(block.fallthrough, b) ? block.fallthrough : -1;
+
+        bool preferTaken = counts != nullptr
+            ? counts->at(static_cast<uint32_t>(block.end - 1)).taken > counts->at(static_cast<uint32_t>(block.end - 1)).notTaken
+            : blocks[block.fallthrough].cold && !blocks[block.target].cold;
+        if (preferTaken && block.invertible && canFollow(block.target, b))
+        {
+            inverted[b] = true;
+            return block.target;
+        }
+        if (canFollow(block.fallthrough, b))
+            return block.fallthrough;
+
+        // The fall-through block is elsewhere, so inverting saves a jump to it
+        if (block.invertible && canFollow(block.target, b))
+        {
+            inverted[b] = true;
+            return block.target;
+        }
+        return -1;
+    };
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (size_t seed = 0; seed < blocks.size(); seed++)
+        {
+            if (placed[seed] || blocks[seed].cold != (pass == 1))
+                continue;
+            for (int b = static_cast<int>(seed); b >= 0; b = chooseSuccessor(b))
+            {
+                placed[b] = true;
+                order.push_back(b);
+            }
+        }
+    }
+
+    // Emit the blocks, adding the jumps to the successors that no longer follow
+    std::vector<BytecodeOp> result;
+    std::vector<int> targets;
+    std::vector<size_t> blockStart(blocks.size());
+    auto emitJump = [&](BytecodeOp op, int target)
+    {
+        result.push_back(op);
+        targets.resize(result.size(), -1);
+        targets.back() = target;
+    };
+
+    for (size_t position = 0; position < order.size(); position++)
+    {
+        auto b = order[position];
+        auto& block = blocks[b];
+        auto next = position + 1 < order.size() ? order[position + 1] : -1;
+        blockStart[b] = result.size();
+
+        auto last = CopyBlock(program, function, code, block, inverted[b], result);
+        if (last.op == Opcode::Jump && rotated[b])
+        {
+            auto& test = blocks[block.target];
+            auto testJump = CopyBlock(program, function, code, test, true, result);
+            emitJump(testJump, test.fallthrough);
+            if (test.target != next)
+                emitJump(BytecodeOp(Opcode::Jump, 0), test.target);
+            statistics.rotatedLoops++;
+        }
+        else if (last.op == Opcode::Jump)
+        {
+            if (block.target != next)
+                emitJump(last, block.target);
+        }
+        else if (IsConditionalJump(last.op))
+        {
+            auto taken = inverted[b] ? block.fallthrough : block.target;
+            auto notTaken = inverted[b] ? block.target : block.fallthrough;
+            emitJump(last, taken);
+            if (notTaken != next)
+                emitJump(BytecodeOp(Opcode::Jump, 0), notTaken);
+            if (inverted[b])
+                statistics.invertedBranches++;
+        }
+        else
+        {
+            result.push_back(last);
+            if (block.fallthrough >= 0 && block.fallthrough != next)
+                emitJump(BytecodeOp(Opcode::Jump, 0), block.fallthrough);
+        }
+        if (block.cold)
+            statistics.coldBlocks++;
+    }
+
+    targets.resize(result.size(), -1);
+    for (size_t i = 0; i < result.size(); i++)
+    {
+        if (targets[i] < 0)
+            continue;
+        auto offset = static_cast<int64_t>(blockStart[targets[i]]) - static_cast<int64_t>(i);
+        if (offset < SHRT_MIN || offset > SHRT_MAX)
+            return false;
+        result[i].param = static_cast<short>(offset);
+    }
+
+    bool changed = result.size() != code.size();
+    for (size_t i = 0; i < result.size() && !changed; i++)
+        changed = result[i].op != code[i].op || result[i].param != code[i].param;
+    if (changed)
+        function.SetBytecode(std::move(result));
+    return changed;
+}
+
+BranchProfile Peisik::ReadBranchCounts(std::istream& profile, const Program& program)
+{
+    std::string line;
+    if (!std::getline(profile, line) || line != "peisik-profile 1")
+        throw InterpreterException("Not a Peisik profile.");
+
+    BranchProfile branches(program.GetFunctionCount());
+    while (std::getline(profile, line))
+    {
+        std::istringstream fields(line);
+        std::string kind;
+        int function;
+        uint32_t index;
+        BranchCounts counts;
+        if (!(fields >> kind) || kind != "branch")
+            continue;
+        if (!(fields >> function >> index >> counts.taken >> counts.notTaken) ||
+            function < 0 || function >= program.GetFunctionCount())
+        {
+            throw InterpreterException("Invalid branch record in the profile.");
+        }
+        branches[function][index] = counts;
+    }
+    return branches;
+}
+
+BlockLayoutStatistics Peisik::ReorderBlocks(Program& program, const BranchProfile* profile)
+{
+    BlockLayoutStatistics statistics = { 0, 0, 0 };
+    for (short i = 0; i < program.GetFunctionCount(); i++)
+    {
+        // The statistics only count the functions that changed
+        auto functionStatistics = statistics;
+        auto counts = profile != nullptr && i < static_cast<short>(profile->size()) && !(*profile)[i].empty()
+            ? &(*profile)[i] : nullptr;
+        if (ReorderFunction(program, program.GetMutableFunction(i), counts, functionStatistics))
+            statistics = functionStatistics;
+    }
+    return statistics;
+}
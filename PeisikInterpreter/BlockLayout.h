@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <vector>
+#include "Program.h"
+
+namespace Peisik
+{
+    // The executions of a conditional jump in a recorded profile.
+    struct BranchCounts
+    {
+        uint64_t taken;
+        uint64_t notTaken;
+    };
+
+    // The branch counts of each function by instruction index, empty for the functions not executed.
+    typedef std::vector<std::map<uint32_t, BranchCounts>> BranchProfile;
+
+    // Counts the changes made by ReorderBlocks.
+    struct BlockLayoutStatistics
+    {
+        int invertedBranches;
+        int rotatedLoops;
+        int coldBlocks;
+    };
+
+    // Reads the branch records of a profile written by peisik --writeprofile (see ProfileRecorder).
+    // The instruction indices refer to the bytecode as stored in the module.
+    // Throws an InterpreterException if the stream does not contain a profile.
+    BranchProfile ReadBranchCounts(std::istream& profile, const Program& program);
+
+    // Reorders the basic blocks of every function so that the hot path falls through.
+    //
+    // The blocks are laid out in chains, each block followed by its hotter successor. A conditional
+    // jump whose taken side is hotter is inverted where that is exact: Equal and NotEqual always, and
+    // the ordered comparisons when both operands are known to be Int, since a comparison with NaN is
+    // false either way. A loop whose body ends in a jump back to a short test is rotated by copying the
+    // test, inverted, to the end of the body, so that each iteration takes one jump instead of two.
+    // The cold blocks are moved to the end of the function, where the jumps over them disappear.
+    //
+    // With a profile, the hotter side of a branch is the one taken more often, and the blocks never
+    // reached are cold. Without one, or if the profile does not match the function, the blocks that
+    // always end in FailFast are cold and the other side of their branches is the hotter one.
+    // Must run before the other load-time passes, since the profile refers to the stored bytecode.
+    // Functions with jumps out of bounds or code running past the end are left unchanged.
+    BlockLayoutStatistics ReorderBlocks(Program& program, const BranchProfile* profile);
+}
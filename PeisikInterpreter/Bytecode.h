@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+
 namespace Peisik
 {
     // Defines all the bytecode instruction types.
@@ -22,11 +24,30 @@ namespace Peisik
         CallI5,
         CallI6,
         CallI7,
+        PushImm,
+        PlusImm,
+        MinusImm,
+        MultiplyImm,
+        JumpIfNotLess,
+        JumpIfNotLessEqual,
+        JumpIfNotGreater,
+        JumpIfNotGreaterEqual,
+        JumpIfNotEqual,
+        JumpIfEqual,
+        NewArray,
+        LoadElement,
+        StoreElement,
+        CallParallel,
+        // A Call that may run concurrently with the code after it, see MarkForkPoints.
+        // Only created at load time, never stored in a module.
+        CallFork,
         OpcodeCount
     };
 
     // Defines parameter values for CallIx instructions.
     // Directly copied from the compiler source.
+    // ArrayGet, ArraySet, ArrayNewInt and ArrayNewReal are compiled to LoadElement, StoreElement
+    // and NewArray instead of internal calls, and ParallelCount and ParallelSum to CallParallel.
     enum class InternalFunction
     {
         Invalid = 0,
@@ -63,7 +84,21 @@ namespace Peisik
         MathRound,
         MathSin,
         MathSqrt,
-        MathTan
+        MathTan,
+        // Array module
+        ArrayAdd,
+        ArrayDot,
+        ArrayFill,
+        ArrayGet,
+        ArrayLength,
+        ArrayMultiply,
+        ArrayNewInt,
+        ArrayNewReal,
+        ArraySet,
+        ArraySum,
+        // Parallel module
+        ParallelCount,
+        ParallelSum
     };
 
     // Represents a single bytecode instruction with a parameter.
@@ -78,4 +113,111 @@ namespace Peisik
         Opcode op;
         short param;
     };
+
+    // Returns the name of the opcode for traces and reports.
+    inline std::string OpcodeToString(const Opcode op)
+    {
+        switch (op)
+        {
+        case Opcode::Call: return "Call";
+        case Opcode::CallI0: return "CallI0";
+        case Opcode::CallI1: return "CallI1";
+        case Opcode::CallI2: return "CallI2";
+        case Opcode::CallI3: return "CallI3";
+        case Opcode::CallI4: return "CallI4";
+        case Opcode::CallI5: return "CallI5";
+        case Opcode::CallI6: return "CallI6";
+        case Opcode::CallI7: return "CallI7";
+        case Opcode::CallFork: return "CallFork";
+        case Opcode::CallParallel: return "CallParallel";
+        case Opcode::Jump: return "Jump";
+        case Opcode::JumpFalse: return "JumpFalse";
+        case Opcode::JumpIfEqual: return "JumpIfEqual";
+        case Opcode::JumpIfNotEqual: return "JumpIfNotEqual";
+        case Opcode::JumpIfNotGreater: return "JumpIfNotGreater";
+        case Opcode::JumpIfNotGreaterEqual: return "JumpIfNotGreaterEqual";
+        case Opcode::JumpIfNotLess: return "JumpIfNotLess";
+        case Opcode::JumpIfNotLessEqual: return "JumpIfNotLessEqual";
+        case Opcode::LoadElement: return "LoadElement";
+        case Opcode::MinusImm: return "MinusImm";
+        case Opcode::MultiplyImm: return "MultiplyImm";
+        case Opcode::NewArray: return "NewArray";
+        case Opcode::PlusImm: return "PlusImm";
+        case Opcode::PopDiscard: return "PopDiscard";
+        case Opcode::PopLocal: return "PopLocal";
+        case Opcode::PushConst: return "PushConst";
+        case Opcode::PushImm: return "PushImm";
+        case Opcode::PushLocal: return "PushLocal";
+        case Opcode::Return: return "Return";
+        case Opcode::StoreElement: return "StoreElement";
+        default:
+            return "????";
+        }
+    }
+
+    // Returns true if the parameter of the instruction is a jump offset.
+    inline bool IsJumpOpcode(const Opcode op)
+    {
+        return op == Opcode::Jump || op == Opcode::JumpFalse ||
+            (op >= Opcode::JumpIfNotLess && op <= Opcode::JumpIfEqual);
+    }
+
+    // Returns true if the internal function belongs to the Array module.
+    inline bool IsArrayFunction(const InternalFunction function)
+    {
+        return function >= InternalFunction::ArrayAdd && function <= InternalFunction::ArraySum;
+    }
+
+    // Returns the internal function applied by an immediate or a compare-and-branch instruction,
+    // or Invalid for other instructions.
+    // The immediate instructions replace the top of the stack with the result of the function
+    // applied to it and the parameter. The compare-and-branch instructions pop the right and then
+    // the left operand, and jump like JumpFalse if the result of the function is false.
+    inline InternalFunction GetFusedFunction(const Opcode op)
+    {
+        switch (op)
+        {
+        case Opcode::PlusImm: return InternalFunction::Plus;
+        case Opcode::MinusImm: return InternalFunction::Minus;
+        case Opcode::MultiplyImm: return InternalFunction::Multiply;
+        case Opcode::JumpIfNotLess: return InternalFunction::Less;
+        case Opcode::JumpIfNotLessEqual: return InternalFunction::LessEqual;
+        case Opcode::JumpIfNotGreater: return InternalFunction::Greater;
+        case Opcode::JumpIfNotGreaterEqual: return InternalFunction::GreaterEqual;
+        case Opcode::JumpIfNotEqual: return InternalFunction::Equal;
+        case Opcode::JumpIfEqual: return InternalFunction::NotEqual;
+        default:
+            return InternalFunction::Invalid;
+        }
+    }
+
+    // Returns the immediate instruction for the internal function, or Invalid if there is none.
+    inline Opcode GetImmediateOpcode(const InternalFunction function)
+    {
+        switch (function)
+        {
+        case InternalFunction::Plus: return Opcode::PlusImm;
+        case InternalFunction::Minus: return Opcode::MinusImm;
+        case InternalFunction::Multiply: return Opcode::MultiplyImm;
+        default:
+            return Opcode::Invalid;
+        }
+    }
+
+    // Returns the compare-and-branch instruction that replaces a CallI2 of the internal function
+    // followed by JumpFalse, or Invalid if there is none.
+    inline Opcode GetFusedJumpOpcode(const InternalFunction function)
+    {
+        switch (function)
+        {
+        case InternalFunction::Less: return Opcode::JumpIfNotLess;
+        case InternalFunction::LessEqual: return Opcode::JumpIfNotLessEqual;
+        case InternalFunction::Greater: return Opcode::JumpIfNotGreater;
+        case InternalFunction::GreaterEqual: return Opcode::JumpIfNotGreaterEqual;
+        case InternalFunction::Equal: return Opcode::JumpIfNotEqual;
+        case InternalFunction::NotEqual: return Opcode::JumpIfEqual;
+        default:
+            return Opcode::Invalid;
+        }
+    }
 }
\ No newline at end of file
@@ -0,0 +1,189 @@
+#include "pch.h"
+#include "CodeLayout.h"
+#include "PeisikException.h"
+
+using namespace Peisik;
+
+// The estimated number of iterations of a loop, and of the calls made by a recursive cycle per entry
+static const double LoopWeight = 10.0;
+// Keeps deeply nested loops from overflowing the estimates
+static const double MaxFrequency = 1e30;
+
+// Returns true if the instruction calls the function in its parameter
+static bool IsFunctionCall(Opcode op)
+{
+    return op == Opcode::Call || op == Opcode::CallFork || op == Opcode::CallParallel;
+}
+
+// Returns the called functions of the function, without duplicates, in the order of their first call
+static std::vector<short> GetCallees(const Program& program, const Function& function)
+{
+    std::vector<short> callees;
+    for (auto& op : function.GetBytecode())
+    {
+        if (IsFunctionCall(op.op) && op.param >= 0 && op.param < program.GetFunctionCount() &&
+            std::find(callees.begin(), callees.end(), op.param) == callees.end())
+        {
+            callees.push_back(op.param);
+        }
+    }
+    return callees;
+}
+
+std::vector<double> Peisik::ReadCallFrequencies(std::istream& profile, const Program& program)
+{
+    std::string line;
+    if (!std::getline(profile, line) || line != "peisik-profile 1")
+        throw InterpreterException("Not a Peisik profile.");
+
+    std::vector<double> frequencies(program.GetFunctionCount(), 0.0);
+    while (std::getline(profile, line))
+    {
+        std::istringstream fields(line);
+        std::string kind;
+        int function;
+        double calls;
+        if (!(fields >> kind) || kind != "function")
+            continue;
+        if (!(fields >> function >> calls) || function < 0 || function >= program.GetFunctionCount())
+            throw InterpreterException("Invalid function record in the profile.");
+        frequencies[function] = calls;
+    }
+    return frequencies;
+}
+
+std::vector<double> Peisik::EstimateCallFrequencies(const Program& program)
+{
+    auto functionCount = program.GetFunctionCount();
+    std::vector<double> frequencies(functionCount, 0.0);
+    auto mainIndex = program.GetMainFunctionIndex();
+    if (mainIndex < 0 || mainIndex >= functionCount)
+        return frequencies;
+
+    // Depth-first from the main function for the reverse postorder, in which every caller comes before
+    // its callees except along the back edges of recursive cycles. The targets of the back edges are
+    // the entries of the cycles.
+    std::vector<std::vector<short>> callees(functionCount);
+    std::vector<int> state(functionCount, 0); // 0: unvisited, 1: on the path, 2: done
+    std::vector<bool> recursive(functionCount, false);
+    std::vector<short> postorder;
+    postorder.reserve(functionCount);
+    std::vector<std::pair<short, size_t>> path(1, std::make_pair(mainIndex, size_t(0)));
+    callees[mainIndex] = GetCallees(program, program.GetFunction(mainIndex));
+    state[mainIndex] = 1;
+    while (!path.empty())
+    {
+        auto caller = path.back().first;
+        auto& next = path.back().second;
+        if (next == callees[caller].size())
+        {
+            state[caller] = 2;
+            postorder.push_back(caller);
+            path.pop_back();
+            continue;
+        }
+
+        auto callee = callees[caller][next++];
+        if (state[callee] == 1)
+        {
+            recursive[callee] = true;
+        }
+        else if (state[callee] == 0)
+        {
+            callees[callee] = GetCallees(program, program.GetFunction(callee));
+            state[callee] = 1;
+            path.push_back(std::make_pair(callee, size_t(0)));
+        }
+    }
+
+    // Propagate the frequencies from the callers to the callees, weighting each call by its loop depth
+    std::vector<size_t> position(functionCount, 0);
+    std::reverse(postorder.begin(), postorder.end());
+    for (size_t i = 0; i < postorder.size(); i++)
+        position[postorder[i]] = i;
+
+    frequencies[mainIndex] = 1.0;
+    for (auto caller : postorder)
+    {
+        if (recursive[caller])
+            frequencies[caller] = std::min(frequencies[caller] * LoopWeight, MaxFrequency);
+
+        // A backward jump closes a loop, and the instructions between its target and it are in the loop
+        auto& bytecode = program.GetFunction(caller).GetBytecode();
+        std::vector<int> loopDepth(bytecode.size(), 0);
+        for (size_t i = 0; i < bytecode.size(); i++)
+        {
+            auto target = static_cast<int64_t>(i) + bytecode[i].param;
+            if (IsJumpOpcode(bytecode[i].op) && bytecode[i].param <= 0 && target >= 0)
+            {
+                for (auto j = static_cast<size_t>(target); j <= i; j++)
+                    loopDepth[j]++;
+            }
+        }
+
+        for (size_t i = 0; i < bytecode.size(); i++)
+        {
+            auto& op = bytecode[i];
+            if (!IsFunctionCall(op.op) || op.param < 0 || op.param >= functionCount)
+                continue;
+
+            // Calls back into a recursive cycle are already counted by the recursion weight
+            if (position[op.param] <= position[caller])
+                continue;
+
+            auto frequency = frequencies[caller];
+            auto depth = loopDepth[i] + (op.op == Opcode::CallParallel ? 1 : 0);
+            for (int d = 0; d < depth && frequency < MaxFrequency; d++)
+                frequency *= LoopWeight;
+            frequencies[op.param] = std::min(frequencies[op.param] + frequency, MaxFrequency);
+        }
+    }
+    return frequencies;
+}
+
+CodeLayoutStatistics Peisik::LayOutCode(Program& program, const std::vector<double>& callFrequencies)
+{
+    auto functionCount = program.GetFunctionCount();
+    CodeLayoutStatistics statistics = { 0, 0, 0 };
+
+    std::vector<short> hottest;
+    for (short i = 0; i < functionCount; i++)
+    {
+        if (callFrequencies[i] > 0)
+            hottest.push_back(i);
+    }
+    auto isHotter = [&](short a, short b) { return callFrequencies[a] > callFrequencies[b]; };
+    std::stable_sort(hottest.begin(), hottest.end(), isHotter);
+
+    std::vector<short> order;
+    std::vector<bool> placed(functionCount, false);
+    for (auto function : hottest)
+    {
+        if (placed[function])
+            continue;
+        placed[function] = true;
+        order.push_back(function);
+
+        auto callees = GetCallees(program, program.GetFunction(function));
+        std::stable_sort(callees.begin(), callees.end(), isHotter);
+        for (auto callee : callees)
+        {
+            if (!placed[callee] && callFrequencies[callee] > 0)
+            {
+                placed[callee] = true;
+                order.push_back(callee);
+            }
+        }
+    }
+    statistics.hotFunctions = static_cast<int>(order.size());
+
+    for (short i = 0; i < functionCount; i++)
+    {
+        if (!placed[i])
+            order.push_back(i);
+    }
+    statistics.coldFunctions = static_cast<int>(order.size()) - statistics.hotFunctions;
+
+    statistics.codeSize = program.PackCode(order);
+    return statistics;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <istream>
+#include <vector>
+#include "Program.h"
+
+namespace Peisik
+{
+    // Counts the functions placed by LayOutCode.
+    struct CodeLayoutStatistics
+    {
+        int hotFunctions;
+        int coldFunctions;
+        size_t codeSize;
+    };
+
+    // Reads the number of calls of each function from a profile written by peisik --writeprofile
+    // (see ProfileRecorder). The functions missing from the profile were never called.
+    // Only the function records are used, so the counts stay valid after the load-time passes.
+    // Throws an InterpreterException if the stream does not contain a profile.
+    std::vector<double> ReadCallFrequencies(std::istream& profile, const Program& program);
+
+    // Estimates the number of calls of each function in a run of the program, starting from one call
+    // of the main function. A call inside a loop is counted ten times per loop level, a Parallel call
+    // like a call inside a loop, and a function that is part of a recursive cycle ten times more often
+    // than its callers call it. The functions not reachable from the main function are never called.
+    std::vector<double> EstimateCallFrequencies(const Program& program);
+
+    // Packs the executable code of the program into one arena (see Program::PackCode) ordered by hotness.
+    //
+    // The functions that are called are placed first, the most frequently called first, and each
+    // function is directly followed by those of its callees that have not been placed yet, hottest first,
+    // so that a loop calling a helper touches as few cache lines and pages as possible. The functions that
+    // are never called, such as error handlers and code unreachable from the main function, are placed
+    // last in the module order. Must run after the other load-time passes, since they replace the code.
+    CodeLayoutStatistics LayOutCode(Program& program, const std::vector<double>& callFrequencies);
+}
@@ -0,0 +1,182 @@
+#include "pch.h"
+#include "CompactBytecode.h"
+#include "PeisikException.h"
+#include "Program.h"
+
+using namespace Peisik;
+
+static void EncodeParameter(short param, std::vector<uint8_t>& output)
+{
+    int32_t value = param;
+    while (true)
+    {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+
+        // Stop when the remaining bits are copies of the sign bit of this byte
+        bool done = (value == 0 && (byte & 0x40) == 0) || (value == -1 && (byte & 0x40) != 0);
+        if (!done)
+            byte |= 0x80;
+        output.push_back(byte);
+
+        if (done)
+            break;
+    }
+}
+
+// Returns the size of an instruction with the parameter in the executable compact form.
+static uint32_t GetExecutableSize(Opcode op, int32_t param)
+{
+    if (!HasCompactParameter(op))
+        return 1;
+    if (param > CompactParameterEscape && param <= 127)
+        return 2;
+    return 4;
+}
+
+static void EncodeExecutableParameter(int32_t param, std::vector<uint8_t>& output)
+{
+    if (param > CompactParameterEscape && param <= 127)
+    {
+        output.push_back(static_cast<uint8_t>(param));
+    }
+    else
+    {
+        output.push_back(static_cast<uint8_t>(CompactParameterEscape));
+        output.push_back(static_cast<uint8_t>(param & 0xFF));
+        output.push_back(static_cast<uint8_t>((param >> 8) & 0xFF));
+    }
+}
+
+
+/*
+ * Stored form
+ */
+
+void Peisik::EncodeCompactBytecode(const std::vector<BytecodeOp>& bytecode, std::vector<uint8_t>& output)
+{
+    for (auto& op : bytecode)
+    {
+        output.push_back(static_cast<uint8_t>(op.op));
+        if (HasCompactParameter(op.op))
+            EncodeParameter(op.param, output);
+    }
+}
+
+std::vector<BytecodeOp> Peisik::DecodeCompactBytecode(const uint8_t* code, size_t size)
+{
+    std::vector<BytecodeOp> result;
+    size_t offset = 0;
+    while (offset < size)
+    {
+        auto op = static_cast<Opcode>(code[offset++]);
+        if (op <= Opcode::Invalid || op >= Opcode::OpcodeCount)
+            throw InterpreterException("Unknown opcode in compact bytecode.");
+
+        if (!HasCompactParameter(op))
+        {
+            result.push_back(BytecodeOp(op, 0));
+            continue;
+        }
+
+        // A parameter takes at most 3 bytes and the last one has the high bit clear
+        size_t end = offset;
+        while (end < size && end - offset < 2 && (code[end] & 0x80) != 0)
+            end++;
+        if (end >= size || (code[end] & 0x80) != 0)
+            throw InterpreterException("Truncated compact bytecode.");
+
+        uint32_t parameterOffset = static_cast<uint32_t>(offset);
+        result.push_back(BytecodeOp(op, DecodeCompactParameter(code, parameterOffset)));
+        offset = parameterOffset;
+    }
+
+    return result;
+}
+
+
+/*
+ * Executable form
+ */
+
+bool Peisik::EncodeExecutableBytecode(const std::vector<BytecodeOp>& bytecode, std::vector<uint8_t>& output)
+{
+    // Returns the byte offset of the jump target relative to the jump instruction.
+    // Jumps out of bounds fail when taken, as in the wide form.
+    std::vector<int32_t> offsets(bytecode.size() + 1);
+    auto getJumpOffset = [&](size_t index)
+    {
+        int64_t target = static_cast<int64_t>(index) + bytecode[index].param;
+        int32_t targetOffset = target < 0 ? -1
+            : target >= static_cast<int64_t>(offsets.size()) ? offsets.back() + 1
+            : offsets[static_cast<size_t>(target)];
+        return targetOffset - offsets[index];
+    };
+
+    // Start with short jumps and lengthen those that do not fit until the layout is stable.
+    // Jumps only grow, so this terminates.
+    std::vector<uint32_t> sizes(bytecode.size());
+    for (size_t i = 0; i < bytecode.size(); i++)
+        sizes[i] = GetExecutableSize(bytecode[i].op, IsJumpOpcode(bytecode[i].op) ? 0 : bytecode[i].param);
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = 0; i < bytecode.size(); i++)
+            offsets[i + 1] = offsets[i] + sizes[i];
+
+        for (size_t i = 0; i < bytecode.size(); i++)
+        {
+            if (IsJumpOpcode(bytecode[i].op) && GetExecutableSize(bytecode[i].op, getJumpOffset(i)) > sizes[i])
+            {
+                sizes[i] = 4;
+                changed = true;
+            }
+        }
+    }
+
+    output.clear();
+    output.reserve(offsets.back() + 1);
+    for (size_t i = 0; i < bytecode.size(); i++)
+    {
+        auto& op = bytecode[i];
+        output.push_back(static_cast<uint8_t>(op.op));
+
+        if (IsJumpOpcode(op.op))
+        {
+            int32_t relative = getJumpOffset(i);
+            if (relative < SHRT_MIN || relative > SHRT_MAX)
+                return false;
+            EncodeExecutableParameter(relative, output);
+        }
+        else if (HasCompactParameter(op.op))
+        {
+            EncodeExecutableParameter(op.param, output);
+        }
+    }
+
+    // The padding byte read by DecodeExecutableOp after the last instruction
+    output.push_back(0);
+    return true;
+}
+
+size_t Peisik::CompactProgram(Program& program)
+{
+    size_t totalSize = 0;
+    for (short i = 0; i < program.GetFunctionCount(); i++)
+        totalSize += CompactFunction(program.GetMutableFunction(i));
+
+    return totalSize;
+}
+
+size_t Peisik::CompactFunction(Function& function)
+{
+    std::vector<uint8_t> code;
+    if (!EncodeExecutableBytecode(function.GetBytecode(), code))
+        return function.GetBytecode().size() * sizeof(BytecodeOp);
+
+    auto size = code.size() - 1;
+    function.SetCompactCode(std::move(code));
+    return size;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Bytecode.h"
+
+namespace Peisik
+{
+    class Function;
+    class Program;
+
+    // The compact encoding stores each instruction as a 1-byte opcode followed by its parameter.
+    // Return and PopDiscard have no parameter. There are two variants:
+    //  - the stored form in .cpeisik files, where the parameters are signed LEB128 numbers
+    //    (1 byte for values in [-64, 63], 2 bytes for values in [-8192, 8191] and 3 bytes otherwise)
+    //    and jump offsets are in instructions like in the wide form,
+    //  - the executable form, where a parameter is a signed byte, or the escape byte -128 followed by
+    //    a 16-bit little-endian value, and jump offsets are in bytes from the start of the jump instruction.
+    // The executable form is faster to decode, and the interpreter can jump without an offset table.
+
+    // Appends the stored compact form of the bytecode to the output.
+    void EncodeCompactBytecode(const std::vector<BytecodeOp>& bytecode, std::vector<uint8_t>& output);
+
+    // Decodes bytecode in the stored compact form.
+    // Throws an InterpreterException if the code is truncated or contains an unknown opcode.
+    std::vector<BytecodeOp> DecodeCompactBytecode(const uint8_t* code, size_t size);
+
+    // Encodes the bytecode in the executable compact form.
+    // Returns false if a jump offset does not fit in 16 bits, in which case the output is unspecified.
+    bool EncodeExecutableBytecode(const std::vector<BytecodeOp>& bytecode, std::vector<uint8_t>& output);
+
+    // Converts every function of the program to the executable compact form, keeping the wide bytecode
+    // for analyses and reports. Functions with too long jumps are left in the wide form.
+    // Returns the total size of the executable code in bytes.
+    size_t CompactProgram(Program& program);
+
+    // Converts a single function to the executable compact form like CompactProgram.
+    // Returns the size of the executable code in bytes.
+    size_t CompactFunction(Function& function);
+
+    // Returns true if the instruction has a parameter in the compact encoding.
+    inline bool HasCompactParameter(const Opcode op)
+    {
+        return op != Opcode::Return && op != Opcode::PopDiscard &&
+            op != Opcode::LoadElement && op != Opcode::StoreElement;
+    }
+
+    // Decodes a signed LEB128 parameter at the offset and advances the offset past it.
+    inline short DecodeCompactParameter(const uint8_t* code, uint32_t& offset)
+    {
+        uint32_t value = 0;
+        int shift = 0;
+        uint8_t byte;
+        do
+        {
+            byte = code[offset++];
+            value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+
+        // Sign extend from the last byte
+        if (byte & 0x40)
+            value |= ~0u << shift;
+        return static_cast<short>(static_cast<int32_t>(value));
+    }
+
+    // The parameter byte that is followed by a 16-bit parameter in the executable form
+    static const int8_t CompactParameterEscape = -128;
+
+    // Decodes the instruction at the offset in executable compact code and advances the offset past it.
+    // The code must be followed by a padding byte, since the parameter byte is read for every instruction.
+    inline BytecodeOp DecodeExecutableOp(const uint8_t* code, uint32_t& offset)
+    {
+        // The opcodes without a parameter, as a bit mask, to avoid mispredicted branches
+        const uint32_t NoParameterMask = (1u << static_cast<int>(Opcode::Return)) | (1u << static_cast<int>(Opcode::PopDiscard)) |
+            (1u << static_cast<int>(Opcode::LoadElement)) | (1u << static_cast<int>(Opcode::StoreElement));
+        static_assert(static_cast<int>(Opcode::OpcodeCount) <= 32, "The opcodes must fit in the mask.");
+
+        auto op = code[offset];
+        uint32_t hasParameter = ((NoParameterMask >> (op & 31)) & 1) ^ 1;
+        short param = static_cast<short>(static_cast<int8_t>(code[offset + 1]) * static_cast<int>(hasParameter));
+        offset += 1 + hasParameter;
+
+        if (param == CompactParameterEscape)
+        {
+            param = static_cast<short>(code[offset] | (code[offset + 1] << 8));
+            offset += 2;
+        }
+        return BytecodeOp(static_cast<Opcode>(op), param);
+    }
+}
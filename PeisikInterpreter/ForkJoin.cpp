@@ -0,0 +1,164 @@
+#include "pch.h"
+#include "ForkJoin.h"
+#include "PurityAnalysis.h"
+#include "Scheduler.h"
+
+using namespace Peisik;
+
+// The instructions a forked call runs before the worker looks at its queue again
+static const uint64_t ForkTimeSlice = 100000;
+
+// Returns the index of the call that is independent of the call at the index, or zero if there is none.
+static size_t FindIndependentCall(const Program& program, const std::vector<BytecodeOp>& bytecode,
+    const std::vector<bool>& pure, const std::vector<bool>& jumpTargets, size_t first)
+{
+    // The operands pushed after the first call, which must never be popped below zero
+    int depth = 0;
+    for (auto i = first + 1; i < bytecode.size() && !jumpTargets[i]; i++)
+    {
+        auto& op = bytecode[i];
+        switch (op.op)
+        {
+        case Opcode::PushConst:
+        case Opcode::PushImm:
+        case Opcode::PushLocal:
+            depth++;
+            break;
+        case Opcode::PlusImm:
+        case Opcode::MinusImm:
+        case Opcode::MultiplyImm:
+            if (depth < 1)
+                return 0;
+            break;
+        case Opcode::CallI0:
+        case Opcode::CallI1:
+        case Opcode::CallI2:
+        case Opcode::CallI3:
+        case Opcode::CallI4:
+        case Opcode::CallI5:
+        case Opcode::CallI6:
+        case Opcode::CallI7:
+        {
+            // The pure internal functions all return a value
+            auto parameterCount = static_cast<int>(op.op) - static_cast<int>(Opcode::CallI0);
+            if (!IsInternalFunctionPure(static_cast<InternalFunction>(op.param)) || depth < parameterCount)
+                return 0;
+            depth = depth - parameterCount + 1;
+            break;
+        }
+        case Opcode::Call:
+        {
+            // A call followed by Return may become a tail call, which would replace the frame that joins
+            auto& callee = program.GetFunction(op.param);
+            if (!pure[op.param] || callee.GetReturnType() == PrimitiveType::Void || depth != callee.GetParameterCount() ||
+                i + 1 >= bytecode.size() || bytecode[i + 1].op == Opcode::Return)
+            {
+                return 0;
+            }
+            return i;
+        }
+        default:
+            return 0;
+        }
+    }
+    return 0;
+}
+
+int Peisik::MarkForkPoints(Program& program)
+{
+    auto pure = FindPureFunctions(program);
+    auto functionCount = program.GetFunctionCount();
+
+    int marked = 0;
+    for (short f = 0; f < functionCount; f++)
+    {
+        auto& function = program.GetMutableFunction(f);
+        auto bytecode = function.GetBytecode();
+
+        // Nothing may jump between the calls, since the code between them would then not always run
+        std::vector<bool> jumpTargets(bytecode.size() + 1);
+        for (size_t i = 0; i < bytecode.size(); i++)
+        {
+            auto target = static_cast<int64_t>(i) + bytecode[i].param;
+            if (IsJumpOpcode(bytecode[i].op) && target >= 0 && target <= static_cast<int64_t>(bytecode.size()))
+                jumpTargets[static_cast<size_t>(target)] = true;
+        }
+
+        bool changed = false;
+        for (size_t i = 0; i < bytecode.size(); i++)
+        {
+            auto& op = bytecode[i];
+            if (op.op != Opcode::Call || op.param < 0 || op.param >= functionCount || !pure[op.param] ||
+                program.GetFunction(op.param).GetReturnType() == PrimitiveType::Void)
+            {
+                continue;
+            }
+
+            auto second = FindIndependentCall(program, bytecode, pure, jumpTargets, i);
+            if (second == 0)
+                continue;
+
+            // The second call may not start another pair, since its result is needed for the join
+            op.op = Opcode::CallFork;
+            marked++;
+            changed = true;
+            i = second;
+        }
+
+        if (changed)
+            function.SetBytecode(std::move(bytecode));
+    }
+    return marked;
+}
+
+
+/*
+ * Forked calls
+ */
+
+ForkedCall::ForkedCall()
+    : m_finished(false)
+{
+}
+
+void ForkedCall::Wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_completed.wait(lock, [this] { return IsFinished(); });
+}
+
+ForkJoinPool::ForkJoinPool(std::shared_ptr<const Program> program, unsigned workerCount, size_t depthCutoff)
+    : m_program(program), m_depthCutoff(depthCutoff), m_scheduler(new Scheduler(workerCount, ForkTimeSlice))
+{
+}
+
+// Defined here, since the scheduler is an incomplete type in the header
+ForkJoinPool::~ForkJoinPool() = default;
+
+size_t ForkJoinPool::GetWorkerCount() const
+{
+    return m_scheduler->GetWorkerCount();
+}
+
+std::shared_ptr<ForkedCall> ForkJoinPool::Fork(short functionIndex, std::vector<PObject> parameters, size_t depth,
+    const ExecutionBudget& budget, std::shared_ptr<SharedBudget> sharedBudget)
+{
+    auto call = std::make_shared<ForkedCall>();
+    call->m_interpreter.reset(new Interpreter(m_program));
+    call->m_interpreter->SetBudget(budget);
+    call->m_interpreter->SetSharedBudget(sharedBudget);
+    call->m_interpreter->SetCall(functionIndex, std::move(parameters));
+    call->m_interpreter->SetForkJoinPool(this, depth - 1);
+
+    // The handler keeps the call alive until it has ended, even if the forking interpreter is gone
+    m_scheduler->Submit(*call->m_interpreter, [call](Interpreter&, ExecutionStatus, std::exception_ptr error)
+    {
+        call->m_error = error;
+        {
+            std::lock_guard<std::mutex> lock(call->m_mutex);
+            call->m_finished.store(true, std::memory_order_release);
+        }
+        call->m_completed.notify_all();
+    });
+    return call;
+}
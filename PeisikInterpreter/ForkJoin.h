@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Interpreter.h"
+#include "PObject.h"
+#include "Program.h"
+
+namespace Peisik
+{
+    class Scheduler;
+
+    // Finds pairs of independent calls to pure functions, such as the two calls in +(Fib(-(n, 1)), Fib(-(n, 2))),
+    // and replaces the first call of each pair with CallFork.
+    //
+    // The calls are independent if the instructions between them only compute the parameters of the second
+    // call from locals and constants with pure internal functions, without touching the result of the first call,
+    // and no jump lands between them. The first call can then run concurrently with the parameters and the
+    // second call, and its result is needed right after the second call returns.
+    // Must run after the other load-time passes, which do not know CallFork.
+    // Returns the number of marked calls.
+    int MarkForkPoints(Program& program);
+
+    // A call started by ForkJoinPool::Fork.
+    class ForkedCall
+    {
+    public:
+        ForkedCall();
+
+        // Returns true if the call has ended, successfully or not.
+        bool IsFinished() const
+        {
+            return m_finished.load(std::memory_order_acquire);
+        }
+
+        // Blocks until the call has ended.
+        void Wait();
+
+        // Gets the interpreter running the call, which may only be accessed once the call has ended.
+        Interpreter& GetInterpreter()
+        {
+            return *m_interpreter;
+        }
+
+        // Gets the exception that ended the call, if any.
+        std::exception_ptr GetError() const
+        {
+            return m_error;
+        }
+
+    private:
+        friend class ForkJoinPool;
+
+        std::unique_ptr<Interpreter> m_interpreter;
+        std::exception_ptr m_error;
+        std::atomic<bool> m_finished;
+        std::mutex m_mutex;
+        std::condition_variable m_completed;
+    };
+
+    // Runs the calls marked with CallFork as tasks on a work-stealing Scheduler.
+    //
+    // Each forked call gets an interpreter of its own, which shares the immutable program and may fork
+    // calls of its own into the same pool. The calls are only forked up to the depth cutoff, counted in
+    // call frames from the main function through the forking interpreters, so that the tasks stay large
+    // enough to be worth their overhead. Below the cutoff CallFork is an ordinary call.
+    class ForkJoinPool
+    {
+    public:
+        // Starts the worker threads, one per hardware thread if the count is zero.
+        ForkJoinPool(std::shared_ptr<const Program> program, unsigned workerCount, size_t depthCutoff);
+
+        // Waits for the forked calls to end and stops the workers.
+        ~ForkJoinPool();
+
+        ForkJoinPool(const ForkJoinPool&) = delete;
+        ForkJoinPool& operator=(const ForkJoinPool&) = delete;
+
+        // Starts calling the function with the parameters. The depth is that of the new frame.
+        // The call charges its instructions to the shared budget of the forking program.
+        std::shared_ptr<ForkedCall> Fork(short functionIndex, std::vector<PObject> parameters, size_t depth,
+            const ExecutionBudget& budget, std::shared_ptr<SharedBudget> sharedBudget);
+
+        // Gets the deepest call frame that may fork.
+        size_t GetDepthCutoff() const
+        {
+            return m_depthCutoff;
+        }
+
+        // Gets the number of worker threads.
+        size_t GetWorkerCount() const;
+
+    private:
+        std::shared_ptr<const Program> m_program;
+        size_t m_depthCutoff;
+        std::unique_ptr<Scheduler> m_scheduler;
+    };
+}
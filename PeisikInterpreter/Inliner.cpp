@@ -0,0 +1,182 @@
+#include "pch.h"
+#include "Inliner.h"
+
+using namespace Peisik;
+
+static bool IsJump(const BytecodeOp& op)
+{
+    return IsJumpOpcode(op.op);
+}
+
+static bool IsInlinable(const Function& function, size_t maxCalleeSize)
+{
+    auto& code = function.GetBytecode();
+    if (code.empty() || code.size() > maxCalleeSize)
+        return false;
+
+    // The inlined code must not be able to run past its end
+    if (code.back().op != Opcode::Return)
+        return false;
+
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        auto& op = code[i];
+
+        // Recursion guard: inlining a recursive function would only peel off one level
+        if (op.op == Opcode::Call && op.param == function.GetFunctionIndex())
+            return false;
+        if (op.op >= Opcode::CallI0 && op.op <= Opcode::CallI7 &&
+            static_cast<InternalFunction>(op.param) == InternalFunction::FailFast)
+            return false;
+
+        if (IsJump(op))
+        {
+            auto target = static_cast<int64_t>(i) + op.param;
+            if (target < 0 || target >= static_cast<int64_t>(code.size()))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// Returns the locals that must be reset to zero when the inlined code is entered, since a called function
+// would get fresh locals. Locals assigned in the straight-line code at the start of the function before
+// they are read are always overwritten before use, so they need no reset.
+static std::vector<bool> FindLocalsToReset(const Function& function)
+{
+    auto localCount = function.GetLocalTypes().size();
+    std::vector<bool> seen(localCount, false);
+    std::vector<bool> reset(localCount, true);
+
+    for (short i = 0; i < function.GetParameterCount(); i++)
+    {
+        seen[i] = true;
+        reset[i] = false;
+    }
+
+    for (auto& op : function.GetBytecode())
+    {
+        if (IsJump(op) || op.op == Opcode::Return)
+            break;
+
+        if ((op.op == Opcode::PopLocal || op.op == Opcode::PushLocal) && !seen[op.param])
+        {
+            seen[op.param] = true;
+            reset[op.param] = (op.op == Opcode::PushLocal);
+        }
+    }
+
+    return reset;
+}
+
+// Rewrites the caller with the inlinable callees expanded. Returns the number of inlined call sites.
+static int InlineCalls(Program& program, short callerIndex, const std::vector<Function>& originals,
+    const std::vector<bool>& inlinable)
+{
+    auto& caller = program.GetMutableFunction(callerIndex);
+    auto& code = originals[callerIndex].GetBytecode();
+
+    // All inlined copies of a callee share the same caller locals, since they cannot be active at the same time
+    std::map<short, short> localBase;
+
+    std::vector<BytecodeOp> result;
+    std::vector<size_t> newIndex(code.size() + 1);
+    int inlinedCount = 0;
+
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        newIndex[i] = result.size();
+        auto& op = code[i];
+
+        if (op.op != Opcode::Call || op.param == callerIndex || !inlinable[op.param])
+        {
+            result.push_back(op);
+            continue;
+        }
+
+        auto& callee = originals[op.param];
+        auto& calleeLocals = callee.GetLocalTypes();
+        if (localBase.find(op.param) == localBase.end())
+        {
+            auto base = static_cast<short>(caller.GetLocalTypes().size());
+            for (auto type : calleeLocals)
+                caller.AddLocal(type);
+            localBase[op.param] = base;
+        }
+        auto base = localBase[op.param];
+
+        // The arguments were pushed left to right, so the last one is on top
+        for (short p = callee.GetParameterCount() - 1; p >= 0; p--)
+            result.push_back(BytecodeOp(Opcode::PopLocal, static_cast<short>(base + p)));
+
+        auto reset = FindLocalsToReset(callee);
+        for (short l = 0; l < static_cast<short>(calleeLocals.size()); l++)
+        {
+            if (!reset[l])
+                continue;
+            result.push_back(BytecodeOp(Opcode::PushConst, program.AddConstant(PObject(calleeLocals[l], 0))));
+            result.push_back(BytecodeOp(Opcode::PopLocal, static_cast<short>(base + l)));
+        }
+
+        // The final Return falls through to the next caller instruction, and the others jump there.
+        // Jumps within the callee keep their offsets since the layout is otherwise unchanged.
+        auto& calleeCode = callee.GetBytecode();
+        auto blockStart = result.size();
+        auto blockEnd = blockStart + calleeCode.size() - 1;
+        for (size_t j = 0; j + 1 < calleeCode.size(); j++)
+        {
+            auto calleeOp = calleeCode[j];
+            if (calleeOp.op == Opcode::PushLocal || calleeOp.op == Opcode::PopLocal)
+                calleeOp.param += base;
+            else if (calleeOp.op == Opcode::Return)
+                calleeOp = BytecodeOp(Opcode::Jump, static_cast<short>(blockEnd - (blockStart + j)));
+            result.push_back(calleeOp);
+        }
+
+        inlinedCount++;
+    }
+    newIndex[code.size()] = result.size();
+
+    if (inlinedCount == 0)
+        return 0;
+
+    // Retarget the jumps of the caller itself
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        if (!IsJump(code[i]))
+            continue;
+
+        // The compiler may leave unreachable jumps with bogus targets after a Return.
+        // Those keep their offset and would fail just like before if they were ever executed.
+        auto target = static_cast<int64_t>(i) + code[i].param;
+        if (target < 0 || target > static_cast<int64_t>(code.size()))
+            continue;
+
+        auto offset = static_cast<int64_t>(newIndex[target]) - static_cast<int64_t>(newIndex[i]);
+        if (offset < SHRT_MIN || offset > SHRT_MAX)
+            throw std::range_error("Jump offset out of range after inlining.");
+        result[newIndex[i]].param = static_cast<short>(offset);
+    }
+
+    caller.SetBytecode(result);
+    return inlinedCount;
+}
+
+int Peisik::InlineSmallFunctions(Program& program, size_t maxCalleeSize)
+{
+    std::vector<Function> originals;
+    std::vector<bool> inlinable;
+    for (short i = 0; i < program.GetFunctionCount(); i++)
+    {
+        originals.push_back(program.GetFunction(i));
+        inlinable.push_back(IsInlinable(originals.back(), maxCalleeSize));
+    }
+
+    int inlinedCount = 0;
+    for (short i = 0; i < program.GetFunctionCount(); i++)
+    {
+        inlinedCount += InlineCalls(program, i, originals, inlinable);
+    }
+    return inlinedCount;
+}
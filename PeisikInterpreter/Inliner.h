@@ -0,0 +1,15 @@
+#pragma once
+
+#include "Program.h"
+
+namespace Peisik
+{
+    // Replaces calls to small functions with copies of their bytecode.
+    //
+    // A callee is inlined if its code is at most maxCalleeSize instructions, it does not call itself
+    // and it does not call FailFast (to keep the stack traces intact). The callee locals become extra
+    // locals of the caller and Return instructions become jumps past the inlined code.
+    // Only the original function bodies are inlined, so the code grows at most one level.
+    // Returns the number of inlined call sites.
+    int InlineSmallFunctions(Program& program, size_t maxCalleeSize);
+}
@@ -1,11 +1,21 @@
 #include "pch.h"
+#include "ArrayHeap.h"
 #include "InternalFunctions.h"
 #include "PeisikException.h"
 #include "PObject.h"
 
+// The array kernels use SSE2, which every x64 processor has, and fall back to plain loops elsewhere
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PEISIK_SSE2
+#include <emmintrin.h>
+#endif
+
 using namespace Peisik;
 
-PObject InternalFunc::Plus(std::stack<PObject>& values)
+// Forward declarations
+static PObject PopTop(ParameterStack& stack);
+
+PObject InternalFunc::Plus(ParameterStack& values)
 {
     // Store both exact integer and floating point values and return the latter only if
     // there is a floating-point parameter.
@@ -347,3 +357,371 @@ PObject InternalFunc::MathTan(const PObject& value)
 {
     return ObjectFromReal(std::tan(value.GetRealValueForAnyNumeric()));
 }
+
+// The kernels of the bulk array functions.
+// Int arithmetic wraps around like in the other internal functions, but without the undefined behavior.
+// The real sums keep four partial sums, elements i % 4, and add them as (s0 + s2) + (s1 + s3)
+// before the remaining elements, so that the vector and plain versions give exactly the same results.
+
+static int64_t SumInts(const int64_t* values, size_t count)
+{
+    size_t i = 0;
+#ifdef PEISIK_SSE2
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 2 <= count; i += 2)
+        acc = _mm_add_epi64(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i)));
+    int64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    uint64_t sum = static_cast<uint64_t>(lanes[0]) + static_cast<uint64_t>(lanes[1]);
+#else
+    uint64_t sum = 0;
+#endif
+    for (; i < count; i++)
+        sum += static_cast<uint64_t>(values[i]);
+    return static_cast<int64_t>(sum);
+}
+
+static double SumReals(const double* values, size_t count)
+{
+    size_t i = 0;
+#ifdef PEISIK_SSE2
+    __m128d acc01 = _mm_setzero_pd();
+    __m128d acc23 = _mm_setzero_pd();
+    for (; i + 4 <= count; i += 4)
+    {
+        acc01 = _mm_add_pd(acc01, _mm_loadu_pd(values + i));
+        acc23 = _mm_add_pd(acc23, _mm_loadu_pd(values + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc01, acc23));
+    double sum = lanes[0] + lanes[1];
+#else
+    double partial[4] = { 0, 0, 0, 0 };
+    for (; i + 4 <= count; i += 4)
+    {
+        for (int lane = 0; lane < 4; lane++)
+            partial[lane] += values[i + lane];
+    }
+    double sum = (partial[0] + partial[2]) + (partial[1] + partial[3]);
+#endif
+    for (; i < count; i++)
+        sum += values[i];
+    return sum;
+}
+
+static int64_t DotInts(const int64_t* left, const int64_t* right, size_t count)
+{
+    // SSE2 has no 64-bit multiplication
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++)
+        sum += static_cast<uint64_t>(left[i]) * static_cast<uint64_t>(right[i]);
+    return static_cast<int64_t>(sum);
+}
+
+static double DotReals(const double* left, const double* right, size_t count)
+{
+    size_t i = 0;
+#ifdef PEISIK_SSE2
+    __m128d acc01 = _mm_setzero_pd();
+    __m128d acc23 = _mm_setzero_pd();
+    for (; i + 4 <= count; i += 4)
+    {
+        acc01 = _mm_add_pd(acc01, _mm_mul_pd(_mm_loadu_pd(left + i), _mm_loadu_pd(right + i)));
+        acc23 = _mm_add_pd(acc23, _mm_mul_pd(_mm_loadu_pd(left + i + 2), _mm_loadu_pd(right + i + 2)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc01, acc23));
+    double sum = lanes[0] + lanes[1];
+#else
+    double partial[4] = { 0, 0, 0, 0 };
+    for (; i + 4 <= count; i += 4)
+    {
+        for (int lane = 0; lane < 4; lane++)
+            partial[lane] += left[i + lane] * right[i + lane];
+    }
+    double sum = (partial[0] + partial[2]) + (partial[1] + partial[3]);
+#endif
+    for (; i < count; i++)
+        sum += left[i] * right[i];
+    return sum;
+}
+
+static void AddInts(int64_t* target, const int64_t* source, size_t count)
+{
+    size_t i = 0;
+#ifdef PEISIK_SSE2
+    for (; i + 2 <= count; i += 2)
+    {
+        auto sum = _mm_add_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(target + i)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), sum);
+    }
+#endif
+    for (; i < count; i++)
+        target[i] = static_cast<int64_t>(static_cast<uint64_t>(target[i]) + static_cast<uint64_t>(source[i]));
+}
+
+static void AddReals(double* target, const double* source, size_t count)
+{
+    size_t i = 0;
+#ifdef PEISIK_SSE2
+    for (; i + 2 <= count; i += 2)
+        _mm_storeu_pd(target + i, _mm_add_pd(_mm_loadu_pd(target + i), _mm_loadu_pd(source + i)));
+#endif
+    for (; i < count; i++)
+        target[i] += source[i];
+}
+
+static void MultiplyInts(int64_t* target, const int64_t* source, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        target[i] = static_cast<int64_t>(static_cast<uint64_t>(target[i]) * static_cast<uint64_t>(source[i]));
+}
+
+static void MultiplyReals(double* target, const double* source, size_t count)
+{
+    size_t i = 0;
+#ifdef PEISIK_SSE2
+    for (; i + 2 <= count; i += 2)
+        _mm_storeu_pd(target + i, _mm_mul_pd(_mm_loadu_pd(target + i), _mm_loadu_pd(source + i)));
+#endif
+    for (; i < count; i++)
+        target[i] *= source[i];
+}
+
+// Gets the two arrays of a bulk operation, which must be of the same type and length.
+static void GetArrayPair(const PObject& left, const PObject& right, const char* functionName,
+    PArray*& leftArray, PArray*& rightArray)
+{
+    leftArray = &GetArray(left);
+    rightArray = &GetArray(right);
+    if (leftArray->GetType() != rightArray->GetType())
+        throw InterpreterException("Array types do not match.");
+    if (leftArray->GetLength() != rightArray->GetLength())
+        throw ApplicationException((std::string(functionName) + " called with arrays of different lengths.").c_str());
+}
+
+PObject InternalFunc::ArrayAdd(const PObject& target, const PObject& source)
+{
+    PArray* targetArray;
+    PArray* sourceArray;
+    GetArrayPair(target, source, "Array.Add", targetArray, sourceArray);
+
+    if (targetArray->GetType() == PrimitiveType::IntArray)
+        AddInts(targetArray->GetInts().data(), sourceArray->GetInts().data(), targetArray->GetLength());
+    else
+        AddReals(targetArray->GetReals().data(), sourceArray->GetReals().data(), targetArray->GetLength());
+    return PObject(PrimitiveType::Void, 0);
+}
+
+PObject InternalFunc::ArrayDot(const PObject& left, const PObject& right)
+{
+    PArray* leftArray;
+    PArray* rightArray;
+    GetArrayPair(left, right, "Array.Dot", leftArray, rightArray);
+
+    if (leftArray->GetType() == PrimitiveType::IntArray)
+        return ObjectFromInt(DotInts(leftArray->GetInts().data(), rightArray->GetInts().data(), leftArray->GetLength()));
+    else
+        return ObjectFromReal(DotReals(leftArray->GetReals().data(), rightArray->GetReals().data(), leftArray->GetLength()));
+}
+
+PObject InternalFunc::ArrayFill(const PObject& array, const PObject& value)
+{
+    auto& target = GetArray(array);
+    if (target.GetType() == PrimitiveType::IntArray)
+        std::fill(target.GetInts().begin(), target.GetInts().end(), value.GetIntValue());
+    else
+        std::fill(target.GetReals().begin(), target.GetReals().end(), value.GetRealValueForAnyNumeric());
+    return PObject(PrimitiveType::Void, 0);
+}
+
+PObject InternalFunc::ArrayLength(const PObject& array)
+{
+    return ObjectFromInt(static_cast<int64_t>(GetArray(array).GetLength()));
+}
+
+PObject InternalFunc::ArrayMultiply(const PObject& target, const PObject& source)
+{
+    PArray* targetArray;
+    PArray* sourceArray;
+    GetArrayPair(target, source, "Array.Multiply", targetArray, sourceArray);
+
+    if (targetArray->GetType() == PrimitiveType::IntArray)
+        MultiplyInts(targetArray->GetInts().data(), sourceArray->GetInts().data(), targetArray->GetLength());
+    else
+        MultiplyReals(targetArray->GetReals().data(), sourceArray->GetReals().data(), targetArray->GetLength());
+    return PObject(PrimitiveType::Void, 0);
+}
+
+PObject InternalFunc::ArraySum(const PObject& array)
+{
+    auto& source = GetArray(array);
+    if (source.GetType() == PrimitiveType::IntArray)
+        return ObjectFromInt(SumInts(source.GetInts().data(), source.GetLength()));
+    else
+        return ObjectFromReal(SumReals(source.GetReals().data(), source.GetLength()));
+}
+
+// Some magic to reduce code repeat in CallPureFunction
+static PObject CallOneArgFunc(ParameterStack& params,
+    PObject(*func)(const PObject& value))
+{
+    if (params.size() != 1)
+        throw InterpreterException("The called function expects 1 parameter.");
+    return func(params.top());
+}
+
+static PObject CallTwoArgFunc(ParameterStack& params,
+    PObject(*func)(const PObject& left, const PObject& right))
+{
+    if (params.size() != 2)
+        throw InterpreterException("The called function expects 2 parameters.");
+    auto left = PopTop(params);
+    auto right = PopTop(params);
+    return func(left, right);
+}
+
+PObject InternalFunc::CallPureFunction(InternalFunction function, ParameterStack& params)
+{
+    switch (function)
+    {
+    case InternalFunction::Plus:
+        return InternalFunc::Plus(params);
+    case InternalFunction::Minus:
+        if (params.size() == 1)
+        {
+            return InternalFunc::Minus(params.top());
+        }
+        else if (params.size() == 2)
+        {
+            auto left = PopTop(params);
+            auto right = PopTop(params);
+            return InternalFunc::Minus(left, right);
+        }
+        else
+        {
+            throw InterpreterException("- expects 1 or 2 parameters.");
+        }
+    case InternalFunction::Multiply:
+        return CallTwoArgFunc(params, InternalFunc::Multiply);
+    case InternalFunction::Divide:
+        return CallTwoArgFunc(params, InternalFunc::Divide);
+    case InternalFunction::FloorDivide:
+        return CallTwoArgFunc(params, InternalFunc::FloorDivide);
+    case InternalFunction::Mod:
+        return CallTwoArgFunc(params, InternalFunc::Mod);
+    case InternalFunction::Less:
+        return CallTwoArgFunc(params, InternalFunc::Less);
+    case InternalFunction::LessEqual:
+        return CallTwoArgFunc(params, InternalFunc::LessEqual);
+    case InternalFunction::Greater:
+        return CallTwoArgFunc(params, InternalFunc::Greater);
+    case InternalFunction::GreaterEqual:
+        return CallTwoArgFunc(params, InternalFunc::GreaterEqual);
+    case InternalFunction::Equal:
+        return CallTwoArgFunc(params, InternalFunc::Equal);
+    case InternalFunction::NotEqual:
+        return CallTwoArgFunc(params, InternalFunc::NotEqual);
+    case InternalFunction::And:
+        return CallTwoArgFunc(params, InternalFunc::And);
+    case InternalFunction::Or:
+        return CallTwoArgFunc(params, InternalFunc::Or);
+    case InternalFunction::Xor:
+        return CallTwoArgFunc(params, InternalFunc::Xor);
+    case InternalFunction::Not:
+        return CallOneArgFunc(params, InternalFunc::Not);
+    case InternalFunction::MathAbs:
+        return CallOneArgFunc(params, InternalFunc::MathAbs);
+    case InternalFunction::MathAcos:
+        return CallOneArgFunc(params, InternalFunc::MathAcos);
+    case InternalFunction::MathAsin:
+        return CallOneArgFunc(params, InternalFunc::MathAsin);
+    case InternalFunction::MathAtan:
+        return CallOneArgFunc(params, InternalFunc::MathAtan);
+    case InternalFunction::MathCeil:
+        return CallOneArgFunc(params, InternalFunc::MathCeil);
+    case InternalFunction::MathCos:
+        return CallOneArgFunc(params, InternalFunc::MathCos);
+    case InternalFunction::MathExp:
+        return CallOneArgFunc(params, InternalFunc::MathExp);
+    case InternalFunction::MathFloor:
+        return CallOneArgFunc(params, InternalFunc::MathFloor);
+    case InternalFunction::MathLog:
+        return CallOneArgFunc(params, InternalFunc::MathLog);
+    case InternalFunction::MathPow:
+        return CallTwoArgFunc(params, InternalFunc::MathPow);
+    case InternalFunction::MathRound:
+        return CallOneArgFunc(params, InternalFunc::MathRound);
+    case InternalFunction::MathSin:
+        return CallOneArgFunc(params, InternalFunc::MathSin);
+    case InternalFunction::MathSqrt:
+        return CallOneArgFunc(params, InternalFunc::MathSqrt);
+    case InternalFunction::MathTan:
+        return CallOneArgFunc(params, InternalFunc::MathTan);
+    default:
+        std::cout << "Trying to call internal function " << static_cast<short>(function) << std::endl;
+        throw InterpreterException("Unknown internal function.");
+    }
+}
+
+PObject InternalFunc::CallArrayFunction(InternalFunction function, ParameterStack& params)
+{
+    switch (function)
+    {
+    case InternalFunction::ArrayAdd:
+        return CallTwoArgFunc(params, InternalFunc::ArrayAdd);
+    case InternalFunction::ArrayDot:
+        return CallTwoArgFunc(params, InternalFunc::ArrayDot);
+    case InternalFunction::ArrayFill:
+        return CallTwoArgFunc(params, InternalFunc::ArrayFill);
+    case InternalFunction::ArrayLength:
+        return CallOneArgFunc(params, InternalFunc::ArrayLength);
+    case InternalFunction::ArrayMultiply:
+        return CallTwoArgFunc(params, InternalFunc::ArrayMultiply);
+    case InternalFunction::ArraySum:
+        return CallOneArgFunc(params, InternalFunc::ArraySum);
+    default:
+        // Including the element access and creation, which have their own instructions
+        throw InterpreterException("Unknown array function.");
+    }
+}
+
+PObject InternalFunc::CallBinaryFunction(InternalFunction function, const PObject& left, const PObject& right)
+{
+    switch (function)
+    {
+    case InternalFunction::Minus:
+        return InternalFunc::Minus(left, right);
+    case InternalFunction::Multiply:
+        return InternalFunc::Multiply(left, right);
+    case InternalFunction::Less:
+        return InternalFunc::Less(left, right);
+    case InternalFunction::LessEqual:
+        return InternalFunc::LessEqual(left, right);
+    case InternalFunction::Greater:
+        return InternalFunc::Greater(left, right);
+    case InternalFunction::GreaterEqual:
+        return InternalFunc::GreaterEqual(left, right);
+    case InternalFunction::Equal:
+        return InternalFunc::Equal(left, right);
+    case InternalFunction::NotEqual:
+        return InternalFunc::NotEqual(left, right);
+    default:
+    {
+        // The first parameter is on top of the stack
+        ParameterStack params;
+        params.push(right);
+        params.push(left);
+        return CallPureFunction(function, params);
+    }
+    }
+}
+
+static PObject PopTop(ParameterStack& stack)
+{
+    auto object = stack.top();
+    stack.pop();
+
+    return object;
+}
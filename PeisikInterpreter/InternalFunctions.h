@@ -1,12 +1,30 @@
 #pragma once
 
+#include <deque>
+#include <stack>
+#include "Bytecode.h"
+#include "MemoryStatistics.h"
 #include "PObject.h"
 
 namespace Peisik
 {
+    // The parameters of an internal function call.
+    typedef std::stack<PObject, std::deque<PObject, CountingAllocator<PObject, MemoryCategory::InternalCallScratch>>> ParameterStack;
+
     namespace InternalFunc
     {
-        PObject Plus(std::stack<PObject>& values);
+        // Calls an internal function without side effects, that is, anything but Print and FailFast.
+        // The first parameter is on top of the stack.
+        PObject CallPureFunction(InternalFunction function, ParameterStack& params);
+
+        // Calls one of the bulk array functions. Add, Multiply and Fill modify the first array in place.
+        // The first parameter is on top of the stack.
+        PObject CallArrayFunction(InternalFunction function, ParameterStack& params);
+
+        // Calls a pure internal function with two parameters without building a parameter stack.
+        PObject CallBinaryFunction(InternalFunction function, const PObject& left, const PObject& right);
+
+        PObject Plus(ParameterStack& values);
         PObject Minus(const PObject& value);
         PObject Minus(const PObject& left, const PObject& right);
         PObject Multiply(const PObject& left, const PObject& right);
@@ -40,5 +58,12 @@ namespace Peisik
         PObject MathSin(const PObject& value);
         PObject MathSqrt(const PObject& value);
         PObject MathTan(const PObject& value);
+
+        PObject ArrayAdd(const PObject& target, const PObject& source);
+        PObject ArrayDot(const PObject& left, const PObject& right);
+        PObject ArrayFill(const PObject& array, const PObject& value);
+        PObject ArrayLength(const PObject& array);
+        PObject ArrayMultiply(const PObject& target, const PObject& source);
+        PObject ArraySum(const PObject& array);
     }
 }
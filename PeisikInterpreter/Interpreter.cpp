@@ -1,184 +1,214 @@
 #include "pch.h"
 #include "Bytecode.h"
+#include "CompactBytecode.h"
+#include "ForkJoin.h"
 #include "InternalFunctions.h"
 #include "Interpreter.h"
+#include "ParallelReduction.h"
 #include "PeisikException.h"
 #include "PObject.h"
+#include "Probes.h"
 #include "Program.h"
+#include "Snapshot.h"
+#include <thread>
 
 using namespace Peisik;
 
 // Forward declarations
-static std::string OpcodeToString(const Opcode op);
-static PObject PopTop(std::stack<PObject>& stack);
-static void PrintObject(const PObject& object);
+template <typename Stack>
+static PObject PopTop(Stack& stack);
+template <typename Stack>
+static const typename Stack::container_type& GetContainer(const Stack& stack);
+static void PrintObject(const PObject& object, std::ostream& output);
+static bool IsInstructionStart(const uint8_t* compactCode, uint32_t codeSize, uint32_t programCounter);
+
+// The number of backward jumps and calls between budget checks, unless the instruction limit is near
+static const uint32_t BudgetCheckInterval = 1024;
 
 Interpreter::Interpreter(Program program)
-    : m_program(program), m_opCounts(static_cast<size_t>(Opcode::OpcodeCount), 0), m_trace(false),
-    m_shouldHalt(false), m_iCallParams()
+    : Interpreter(std::make_shared<const Program>(std::move(program)))
 {
 }
 
-// Some magic to reduce code repeat in DispatchInternalCall
-static PObject CallOneArgFunc(std::stack<PObject>& params,
-    PObject(*func)(const PObject& value))
+Interpreter::Interpreter(std::shared_ptr<const Program> program)
+    : m_trace(false), m_instrumented(false), m_output(&std::cout),
+    m_opCounts(static_cast<size_t>(Opcode::OpcodeCount), 0), m_parallelWorkers(0),
+    m_forkPool(nullptr), m_forkDepthCutoff(0), m_forkBaseDepth(0),
+    m_sharedProgram(program), m_program(*m_sharedProgram), m_shouldHalt(false), m_failed(false),
+    m_started(false), m_finished(false), m_yielding(false), m_stepLimit(UINT64_MAX),
+    m_callDepthLimit(SIZE_MAX), m_longestFunction(std::max<size_t>(m_program.GetLongestFunctionLength(), 1)),
+    m_checkpointCountdown(1), m_chargedOpCount(0), m_peakFrameDepth(0), m_iCallParams(), m_joinPending(false)
 {
-    if (params.size() != 1)
-        throw InterpreterException("The called function expects 1 parameter.");
-    return func(params.top());
 }
 
-static PObject CallTwoArgFunc(std::stack<PObject>& params,
-    PObject(*func)(const PObject& left, const PObject& right))
-{
-    if (params.size() != 2)
-        throw InterpreterException("The called function expects 2 parameters.");
-    auto left = PopTop(params);
-    auto right = PopTop(params);
-    return func(left, right);
-}
+// Defined here, since the parallel reducer is an incomplete type in the header
+Interpreter::~Interpreter() = default;
 
-PObject Interpreter::DispatchInternalCall(const InternalFunction funcIndex, std::stack<PObject>& params)
+PObject Interpreter::DispatchInternalCall(const InternalFunction funcIndex, ParameterStack& params)
 {
     switch (funcIndex)
     {
-    case InternalFunction::Plus:
-        return InternalFunc::Plus(params);
-    case InternalFunction::Minus:
-        if (params.size() == 1)
-        {
-            return InternalFunc::Minus(params.top());
-        }
-        else if (params.size() == 2)
-        {
-            auto left = PopTop(params);
-            auto right = PopTop(params);
-            return InternalFunc::Minus(left, right);
-        }
-        else
-        {
-            throw InterpreterException("- expects 1 or 2 parameters.");
-        }
-    case InternalFunction::Multiply:
-        return CallTwoArgFunc(params, InternalFunc::Multiply);
-    case InternalFunction::Divide:
-        return CallTwoArgFunc(params, InternalFunc::Divide);
-    case InternalFunction::FloorDivide:
-        return CallTwoArgFunc(params, InternalFunc::FloorDivide);
-    case InternalFunction::Mod:
-        return CallTwoArgFunc(params, InternalFunc::Mod);
-    case InternalFunction::Less:
-        return CallTwoArgFunc(params, InternalFunc::Less);
-    case InternalFunction::LessEqual:
-        return CallTwoArgFunc(params, InternalFunc::LessEqual);
-    case InternalFunction::Greater:
-        return CallTwoArgFunc(params, InternalFunc::Greater);
-    case InternalFunction::GreaterEqual:
-        return CallTwoArgFunc(params, InternalFunc::GreaterEqual);
-    case InternalFunction::Equal:
-        return CallTwoArgFunc(params, InternalFunc::Equal);
-    case InternalFunction::NotEqual:
-        return CallTwoArgFunc(params, InternalFunc::NotEqual);
-    case InternalFunction::And:
-        return CallTwoArgFunc(params, InternalFunc::And);
-    case InternalFunction::Or:
-        return CallTwoArgFunc(params, InternalFunc::Or);
-    case InternalFunction::Xor:
-        return CallTwoArgFunc(params, InternalFunc::Xor);
-    case InternalFunction::Not:
-        return CallOneArgFunc(params, InternalFunc::Not);
     case InternalFunction::Print:
     {
         while (!params.empty())
         {
-            PrintObject(PopTop(params));
+            PrintObject(PopTop(params), *m_output);
             if (!params.empty())
-                std::cout << " ";
+                *m_output << " ";
         }
-        std::cout << std::endl;
+        *m_output << std::endl;
         return PObject(PrimitiveType::Void, 0);
     }
     case InternalFunction::FailFast:
     {
-        std::cout << "The program requested termination by calling FailFast. Stack trace:" << std::endl;
-        auto stack(m_stack);
-        while (!stack.empty())
+        *m_output << "The program requested termination by calling FailFast. Stack trace:" << std::endl;
+        for (auto frame = m_stack.rbegin(); frame != m_stack.rend(); ++frame)
         {
-            auto &frame = stack.top();
-            std::cout << "Function " << frame.function.GetFunctionIndex() << ", instruction " << frame.programCounter - 1 << std::endl;
-            stack.pop();
+            *m_output << "Function " << frame->function.GetFunctionIndex() << ", instruction " << GetCurrentInstruction(*frame) << std::endl;
         }
         m_shouldHalt = true;
+        m_failed = true;
         return PObject(PrimitiveType::Void, 0);
     }
-    case InternalFunction::MathAbs:
-        return CallOneArgFunc(params, InternalFunc::MathAbs);
-    case InternalFunction::MathAcos:
-        return CallOneArgFunc(params, InternalFunc::MathAcos);
-    case InternalFunction::MathAsin:
-        return CallOneArgFunc(params, InternalFunc::MathAsin);
-    case InternalFunction::MathAtan:
-        return CallOneArgFunc(params, InternalFunc::MathAtan);
-    case InternalFunction::MathCeil:
-        return CallOneArgFunc(params, InternalFunc::MathCeil);
-    case InternalFunction::MathCos:
-        return CallOneArgFunc(params, InternalFunc::MathCos);
-    case InternalFunction::MathExp:
-        return CallOneArgFunc(params, InternalFunc::MathExp);
-    case InternalFunction::MathFloor:
-        return CallOneArgFunc(params, InternalFunc::MathFloor);
-    case InternalFunction::MathLog:
-        return CallOneArgFunc(params, InternalFunc::MathLog);
-    case InternalFunction::MathPow:
-        return CallTwoArgFunc(params, InternalFunc::MathPow);
-    case InternalFunction::MathRound:
-        return CallOneArgFunc(params, InternalFunc::MathRound);
-    case InternalFunction::MathSin:
-        return CallOneArgFunc(params, InternalFunc::MathSin);
-    case InternalFunction::MathSqrt:
-        return CallOneArgFunc(params, InternalFunc::MathSqrt);
-    case InternalFunction::MathTan:
-        return CallOneArgFunc(params, InternalFunc::MathTan);
     default:
-        std::cout << "Trying to call internal function " << static_cast<short>(funcIndex) << std::endl;
-        throw InterpreterException("Unknown internal function.");
+        if (IsArrayFunction(funcIndex))
+            return InternalFunc::CallArrayFunction(funcIndex, params);
+        return InternalFunc::CallPureFunction(funcIndex, params);
     }
 }
 
 void Interpreter::Execute()
 {
-    // Create the initial frame
-    m_stack.push(PrepareFrameForFunction(m_program.GetFunction(m_program.GetMainFunctionIndex())));
+    while (Step(0) == ExecutionStatus::Yielded)
+    {
+    }
+}
+
+ExecutionStatus Interpreter::Step(uint64_t maxInstructions)
+{
+    try
+    {
+        return RunStep(maxInstructions);
+    }
+    catch (std::exception& e)
+    {
+        // The program counter has advanced past the instruction that threw
+        if (!m_stack.empty())
+            PEISIK_PROBE3(error, m_stack.back().function.GetFunctionIndex(), GetInstructionStart(m_stack.back()), e.what());
+
+        // An error in any part of the program ends all of it
+        if (m_sharedBudget)
+            m_sharedBudget->Stop(std::current_exception());
+        throw;
+    }
+}
+
+ExecutionStatus Interpreter::RunStep(uint64_t maxInstructions)
+{
+    if (m_finished)
+        return m_failed ? ExecutionStatus::Failed : ExecutionStatus::Finished;
+
+    if (!m_started)
+    {
+        m_started = true;
+        m_startTime = std::chrono::steady_clock::now();
+
+        // Create the initial frame
+        auto entryIndex = m_program.GetMainFunctionIndex();
+        if (m_range)
+            entryIndex = m_range->functionIndex;
+        else if (m_call)
+            entryIndex = m_call->functionIndex;
+        if (m_range && m_range->next >= m_range->to)
+        {
+            m_finished = true;
+            return ExecutionStatus::Finished;
+        }
+        m_stack.push_back(PrepareFrameForFunction(m_program.GetFunction(entryIndex)));
+        if (m_range)
+            m_stack.back().locals[0] = ObjectFromInt(m_range->next);
+        if (m_call)
+            std::copy(m_call->parameters.begin(), m_call->parameters.end(), m_stack.back().locals.begin());
+        m_peakFrameDepth = 1;
+        if (m_profiler)
+            m_profiler->EnterFunction(entryIndex);
+        PEISIK_PROBE4(function__entry, entryIndex, -1, 0, 1);
+        if (m_sampler)
+            m_sampler->Start();
+    }
+
+    // A forked call may have ended since the previous step
+    if (m_joinPending)
+    {
+        if (!TryJoin())
+        {
+            std::this_thread::yield();
+            return ExecutionStatus::Yielded;
+        }
+        m_joinPending = false;
+    }
+
+    // The step limit is checked with the budget, so make the next checkpoint recompute the interval
+    m_stepLimit = maxInstructions > 0 ? GetExecutedOpCount() + maxInstructions : UINT64_MAX;
+    m_checkpointCountdown = 1;
 
-    // Run the main loop until done
+    // Run the main loop until done or yielding
     while (!m_shouldHalt)
     {
         // References to the current frame and instruction
-        StackFrame& frame = m_stack.top();
-        auto& bytecode = frame.function.GetBytecode();
-        if (frame.programCounter >= bytecode.size())
+        StackFrame& frame = m_stack.back();
+        if (frame.programCounter >= frame.codeSize)
             throw InterpreterException("Out of bytecode bounds.");
-        BytecodeOp op = bytecode[frame.programCounter];
 
-        // Increase the program counter now
-        frame.programCounter++;
+        // Jump offsets are relative to the start of the instruction.
+        // Increase the program counter now.
+        uint32_t instructionStart = frame.programCounter;
+        BytecodeOp op(Opcode::Invalid, 0);
+        if (frame.compactCode != nullptr)
+            op = DecodeExecutableOp(frame.compactCode, frame.programCounter);
+        else
+            op = frame.bytecode[frame.programCounter++];
 
         // Tracing and opcode counting
         m_opCounts[static_cast<int>(op.op)]++;
-        if (m_trace)
+        if (m_instrumented)
         {
-            std::cout << "* "
-                << std::right << std::setw(3) << frame.function.GetFunctionIndex() << ":"
-                << std::left << std::setw(3) << (frame.programCounter - 1)
-                << " " << std::setw(12) << OpcodeToString(op.op)
-                << " " << op.param << std::endl;
+            if (m_profiler)
+                m_profiler->CountInstruction(frame.function.GetFunctionIndex());
+            if (m_sampler && m_sampler->IsSamplePending())
+                TakeSample();
+            if (m_recorder)
+                RecordProfile(frame, instructionStart, op.op);
+            if (m_binaryTrace)
+            {
+                m_binaryTrace->Append(frame.function.GetFunctionIndex(), instructionStart, op,
+                    frame.functionStack.empty() ? nullptr : &frame.functionStack.top(),
+                    frame.compactCode != nullptr ? TraceCompactCode : 0);
+            }
+            if (m_trace)
+            {
+                // Print the wide instruction, since the jump offsets differ in compact code
+                auto index = GetCurrentInstruction(frame);
+                *m_output << "* "
+                    << std::right << std::setw(3) << frame.function.GetFunctionIndex() << ":"
+                    << std::left << std::setw(3) << index
+                    << " " << std::setw(22) << OpcodeToString(op.op)
+                    << " " << frame.function.GetBytecode()[index].param << std::endl;
+            }
         }
 
         switch (op.op)
         {
+        case Opcode::CallFork:
         case Opcode::Call:
         {
+            // A forked call does not depend on the code up to the next call, so it can run concurrently.
+            // Otherwise it is an ordinary call.
+            if (op.op == Opcode::CallFork && m_forkDepthCutoff > 0 && TryFork(frame, op.param))
+                break;
+
             const Function& func = m_program.GetFunction(op.param);
+            auto caller = frame.function.GetFunctionIndex();
             auto callFrame = PrepareFrameForFunction(func);
             // Parameters are passed as locals.
             // Since they are evaluated left to right, they are in reverse order on the stack.
@@ -191,11 +221,43 @@ void Interpreter::Execute()
             // Optimization: If this is a tail call, turn the call into a jump by removing the current frame.
             // Because this is implemented in the interpreter, no compiler magic is needed.
             // On the other hand, stack traces may become more inaccurate... but they weren't exactly useful in the first place.
-            if (op.param == frame.function.GetFunctionIndex() && bytecode[frame.programCounter].op == Opcode::Return)
+            if (op.param == caller && IsFollowedByReturn(frame))
+            {
+                // The result of the new frame is also the result of the replaced one
+                callFrame.memoized = frame.memoized;
+                PEISIK_PROBE3(function__return, caller, instructionStart, m_stack.size());
+                m_stack.pop_back();
+                if (m_profiler)
+                    m_profiler->LeaveFunction();
+            }
+            else if (m_memoizer && m_memoizer->IsMemoized(op.param))
             {
-                m_stack.pop();
+                PObject result(PrimitiveType::Void, 0);
+                if (m_memoizer->Lookup(op.param, callFrame.locals.data(), result))
+                {
+                    frame.functionStack.push(result);
+                    if (!m_forks.empty() && m_forks.back().stackDepth == m_stack.size() && !TryJoin())
+                    {
+                        m_joinPending = true;
+                        m_yielding = true;
+                        m_shouldHalt = true;
+                    }
+                    break;
+                }
+                callFrame.memoized = true;
             }
-            m_stack.push(callFrame);
+
+            // Recursion is the other way to run for long
+            if (m_stack.size() >= m_callDepthLimit)
+                ExceedBudget("call depth limit of " + std::to_string(m_callDepthLimit));
+            if (--m_checkpointCountdown == 0)
+                CheckBudget();
+
+            m_stack.push_back(callFrame);
+            m_peakFrameDepth = std::max(m_peakFrameDepth, m_stack.size());
+            if (m_profiler)
+                m_profiler->EnterFunction(op.param);
+            PEISIK_PROBE4(function__entry, op.param, caller, instructionStart, m_stack.size());
             break;
         }
 
@@ -216,7 +278,10 @@ void Interpreter::Execute()
             m_iCallParams.push(PopTop(frame.functionStack));
         case Opcode::CallI0:
         {
+            PEISIK_PROBE3(internal__call, op.param, frame.function.GetFunctionIndex(), instructionStart);
             PObject callResult = DispatchInternalCall(static_cast<InternalFunction>(op.param), m_iCallParams);
+            if (m_failed)
+                PEISIK_PROBE3(fail__fast, frame.function.GetFunctionIndex(), instructionStart, m_stack.size());
             // Clean up the param stack since it is cached
             while (!m_iCallParams.empty())
             {
@@ -228,14 +293,52 @@ void Interpreter::Execute()
         }
 
         case Opcode::Jump:
-            frame.programCounter += op.param - 1; // -1 because it was already incremented
+            // Every loop contains a backward jump, so checking the budget there is enough
+            if (op.param <= 0 && --m_checkpointCountdown == 0)
+                CheckBudget();
+            frame.programCounter = instructionStart + op.param;
             break;
         case Opcode::JumpFalse:
             if (PopTop(frame.functionStack).GetBoolValue() == false)
             {
-                frame.programCounter += op.param - 1; // -1 because it was already incremented
+                if (op.param <= 0 && --m_checkpointCountdown == 0)
+                    CheckBudget();
+                frame.programCounter = instructionStart + op.param;
             }
             break;
+        case Opcode::JumpIfNotLess:
+        case Opcode::JumpIfNotLessEqual:
+        case Opcode::JumpIfNotGreater:
+        case Opcode::JumpIfNotGreaterEqual:
+        case Opcode::JumpIfNotEqual:
+        case Opcode::JumpIfEqual:
+        {
+            PObject right = PopTop(frame.functionStack);
+            PObject left = PopTop(frame.functionStack);
+            if (InternalFunc::CallBinaryFunction(GetFusedFunction(op.op), left, right).GetBoolValue() == false)
+            {
+                if (op.param <= 0 && --m_checkpointCountdown == 0)
+                    CheckBudget();
+                frame.programCounter = instructionStart + op.param;
+            }
+            break;
+        }
+        case Opcode::PlusImm:
+        {
+            PObject& top = frame.functionStack.top();
+            if (top.GetType() == PrimitiveType::Int)
+                top = ObjectFromInt(top.GetIntValue() + op.param);
+            else
+                top = InternalFunc::CallBinaryFunction(InternalFunction::Plus, top, ObjectFromInt(op.param));
+            break;
+        }
+        case Opcode::MinusImm:
+        case Opcode::MultiplyImm:
+        {
+            PObject& top = frame.functionStack.top();
+            top = InternalFunc::CallBinaryFunction(GetFusedFunction(op.op), top, ObjectFromInt(op.param));
+            break;
+        }
         case Opcode::PopDiscard:
             frame.functionStack.pop();
             break;
@@ -246,34 +349,101 @@ void Interpreter::Execute()
         case Opcode::PushConst:
             frame.functionStack.push(m_program.GetConstant(op.param));
             break;
+        case Opcode::PushImm:
+            frame.functionStack.push(ObjectFromInt(op.param));
+            break;
         case Opcode::PushLocal:
             frame.functionStack.push(frame.locals[op.param]);
             break;
+        case Opcode::NewArray:
+        {
+            auto length = PopTop(frame.functionStack).GetIntValue();
+            if (m_heap.ShouldCollect())
+                CollectGarbage();
+            auto type = static_cast<PrimitiveType>(op.param);
+            frame.functionStack.push(ObjectFromArray(type, m_heap.Allocate(type, length)));
+            break;
+        }
+        case Opcode::LoadElement:
+        {
+            auto index = PopTop(frame.functionStack).GetIntValue();
+            PObject& top = frame.functionStack.top();
+            top = GetArray(top).GetElement(index);
+            break;
+        }
+        case Opcode::StoreElement:
+        {
+            // The array, index and value are pushed in this order
+            PObject value = PopTop(frame.functionStack);
+            auto index = PopTop(frame.functionStack).GetIntValue();
+            GetArray(PopTop(frame.functionStack)).SetElement(index, value);
+            break;
+        }
+        case Opcode::CallParallel:
+        {
+            auto to = PopTop(frame.functionStack).GetIntValue();
+            auto from = PopTop(frame.functionStack).GetIntValue();
+            if (!m_parallel)
+                m_parallel.reset(new ParallelReducer(m_sharedProgram, m_parallelWorkers));
+
+            // The chunks charge their instructions to the shared budget themselves, and they are added
+            // to the op counts here, so only the instructions of this interpreter are left to charge
+            auto sharedBudget = ShareBudget();
+            auto uncharged = GetExecutedOpCount() - m_chargedOpCount;
+            frame.functionStack.push(m_parallel->Reduce(op.param, from, to, GetChildBudget(), sharedBudget, m_opCounts));
+            m_chargedOpCount = GetExecutedOpCount() - uncharged;
+            CheckBudget();
+            break;
+        }
         case Opcode::Return:
+            PEISIK_PROBE3(function__return, frame.function.GetFunctionIndex(), instructionStart, m_stack.size());
             if (m_stack.size() == 1)
             {
+                // In range mode, call the function again with the next parameter
+                if (m_range && ContinueRange(frame))
+                    break;
+                if (m_call)
+                {
+                    m_call->result = frame.functionStack.top();
+                    m_shouldHalt = true;
+                    break;
+                }
+
                 // If this is the main function, print the possible return value
-                if (frame.function.GetReturnType() != PrimitiveType::Void)
+                if (!m_range && frame.function.GetReturnType() != PrimitiveType::Void)
                 {
-                    PrintObject(frame.functionStack.top());
-                    std::cout << std::endl;
+                    PrintObject(frame.functionStack.top(), *m_output);
+                    *m_output << std::endl;
                 }
                 m_shouldHalt = true;
                 break;
             }
             else
             {
+                if (m_profiler)
+                    m_profiler->LeaveFunction();
+
                 // Else, pop off the frame to return to the caller
                 if (frame.function.GetReturnType() != PrimitiveType::Void)
                 {
                     // Move the return value onto the caller's stack
                     PObject returnValue = frame.functionStack.top();
-                    m_stack.pop();
-                    m_stack.top().functionStack.push(returnValue);
+                    if (frame.memoized)
+                        m_memoizer->Store(returnValue);
+                    m_stack.pop_back();
+                    m_stack.back().functionStack.push(returnValue);
+
+                    // The result of the call after a fork completes the operands
+                    if (!m_forks.empty() && m_forks.back().stackDepth == m_stack.size() && !TryJoin())
+                    {
+                        m_joinPending = true;
+                        m_yielding = true;
+                        m_shouldHalt = true;
+                    }
                 }
                 else
                 {
-                    m_stack.pop();
+                    m_stack.pop_back();
                 }
                 break;
             }
@@ -281,12 +451,421 @@ void Interpreter::Execute()
             throw InterpreterException("Unknown opcode");
         }
     }
+
+    if (m_yielding)
+    {
+        m_yielding = false;
+        m_shouldHalt = false;
+        return ExecutionStatus::Yielded;
+    }
+
+    m_finished = true;
+    if (m_sharedBudget)
+    {
+        // The instructions since the last checkpoint
+        auto executed = GetExecutedOpCount();
+        m_sharedBudget->Charge(executed - m_chargedOpCount);
+        m_chargedOpCount = executed;
+    }
+    if (m_profiler)
+        m_profiler->Finish();
+    if (m_sampler)
+        m_sampler->Stop();
+    return m_failed ? ExecutionStatus::Failed : ExecutionStatus::Finished;
+}
+
+void Interpreter::SetMemoization(bool value)
+{
+    if (value)
+        m_memoizer.reset(new Memoizer(m_program));
+    else
+        m_memoizer.reset();
+}
+
+void Interpreter::SetProfiling(bool value)
+{
+    if (value)
+        m_profiler.reset(new Profiler(m_program.GetFunctionCount()));
+    else
+        m_profiler.reset();
+    UpdateInstrumented();
+}
+
+void Interpreter::SetBudget(const ExecutionBudget& budget)
+{
+    m_budget = budget;
+    m_callDepthLimit = budget.maxCallDepth > 0 ? budget.maxCallDepth : SIZE_MAX;
+}
+
+void Interpreter::CheckBudget()
+{
+    uint64_t interval = BudgetCheckInterval;
+    auto executed = GetExecutedOpCount();
+    auto startTime = m_startTime;
+
+    if (m_sharedBudget)
+    {
+        auto error = m_sharedBudget->GetError();
+        if (error)
+            std::rethrow_exception(error);
+
+        // The other interpreters may also run until their next checkpoint
+        auto total = m_sharedBudget->Charge(executed - m_chargedOpCount);
+        m_chargedOpCount = executed;
+        if (m_budget.maxInstructions > 0)
+        {
+            if (total >= m_budget.maxInstructions)
+                ExceedBudget("instruction limit of " + std::to_string(m_budget.maxInstructions));
+            interval = std::min<uint64_t>(interval,
+                (m_budget.maxInstructions - total) / (m_longestFunction * m_sharedBudget->GetThreadCount()) + 1);
+        }
+        startTime = m_sharedBudget->GetStartTime();
+    }
+    else if (m_budget.maxInstructions > 0)
+    {
+        if (executed >= m_budget.maxInstructions)
+            ExceedBudget("instruction limit of " + std::to_string(m_budget.maxInstructions));
+
+        // Up to a function's worth of instructions may run between two checkpoints,
+        // so check more often as the limit comes closer
+        interval = std::min(interval, (m_budget.maxInstructions - executed) / m_longestFunction + 1);
+    }
+
+    if (m_stepLimit != UINT64_MAX)
+    {
+        // Yield after the current instruction, which leaves the state consistent
+        if (executed >= m_stepLimit)
+        {
+            m_yielding = true;
+            m_shouldHalt = true;
+        }
+        else
+        {
+            interval = std::min(interval, (m_stepLimit - executed) / m_longestFunction + 1);
+        }
+    }
+
+    if (m_budget.timeLimit.count() > 0 && std::chrono::steady_clock::now() - startTime >= m_budget.timeLimit)
+        ExceedBudget("time limit of " + std::to_string(m_budget.timeLimit.count()) + " ms");
+
+    m_checkpointCountdown = static_cast<uint32_t>(interval);
+}
+
+void Interpreter::SetForkJoinPool(ForkJoinPool* pool, size_t baseDepth)
+{
+    m_forkPool = pool;
+    m_forkDepthCutoff = pool->GetDepthCutoff();
+    m_forkBaseDepth = baseDepth;
+}
+
+void Interpreter::SetCall(short functionIndex, std::vector<PObject> parameters)
+{
+    if (parameters.size() != static_cast<size_t>(m_program.GetFunction(functionIndex).GetParameterCount()))
+        throw InterpreterException("Wrong number of parameters for the call.");
+    m_call.reset(new EntryCall(functionIndex, std::move(parameters)));
+}
+
+PObject Interpreter::GetCallResult() const
+{
+    if (!m_call)
+        throw InterpreterException("The interpreter is not in call mode.");
+    return m_call->result;
+}
+
+bool Interpreter::TryFork(StackFrame& frame, short functionIndex)
+{
+    auto depth = m_forkBaseDepth + m_stack.size() + 1;
+    if (depth > m_forkDepthCutoff)
+        return false;
+
+    // Do not start new work if the budget is exhausted or another part of the program has failed
+    CheckBudget();
+
+    if (m_forkPool == nullptr)
+    {
+        m_ownForkPool.reset(new ForkJoinPool(m_sharedProgram, m_parallelWorkers, m_forkDepthCutoff));
+        m_forkPool = m_ownForkPool.get();
+        if (m_forkPool->GetWorkerCount() == 1)
+        {
+            // A single thread would only add overhead
+            m_forkDepthCutoff = 0;
+            return false;
+        }
+    }
+
+    // Since parameters are evaluated left to right, they are in reverse order on the stack
+    std::vector<PObject> parameters(m_program.GetFunction(functionIndex).GetParameterCount(), PObject(PrimitiveType::Void, 0));
+    for (auto i = parameters.size(); i > 0; i--)
+        parameters[i - 1] = PopTop(frame.functionStack);
+
+    auto sharedBudget = ShareBudget();
+    m_forks.push_back({ m_stack.size(), m_forkPool->Fork(functionIndex, std::move(parameters), depth, GetChildBudget(), sharedBudget) });
+    return true;
+}
+
+bool Interpreter::TryJoin()
+{
+    auto& call = *m_forks.back().call;
+    if (!call.IsFinished())
+    {
+        // A forked call must not block a worker of the pool, since the calls it waits for may be queued behind it
+        if (m_ownForkPool == nullptr)
+            return false;
+        call.Wait();
+    }
+
+    auto& forked = call.GetInterpreter();
+    auto& forkedCounts = forked.GetOpCounts();
+    for (size_t i = 0; i < m_opCounts.size(); i++)
+        m_opCounts[i] += forkedCounts[i];
+    // The forked call has charged its instructions to the shared budget itself
+    m_chargedOpCount += forked.GetExecutedOpCount();
+    m_peakFrameDepth = std::max(m_peakFrameDepth, m_stack.size() + forked.GetPeakFrameDepth());
+    if (call.GetError())
+        std::rethrow_exception(call.GetError());
+
+    // The result of the forked call goes below the result of the call after it
+    auto& stack = m_stack.back().functionStack;
+    auto second = PopTop(stack);
+    stack.push(forked.GetCallResult());
+    stack.push(second);
+    m_forks.pop_back();
+    return true;
+}
+
+std::shared_ptr<SharedBudget> Interpreter::ShareBudget()
+{
+    // The instructions executed so far are charged at the next checkpoint
+    if (!m_sharedBudget)
+    {
+        auto threadCount = m_parallelWorkers > 0 ? m_parallelWorkers : std::max(std::thread::hardware_concurrency(), 1u);
+        m_sharedBudget = std::make_shared<SharedBudget>(m_startTime, threadCount);
+    }
+    return m_sharedBudget;
+}
+
+ExecutionBudget Interpreter::GetChildBudget() const
+{
+    // The instruction and time limits apply to the shared budget, so only the call depth is reduced
+    ExecutionBudget budget = m_budget;
+    if (m_budget.maxCallDepth > 0)
+        budget.maxCallDepth = std::max<size_t>(m_budget.maxCallDepth - std::min(m_budget.maxCallDepth, m_stack.size()), 1);
+    return budget;
+}
+
+void Interpreter::SetRange(short functionIndex, int64_t from, int64_t to)
+{
+    auto& function = m_program.GetFunction(functionIndex);
+    if (function.GetParameterCount() != 1 || function.GetLocalTypes()[0] != PrimitiveType::Int)
+        throw InterpreterException("The range function must take one Int parameter.");
+
+    auto initial = function.GetReturnType() == PrimitiveType::Real ? ObjectFromReal(0.0) : ObjectFromInt(0);
+    m_range.reset(new RangeCall(functionIndex, from, to, initial));
+}
+
+PObject Interpreter::GetRangeResult() const
+{
+    if (!m_range)
+        throw InterpreterException("The interpreter is not in range mode.");
+    return m_range->result;
+}
+
+bool Interpreter::ContinueRange(StackFrame& frame)
+{
+    auto& value = frame.functionStack.top();
+    if (value.GetType() == PrimitiveType::Bool)
+    {
+        if (value.GetBoolValue())
+            m_range->result = ObjectFromInt(m_range->result.GetIntValue() + 1);
+    }
+    else
+    {
+        m_range->result = InternalFunc::CallBinaryFunction(InternalFunction::Plus, m_range->result, value);
+    }
+
+    if (++m_range->next >= m_range->to)
+        return false;
+
+    // Replace the frame with a fresh one, which invalidates the reference
+    auto& function = frame.function;
+    m_stack.pop_back();
+    m_stack.push_back(PrepareFrameForFunction(function));
+    m_stack.back().locals[0] = ObjectFromInt(m_range->next);
+    if (m_profiler)
+    {
+        m_profiler->LeaveFunction();
+        m_profiler->EnterFunction(function.GetFunctionIndex());
+    }
+    PEISIK_PROBE4(function__entry, function.GetFunctionIndex(), -1, 0, 1);
+
+    // Every call is a checkpoint, so this is one too
+    if (--m_checkpointCountdown == 0)
+        CheckBudget();
+    return true;
+}
+
+void Interpreter::CollectGarbage()
+{
+    // The arrays are only referenced from the locals and operand stacks
+    for (auto& frame : m_stack)
+    {
+        for (auto& local : frame.locals)
+            m_heap.Mark(local);
+        for (auto& operand : GetContainer(frame.functionStack))
+            m_heap.Mark(operand);
+    }
+    m_heap.Sweep();
+}
+
+void Interpreter::ExceedBudget(const std::string& reason)
+{
+    auto& frame = m_stack.back();
+    auto startTime = m_sharedBudget ? m_sharedBudget->GetStartTime() : m_startTime;
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime);
+    auto executed = m_sharedBudget ? m_sharedBudget->GetExecutedCount() : GetExecutedOpCount();
+
+    std::string message = "Execution budget exceeded: " + reason
+        + " reached in function " + std::to_string(frame.function.GetFunctionIndex())
+        + ", instruction " + std::to_string(GetCurrentInstruction(frame))
+        + " (" + std::to_string(executed) + " instructions executed, call depth "
+        + std::to_string(m_stack.size()) + ", " + std::to_string(elapsed.count()) + " s elapsed).";
+    throw BudgetExceededException(message.c_str());
+}
+
+void Interpreter::SetSampling(int frequency)
+{
+    if (frequency > 0)
+        m_sampler.reset(new SamplingProfiler(frequency));
+    else
+        m_sampler.reset();
+    UpdateInstrumented();
+}
+
+void Interpreter::SetProfileRecording(bool value)
+{
+    if (value)
+        m_recorder.reset(new ProfileRecorder(m_program));
+    else
+        m_recorder.reset();
+    UpdateInstrumented();
+}
+
+void Interpreter::WriteRecordedProfile(std::ostream& stream) const
+{
+    if (m_recorder)
+        m_recorder->Write(stream);
+}
+
+void Interpreter::RecordProfile(const StackFrame& frame, uint32_t instructionStart, Opcode op)
+{
+    // The parameters of an internal call are the topmost operands, the first one deepest
+    uint32_t typeSignature = 0;
+    if (op > Opcode::CallI0 && op <= Opcode::CallI7)
+    {
+        auto& container = GetContainer(frame.functionStack);
+        auto parameterCount = static_cast<int>(op) - static_cast<int>(Opcode::CallI0);
+        typeSignature = ProfileRecorder::GetTypeSignature(container.end() - parameterCount, container.end());
+    }
+
+    m_recorder->CountInstruction(frame.function.GetFunctionIndex(), instructionStart, frame.codeSize,
+        frame.programCounter, op, typeSignature);
+}
+
+void Interpreter::SetBinaryTrace(const std::string& path, uint32_t capacity)
+{
+    if (capacity > 0)
+        m_binaryTrace.reset(new TraceBuffer(path, capacity));
+    else
+        m_binaryTrace.reset();
+    UpdateInstrumented();
+}
+
+uint64_t Interpreter::GetSampleCount() const
+{
+    return m_sampler ? m_sampler->GetSampleCount() : 0;
+}
+
+void Interpreter::WriteSamples(std::ostream& foldedStacks, std::ostream& instructionHotness) const
+{
+    if (m_sampler)
+    {
+        m_sampler->WriteFoldedStacks(foldedStacks);
+        m_sampler->WriteInstructionHotness(instructionHotness, m_program);
+    }
+}
+
+void Interpreter::TakeSample()
+{
+    // Every frame, including the innermost one, has already advanced past its current instruction
+    auto depth = m_stack.size();
+    size_t first = depth > SamplingProfiler::MaxSampleDepth ? depth - SamplingProfiler::MaxSampleDepth : 0;
+
+    m_sampler->BeginSample(first > 0);
+    for (auto i = first; i < depth; i++)
+    {
+        auto& frame = m_stack[i];
+        m_sampler->AddFrame(frame.function.GetFunctionIndex(), GetCurrentInstruction(frame));
+    }
+    m_sampler->EndSample();
+}
+
+uint32_t Interpreter::GetCurrentInstruction(const StackFrame& frame) const
+{
+    // The program counter has already advanced past the current instruction
+    return frame.function.GetInstructionIndex(frame.programCounter) - 1;
+}
+
+uint32_t Interpreter::GetInstructionStart(const StackFrame& frame) const
+{
+    if (frame.compactCode == nullptr)
+        return frame.programCounter > 0 ? frame.programCounter - 1 : 0;
+
+    // The last instruction that starts before the program counter
+    uint32_t start = 0;
+    uint32_t offset = 0;
+    while (offset < frame.programCounter)
+    {
+        start = offset;
+        DecodeExecutableOp(frame.compactCode, offset);
+    }
+    return start;
+}
+
+bool Interpreter::IsFollowedByReturn(const StackFrame& frame) const
+{
+    if (frame.programCounter >= frame.codeSize)
+        return false;
+    if (frame.compactCode != nullptr)
+        return frame.compactCode[frame.programCounter] == static_cast<uint8_t>(Opcode::Return);
+    return frame.bytecode[frame.programCounter].op == Opcode::Return;
+}
+
+void Interpreter::UpdateInstrumented()
+{
+    m_instrumented = m_trace || m_profiler || m_sampler || m_recorder || m_binaryTrace;
+}
+
+void Interpreter::PrintProfile() const
+{
+    if (m_profiler)
+        m_profiler->PrintReport(m_program.GetMainFunctionIndex());
 }
 
 Interpreter::StackFrame Interpreter::PrepareFrameForFunction(const Function & func) const
 {
     auto frame = StackFrame(func);
-    
+    frame.bytecode = func.GetExecutableBytecode();
+    frame.compactCode = func.GetExecutableCompactCode();
+    if (frame.compactCode == nullptr)
+    {
+        frame.codeSize = static_cast<uint32_t>(func.GetBytecode().size());
+    }
+    else
+    {
+        // Excluding the padding byte
+        frame.codeSize = static_cast<uint32_t>(func.GetCompactCode().size() - 1);
+    }
+
     // Initialize locals
     auto& localTypes = func.GetLocalTypes();
     frame.locals.reserve(localTypes.size());
@@ -296,14 +875,93 @@ Interpreter::StackFrame Interpreter::PrepareFrameForFunction(const Function & fu
     return frame;
 }
 
+void Interpreter::WriteSnapshot(std::ostream& stream) const
+{
+    if (!m_started || m_finished)
+        throw InterpreterException("Only a running program can be snapshotted.");
+    if (m_range || m_call)
+        throw InterpreterException("Parallel and forked calls cannot be snapshotted.");
+    // The forked calls run on other threads, and their state is not ours to write
+    if (!m_forks.empty())
+        throw InterpreterException("A program cannot be snapshotted while forked calls are running.");
+
+    InterpreterSnapshot snapshot;
+    snapshot.programHash = m_program.GetIdentityHash();
+    snapshot.opCounts = m_opCounts;
+    snapshot.peakFrameDepth = m_peakFrameDepth;
+    for (auto& frame : m_stack)
+    {
+        SnapshotFrame saved;
+        saved.functionIndex = frame.function.GetFunctionIndex();
+        saved.programCounter = frame.programCounter;
+        saved.locals.assign(frame.locals.begin(), frame.locals.end());
+        auto& operands = GetContainer(frame.functionStack);
+        saved.operands.assign(operands.begin(), operands.end());
+        snapshot.frames.push_back(std::move(saved));
+    }
+    SerializeSnapshot(stream, snapshot);
+}
+
+void Interpreter::RestoreSnapshot(std::istream& stream)
+{
+    if (m_started || m_range || m_call)
+        throw InterpreterException("A snapshot can only be restored before the program has started.");
+
+    auto snapshot = DeserializeSnapshot(stream, m_program.GetIdentityHash(), m_heap);
+    if (snapshot.opCounts.size() != m_opCounts.size() || snapshot.frames.empty())
+        throw InterpreterException("Invalid snapshot.");
+
+    for (auto& saved : snapshot.frames)
+    {
+        if (saved.functionIndex < 0 || saved.functionIndex >= m_program.GetFunctionCount())
+            throw InterpreterException("Invalid function index in the snapshot.");
+        auto frame = PrepareFrameForFunction(m_program.GetFunction(saved.functionIndex));
+        if (!IsInstructionStart(frame.compactCode, frame.codeSize, saved.programCounter))
+            throw InterpreterException("Invalid program counter in the snapshot.");
+
+        // The locals keep their declared types, which the instructions rely on
+        if (saved.locals.size() != frame.locals.size())
+            throw InterpreterException("Invalid locals in the snapshot.");
+        for (size_t i = 0; i < saved.locals.size(); i++)
+        {
+            if (saved.locals[i].GetType() != frame.locals[i].GetType())
+                throw InterpreterException("Invalid locals in the snapshot.");
+            frame.locals[i] = saved.locals[i];
+        }
+        for (auto& operand : saved.operands)
+            frame.functionStack.push(operand);
+        frame.programCounter = saved.programCounter;
+
+        // The memoizer has not seen the call, so the result of a memoized frame is not stored
+        m_stack.push_back(frame);
+        if (m_profiler)
+            m_profiler->EnterFunction(saved.functionIndex);
+    }
+
+    m_opCounts = snapshot.opCounts;
+    m_peakFrameDepth = std::max(static_cast<size_t>(snapshot.peakFrameDepth), m_stack.size());
+    m_started = true;
+    m_startTime = std::chrono::steady_clock::now();
+    if (m_sampler)
+        m_sampler->Start();
+}
+
+uint64_t Interpreter::GetExecutedOpCount() const
+{
+    uint64_t total = 0;
+    for (auto count : m_opCounts)
+        total += count;
+    return total;
+}
+
 void Interpreter::PrintOpCount() const
 {
     struct OpHits
     {
-        int hits;
+        uint64_t hits;
         Opcode op;
 
-        OpHits(Opcode o, int h) : hits(h), op(o) { };
+        OpHits(Opcode o, uint64_t h) : hits(h), op(o) { };
     };
 
     // Sort the ops by their hit count
@@ -324,11 +982,23 @@ void Interpreter::PrintOpCount() const
     std::cout << "-- Executed opcode count: " << total << std::endl;
     for (auto oh : sortedOps)
     {
-        std::cout << std::left << std::setw(12) << OpcodeToString(oh.op) << oh.hits << std::endl;
+        std::cout << std::left << std::setw(22) << OpcodeToString(oh.op) << oh.hits << std::endl;
     }
+
+    if (m_memoizer)
+        m_memoizer->PrintStatistics();
+}
+
+void Interpreter::PrintMemoryStatistics() const
+{
+    std::cout << "-- Memory usage" << std::endl;
+    MemoryStatistics::PrintReport(std::cout);
+    std::cout << "     " << std::left << std::setw(18) << "Peak frame depth" << m_peakFrameDepth << std::endl;
+    std::cout << "     " << std::left << std::setw(18) << "Array collections" << m_heap.GetCollectionCount() << std::endl;
 }
 
-static PObject PopTop(std::stack<PObject>& stack)
+template <typename Stack>
+static PObject PopTop(Stack& stack)
 {
     // The Poptop hums beautifully to confuse its prey.
     auto object = stack.top();
@@ -337,48 +1007,65 @@ static PObject PopTop(std::stack<PObject>& stack)
     return object;
 }
 
-static void PrintObject(const PObject& object)
+template <typename Stack>
+static const typename Stack::container_type& GetContainer(const Stack& stack)
+{
+    // The container is a protected member of the standard stack
+    struct Access : Stack
+    {
+        static const typename Stack::container_type& Get(const Stack& stack)
+        {
+            return stack.*&Access::c;
+        }
+    };
+    return Access::Get(stack);
+}
+
+static void PrintObject(const PObject& object, std::ostream& output)
 {
     switch (object.GetType())
     {
     case PrimitiveType::Bool:
         if (object.GetBoolValue())
-            std::cout << "true";
+            output << "true";
         else
-            std::cout << "false";
+            output << "false";
         break;
     case PrimitiveType::Int:
-        std::cout << object.GetIntValue();
+        output << object.GetIntValue();
         break;
     case PrimitiveType::Real:
-        std::cout << object.GetRealValue();
+        output << object.GetRealValue();
         break;
+    case PrimitiveType::IntArray:
+    case PrimitiveType::RealArray:
+    {
+        auto& array = GetArray(object);
+        output << "[";
+        for (size_t i = 0; i < array.GetLength(); i++)
+        {
+            if (i > 0)
+                output << " ";
+            PrintObject(array.GetElement(static_cast<int64_t>(i)), output);
+        }
+        output << "]";
+        break;
+    }
     default:
         throw std::invalid_argument("Unimplemented type in PrintObject().");
     }
 }
 
-static std::string OpcodeToString(const Opcode op)
+static bool IsInstructionStart(const uint8_t* compactCode, uint32_t codeSize, uint32_t programCounter)
 {
-    switch (op)
-    {
-    case Opcode::Call: return "Call";
-    case Opcode::CallI0: return "CallI0";
-    case Opcode::CallI1: return "CallI1";
-    case Opcode::CallI2: return "CallI2";
-    case Opcode::CallI3: return "CallI3";
-    case Opcode::CallI4: return "CallI4";
-    case Opcode::CallI5: return "CallI5";
-    case Opcode::CallI6: return "CallI6";
-    case Opcode::CallI7: return "CallI7";
-    case Opcode::Jump: return "Jump";
-    case Opcode::JumpFalse: return "JumpFalse";
-    case Opcode::PopDiscard: return "PopDiscard";
-    case Opcode::PopLocal: return "PopLocal";
-    case Opcode::PushConst: return "PushConst";
-    case Opcode::PushLocal: return "PushLocal";
-    case Opcode::Return: return "Return";
-    default:
-        return "????";
-    }
-}
\ No newline at end of file
+    if (programCounter >= codeSize)
+        return false;
+    if (compactCode == nullptr)
+        return true;
+
+    // The compact instructions vary in length, so walk them from the start
+    uint32_t offset = 0;
+    while (offset < programCounter)
+        DecodeExecutableOp(compactCode, offset);
+    return offset == programCounter;
+}
@@ -1,54 +1,402 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <stack>
+#include "ArrayHeap.h"
+#include "InternalFunctions.h"
+#include "Memoizer.h"
+#include "MemoryStatistics.h"
+#include "Profiler.h"
+#include "ProfileRecorder.h"
 #include "Program.h"
+#include "SamplingProfiler.h"
+#include "TraceBuffer.h"
 
 namespace Peisik
 {
+    class ForkedCall;
+    class ForkJoinPool;
+    class ParallelReducer;
+
+    // Limits on the execution of a program. Zero means unlimited.
+    struct ExecutionBudget
+    {
+        ExecutionBudget()
+            : maxInstructions(0), maxCallDepth(0), timeLimit(0)
+        {
+        }
+
+        uint64_t maxInstructions;
+        size_t maxCallDepth;
+        std::chrono::milliseconds timeLimit;
+    };
+
+    // The budget of a program that runs on several interpreters at once, the chunks of parallel calls and forked calls.
+    // Each interpreter adds the instructions it has executed to the common count at its checkpoints,
+    // so the instruction limit applies to the total, and the time limit is measured from the start of the program.
+    // The first error in any of the interpreters stops the others at their next checkpoint.
+    class SharedBudget
+    {
+    public:
+        SharedBudget(std::chrono::steady_clock::time_point startTime, unsigned threadCount)
+            : m_startTime(startTime), m_threadCount(threadCount), m_executed(0), m_stopped(false)
+        {
+        }
+
+        // Adds the instructions to the count and returns the new total.
+        uint64_t Charge(uint64_t instructions)
+        {
+            return m_executed.fetch_add(instructions, std::memory_order_relaxed) + instructions;
+        }
+
+        // Gets the instructions counted so far.
+        uint64_t GetExecutedCount() const
+        {
+            return m_executed.load(std::memory_order_relaxed);
+        }
+
+        std::chrono::steady_clock::time_point GetStartTime() const
+        {
+            return m_startTime;
+        }
+
+        // Gets the number of threads that may run the interpreters at the same time.
+        unsigned GetThreadCount() const
+        {
+            return m_threadCount;
+        }
+
+        // Records the error that stops the program, unless an earlier one has already been recorded.
+        void Stop(std::exception_ptr error)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stopped.load(std::memory_order_relaxed))
+                return;
+            m_error = error;
+            m_stopped.store(true, std::memory_order_release);
+        }
+
+        // Gets the first error if the program has been stopped, or null.
+        std::exception_ptr GetError() const
+        {
+            return m_stopped.load(std::memory_order_acquire) ? m_error : nullptr;
+        }
+
+    private:
+        std::chrono::steady_clock::time_point m_startTime;
+        unsigned m_threadCount;
+        std::atomic<uint64_t> m_executed;
+        std::atomic<bool> m_stopped;
+        std::mutex m_mutex;
+        std::exception_ptr m_error;
+    };
+
+    // The result of Interpreter::Step.
+    enum class ExecutionStatus
+    {
+        // The instruction limit of the step was reached, and the next step continues the program.
+        Yielded,
+        // The main function returned.
+        Finished,
+        // The program was terminated by a FailFast call.
+        Failed
+    };
+
     class Interpreter
     {
     public:
         Interpreter(Program program);
-        ~Interpreter() = default;
+        // Creates an interpreter for a program that may be shared with other interpreters.
+        Interpreter(std::shared_ptr<const Program> program);
+        ~Interpreter();
 
-        // Runs the program.
+        // Runs the program to completion, or the rest of it if Step() has been called.
         void Execute();
 
+        // Runs about the specified number of instructions of the program, or until it ends if zero.
+        // All the state is kept in the interpreter, so the program can be continued with another call,
+        // possibly on a different thread. The step yields at backward jumps and calls, so it may run
+        // over the limit by up to the length of the longest function. Once the program has ended,
+        // further calls return the final status.
+        // If the budget is exceeded or an error occurs, an exception is thrown and the program
+        // cannot be continued.
+        ExecutionStatus Step(uint64_t maxInstructions);
+
+        // Writes the state of the running program, see Snapshot.h: the call frames with their locals
+        // and operand stacks, the arrays they reference and the instruction counts. Only valid between
+        // steps, and not while forked calls are running or in range or call mode, which throws an
+        // InterpreterException. The memoized results and profiles are not included.
+        void WriteSnapshot(std::ostream& stream) const;
+
+        // Continues the program from a snapshot written by WriteSnapshot() instead of starting it.
+        // The program must have been loaded with the same options, which is checked with its identity hash.
+        // The instruction counts continue from the snapshot, but the time limit starts again.
+        // Must be called after the other settings and before Execute().
+        void RestoreSnapshot(std::istream& stream);
+
         // Prints an instruction count report
         void PrintOpCount() const;
 
-        // Controls whether to output each instruction to the standard output.
+        // Gets the total number of instructions executed so far.
+        uint64_t GetExecutedOpCount() const;
+
+        // Gets the number of instructions executed so far, indexed by opcode.
+        const std::vector<uint64_t>& GetOpCounts() const
+        {
+            return m_opCounts;
+        }
+
+        // Gets the deepest call stack reached so far.
+        size_t GetPeakFrameDepth() const
+        {
+            return m_peakFrameDepth;
+        }
+
+        // Prints the memory counted by MemoryStatistics and the peak call stack depth.
+        // The memory counters are process-wide and must have been enabled before loading the program.
+        void PrintMemoryStatistics() const;
+
+        // Returns true if the program was terminated by a FailFast call.
+        bool HasFailed() const
+        {
+            return m_failed;
+        }
+
+        // Controls whether to cache the results of pure functions with Int parameters.
+        // Must be set before calling Execute().
+        void SetMemoization(bool value);
+
+        // Prints the per-function profile. Profiling must have been enabled before execution.
+        void PrintProfile() const;
+
+        // Controls whether to collect per-function statistics.
+        // Must be set before calling Execute().
+        void SetProfiling(bool value);
+
+        // Sets the limits for the execution. If a limit is exceeded, Execute() throws a BudgetExceededException.
+        // Must be set before calling Execute().
+        void SetBudget(const ExecutionBudget& budget);
+
+        // Makes the interpreter charge its instructions to the budget of a program that it runs a part of,
+        // and stop when another part has failed. The limits are still set with SetBudget().
+        // This is how ParallelReducer and ForkJoinPool run their parts. Must be set before calling Execute().
+        void SetSharedBudget(std::shared_ptr<SharedBudget> budget)
+        {
+            m_sharedBudget = budget;
+        }
+
+        // Sets the number of worker threads for the parallel calls, one per hardware thread if zero.
+        // With one worker the parallel calls run on the calling thread.
+        // Must be set before calling Execute().
+        void SetParallelism(unsigned workerCount)
+        {
+            m_parallelWorkers = workerCount;
+        }
+
+        // Runs the calls marked with CallFork concurrently in call frames up to the depth, or not at all if zero.
+        // The calls are run on a pool of SetParallelism() threads, see ForkJoinPool.
+        // Must be set before calling Execute().
+        void SetForkJoin(size_t depthCutoff)
+        {
+            m_forkDepthCutoff = depthCutoff;
+        }
+
+        // Makes the interpreter run a forked call of the pool. Its call frames are counted from the base depth.
+        void SetForkJoinPool(ForkJoinPool* pool, size_t baseDepth);
+
+        // Calls the function with the parameters instead of running the main function.
+        // This is how ForkJoinPool runs a forked call. Must be set before calling Execute().
+        void SetCall(short functionIndex, std::vector<PObject> parameters);
+
+        // Gets the result of the call once it has returned.
+        PObject GetCallResult() const;
+
+        // Runs the function with each integer of [from, to) in turn instead of running the main function.
+        // This is how ParallelReducer runs a chunk of a parallel call. The function must take one Int parameter.
+        // Must be set before calling Execute().
+        void SetRange(short functionIndex, int64_t from, int64_t to);
+
+        // Gets the sum of the results of the range function so far, or the number of true results
+        // for a Bool function.
+        PObject GetRangeResult() const;
+
+        // Enables sampling of the call stack at the specified frequency, or disables it if zero.
+        // Must be set before calling Execute().
+        void SetSampling(int frequency);
+
+        // Gets the number of call stack samples taken.
+        uint64_t GetSampleCount() const;
+
+        // Writes the call stack samples as folded stacks and as an annotated instruction listing.
+        void WriteSamples(std::ostream& foldedStacks, std::ostream& instructionHotness) const;
+
+        // Controls whether to record the call, branch and operand type profile for the compiler.
+        // Must be set before calling Execute().
+        void SetProfileRecording(bool value);
+
+        // Writes the recorded profile, see ProfileRecorder. Recording must have been enabled before execution.
+        void WriteRecordedProfile(std::ostream& stream) const;
+
+        // Enables recording each executed instruction into a binary ring buffer of the specified capacity.
+        // If the path is not empty, the buffer is a memory-mapped trace file. Zero capacity disables the trace.
+        // Must be set before calling Execute().
+        void SetBinaryTrace(const std::string& path, uint32_t capacity);
+
+        // Gets the binary trace buffer, or null if the binary trace is not enabled.
+        const TraceBuffer* GetBinaryTrace() const
+        {
+            return m_binaryTrace.get();
+        }
+
+        // Controls whether to output each instruction to the program output.
         void SetTrace(bool value)
         {
             m_trace = value;
+            UpdateInstrumented();
+        }
+
+        // Sets the stream for the output of the program, the standard output by default.
+        // The stream must outlive the execution.
+        void SetOutput(std::ostream& output)
+        {
+            m_output = &output;
         }
 
     private:
         bool m_trace;
+        // True if any per-instruction instrumentation is enabled
+        bool m_instrumented;
+        std::ostream* m_output;
 
-        std::vector<int> m_opCounts;
-        Program m_program;
+        std::vector<uint64_t> m_opCounts;
+        std::unique_ptr<Memoizer> m_memoizer;
+        std::unique_ptr<Profiler> m_profiler;
+        std::unique_ptr<SamplingProfiler> m_sampler;
+        std::unique_ptr<ProfileRecorder> m_recorder;
+        std::unique_ptr<TraceBuffer> m_binaryTrace;
+        std::unique_ptr<ParallelReducer> m_parallel;
+        unsigned m_parallelWorkers;
+        // The pool for forked calls, owned by the interpreter running the main function
+        std::unique_ptr<ForkJoinPool> m_ownForkPool;
+        ForkJoinPool* m_forkPool;
+        size_t m_forkDepthCutoff;
+        size_t m_forkBaseDepth;
+        std::shared_ptr<const Program> m_sharedProgram;
+        const Program& m_program;
         bool m_shouldHalt;
+        bool m_failed;
+        bool m_started;
+        bool m_finished;
+        // True if the main loop is stopping because the step limit was reached
+        bool m_yielding;
+        // The executed instruction count at which the current step yields
+        uint64_t m_stepLimit;
+
+        // The instruction and time budgets are only checked every m_checkpointCountdown
+        // backward jumps and calls, the call depth on every call
+        ExecutionBudget m_budget;
+        size_t m_callDepthLimit;
+        size_t m_longestFunction;
+        uint32_t m_checkpointCountdown;
+        std::chrono::steady_clock::time_point m_startTime;
+        // Set once the program has more than one interpreter, see SharedBudget
+        std::shared_ptr<SharedBudget> m_sharedBudget;
+        // The executed instructions already added to the shared budget
+        uint64_t m_chargedOpCount;
 
         class StackFrame
         {
         public:
             StackFrame(const Function& func)
-                : function(func), programCounter(0)
+                : function(func), bytecode(nullptr), compactCode(nullptr), codeSize(0), programCounter(0), memoized(false)
             {
             };
 
             const Function& function;
-            std::stack<PObject> functionStack;
-            std::vector<PObject> locals;
+            // The executable wide bytecode of the function, or null if the compact code is run
+            const BytecodeOp* bytecode;
+            // The executable compact code of the function, or null if the wide bytecode is run
+            const uint8_t* compactCode;
+            // The size of the executed code, in bytes for compact code and in instructions otherwise
+            uint32_t codeSize;
+            std::stack<PObject, std::deque<PObject, CountingAllocator<PObject, MemoryCategory::OperandStack>>> functionStack;
+            std::vector<PObject, CountingAllocator<PObject, MemoryCategory::Frames>> locals;
             uint32_t programCounter;
+            // True if the return value should be stored in the memoizer
+            bool memoized;
         };
-        std::stack<StackFrame> m_stack;
+        // The call stack, innermost frame at the back
+        std::deque<StackFrame, CountingAllocator<StackFrame, MemoryCategory::Frames>> m_stack;
+        // The deepest the call stack has been
+        size_t m_peakFrameDepth;
         // Cached stack for internal call parameters
-        std::stack<PObject> m_iCallParams;
+        ParameterStack m_iCallParams;
+        // The arrays created by the program
+        ArrayHeap m_heap;
+
+        // The state of the range mode, see SetRange
+        struct RangeCall
+        {
+            RangeCall(short function, int64_t from, int64_t end, PObject initial)
+                : functionIndex(function), next(from), to(end), result(initial)
+            {
+            }
+
+            short functionIndex;
+            // The parameter of the current call
+            int64_t next;
+            int64_t to;
+            PObject result;
+        };
+        std::unique_ptr<RangeCall> m_range;
+
+        // The state of the call mode, see SetCall
+        struct EntryCall
+        {
+            EntryCall(short function, std::vector<PObject> callParameters)
+                : functionIndex(function), parameters(std::move(callParameters)), result(PrimitiveType::Void, 0)
+            {
+            }
+
+            short functionIndex;
+            std::vector<PObject> parameters;
+            PObject result;
+        };
+        std::unique_ptr<EntryCall> m_call;
+
+        // The calls forked by CallFork that have not been joined, innermost last
+        struct PendingFork
+        {
+            // The number of frames when the call was forked, and so when it is joined
+            size_t stackDepth;
+            std::shared_ptr<ForkedCall> call;
+        };
+        std::vector<PendingFork> m_forks;
+        // True if the step yielded because the innermost forked call had not ended
+        bool m_joinPending;
 
-        PObject DispatchInternalCall(const InternalFunction funcIndex, std::stack<PObject>& params);
+        ExecutionStatus RunStep(uint64_t maxInstructions);
+        PObject DispatchInternalCall(const InternalFunction funcIndex, ParameterStack& params);
         StackFrame PrepareFrameForFunction(const Function& func) const;
+        void CheckBudget();
+        bool ContinueRange(StackFrame& frame);
+        bool TryFork(StackFrame& frame, short functionIndex);
+        bool TryJoin();
+        std::shared_ptr<SharedBudget> ShareBudget();
+        ExecutionBudget GetChildBudget() const;
+        void CollectGarbage();
+        void RecordProfile(const StackFrame& frame, uint32_t instructionStart, Opcode op);
+        void ExceedBudget(const std::string& reason);
+        uint32_t GetCurrentInstruction(const StackFrame& frame) const;
+        uint32_t GetInstructionStart(const StackFrame& frame) const;
+        bool IsFollowedByReturn(const StackFrame& frame) const;
+        void TakeSample();
+        void UpdateInstrumented();
     };
 }
@@ -1,7 +1,21 @@
 #include "pch.h"
+#include "BlockLayout.h"
+#include "CodeLayout.h"
+#include "CompactBytecode.h"
+#include "ForkJoin.h"
+#include "Inliner.h"
 #include "Interpreter.h"
+#include "MemoryStatistics.h"
 #include "PeisikException.h"
+#include "Peephole.h"
+#include "PerfCounters.h"
 #include "Program.h"
+#include "ProgramCache.h"
+#include "Scheduler.h"
+#include "Server.h"
+#include "SsaOptimizer.h"
+#include <csignal>
+#include <cstdio>
 
 void DumpModuleInfo(const Peisik::Program& program, const std::string& moduleName)
 {
@@ -19,17 +33,108 @@ void DumpModuleInfo(const Peisik::Program& program, const std::string& moduleNam
     std::cout << "   Total code size: " << totalCodeSize << std::endl;
 }
 
+// Returns the module name with the .cpeisik extension added, unless it already has an extension.
+std::string AddModuleExtension(const std::string& moduleName)
+{
+    if (moduleName.find('.') == std::string::npos)
+        return moduleName + ".cpeisik";
+    return moduleName;
+}
+
+// Prints the exception of a failed module and returns the exit code.
+int ReportError(std::exception_ptr error)
+{
+    try
+    {
+        std::rethrow_exception(error);
+    }
+    catch (Peisik::ApplicationException& e)
+    {
+        // Application exceptions arise because of user code bugs
+
+        std::cout << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+    catch (std::exception& e)
+    {
+        // The rest are because of invalid programs, failed invariants or other interpreter bugs.
+
+        std::cout << "Interpreter error: " << e.what() << std::endl;
+#if DEBUG
+        throw;
+#else
+        return -1;
+#endif
+    }
+}
+
+// Set by the signal handler: 1 to write a snapshot and continue, 2 to write one and exit
+static volatile std::sig_atomic_t s_snapshotRequest = 0;
+
+extern "C" void RequestSnapshot(int signal)
+{
+    s_snapshotRequest = (signal == SIGTERM) ? 2 : 1;
+}
+
+// Writes the snapshot through a temporary file, so that a failed write does not destroy the previous snapshot.
+void WriteSnapshotFile(const Peisik::Interpreter& interpreter, const std::string& path)
+{
+    auto temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ofstream::binary);
+        interpreter.WriteSnapshot(file);
+        if (!file.flush())
+            throw std::runtime_error("Could not write " + temporaryPath + ".");
+    }
+#ifdef _WIN32
+    // Unlike POSIX, Windows does not replace the target
+    std::remove(path.c_str());
+#endif
+    if (std::rename(temporaryPath.c_str(), path.c_str()) != 0)
+        throw std::runtime_error("Could not replace " + path + ".");
+}
+
 void PrintHelp()
 {
     std::cout << "The Peisik interpreter" << std::endl;
     std::cout << "Usage: peisik [modules] [parameters]" << std::endl;
     std::cout << "Possible parameters:" << std::endl;
-    std::cout << " --countops  Print statistics on executed operations." << std::endl;
-    std::cout << " --dumpstats Instead of running the program, print basic bytecode statistics." << std::endl;
-    std::cout << " --help      Show this help." << std::endl;
-    std::cout << " --timing    Print timings." << std::endl;
-    std::cout << " --trace     Print each executed instruction." << std::endl;
-    std::cout << " --verbose   Print extended debugging information." << std::endl;
+    std::cout << " --bintrace      Record the last executed instructions into MODULE.trace, see peisiktrace." << std::endl;
+    std::cout << " --cachesize N   Programs kept loaded by --serve (default: 64)." << std::endl;
+    std::cout << " --compact       Run the code in the compact encoding with 1-byte opcodes and variable-length parameters." << std::endl;
+    std::cout << " --connect PATH  Run the modules on the server listening on the socket PATH." << std::endl;
+    std::cout << " --countops      Print statistics on executed operations." << std::endl;
+    std::cout << " --dumpstats     Instead of running the program, print basic bytecode statistics." << std::endl;
+    std::cout << " --forkjoin N    Run independent calls of pure functions concurrently up to call depth N." << std::endl;
+    std::cout << " --help          Show this help." << std::endl;
+    std::cout << " --inline N      Inline functions of at most N instructions when loading." << std::endl;
+    std::cout << " --layout        Lay out the hot code together, using the counts in MODULE.profile if it exists." << std::endl;
+    std::cout << " --lazy          Decode each function on its first call instead of when loading." << std::endl;
+    std::cout << " --maxdepth N    Stop the program if the call depth exceeds N." << std::endl;
+    std::cout << " --maxops N      Stop the program after about N executed instructions." << std::endl;
+    std::cout << " --memoize       Cache the results of pure functions with Int parameters." << std::endl;
+    std::cout << " --memstats      Print the memory used by programs, frames and stacks, and the peak RSS." << std::endl;
+    std::cout << " --nopeephole    Do not simplify the bytecode when loading." << std::endl;
+    std::cout << " --optimize      Run the SSA optimizer (constants, value numbering, loop invariants) when loading." << std::endl;
+    std::cout << " --parallel N    Run Parallel.Sum, Parallel.Count and --forkjoin on N threads (default: one per core)." << std::endl;
+    std::cout << " --perfcounters  Print hardware performance counters (Linux only)." << std::endl;
+    std::cout << " --predecode     With --lazy, decode the functions in call graph order on a background thread." << std::endl;
+    std::cout << " --profile       Print call counts and times for each function." << std::endl;
+    std::cout << " --restore FILE  Continue the module from a snapshot written by --snapshot." << std::endl;
+    std::cout << " --serve PATH    Listen on the socket PATH and run the modules requested with --connect." << std::endl;
+    std::cout << " --sample        Sample the call stack, writing MODULE.folded and MODULE.hotness." << std::endl;
+    std::cout << " --samplerate N  Samples per second of CPU time for --sample (default: 1000)." << std::endl;
+    std::cout << " --snapshot FILE Write the state of the module to FILE on SIGUSR1, or on SIGTERM and exit." << std::endl;
+    std::cout << "                 --maxops and --timeout also write the snapshot and exit instead of failing." << std::endl;
+    std::cout << " --timeout MS    Stop the program after MS milliseconds of execution." << std::endl;
+    std::cout << " --timeslice N   Instructions run by --workers before switching programs (default: 10000)." << std::endl;
+    std::cout << " --timing        Print timings." << std::endl;
+    std::cout << " --trace         Print each executed instruction." << std::endl;
+    std::cout << " --tracesize N   Instructions kept by --bintrace, rounded up to a power of two (default: 1048576)." << std::endl;
+    std::cout << " --verbose       Print extended debugging information." << std::endl;
+    std::cout << " --workers N     Run the modules concurrently on N threads, printing the results in order." << std::endl;
+    std::cout << "                 --serve uses one thread per core by default." << std::endl;
+    std::cout << " --writeprofile  Record call, branch and type counts into MODULE.profile for peisikc --profile-use." << std::endl;
 }
 
 int main(int argc, char **argv)
@@ -37,11 +142,37 @@ int main(int argc, char **argv)
     // Parse the command line
 
     std::vector<std::string> modulesToExecute;
+    Peisik::ExecutionBudget budget;
+    bool binaryTrace = false;
+    size_t cacheSize = 64;
+    bool compact = false;
+    std::string connectSocket;
     bool countOps = false;
     bool dumpStats = false;
+    size_t forkDepth = 0;
+    int inlineThreshold = 0;
+    bool layout = false;
+    bool lazy = false;
+    bool memoize = false;
+    bool memoryStatistics = false;
+    bool optimize = false;
+    int parallelism = 0;
+    bool peephole = true;
+    bool perfCounters = false;
+    bool predecode = false;
+    bool profile = false;
+    std::string restorePath;
+    bool sample = false;
+    std::string serveSocket;
+    int sampleRate = 1000;
+    std::string snapshotPath;
+    uint64_t timeSlice = 10000;
     bool timing = false;
     bool trace = false;
+    uint32_t traceSize = 1 << 20;
     bool verbose = false;
+    int workers = 0;
+    bool writeProfile = false;
     bool showHelp = (argc <= 1);
 
     for (int i = 1; i < argc; i++)
@@ -52,6 +183,22 @@ int main(int argc, char **argv)
         {
             verbose = true;
         }
+        else if (arg == "--bintrace")
+        {
+            binaryTrace = true;
+        }
+        else if (arg == "--cachesize" && i + 1 < argc)
+        {
+            cacheSize = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--compact")
+        {
+            compact = true;
+        }
+        else if (arg == "--connect" && i + 1 < argc)
+        {
+            connectSocket = argv[++i];
+        }
         else if (arg == "--countops")
         {
             countOps = true;
@@ -60,6 +207,101 @@ int main(int argc, char **argv)
         {
             dumpStats = true;
         }
+        else if (arg == "--inline" && i + 1 < argc)
+        {
+            inlineThreshold = std::atoi(argv[++i]);
+        }
+        else if (arg == "--layout")
+        {
+            layout = true;
+        }
+        else if (arg == "--lazy")
+        {
+            lazy = true;
+        }
+        else if (arg == "--maxdepth" && i + 1 < argc)
+        {
+            budget.maxCallDepth = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--maxops" && i + 1 < argc)
+        {
+            budget.maxInstructions = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--forkjoin" && i + 1 < argc)
+        {
+            forkDepth = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--memoize")
+        {
+            memoize = true;
+        }
+        else if (arg == "--memstats")
+        {
+            memoryStatistics = true;
+        }
+        else if (arg == "--nopeephole")
+        {
+            peephole = false;
+        }
+        else if (arg == "--optimize")
+        {
+            optimize = true;
+        }
+        else if (arg == "--parallel" && i + 1 < argc)
+        {
+            parallelism = std::atoi(argv[++i]);
+            if (parallelism < 1)
+            {
+                std::cout << "The parallel thread count must be at least 1." << std::endl;
+                showHelp = true;
+            }
+        }
+        else if (arg == "--perfcounters")
+        {
+            perfCounters = true;
+        }
+        else if (arg == "--predecode")
+        {
+            lazy = true;
+            predecode = true;
+        }
+        else if (arg == "--profile")
+        {
+            profile = true;
+        }
+        else if (arg == "--restore" && i + 1 < argc)
+        {
+            restorePath = argv[++i];
+        }
+        else if (arg == "--serve" && i + 1 < argc)
+        {
+            serveSocket = argv[++i];
+        }
+        else if (arg == "--sample")
+        {
+            sample = true;
+        }
+        else if (arg == "--samplerate" && i + 1 < argc)
+        {
+            sampleRate = std::atoi(argv[++i]);
+            if (sampleRate < 1 || sampleRate > 1000000)
+            {
+                std::cout << "The sample rate must be between 1 and 1000000." << std::endl;
+                showHelp = true;
+            }
+        }
+        else if (arg == "--snapshot" && i + 1 < argc)
+        {
+            snapshotPath = argv[++i];
+        }
+        else if (arg == "--timeout" && i + 1 < argc)
+        {
+            budget.timeLimit = std::chrono::milliseconds(std::strtoull(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--timeslice" && i + 1 < argc)
+        {
+            timeSlice = std::strtoull(argv[++i], nullptr, 10);
+        }
         else if (arg == "--timing")
         {
             timing = true;
@@ -68,6 +310,23 @@ int main(int argc, char **argv)
         {
             trace = true;
         }
+        else if (arg == "--tracesize" && i + 1 < argc)
+        {
+            traceSize = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--workers" && i + 1 < argc)
+        {
+            workers = std::atoi(argv[++i]);
+            if (workers < 1)
+            {
+                std::cout << "The worker count must be at least 1." << std::endl;
+                showHelp = true;
+            }
+        }
+        else if (arg == "--writeprofile")
+        {
+            writeProfile = true;
+        }
         else if (arg == "--help")
         {
             showHelp = true;
@@ -89,16 +348,301 @@ int main(int argc, char **argv)
         return 0;
     }
 
+    // Before anything is loaded, so that all the counted memory is counted
+    Peisik::MemoryStatistics::SetEnabled(memoryStatistics);
+
+    // The counters are opened once and reused for each module
+    Peisik::PerfCounters importCounters;
+    Peisik::PerfCounters executeCounters;
+    if (perfCounters && workers > 0)
+    {
+        std::cout << "-- Hardware performance counters are not available with --workers." << std::endl;
+        perfCounters = false;
+    }
+    if (perfCounters && !executeCounters.IsAvailable())
+    {
+        std::cout << "-- Hardware performance counters are not available on this system." << std::endl;
+        perfCounters = false;
+    }
+    if (lazy && (inlineThreshold > 0 || optimize || forkDepth > 0 || layout || !serveSocket.empty()))
+    {
+        // The whole-program passes need every function, and the server shares the programs between threads
+        std::cout << "-- Lazy decoding is not available with --inline, --optimize, --forkjoin, --layout or --serve." << std::endl;
+        lazy = false;
+        predecode = false;
+    }
+    if (writeProfile)
+    {
+        // The compiler matches the profile to the code it generated, so the bytecode must not be rewritten
+        if (inlineThreshold > 0 || optimize || forkDepth > 0 || layout)
+        {
+            std::cout << "-- Inlining, the SSA optimizer, --forkjoin and the block layout of --layout are not available"
+                " with --writeprofile." << std::endl;
+        }
+        peephole = false;
+        inlineThreshold = 0;
+        optimize = false;
+        forkDepth = 0;
+    }
+    if (sample && workers > 0)
+    {
+        // The sampling timer is process-wide
+        std::cout << "-- Sampling is not available with --workers." << std::endl;
+        sample = false;
+    }
+    if ((!snapshotPath.empty() || !restorePath.empty()) &&
+        (workers > 0 || !serveSocket.empty() || forkDepth > 0 || modulesToExecute.size() != 1))
+    {
+        // A snapshot holds the call stack of one interpreter, and forked calls run on interpreters of their own
+        std::cout << "-- Snapshots are only available for a single module, without --workers, --serve or --forkjoin." << std::endl;
+        snapshotPath.clear();
+        restorePath.clear();
+    }
+    if (!snapshotPath.empty())
+    {
+        std::signal(SIGTERM, RequestSnapshot);
+#ifdef SIGUSR1
+        std::signal(SIGUSR1, RequestSnapshot);
+#endif
+    }
+
+    // The modules run by the scheduler, reported in order once all have ended
+    struct ScheduledModule
+    {
+        std::string path;
+        std::unique_ptr<Peisik::Interpreter> interpreter;
+        std::ostringstream output;
+        std::exception_ptr error;
+        std::chrono::high_resolution_clock::time_point importStart;
+        std::chrono::high_resolution_clock::time_point importEnd;
+        std::chrono::high_resolution_clock::time_point executeStart;
+        std::chrono::high_resolution_clock::time_point executeEnd;
+    };
+    std::vector<std::unique_ptr<ScheduledModule>> scheduledModules;
+    std::unique_ptr<Peisik::Scheduler> scheduler;
+    if (workers > 0 || !serveSocket.empty())
+        scheduler.reset(new Peisik::Scheduler(workers, timeSlice));
+
+    // Loads a module and runs the load-time optimizations
+    auto loadProgram = [&](std::istream& stream, const std::string& modulePath) -> Peisik::Program
+    {
+        if (lazy)
+        {
+            // The per-function passes run as each function is decoded
+            auto program = Peisik::DeserializeProgramLazily(stream, predecode);
+            program.SetFunctionDecodedHandler([peephole, compact](Peisik::Program& program, Peisik::Function& function)
+            {
+                if (peephole)
+                    Peisik::OptimizePeephole(program, function);
+                if (compact)
+                    Peisik::CompactFunction(function);
+            });
+            if (verbose)
+                std::cout << "Indexed " << program.GetFunctionCount() << " functions for lazy decoding" << std::endl;
+            return program;
+        }
+
+        auto program = Peisik::DeserializeProgram(stream);
+
+        // The profile recorded for --layout, read before any pass rewrites the code it refers to
+        Peisik::BranchProfile branchCounts;
+        std::vector<double> callFrequencies;
+        bool profiled = false;
+        std::ifstream profileFile(modulePath + ".profile");
+        if (layout && profileFile)
+        {
+            std::stringstream recordedProfile;
+            recordedProfile << profileFile.rdbuf();
+            try
+            {
+                branchCounts = Peisik::ReadBranchCounts(recordedProfile, program);
+                recordedProfile.clear();
+                recordedProfile.seekg(0);
+                callFrequencies = Peisik::ReadCallFrequencies(recordedProfile, program);
+                profiled = true;
+            }
+            catch (Peisik::InterpreterException& e)
+            {
+                std::cout << "-- Ignoring " << modulePath << ".profile: " << e.what() << std::endl;
+            }
+        }
+        if (layout && !writeProfile)
+        {
+            auto statistics = Peisik::ReorderBlocks(program, profiled ? &branchCounts : nullptr);
+            if (verbose)
+            {
+                std::cout << "Block layout inverted " << statistics.invertedBranches << " branches, rotated "
+                    << statistics.rotatedLoops << " loops and moved " << statistics.coldBlocks << " cold blocks" << std::endl;
+            }
+        }
+
+        // Load-time optimizations. The peephole pass runs again to clean up the inlined and optimized code.
+        int removedOps = peephole ? Peisik::OptimizePeephole(program) : 0;
+        if (inlineThreshold > 0)
+        {
+            auto inlined = Peisik::InlineSmallFunctions(program, inlineThreshold);
+            if (verbose)
+                std::cout << "Inlined " << inlined << " call sites" << std::endl;
+            if (peephole && inlined > 0)
+                removedOps += Peisik::OptimizePeephole(program);
+        }
+        if (optimize)
+        {
+            auto statistics = Peisik::OptimizeSsa(program);
+            if (verbose)
+            {
+                std::cout << "SSA optimizer folded " << statistics.foldedExpressions
+                    << ", reused " << statistics.reusedExpressions
+                    << " and hoisted " << statistics.hoistedExpressions
+                    << " expressions, and removed " << statistics.removedStatements << " statements" << std::endl;
+            }
+            if (peephole)
+                removedOps += Peisik::OptimizePeephole(program);
+        }
+        if (verbose && peephole)
+            std::cout << "Peephole optimizer removed " << removedOps << " instructions" << std::endl;
+        if (forkDepth > 0)
+        {
+            // After the other passes, since they do not know CallFork
+            auto marked = Peisik::MarkForkPoints(program);
+            if (verbose)
+                std::cout << "Marked " << marked << " calls for fork-join" << std::endl;
+        }
+        if (compact)
+        {
+            // After the load-time optimizations, since they work on the wide bytecode
+            auto compactSize = Peisik::CompactProgram(program);
+            if (verbose)
+                std::cout << "Compact code size: " << compactSize << " bytes" << std::endl;
+        }
+        if (layout)
+        {
+            // Last, since the code of a function must not be replaced after it has been packed
+            if (!profiled)
+                callFrequencies = Peisik::EstimateCallFrequencies(program);
+            auto statistics = Peisik::LayOutCode(program, callFrequencies);
+            if (verbose)
+            {
+                std::cout << "Laid out " << statistics.hotFunctions << " hot and " << statistics.coldFunctions
+                    << " cold functions in " << statistics.codeSize << " bytes, "
+                    << (profiled ? "using the profile" : "using estimated call counts") << std::endl;
+            }
+        }
+        return program;
+    };
+
+    if (!serveSocket.empty())
+    {
+        // The programs of the clients run concurrently, so the reports are not available
+        try
+        {
+            Peisik::ProgramCache cache(cacheSize, loadProgram);
+            Peisik::Server server(serveSocket, cache, *scheduler, [&](Peisik::Interpreter& interpreter)
+            {
+                interpreter.SetTrace(trace);
+                interpreter.SetMemoization(memoize);
+                interpreter.SetParallelism(parallelism);
+                interpreter.SetForkJoin(forkDepth);
+                interpreter.SetBudget(budget);
+            });
+            std::cout << "-- Serving on " << serveSocket << " with " << scheduler->GetWorkerCount() << " workers" << std::endl;
+            server.Run();
+        }
+        catch (...)
+        {
+            return ReportError(std::current_exception());
+        }
+        return 0;
+    }
+
+    if (!connectSocket.empty())
+    {
+        for (auto modulePath : modulesToExecute)
+        {
+            modulePath = AddModuleExtension(modulePath);
+            try
+            {
+                auto exitCode = Peisik::RunOnServer(connectSocket, modulePath, std::cout);
+                if (exitCode != 0)
+                    return exitCode;
+            }
+            catch (...)
+            {
+                return ReportError(std::current_exception());
+            }
+        }
+        return 0;
+    }
+
+    // Prints the reports requested on the command line after the module has been executed
+    auto reportExecution = [&](Peisik::Interpreter& interpreter, const std::string& modulePath,
+        std::chrono::high_resolution_clock::time_point importStart, std::chrono::high_resolution_clock::time_point importEnd,
+        std::chrono::high_resolution_clock::time_point executeStart, std::chrono::high_resolution_clock::time_point executeEnd)
+    {
+        if (countOps)
+        {
+            interpreter.PrintOpCount();
+        }
+
+        if (profile)
+        {
+            interpreter.PrintProfile();
+        }
+
+        if (sample)
+        {
+            std::ofstream foldedStacks(modulePath + ".folded");
+            std::ofstream instructionHotness(modulePath + ".hotness");
+            interpreter.WriteSamples(foldedStacks, instructionHotness);
+            std::cout << "-- Wrote " << interpreter.GetSampleCount() << " samples to "
+                << modulePath << ".folded and " << modulePath << ".hotness" << std::endl;
+        }
+
+        if (writeProfile)
+        {
+            std::ofstream recordedProfile(modulePath + ".profile");
+            interpreter.WriteRecordedProfile(recordedProfile);
+            std::cout << "-- Wrote the profile to " << modulePath << ".profile" << std::endl;
+        }
+
+        if (interpreter.GetBinaryTrace() != nullptr)
+        {
+            auto recorded = interpreter.GetBinaryTrace()->GetRecordCount();
+            auto capacity = interpreter.GetBinaryTrace()->GetCapacity();
+            std::cout << "-- Wrote the last " << std::min<uint64_t>(recorded, capacity) << " of " << recorded
+                << " instructions to " << modulePath << ".trace" << std::endl;
+        }
+
+        if (timing)
+        {
+            std::cout << "-- Timings for " << modulePath << std::endl;
+            auto importTime = std::chrono::duration_cast<std::chrono::microseconds>(importEnd - importStart);
+            std::cout << "   Import: " << importTime.count() / 1000000.0 << " s" << std::endl;
+            auto executeTime = std::chrono::duration_cast<std::chrono::microseconds>(executeEnd - executeStart);
+            std::cout << "   Execution: " << executeTime.count() / 1000000.0 << " s" << std::endl;
+            auto totalTime = std::chrono::duration_cast<std::chrono::microseconds>(executeEnd - importStart);
+            std::cout << "   Total: " << totalTime.count() / 1000000.0 << " s" << std::endl;
+        }
+
+        if (perfCounters)
+        {
+            std::cout << "-- Performance counters for " << modulePath << std::endl;
+            importCounters.PrintReport("Import");
+            executeCounters.PrintReport("Execution");
+        }
+
+        if (memoryStatistics)
+        {
+            interpreter.PrintMemoryStatistics();
+        }
+    };
+
     auto totalStart = std::chrono::high_resolution_clock::now();
 
     // Load and execute each module
     for (auto modulePath : modulesToExecute)
     {
-        // If the module name does not have an extension, add it
-        if (modulePath.find(".") == -1)
-        {
-            modulePath += ".cpeisik";
-        }
+        modulePath = AddModuleExtension(modulePath);
 
         // Load the module
         if (verbose)
@@ -113,8 +657,16 @@ int main(int argc, char **argv)
 
         try
         {
+            // The memory counters are process-wide, so the modules run by the scheduler share the peaks
+            if (!scheduler)
+                Peisik::MemoryStatistics::ResetPeaks();
+
             auto importStart = std::chrono::high_resolution_clock::now();
-            auto program = Peisik::DeserializeProgram(stream);
+            if (perfCounters)
+                importCounters.Start();
+            auto program = loadProgram(stream, modulePath);
+            if (perfCounters)
+                importCounters.Stop();
             auto importEnd = std::chrono::high_resolution_clock::now();
 
             if (dumpStats)
@@ -126,48 +678,137 @@ int main(int argc, char **argv)
             {
                 // Execute the module
                 auto executeStart = std::chrono::high_resolution_clock::now();
-                Peisik::Interpreter interpreter(program);
-                interpreter.SetTrace(trace);
-
-                interpreter.Execute();
-                auto executeEnd = std::chrono::high_resolution_clock::now();
+                std::unique_ptr<Peisik::Interpreter> interpreter(new Peisik::Interpreter(program));
+                interpreter->SetTrace(trace);
+                interpreter->SetMemoization(memoize);
+                interpreter->SetParallelism(parallelism);
+                interpreter->SetForkJoin(forkDepth);
+                interpreter->SetProfiling(profile);
+                interpreter->SetSampling(sample ? sampleRate : 0);
+                interpreter->SetProfileRecording(writeProfile);
+                if (snapshotPath.empty())
+                {
+                    interpreter->SetBudget(budget);
+                }
+                else
+                {
+                    // The instruction and time limits are checked between the slices, so that the program
+                    // can be continued from the snapshot
+                    Peisik::ExecutionBudget depthBudget;
+                    depthBudget.maxCallDepth = budget.maxCallDepth;
+                    interpreter->SetBudget(depthBudget);
+                }
+                if (binaryTrace)
+                    interpreter->SetBinaryTrace(modulePath + ".trace", traceSize);
+                if (!restorePath.empty())
+                {
+                    std::ifstream snapshot(restorePath, std::ifstream::binary);
+                    if (snapshot.fail())
+                    {
+                        std::cout << "Could not open the snapshot " << restorePath << std::endl;
+                        return -1;
+                    }
+                    interpreter->RestoreSnapshot(snapshot);
+                    if (verbose)
+                        std::cout << "Restored the snapshot " << restorePath << std::endl;
+                }
 
-                if (countOps)
+                if (scheduler)
                 {
-                    interpreter.PrintOpCount();
+                    // The output is buffered so that the modules do not mix their output
+                    std::unique_ptr<ScheduledModule> module(new ScheduledModule());
+                    module->path = modulePath;
+                    module->interpreter = std::move(interpreter);
+                    module->interpreter->SetOutput(module->output);
+                    module->importStart = importStart;
+                    module->importEnd = importEnd;
+                    module->executeStart = executeStart;
+
+                    auto& scheduled = *module;
+                    scheduledModules.push_back(std::move(module));
+                    scheduler->Submit(*scheduled.interpreter,
+                        [&scheduled](Peisik::Interpreter&, Peisik::ExecutionStatus, std::exception_ptr error)
+                    {
+                        scheduled.error = error;
+                        scheduled.executeEnd = std::chrono::high_resolution_clock::now();
+                    });
+                    continue;
                 }
 
-                if (timing)
+                if (perfCounters)
+                    executeCounters.Start();
+                if (snapshotPath.empty())
                 {
-                    std::cout << "-- Timings for " << modulePath << std::endl;
-                    auto importTime = std::chrono::duration_cast<std::chrono::microseconds>(importEnd - importStart);
-                    std::cout << "   Import: " << importTime.count() / 1000000.0 << " s" << std::endl;
-                    auto executeTime = std::chrono::duration_cast<std::chrono::microseconds>(executeEnd - executeStart);
-                    std::cout << "   Execution: " << executeTime.count() / 1000000.0 << " s" << std::endl;
-                    auto totalTime = std::chrono::duration_cast<std::chrono::microseconds>(executeEnd - importStart);
-                    std::cout << "   Total: " << totalTime.count() / 1000000.0 << " s" << std::endl;
+                    interpreter->Execute();
                 }
+                else
+                {
+                    // Run in slices, since the snapshot can only be taken between them.
+                    // The instruction counts continue from a restored snapshot, but the time limit starts again.
+                    auto deadline = std::chrono::steady_clock::now() + budget.timeLimit;
+                    while (true)
+                    {
+                        auto slice = std::max<uint64_t>(timeSlice, 1);
+                        if (budget.maxInstructions > 0)
+                        {
+                            // A restored program may already be past the limit
+                            auto executed = interpreter->GetExecutedOpCount();
+                            slice = executed < budget.maxInstructions ? std::min(slice, budget.maxInstructions - executed) : 1;
+                        }
+                        if (interpreter->Step(slice) != Peisik::ExecutionStatus::Yielded)
+                            break;
+
+                        std::string limitReached;
+                        if (budget.maxInstructions > 0 && interpreter->GetExecutedOpCount() >= budget.maxInstructions)
+                            limitReached = "instruction limit of " + std::to_string(budget.maxInstructions);
+                        else if (budget.timeLimit.count() > 0 && std::chrono::steady_clock::now() >= deadline)
+                            limitReached = "time limit of " + std::to_string(budget.timeLimit.count()) + " ms";
+                        if (s_snapshotRequest == 0 && limitReached.empty())
+                            continue;
+
+                        auto exitAfterwards = (s_snapshotRequest == 2 || !limitReached.empty());
+                        s_snapshotRequest = 0;
+                        WriteSnapshotFile(*interpreter, snapshotPath);
+                        if (!limitReached.empty())
+                            std::cout << "-- Stopped at the " << limitReached << std::endl;
+                        std::cout << "-- Wrote the snapshot to " << snapshotPath << std::endl;
+                        if (exitAfterwards)
+                            return 0;
+                    }
+                }
+                if (perfCounters)
+                    executeCounters.Stop();
+                auto executeEnd = std::chrono::high_resolution_clock::now();
+
+                reportExecution(*interpreter, modulePath, importStart, importEnd, executeStart, executeEnd);
             }
         }
-        catch (Peisik::ApplicationException& e)
+        catch (...)
         {
-            // Application exceptions arise because of user code bugs
-
-            std::cout << "Error: " << e.what() << std::endl;
-            return -1;
+            return ReportError(std::current_exception());
         }
-        catch (std::exception& e)
+    }
+
+    if (scheduler)
+    {
+        scheduler->WaitAll();
+        for (auto& module : scheduledModules)
         {
-            // The rest are because of invalid programs, failed invariants or other interpreter bugs.
+            std::cout << module->output.str();
+            if (module->error)
+                return ReportError(module->error);
 
-            std::cout << "Interpreter error: " << e.what() << std::endl;
-#if DEBUG
-            throw;
-#else
-            return -1;
-#endif
+            reportExecution(*module->interpreter, module->path,
+                module->importStart, module->importEnd, module->executeStart, module->executeEnd);
+        }
+
+        if (verbose)
+        {
+            std::cout << "-- Scheduler ran " << scheduler->GetSliceCount() << " time slices on "
+                << scheduler->GetWorkerCount() << " workers, stealing " << scheduler->GetStealCount() << " times" << std::endl;
         }
     }
+
     if (timing)
     {
         auto totalEnd = std::chrono::high_resolution_clock::now();
@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "Memoizer.h"
+#include "PurityAnalysis.h"
+
+using namespace Peisik;
+
+Memoizer::Memoizer(const Program& program)
+{
+    auto pure = FindPureFunctions(program);
+
+    m_functions.resize(program.GetFunctionCount());
+    for (short i = 0; i < program.GetFunctionCount(); i++)
+    {
+        auto& function = program.GetFunction(i);
+        auto& cache = m_functions[i];
+        cache.parameterCount = function.GetParameterCount();
+        cache.hits = 0;
+        cache.misses = 0;
+        cache.clears = 0;
+
+        // Void functions have nothing to cache, and only Int parameters make exact keys
+        cache.enabled = pure[i] && function.GetReturnType() != PrimitiveType::Void;
+        for (short p = 0; p < cache.parameterCount; p++)
+        {
+            if (function.GetLocalTypes()[p] != PrimitiveType::Int)
+                cache.enabled = false;
+        }
+    }
+}
+
+bool Memoizer::Lookup(short functionIndex, const PObject* arguments, PObject& result)
+{
+    auto& cache = m_functions[functionIndex];
+
+    m_lookupKey.clear();
+    for (short i = 0; i < cache.parameterCount; i++)
+        m_lookupKey.push_back(arguments[i].GetIntValue());
+
+    auto found = cache.results.find(m_lookupKey);
+    if (found != cache.results.end())
+    {
+        cache.hits++;
+        result = found->second;
+        return true;
+    }
+
+    cache.misses++;
+    PendingCall call = { functionIndex, m_lookupKey };
+    m_pendingCalls.push_back(call);
+    return false;
+}
+
+void Memoizer::Store(const PObject& result)
+{
+    auto& call = m_pendingCalls.back();
+    auto& cache = m_functions[call.functionIndex];
+
+    if (cache.results.size() >= MaxEntriesPerFunction)
+    {
+        cache.results.clear();
+        cache.clears++;
+    }
+    cache.results.emplace(std::move(call.key), result);
+
+    m_pendingCalls.pop_back();
+}
+
+size_t Memoizer::GetMemoizedFunctionCount() const
+{
+    size_t count = 0;
+    for (auto& cache : m_functions)
+    {
+        if (cache.enabled)
+            count++;
+    }
+    return count;
+}
+
+void Memoizer::PrintStatistics() const
+{
+    std::cout << "-- Memoized functions: " << GetMemoizedFunctionCount() << std::endl;
+    std::cout << std::left << std::setw(10) << "Function" << std::right
+        << std::setw(14) << "Hits" << std::setw(14) << "Misses" << std::setw(9) << "Clears" << std::endl;
+
+    for (size_t i = 0; i < m_functions.size(); i++)
+    {
+        auto& cache = m_functions[i];
+        if (cache.hits == 0 && cache.misses == 0)
+            continue;
+
+        std::cout << std::left << std::setw(10) << i << std::right
+            << std::setw(14) << cache.hits << std::setw(14) << cache.misses
+            << std::setw(9) << cache.clears << std::endl;
+    }
+}
+
+size_t Memoizer::KeyHash::operator()(const Key& key) const
+{
+    // FNV-1a over the argument values
+    uint64_t hash = 14695981039346656037ULL;
+    for (auto value : key)
+    {
+        hash ^= static_cast<uint64_t>(value);
+        hash *= 1099511628211ULL;
+    }
+    return static_cast<size_t>(hash ^ (hash >> 32));
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "Program.h"
+
+namespace Peisik
+{
+    // Caches the results of pure functions whose parameters are all Int.
+    // Each function has its own cache, which is cleared when it reaches MaxEntriesPerFunction.
+    class Memoizer
+    {
+    public:
+        static const size_t MaxEntriesPerFunction = 1 << 16;
+
+        // Runs the purity analysis and enables caching for the eligible functions.
+        Memoizer(const Program& program);
+
+        // Returns true if the results of the function are cached.
+        bool IsMemoized(short functionIndex) const
+        {
+            return m_functions[functionIndex].enabled;
+        }
+
+        // Looks up the result for the arguments, which are the first locals of the new frame.
+        // On a miss, the arguments are remembered until the matching Store() call.
+        bool Lookup(short functionIndex, const PObject* arguments, PObject& result);
+
+        // Stores the result of the innermost call that missed the cache.
+        void Store(const PObject& result);
+
+        // Gets the number of memoized functions.
+        size_t GetMemoizedFunctionCount() const;
+
+        // Prints the hit and miss counts of each called memoized function.
+        void PrintStatistics() const;
+
+    private:
+        typedef std::vector<int64_t> Key;
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& key) const;
+        };
+
+        struct FunctionCache
+        {
+            bool enabled;
+            short parameterCount;
+            std::unordered_map<Key, PObject, KeyHash> results;
+            uint64_t hits;
+            uint64_t misses;
+            uint64_t clears;
+        };
+
+        struct PendingCall
+        {
+            short functionIndex;
+            Key key;
+        };
+
+        std::vector<FunctionCache> m_functions;
+        std::vector<PendingCall> m_pendingCalls;
+        // Reused to avoid allocating a key on every lookup
+        Key m_lookupKey;
+    };
+}
@@ -0,0 +1,121 @@
+#include "pch.h"
+#include "MemoryStatistics.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#elif defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+using namespace Peisik;
+
+std::atomic<bool> MemoryStatistics::s_enabled(false);
+MemoryStatistics::Counters MemoryStatistics::s_counters[static_cast<int>(MemoryCategory::CategoryCount)];
+
+void MemoryStatistics::SetEnabled(bool value)
+{
+    s_enabled.store(value, std::memory_order_relaxed);
+}
+
+void MemoryStatistics::CountAllocation(MemoryCategory category, size_t bytes)
+{
+    auto& counters = s_counters[static_cast<int>(category)];
+    counters.allocationCount.fetch_add(1, std::memory_order_relaxed);
+    auto current = counters.currentBytes.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed)
+        + static_cast<int64_t>(bytes);
+
+    // Another thread may raise the peak at the same time, so only ever raise it
+    auto peak = counters.peakBytes.load(std::memory_order_relaxed);
+    while (current > peak && !counters.peakBytes.compare_exchange_weak(peak, current, std::memory_order_relaxed))
+    {
+    }
+}
+
+void MemoryStatistics::CountDeallocation(MemoryCategory category, size_t bytes)
+{
+    s_counters[static_cast<int>(category)].currentBytes.fetch_sub(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+}
+
+MemoryUsage MemoryStatistics::GetUsage(MemoryCategory category)
+{
+    auto& counters = s_counters[static_cast<int>(category)];
+    MemoryUsage result;
+    result.currentBytes = static_cast<uint64_t>(std::max<int64_t>(counters.currentBytes.load(std::memory_order_relaxed), 0));
+    result.peakBytes = static_cast<uint64_t>(std::max<int64_t>(counters.peakBytes.load(std::memory_order_relaxed), 0));
+    result.allocationCount = counters.allocationCount.load(std::memory_order_relaxed);
+    return result;
+}
+
+void MemoryStatistics::ResetPeaks()
+{
+    for (auto& counters : s_counters)
+        counters.peakBytes.store(counters.currentBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+uint64_t MemoryStatistics::GetPeakResidentBytes()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+    // In kilobytes
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#elif defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return static_cast<uint64_t>(counters.PeakWorkingSetSize);
+#else
+    return 0;
+#endif
+}
+
+const char* MemoryStatistics::CategoryToString(MemoryCategory category)
+{
+    switch (category)
+    {
+    case MemoryCategory::ProgramImage:
+        return "Program image";
+    case MemoryCategory::Frames:
+        return "Frames";
+    case MemoryCategory::OperandStack:
+        return "Operand stacks";
+    case MemoryCategory::InternalCallScratch:
+        return "Internal calls";
+    case MemoryCategory::Arrays:
+        return "Arrays";
+    default:
+        return "Unknown";
+    }
+}
+
+void MemoryStatistics::PrintReport(std::ostream& output)
+{
+    output << "     " << std::left << std::setw(18) << "Category"
+        << std::right << std::setw(16) << "Current bytes"
+        << std::setw(16) << "Peak bytes"
+        << std::setw(14) << "Allocations" << std::endl;
+    for (int i = 0; i < static_cast<int>(MemoryCategory::CategoryCount); i++)
+    {
+        auto category = static_cast<MemoryCategory>(i);
+        auto usage = GetUsage(category);
+        output << "     " << std::left << std::setw(18) << CategoryToString(category)
+            << std::right << std::setw(16) << usage.currentBytes
+            << std::setw(16) << usage.peakBytes
+            << std::setw(14) << usage.allocationCount << std::endl;
+    }
+    output << std::left;
+
+    auto peakResident = GetPeakResidentBytes();
+    output << "     " << std::setw(18) << "Peak RSS";
+    if (peakResident > 0)
+        output << peakResident << " bytes" << std::endl;
+    else
+        output << "n/a" << std::endl;
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+namespace Peisik
+{
+    // The kinds of memory counted by MemoryStatistics.
+    enum class MemoryCategory
+    {
+        // The module image, and the decoded code, constants and function table of the programs
+        ProgramImage,
+        // The call stacks and the locals of each frame
+        Frames,
+        // The operand stacks of the frames
+        OperandStack,
+        // The parameter stacks of internal function calls
+        InternalCallScratch,
+        // The arrays on the heap, with their elements
+        Arrays,
+        CategoryCount
+    };
+
+    // The memory counted in a category.
+    struct MemoryUsage
+    {
+        uint64_t currentBytes;
+        uint64_t peakBytes;
+        uint64_t allocationCount;
+    };
+
+    // Process-wide counters of the memory allocated by the interpreter's containers, see CountingAllocator.
+    //
+    // Counting is disabled by default, when it costs one predictable branch per allocation.
+    // Memory allocated before counting was enabled is not counted, but its release is,
+    // so counting should be enabled before the programs are loaded.
+    class MemoryStatistics
+    {
+    public:
+        // Enables or disables counting the allocations.
+        static void SetEnabled(bool value);
+
+        // Returns true if the allocations are counted.
+        static bool IsEnabled()
+        {
+            return s_enabled.load(std::memory_order_relaxed);
+        }
+
+        // Records an allocation in the category.
+        static void CountAllocation(MemoryCategory category, size_t bytes);
+
+        // Records the release of memory in the category.
+        static void CountDeallocation(MemoryCategory category, size_t bytes);
+
+        // Gets the memory counted in the category.
+        static MemoryUsage GetUsage(MemoryCategory category);
+
+        // Measures the peaks again starting from the current usage, for example before running another module.
+        static void ResetPeaks();
+
+        // Gets the peak resident set size of the process in bytes, or zero if it is not available.
+        static uint64_t GetPeakResidentBytes();
+
+        // Gets the name of the category for reports.
+        static const char* CategoryToString(MemoryCategory category);
+
+        // Prints the usage of each category and the peak resident set size, indented for the per-module report.
+        static void PrintReport(std::ostream& output);
+
+    private:
+        struct Counters
+        {
+            // Signed, since memory allocated before enabling may be released while counting
+            std::atomic<int64_t> currentBytes;
+            std::atomic<int64_t> peakBytes;
+            std::atomic<uint64_t> allocationCount;
+        };
+
+        static std::atomic<bool> s_enabled;
+        static Counters s_counters[static_cast<int>(MemoryCategory::CategoryCount)];
+    };
+
+    // A standard allocator that records its allocations in a MemoryStatistics category.
+    // Allocators of the same category are interchangeable.
+    template <typename T, MemoryCategory Category>
+    class CountingAllocator
+    {
+    public:
+        typedef T value_type;
+
+        template <typename U>
+        struct rebind
+        {
+            typedef CountingAllocator<U, Category> other;
+        };
+
+        CountingAllocator()
+        {
+        }
+
+        template <typename U>
+        CountingAllocator(const CountingAllocator<U, Category>&)
+        {
+        }
+
+        T* allocate(size_t count)
+        {
+            T* result = std::allocator<T>().allocate(count);
+            if (MemoryStatistics::IsEnabled())
+                MemoryStatistics::CountAllocation(Category, count * sizeof(T));
+            return result;
+        }
+
+        void deallocate(T* pointer, size_t count)
+        {
+            if (MemoryStatistics::IsEnabled())
+                MemoryStatistics::CountDeallocation(Category, count * sizeof(T));
+            std::allocator<T>().deallocate(pointer, count);
+        }
+    };
+
+    template <typename T, typename U, MemoryCategory Category>
+    bool operator==(const CountingAllocator<T, Category>&, const CountingAllocator<U, Category>&)
+    {
+        return true;
+    }
+
+    template <typename T, typename U, MemoryCategory Category>
+    bool operator!=(const CountingAllocator<T, Category>&, const CountingAllocator<U, Category>&)
+    {
+        return false;
+    }
+
+    // Counts memory that is owned by containers with the standard allocator, such as the code
+    // of a function, which is shared with the load-time passes. The owner sets the size whenever
+    // the containers change. A copy counts the memory again.
+    template <MemoryCategory Category>
+    class CountedBlock
+    {
+    public:
+        CountedBlock()
+            : m_bytes(0)
+        {
+        }
+
+        CountedBlock(const CountedBlock& other)
+            : m_bytes(0)
+        {
+            SetSize(other.m_bytes);
+        }
+
+        CountedBlock& operator=(const CountedBlock& other)
+        {
+            SetSize(other.m_bytes);
+            return *this;
+        }
+
+        ~CountedBlock()
+        {
+            SetSize(0);
+        }
+
+        void SetSize(size_t bytes)
+        {
+            // Only what was counted is released, so the counters stay exact if counting is enabled midway
+            if (m_bytes > 0)
+                MemoryStatistics::CountDeallocation(Category, m_bytes);
+            m_bytes = MemoryStatistics::IsEnabled() ? bytes : 0;
+            if (m_bytes > 0)
+                MemoryStatistics::CountAllocation(Category, m_bytes);
+        }
+
+    private:
+        size_t m_bytes;
+    };
+}
@@ -43,6 +43,44 @@ double Peisik::PObject::GetRealValueForAnyNumeric() const
         throw InterpreterException("Trying to get real value of non-numeric constant.");
 }
 
+PArray* PObject::GetArrayValue() const
+{
+    if (!IsArrayType(m_type))
+        throw InterpreterException("Trying to get array value of a non-array object.");
+
+    return reinterpret_cast<PArray*>(static_cast<intptr_t>(m_intValue));
+}
+
+int64_t PObject::GetRawValue() const
+{
+    // A bool only sets the first byte of the union
+    if (m_type == PrimitiveType::Bool)
+        return m_boolValue ? 1 : 0;
+    return m_intValue;
+}
+
+bool PObject::IsIdenticalTo(const PObject& other) const
+{
+    if (m_type != other.m_type)
+        return false;
+
+    switch (m_type)
+    {
+    case PrimitiveType::Bool:
+        return m_boolValue == other.m_boolValue;
+    case PrimitiveType::Int:
+        return m_intValue == other.m_intValue;
+    case PrimitiveType::Real:
+        return std::memcmp(&m_realValue, &other.m_realValue, sizeof(double)) == 0;
+    case PrimitiveType::IntArray:
+    case PrimitiveType::RealArray:
+        // Arrays are identical only if they are the same array
+        return m_intValue == other.m_intValue;
+    default:
+        return false;
+    }
+}
+
 void Peisik::PObject::SetValue(bool newValue)
 {
     if (m_type != PrimitiveType::Bool)
@@ -4,6 +4,8 @@
 
 namespace Peisik
 {
+    class PArray;
+
     // All primitive types in the Peisik type system.
     enum class PrimitiveType
     {
@@ -11,10 +13,30 @@ namespace Peisik
         Void,
         Int,
         Real,
-        Bool
+        Bool,
+        IntArray,
+        RealArray
     };
 
+    // Returns true if the type is an array type.
+    inline bool IsArrayType(PrimitiveType type)
+    {
+        return type == PrimitiveType::IntArray || type == PrimitiveType::RealArray;
+    }
+
+    // Returns the element type of an array type, or NoType for other types.
+    inline PrimitiveType GetElementType(PrimitiveType type)
+    {
+        switch (type)
+        {
+        case PrimitiveType::IntArray: return PrimitiveType::Int;
+        case PrimitiveType::RealArray: return PrimitiveType::Real;
+        default: return PrimitiveType::NoType;
+        }
+    }
+
     // Represents an object in the Peisik type system.
+    // Arrays are stored as a pointer to the array on the heap, so that copying an object copies the reference.
     class PObject
     {
     public:
@@ -42,6 +64,18 @@ namespace Peisik
         // For other object types, an exception is thrown.
         double GetRealValueForAnyNumeric() const;
 
+        // Gets the array referenced by this object, or null if the array has not been created yet.
+        // If this is not an array object, an exception is thrown.
+        PArray* GetArrayValue() const;
+
+        // Gets the value in the representation accepted by the constructor.
+        // Unlike the typed getters, this works for any type.
+        int64_t GetRawValue() const;
+
+        // Returns true if the other object has the same type and exactly the same representation,
+        // so that for example 0.0 and -0.0 differ.
+        bool IsIdenticalTo(const PObject& other) const;
+
         // Sets the boolean value of this object.
         // If this is not an bool object, an exception is thrown.
         void SetValue(bool newValue);
@@ -84,4 +118,9 @@ namespace Peisik
         result.SetValue(value);
         return result;
     }
+
+    inline PObject ObjectFromArray(const PrimitiveType type, PArray* const value)
+    {
+        return PObject(type, static_cast<int64_t>(reinterpret_cast<intptr_t>(value)));
+    }
 }
\ No newline at end of file
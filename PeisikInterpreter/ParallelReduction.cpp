@@ -0,0 +1,126 @@
+#include "pch.h"
+#include "InternalFunctions.h"
+#include "ParallelReduction.h"
+#include "PeisikException.h"
+#include "PurityAnalysis.h"
+#include "Scheduler.h"
+
+using namespace Peisik;
+
+// The instructions a chunk runs before the worker looks at its queue again
+static const uint64_t ChunkTimeSlice = 100000;
+
+ParallelReducer::ParallelReducer(std::shared_ptr<const Program> program, unsigned workerCount)
+    : m_program(program), m_workerCount(workerCount)
+{
+    if (m_workerCount == 0)
+        m_workerCount = std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+// Defined here, since the scheduler is an incomplete type in the header
+ParallelReducer::~ParallelReducer() = default;
+
+PObject ParallelReducer::Reduce(short functionIndex, int64_t from, int64_t to, const ExecutionBudget& budget,
+    std::shared_ptr<SharedBudget> sharedBudget, std::vector<uint64_t>& opCounts)
+{
+    CheckFunction(functionIndex);
+    auto returnType = m_program->GetFunction(functionIndex).GetReturnType();
+    PObject result = returnType == PrimitiveType::Real ? ObjectFromReal(0.0) : ObjectFromInt(0);
+    if (from >= to)
+        return result;
+
+    // Split the range into chunks whose lengths differ by at most one.
+    // The length may not fit in an int64_t, but it does fit in an uint64_t.
+    auto length = static_cast<uint64_t>(to) - static_cast<uint64_t>(from);
+    auto chunkCount = std::min<uint64_t>(length, ChunkCount);
+    auto chunkLength = length / chunkCount;
+    auto longChunks = length % chunkCount;
+
+    std::vector<std::unique_ptr<Interpreter>> chunks;
+    auto start = static_cast<uint64_t>(from);
+    for (uint64_t i = 0; i < chunkCount; i++)
+    {
+        auto end = start + chunkLength + (i < longChunks ? 1 : 0);
+        chunks.emplace_back(new Interpreter(m_program));
+        chunks.back()->SetBudget(budget);
+        chunks.back()->SetSharedBudget(sharedBudget);
+        chunks.back()->SetRange(functionIndex, static_cast<int64_t>(start), static_cast<int64_t>(end));
+        start = end;
+    }
+
+    std::vector<std::exception_ptr> errors(chunks.size());
+    if (m_workerCount == 1)
+    {
+        for (size_t i = 0; i < chunks.size() && !errors[0]; i++)
+        {
+            try
+            {
+                chunks[i]->Execute();
+            }
+            catch (...)
+            {
+                errors[0] = std::current_exception();
+            }
+        }
+    }
+    else
+    {
+        if (!m_scheduler)
+            m_scheduler.reset(new Scheduler(m_workerCount, ChunkTimeSlice));
+
+        // Count the completed chunks instead of calling WaitAll(), so that the scheduler could be shared
+        std::mutex mutex;
+        std::condition_variable chunkCompleted;
+        size_t pendingCount = chunks.size();
+        for (size_t i = 0; i < chunks.size(); i++)
+        {
+            m_scheduler->Submit(*chunks[i], [&, i](Interpreter&, ExecutionStatus, std::exception_ptr error)
+            {
+                errors[i] = error;
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--pendingCount == 0)
+                    chunkCompleted.notify_all();
+            });
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        chunkCompleted.wait(lock, [&] { return pendingCount == 0; });
+    }
+
+    for (auto& chunk : chunks)
+    {
+        auto& chunkCounts = chunk->GetOpCounts();
+        for (size_t i = 0; i < opCounts.size() && i < chunkCounts.size(); i++)
+            opCounts[i] += chunkCounts[i];
+    }
+    for (auto& error : errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    // Combine in chunk order, so that rounding does not depend on the scheduling
+    for (auto& chunk : chunks)
+        result = InternalFunc::CallBinaryFunction(InternalFunction::Plus, result, chunk->GetRangeResult());
+    return result;
+}
+
+void ParallelReducer::CheckFunction(short functionIndex)
+{
+    // Decoding every function here also means that the chunks never decode a lazily loaded function
+    if (m_pureFunctions.empty())
+        m_pureFunctions = FindPureFunctions(*m_program);
+
+    if (functionIndex < 0 || functionIndex >= m_program->GetFunctionCount())
+        throw InterpreterException("Parallel call to an invalid function index.");
+    if (!m_pureFunctions[functionIndex])
+        throw InterpreterException("Parallel call to a function that is not pure.");
+
+    auto& function = m_program->GetFunction(functionIndex);
+    auto returnType = function.GetReturnType();
+    if (function.GetParameterCount() != 1 || function.GetLocalTypes()[0] != PrimitiveType::Int ||
+        (returnType != PrimitiveType::Int && returnType != PrimitiveType::Real && returnType != PrimitiveType::Bool))
+    {
+        throw InterpreterException("Parallel call to a function that does not take an Int and return Int, Real or Bool.");
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Interpreter.h"
+#include "PObject.h"
+#include "Program.h"
+
+namespace Peisik
+{
+    class Scheduler;
+
+    // Runs the CallParallel instruction: calls a pure function with each integer of a range and
+    // combines the results.
+    //
+    // The range is split into chunks, and each chunk is run by an interpreter of its own in range mode
+    // (see Interpreter::SetRange). The interpreters share the immutable program and are scheduled as
+    // green threads on a work-stealing Scheduler owned by the reducer, so that a program that itself runs
+    // on a Scheduler does not wait for its own workers. The chunk boundaries do not depend on the number
+    // of workers and the chunk results are combined in order, so a sum of reals is the same on any machine.
+    class ParallelReducer
+    {
+    public:
+        // The number of chunks a large range is split into.
+        static const int64_t ChunkCount = 256;
+
+        // Creates a reducer for the program. The worker threads are only started on the first call,
+        // one per hardware thread if the count is zero. With one worker the chunks are run inline.
+        ParallelReducer(std::shared_ptr<const Program> program, unsigned workerCount);
+
+        // Stops the worker threads.
+        ~ParallelReducer();
+
+        ParallelReducer(const ParallelReducer&) = delete;
+        ParallelReducer& operator=(const ParallelReducer&) = delete;
+
+        // Calls the function for each integer in [from, to) and returns the sum of the results,
+        // or the number of true results for a Bool function. The chunk interpreters get the budget and
+        // charge their instructions to the shared budget of the calling program, and the instructions
+        // they execute are added to the op counts.
+        // If the function is not pure or does not take one Int parameter, an InterpreterException is thrown.
+        // If a chunk throws, the other chunks stop at their next checkpoint and the exception of the first
+        // failed chunk is rethrown.
+        PObject Reduce(short functionIndex, int64_t from, int64_t to, const ExecutionBudget& budget,
+            std::shared_ptr<SharedBudget> sharedBudget, std::vector<uint64_t>& opCounts);
+
+    private:
+        void CheckFunction(short functionIndex);
+
+        std::shared_ptr<const Program> m_program;
+        unsigned m_workerCount;
+        std::unique_ptr<Scheduler> m_scheduler;
+        // Computed on the first call, which also decodes a lazily loaded program before the threads start
+        std::vector<bool> m_pureFunctions;
+    };
+}
@@ -0,0 +1,327 @@
+#include "pch.h"
+#include "InternalFunctions.h"
+#include "Peephole.h"
+#include "PurityAnalysis.h"
+
+using namespace Peisik;
+
+// An instruction with the jump target stored as an absolute index, so that instructions can be
+// removed without updating the relative offsets of every jump over them.
+struct PeepholeOp
+{
+    BytecodeOp op;
+    int64_t target;
+    bool removed;
+};
+
+static bool IsJump(const BytecodeOp& op)
+{
+    return IsJumpOpcode(op.op);
+}
+
+static bool IsInternalCall(const BytecodeOp& op)
+{
+    return op.op >= Opcode::CallI0 && op.op <= Opcode::CallI7;
+}
+
+static bool IsConstantPush(const BytecodeOp& op)
+{
+    return op.op == Opcode::PushConst || op.op == Opcode::PushImm;
+}
+
+static PObject GetPushedConstant(const Program& program, const BytecodeOp& op)
+{
+    if (op.op == Opcode::PushImm)
+        return ObjectFromInt(op.param);
+    else
+        return program.GetConstant(op.param);
+}
+
+// Returns true if the constant fits in the parameter of PushImm and the other immediate instructions.
+static bool IsImmediate(const PObject& constant)
+{
+    return constant.GetType() == PrimitiveType::Int &&
+        constant.GetIntValue() >= SHRT_MIN && constant.GetIntValue() <= SHRT_MAX;
+}
+
+// Removes the instructions marked as removed. The jumps to a removed instruction are moved
+// to the next remaining one, which is only correct because removed sequences have no effect.
+static void Compact(std::vector<PeepholeOp>& code)
+{
+    std::vector<int64_t> newIndex(code.size() + 1);
+    int64_t count = 0;
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        newIndex[i] = count;
+        if (!code[i].removed)
+            count++;
+    }
+    newIndex[code.size()] = count;
+
+    std::vector<PeepholeOp> result;
+    result.reserve(static_cast<size_t>(count));
+    for (auto& instruction : code)
+    {
+        if (instruction.removed)
+            continue;
+        result.push_back(instruction);
+        if (IsJump(instruction.op))
+            result.back().target = newIndex[instruction.target];
+    }
+    code.swap(result);
+}
+
+// Marks the instructions that cannot be reached from the function start as removed.
+// Returns false if a reachable jump points outside the function.
+static bool RemoveUnreachable(std::vector<PeepholeOp>& code, bool& changed)
+{
+    std::vector<bool> reachable(code.size(), false);
+    std::vector<int64_t> worklist;
+    if (!code.empty())
+        worklist.push_back(0);
+
+    while (!worklist.empty())
+    {
+        auto i = worklist.back();
+        worklist.pop_back();
+        if (reachable[i])
+            continue;
+        reachable[i] = true;
+
+        auto& op = code[i].op;
+        if (IsJump(op))
+        {
+            if (code[i].target < 0 || code[i].target >= static_cast<int64_t>(code.size()))
+                return false;
+            worklist.push_back(code[i].target);
+        }
+        if (op.op != Opcode::Jump && op.op != Opcode::Return && i + 1 < static_cast<int64_t>(code.size()))
+            worklist.push_back(i + 1);
+    }
+
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        if (!reachable[i])
+        {
+            code[i].removed = true;
+            changed = true;
+        }
+    }
+    return true;
+}
+
+static void ThreadJumps(std::vector<PeepholeOp>& code, bool& changed)
+{
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        auto& instruction = code[i];
+        if (!IsJump(instruction.op))
+            continue;
+
+        // Follow chains of unconditional jumps, giving up on cycles
+        auto target = instruction.target;
+        for (size_t steps = 0; code[target].op.op == Opcode::Jump && steps < code.size(); steps++)
+            target = code[target].target;
+        if (target != instruction.target)
+        {
+            instruction.target = target;
+            changed = true;
+        }
+
+        if (instruction.op.op == Opcode::Jump && code[target].op.op == Opcode::Return)
+        {
+            instruction.op = code[target].op;
+            changed = true;
+        }
+        else if (target == static_cast<int64_t>(i + 1) &&
+            (instruction.op.op == Opcode::Jump || instruction.op.op == Opcode::JumpFalse))
+        {
+            // Only the condition of a JumpFalse needs to be discarded.
+            // Compare-and-branch instructions are kept, since the comparison may fail.
+            if (instruction.op.op == Opcode::Jump)
+                instruction.removed = true;
+            else
+                instruction.op = BytecodeOp(Opcode::PopDiscard, 0);
+            changed = true;
+        }
+    }
+}
+
+// Evaluates the internal call at the specified index if all its parameters are constants.
+static bool TryFoldConstantCall(Program& program, std::vector<PeepholeOp>& code,
+    const std::vector<bool>& isTarget, size_t index)
+{
+    auto& call = code[index].op;
+    auto paramCount = static_cast<size_t>(call.op) - static_cast<size_t>(Opcode::CallI0);
+    auto function = static_cast<InternalFunction>(call.param);
+    if (paramCount == 0 || paramCount > index || !IsInternalFunctionPure(function))
+        return false;
+
+    // Jumping into the middle of the sequence would skip some of the pushes
+    for (auto i = index - paramCount; i < index; i++)
+    {
+        if (code[i].removed || !IsConstantPush(code[i].op) || (i > index - paramCount && isTarget[i]))
+            return false;
+    }
+    if (isTarget[index])
+        return false;
+
+    // The first parameter is on top of the parameter stack
+    ParameterStack params;
+    for (auto i = index; i > index - paramCount; i--)
+        params.push(GetPushedConstant(program, code[i - 1].op));
+
+    try
+    {
+        auto result = InternalFunc::CallPureFunction(function, params);
+        if (result.GetType() == PrimitiveType::Void)
+            return false;
+
+        code[index].op = BytecodeOp(Opcode::PushConst, program.AddConstant(result));
+    }
+    catch (std::exception&)
+    {
+        // Errors such as division by zero are left to happen at run time, if the code is ever reached
+        return false;
+    }
+
+    for (auto i = index - paramCount; i < index; i++)
+        code[i].removed = true;
+    return true;
+}
+
+static void RemovePatterns(Program& program, std::vector<PeepholeOp>& code, bool& changed)
+{
+    std::vector<bool> isTarget(code.size(), false);
+    for (auto& instruction : code)
+    {
+        if (IsJump(instruction.op))
+            isTarget[instruction.target] = true;
+    }
+
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        auto& op = code[i].op;
+        if (code[i].removed)
+            continue;
+
+        if (IsInternalCall(op))
+        {
+            if (TryFoldConstantCall(program, code, isTarget, i))
+                changed = true;
+            continue;
+        }
+
+        if (i + 1 >= code.size() || isTarget[i + 1])
+            continue;
+        auto& next = code[i + 1].op;
+
+        bool deadPush = (IsConstantPush(op) || op.op == Opcode::PushLocal) && next.op == Opcode::PopDiscard;
+        bool selfAssignment = op.op == Opcode::PushLocal && next.op == Opcode::PopLocal && op.param == next.param;
+        if (deadPush || selfAssignment)
+        {
+            code[i].removed = true;
+            code[i + 1].removed = true;
+            changed = true;
+            i++;
+        }
+    }
+}
+
+// Replaces small integer constants with PushImm, PushImm followed by an arithmetic CallI2 with
+// the immediate instruction, and a comparison followed by JumpFalse with the compare-and-branch instruction.
+static void FuseInstructions(Program& program, std::vector<PeepholeOp>& code)
+{
+    std::vector<bool> isTarget(code.size(), false);
+    for (auto& instruction : code)
+    {
+        if (IsJump(instruction.op))
+            isTarget[instruction.target] = true;
+    }
+
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        auto& op = code[i].op;
+        if (op.op == Opcode::PushConst && IsImmediate(program.GetConstant(op.param)))
+            op = BytecodeOp(Opcode::PushImm, static_cast<short>(program.GetConstant(op.param).GetIntValue()));
+
+        if (i + 1 >= code.size() || isTarget[i + 1])
+            continue;
+        auto& next = code[i + 1].op;
+        if (op.op == Opcode::PushImm && next.op == Opcode::CallI2)
+        {
+            auto immediateOp = GetImmediateOpcode(static_cast<InternalFunction>(next.param));
+            if (immediateOp != Opcode::Invalid)
+            {
+                next = BytecodeOp(immediateOp, op.param);
+                code[i].removed = true;
+            }
+        }
+        else if (op.op == Opcode::CallI2 && next.op == Opcode::JumpFalse)
+        {
+            auto jumpOp = GetFusedJumpOpcode(static_cast<InternalFunction>(op.param));
+            if (jumpOp != Opcode::Invalid)
+            {
+                op = BytecodeOp(jumpOp, 0);
+                code[i].target = code[i + 1].target;
+                code[i + 1].removed = true;
+                i++;
+            }
+        }
+    }
+}
+
+int Peisik::OptimizePeephole(Program& program, Function& function)
+{
+    auto& bytecode = function.GetBytecode();
+
+    std::vector<PeepholeOp> code;
+    code.reserve(bytecode.size());
+    for (size_t i = 0; i < bytecode.size(); i++)
+    {
+        PeepholeOp instruction = { bytecode[i], static_cast<int64_t>(i) + bytecode[i].param, false };
+        code.push_back(instruction);
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        if (!RemoveUnreachable(code, changed))
+            return 0;
+        Compact(code);
+
+        ThreadJumps(code, changed);
+        Compact(code);
+
+        RemovePatterns(program, code, changed);
+        Compact(code);
+    }
+
+    // Fusing is done last, so that constant folding sees the separate internal calls
+    FuseInstructions(program, code);
+    Compact(code);
+
+    std::vector<BytecodeOp> result;
+    result.reserve(code.size());
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        result.push_back(code[i].op);
+        if (IsJump(code[i].op))
+            result.back().param = static_cast<short>(code[i].target - static_cast<int64_t>(i));
+    }
+
+    auto removed = static_cast<int>(bytecode.size() - result.size());
+    function.SetBytecode(result);
+    return removed;
+}
+
+int Peisik::OptimizePeephole(Program& program)
+{
+    int removed = 0;
+    for (short i = 0; i < program.GetFunctionCount(); i++)
+    {
+        removed += OptimizePeephole(program, program.GetMutableFunction(i));
+    }
+    return removed;
+}
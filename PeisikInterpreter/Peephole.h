@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Program.h"
+
+namespace Peisik
+{
+    // Simplifies the bytecode of every function after loading:
+    //  - internal calls with only constant parameters are folded into new constants,
+    //  - pushes that are immediately discarded and PushLocal x + PopLocal x are removed,
+    //  - jumps to jumps are threaded, jumps to Return become Return and jumps to the next instruction are removed,
+    //  - unreachable code is dropped.
+    // Finally, small integer constants become PushImm, and PushImm or a comparison followed by an internal
+    // call or JumpFalse is fused into an immediate or a compare-and-branch instruction.
+    // Functions with reachable jumps out of bounds are left unchanged.
+    // Returns the number of removed instructions.
+    int OptimizePeephole(Program& program);
+
+    // Simplifies the bytecode of a single function of the program, for example one decoded lazily.
+    // Returns the number of removed instructions.
+    int OptimizePeephole(Program& program, Function& function);
+}
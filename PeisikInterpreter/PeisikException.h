@@ -11,6 +11,13 @@ namespace Peisik
         ApplicationException(const char* msg) : std::runtime_error(msg) {};
     };
 
+    // The program ran out of its execution budget.
+    class BudgetExceededException : public ApplicationException
+    {
+    public:
+        BudgetExceededException(const char* msg) : ApplicationException(msg) {};
+    };
+
     // Invalid program.
     class InterpreterException : public std::runtime_error
     {
@@ -0,0 +1,201 @@
+#include "pch.h"
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace Peisik;
+
+static const int EventCount = static_cast<int>(PerfEvent::EventCount);
+
+#ifdef __linux__
+
+// Fills in the type and config of the perf_event_attr structure for the given event.
+static void DescribeEvent(PerfEvent event, perf_event_attr& attr)
+{
+    const uint64_t cacheReadMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+    switch (event)
+    {
+    case PerfEvent::Cycles:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PerfEvent::Instructions:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PerfEvent::Branches:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_BRANCH_INSTRUCTIONS;
+        break;
+    case PerfEvent::BranchMisses:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    case PerfEvent::L1DataMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D | cacheReadMiss;
+        break;
+    case PerfEvent::L1InstructionMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1I | cacheReadMiss;
+        break;
+    case PerfEvent::LastLevelCacheMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_LL | cacheReadMiss;
+        break;
+    default:
+        throw std::invalid_argument("Unknown performance event.");
+    }
+}
+
+PerfCounters::PerfCounters()
+{
+    for (int i = 0; i < EventCount; i++)
+    {
+        m_values[i] = 0;
+
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        DescribeEvent(static_cast<PerfEvent>(i), attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // This thread on any CPU. Failures (no PMU, perf_event_paranoid, seccomp...) leave the counter closed.
+        m_fds[i] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    for (int i = 0; i < EventCount; i++)
+    {
+        if (m_fds[i] >= 0)
+            close(m_fds[i]);
+    }
+}
+
+void PerfCounters::Start()
+{
+    for (int i = 0; i < EventCount; i++)
+    {
+        if (m_fds[i] < 0)
+            continue;
+        ioctl(m_fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(m_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void PerfCounters::Stop()
+{
+    for (int i = 0; i < EventCount; i++)
+    {
+        if (m_fds[i] < 0)
+            continue;
+        ioctl(m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    for (int i = 0; i < EventCount; i++)
+    {
+        m_values[i] = 0;
+        if (m_fds[i] < 0)
+            continue;
+
+        // Value, time enabled, time running
+        uint64_t data[3] = { 0, 0, 0 };
+        if (read(m_fds[i], data, sizeof(data)) != sizeof(data))
+            continue;
+
+        if (data[2] > 0 && data[2] < data[1])
+            m_values[i] = static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] / data[2]);
+        else
+            m_values[i] = data[0];
+    }
+}
+
+#else
+
+PerfCounters::PerfCounters()
+{
+    for (int i = 0; i < EventCount; i++)
+    {
+        m_fds[i] = -1;
+        m_values[i] = 0;
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+}
+
+void PerfCounters::Start()
+{
+}
+
+void PerfCounters::Stop()
+{
+}
+
+#endif
+
+bool PerfCounters::IsAvailable() const
+{
+    for (int i = 0; i < EventCount; i++)
+    {
+        if (m_fds[i] >= 0)
+            return true;
+    }
+    return false;
+}
+
+bool PerfCounters::IsAvailable(PerfEvent event) const
+{
+    return m_fds[static_cast<int>(event)] >= 0;
+}
+
+uint64_t PerfCounters::GetValue(PerfEvent event) const
+{
+    return m_values[static_cast<int>(event)];
+}
+
+void PerfCounters::PrintReport(const std::string& title) const
+{
+    const char* names[] = {
+        "Cycles", "Instructions", "Branches", "Branch misses",
+        "L1d read misses", "L1i read misses", "LLC read misses"
+    };
+
+    auto oldPrecision = std::cout.precision();
+    std::cout << "   " << title << ":" << std::endl;
+    for (int i = 0; i < EventCount; i++)
+    {
+        std::cout << "     " << std::left << std::setw(18) << names[i];
+        if (m_fds[i] >= 0)
+            std::cout << m_values[i] << std::endl;
+        else
+            std::cout << "n/a" << std::endl;
+    }
+
+    // Derived metrics
+    if (IsAvailable(PerfEvent::Cycles) && IsAvailable(PerfEvent::Instructions) && GetValue(PerfEvent::Cycles) > 0)
+    {
+        std::cout << "     " << std::setw(18) << "IPC" << std::fixed << std::setprecision(2)
+            << static_cast<double>(GetValue(PerfEvent::Instructions)) / GetValue(PerfEvent::Cycles) << std::endl;
+        std::cout.unsetf(std::ios_base::floatfield);
+    }
+    if (IsAvailable(PerfEvent::Branches) && IsAvailable(PerfEvent::BranchMisses) && GetValue(PerfEvent::Branches) > 0)
+    {
+        std::cout << "     " << std::setw(18) << "Branch miss rate" << std::fixed << std::setprecision(2)
+            << 100.0 * GetValue(PerfEvent::BranchMisses) / GetValue(PerfEvent::Branches) << " %" << std::endl;
+        std::cout.unsetf(std::ios_base::floatfield);
+    }
+    std::cout.precision(oldPrecision);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace Peisik
+{
+    // Hardware events measured by PerfCounters.
+    enum class PerfEvent
+    {
+        Cycles,
+        Instructions,
+        Branches,
+        BranchMisses,
+        L1DataMisses,
+        L1InstructionMisses,
+        LastLevelCacheMisses,
+        EventCount
+    };
+
+    // Measures hardware performance counters for the current thread.
+    // Only implemented on Linux via perf_event_open. Elsewhere, or if the kernel denies access,
+    // the counters are simply unavailable and all operations do nothing.
+    class PerfCounters
+    {
+    public:
+        PerfCounters();
+        ~PerfCounters();
+
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        // Returns true if at least one counter could be opened.
+        bool IsAvailable() const;
+
+        // Returns true if the specified counter could be opened.
+        bool IsAvailable(PerfEvent event) const;
+
+        // Resets and starts all counters.
+        void Start();
+
+        // Stops all counters and stores their values.
+        void Stop();
+
+        // Gets the value of the counter measured between the last Start() and Stop().
+        // The value is scaled if the kernel had to multiplex the counters.
+        uint64_t GetValue(PerfEvent event) const;
+
+        // Prints the counter values, indented for the per-module report.
+        void PrintReport(const std::string& title) const;
+
+    private:
+        int m_fds[static_cast<int>(PerfEvent::EventCount)];
+        uint64_t m_values[static_cast<int>(PerfEvent::EventCount)];
+    };
+}
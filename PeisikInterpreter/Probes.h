@@ -0,0 +1,40 @@
+#pragma once
+
+// Static tracepoints for bpftrace, perf and other USDT consumers, in the "peisik" provider.
+//
+// With the systemtap sys/sdt.h header, each probe compiles to a single nop and an ELF note that tells
+// the tracer where the nop is and where the arguments are. The arguments are only read when a tracer
+// attaches, so they must be cheap to compute. Without the header, or if PEISIK_NO_USDT is defined,
+// the probes compile to nothing. List the probes with `readelf -n peisik` or `bpftrace -l 'usdt:./peisik:*'`.
+//
+// The program counter of a probe is that of the instruction, like in the binary trace: the instruction
+// index in the wide bytecode, or the byte offset in the compact code. The call depth counts the frames.
+//
+//   function__entry(function, caller, pc, depth)   A frame was pushed for the function. The caller is the
+//                                                  calling function and the pc that of its call, or -1 and 0
+//                                                  for the entry function.
+//   function__return(function, pc, depth)         The frame of the function was popped by a Return or
+//                                                  replaced by a tail call at the pc.
+//   internal__call(id, function, pc)               The function calls the InternalFunction with the id.
+//   fail__fast(function, pc, depth)                The program called FailFast.
+//   error(function, pc, message)                   The program is stopped by an exception, such as an
+//                                                  ApplicationException or an exceeded budget.
+//   load__start(lazy)                              DeserializeProgram starts reading a module.
+//   load__done(lazy, functions, main)              The module has been loaded, but not yet optimized.
+
+#if !defined(PEISIK_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PEISIK_USDT 1
+#endif
+#endif
+
+#ifdef PEISIK_USDT
+#define PEISIK_PROBE1(name, a) DTRACE_PROBE1(peisik, name, a)
+#define PEISIK_PROBE3(name, a, b, c) DTRACE_PROBE3(peisik, name, a, b, c)
+#define PEISIK_PROBE4(name, a, b, c, d) DTRACE_PROBE4(peisik, name, a, b, c, d)
+#else
+#define PEISIK_PROBE1(name, a) do { } while (0)
+#define PEISIK_PROBE3(name, a, b, c) do { } while (0)
+#define PEISIK_PROBE4(name, a, b, c, d) do { } while (0)
+#endif
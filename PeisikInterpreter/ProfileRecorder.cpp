@@ -0,0 +1,144 @@
+#include "pch.h"
+#include "CompactBytecode.h"
+#include "ProfileRecorder.h"
+
+using namespace Peisik;
+
+static const char* TypeToString(uint32_t type)
+{
+    switch (static_cast<PrimitiveType>(type))
+    {
+    case PrimitiveType::Int:
+        return "Int";
+    case PrimitiveType::Real:
+        return "Real";
+    case PrimitiveType::Bool:
+        return "Bool";
+    case PrimitiveType::Void:
+        return "Void";
+    case PrimitiveType::IntArray:
+        return "IntArray";
+    case PrimitiveType::RealArray:
+        return "RealArray";
+    default:
+        return "NoType";
+    }
+}
+
+ProfileRecorder::ProfileRecorder(const Program& program)
+    : m_program(program), m_sites(program.GetFunctionCount()), m_pendingBranch(nullptr), m_pendingFallthrough(0)
+{
+}
+
+bool ProfileRecorder::IsConditionalJump(Opcode op)
+{
+    switch (op)
+    {
+    case Opcode::JumpFalse:
+    case Opcode::JumpIfNotLess:
+    case Opcode::JumpIfNotLessEqual:
+    case Opcode::JumpIfNotGreater:
+    case Opcode::JumpIfNotGreaterEqual:
+    case Opcode::JumpIfNotEqual:
+    case Opcode::JumpIfEqual:
+        return true;
+    default:
+        return false;
+    }
+}
+
+ProfileRecorder::Site& ProfileRecorder::GetSite(short functionIndex, uint32_t programCounter, uint32_t codeSize)
+{
+    // Allocated once per function, so the pending branch stays valid
+    auto& sites = m_sites[functionIndex];
+    if (sites.empty())
+    {
+        Site empty = { 0, 0, 0, false };
+        sites.resize(codeSize, empty);
+    }
+    return sites[programCounter];
+}
+
+void ProfileRecorder::CountSite(short functionIndex, uint32_t programCounter, uint32_t codeSize,
+    uint32_t nextProgramCounter, Opcode op)
+{
+    auto& site = GetSite(functionIndex, programCounter, codeSize);
+    site.count++;
+    if (op != Opcode::Call)
+    {
+        m_pendingBranch = &site;
+        m_pendingFallthrough = nextProgramCounter;
+    }
+}
+
+void ProfileRecorder::CountInternalCall(short functionIndex, uint32_t programCounter, uint32_t codeSize, uint32_t typeSignature)
+{
+    auto& site = GetSite(functionIndex, programCounter, codeSize);
+    if (site.count == 0)
+        site.typeSignature = typeSignature;
+    else if (site.typeSignature != typeSignature)
+        site.mixedTypes = true;
+    site.count++;
+}
+
+void ProfileRecorder::Write(std::ostream& stream) const
+{
+    stream << "peisik-profile 1" << std::endl;
+
+    // The main function is entered once, every other function through call sites
+    std::vector<uint64_t> calls(m_program.GetFunctionCount(), 0);
+    if (!m_sites[m_program.GetMainFunctionIndex()].empty())
+        calls[m_program.GetMainFunctionIndex()] = 1;
+
+    std::ostringstream sites;
+    for (short function = 0; function < m_program.GetFunctionCount(); function++)
+    {
+        auto& functionSites = m_sites[function];
+        if (functionSites.empty())
+            continue;
+
+        // The sites are indexed by the program counter, which is a byte offset in compact code
+        auto& bytecode = m_program.GetFunction(function).GetBytecode();
+        auto& compactCode = m_program.GetFunction(function).GetCompactCode();
+        uint32_t programCounter = 0;
+        for (uint32_t index = 0; index < bytecode.size(); index++)
+        {
+            auto& op = bytecode[index];
+            auto& site = functionSites[programCounter];
+            if (op.op == Opcode::Call)
+            {
+                calls[op.param] += site.count;
+                sites << "call " << function << " " << index << " " << op.param << " " << site.count << std::endl;
+            }
+            else if (IsConditionalJump(op.op))
+            {
+                sites << "branch " << function << " " << index << " " << site.taken << " "
+                    << (site.count - site.taken) << std::endl;
+            }
+            else if (op.op >= Opcode::CallI0 && op.op <= Opcode::CallI7 && site.count > 0)
+            {
+                sites << "types " << function << " " << index << " " << op.param << " " << site.count << " ";
+                auto parameterCount = static_cast<int>(op.op) - static_cast<int>(Opcode::CallI0);
+                if (site.mixedTypes)
+                    sites << "mixed";
+                else if (parameterCount == 0)
+                    sites << "none";
+                for (int i = 0; i < parameterCount && !site.mixedTypes; i++)
+                    sites << (i > 0 ? "," : "") << TypeToString((site.typeSignature >> (4 * i)) & 0xF);
+                sites << std::endl;
+            }
+
+            if (compactCode.empty())
+                programCounter++;
+            else
+                DecodeExecutableOp(compactCode.data(), programCounter);
+        }
+    }
+
+    for (short function = 0; function < m_program.GetFunctionCount(); function++)
+    {
+        if (calls[function] > 0)
+            stream << "function " << function << " " << calls[function] << std::endl;
+    }
+    stream << sites.str();
+}
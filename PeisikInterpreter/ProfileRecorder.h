@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "PObject.h"
+#include "Program.h"
+
+namespace Peisik
+{
+    // Records the execution profile of a program for profile-guided optimization in the compiler
+    // (peisikc --profile-use): how often each function is called and from where, how often each
+    // conditional jump is taken, and the operand types seen by each internal call.
+    //
+    // The sites are indexed by the program counter, so the counts are only meaningful if the
+    // bytecode has not been rewritten by the load-time passes since it was compiled.
+    //
+    // The profile is a text file with one record per line, the fields separated by spaces:
+    //   peisik-profile 1                                   the format version, first
+    //   function F CALLS                                   calls of function F, 1 for main
+    //   call F I CALLEE COUNT                              executions of the Call at instruction I of F
+    //   branch F I TAKEN NOTTAKEN                          executions of the conditional jump at I of F
+    //   types F I FUNCTION COUNT TYPE,...|mixed|none      operand types of the internal call at I of F
+    // Every call and branch site of an executed function is listed, including the ones never executed,
+    // so that the compiler can detect a profile of different code.
+    class ProfileRecorder
+    {
+    public:
+        ProfileRecorder(const Program& program);
+
+        ProfileRecorder(const ProfileRecorder&) = delete;
+        ProfileRecorder& operator=(const ProfileRecorder&) = delete;
+
+        // Records an instruction before it is executed. The code size is the size of the executed code
+        // of the function, and the next program counter the address of the following instruction.
+        // The type signature is that of the parameters of an internal call, see GetTypeSignature().
+        void CountInstruction(short functionIndex, uint32_t programCounter, uint32_t codeSize,
+            uint32_t nextProgramCounter, Opcode op, uint32_t typeSignature)
+        {
+            // A conditional jump was taken if the next instruction is not the one following it
+            if (m_pendingBranch != nullptr)
+            {
+                if (programCounter != m_pendingFallthrough)
+                    m_pendingBranch->taken++;
+                m_pendingBranch = nullptr;
+            }
+
+            if (op == Opcode::Call || IsConditionalJump(op))
+                CountSite(functionIndex, programCounter, codeSize, nextProgramCounter, op);
+            else if (op >= Opcode::CallI0 && op <= Opcode::CallI7)
+                CountInternalCall(functionIndex, programCounter, codeSize, typeSignature);
+        }
+
+        // Encodes the types of up to eight objects in 4 bits each, the first object in the lowest bits.
+        template <typename Iterator>
+        static uint32_t GetTypeSignature(Iterator first, Iterator last)
+        {
+            uint32_t signature = 0;
+            for (int shift = 0; first != last; ++first, shift += 4)
+                signature |= static_cast<uint32_t>(first->GetType()) << shift;
+            return signature;
+        }
+
+        // Writes the profile in the format above.
+        void Write(std::ostream& stream) const;
+
+    private:
+        struct Site
+        {
+            uint64_t count;
+            uint64_t taken;
+            // The parameter types of the first execution of an internal call
+            uint32_t typeSignature;
+            bool mixedTypes;
+        };
+
+        static bool IsConditionalJump(Opcode op);
+        Site& GetSite(short functionIndex, uint32_t programCounter, uint32_t codeSize);
+        void CountSite(short functionIndex, uint32_t programCounter, uint32_t codeSize,
+            uint32_t nextProgramCounter, Opcode op);
+        void CountInternalCall(short functionIndex, uint32_t programCounter, uint32_t codeSize, uint32_t typeSignature);
+
+        const Program& m_program;
+        // The sites of each executed function by program counter, empty for the others
+        std::vector<std::vector<Site>> m_sites;
+        // The conditional jump executed last, resolved when the next instruction starts
+        Site* m_pendingBranch;
+        uint32_t m_pendingFallthrough;
+    };
+}
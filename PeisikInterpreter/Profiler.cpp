@@ -0,0 +1,101 @@
+#include "pch.h"
+#include "Profiler.h"
+
+using namespace Peisik;
+
+Profiler::Profiler(short functionCount)
+    : m_functions(functionCount, FunctionStats()),
+    m_startTicks(ReadTimestamp()), m_endTicks(0),
+    m_startTime(std::chrono::steady_clock::now())
+{
+}
+
+void Profiler::EnterFunction(short functionIndex)
+{
+    auto& stats = m_functions[functionIndex];
+    stats.calls++;
+    stats.activeCount++;
+    if (stats.activeCount > stats.maxDepth)
+        stats.maxDepth = stats.activeCount;
+
+    ActiveCall call = { functionIndex, ReadTimestamp(), 0 };
+    m_callStack.push_back(call);
+}
+
+void Profiler::LeaveFunction()
+{
+    auto now = ReadTimestamp();
+    auto call = m_callStack.back();
+    m_callStack.pop_back();
+
+    auto elapsed = now - call.enterTicks;
+    auto& stats = m_functions[call.functionIndex];
+    stats.activeCount--;
+    stats.exclusiveTicks += elapsed - call.childTicks;
+
+    // Only the outermost activation of a recursive function counts towards inclusive time,
+    // since the inner activations are already contained in it
+    if (stats.activeCount == 0)
+        stats.inclusiveTicks += elapsed;
+
+    if (!m_callStack.empty())
+        m_callStack.back().childTicks += elapsed;
+}
+
+void Profiler::Finish()
+{
+    while (!m_callStack.empty())
+        LeaveFunction();
+
+    m_endTicks = ReadTimestamp();
+    m_endTime = std::chrono::steady_clock::now();
+}
+
+void Profiler::PrintReport(short mainFunctionIndex) const
+{
+    // Calibrate the timestamp counter against the steady clock over the whole run
+    double seconds = std::chrono::duration<double>(m_endTime - m_startTime).count();
+    double secondsPerTick = (m_endTicks > m_startTicks && seconds > 0)
+        ? seconds / (m_endTicks - m_startTicks) : 0;
+
+    uint64_t totalExclusive = 0;
+    std::vector<short> order;
+    for (size_t i = 0; i < m_functions.size(); i++)
+    {
+        totalExclusive += m_functions[i].exclusiveTicks;
+        if (m_functions[i].calls > 0)
+            order.push_back(static_cast<short>(i));
+    }
+    std::sort(order.begin(), order.end(), [this](short a, short b)
+    {
+        return m_functions[a].exclusiveTicks > m_functions[b].exclusiveTicks;
+    });
+
+    auto oldPrecision = std::cout.precision();
+    std::cout << "-- Function profile (sorted by exclusive time)" << std::endl;
+    std::cout << std::left << std::setw(10) << "Function"
+        << std::right << std::setw(12) << "Calls"
+        << std::setw(15) << "Instructions"
+        << std::setw(12) << "Incl. (s)"
+        << std::setw(12) << "Excl. (s)"
+        << std::setw(9) << "Excl. %"
+        << std::setw(11) << "Max depth" << std::endl;
+
+    for (auto index : order)
+    {
+        auto& stats = m_functions[index];
+        std::string name = std::to_string(index) + (index == mainFunctionIndex ? " (main)" : "");
+        double exclusivePercent = totalExclusive > 0 ? 100.0 * stats.exclusiveTicks / totalExclusive : 0;
+
+        std::cout << std::left << std::setw(10) << name << std::right
+            << std::setw(12) << stats.calls
+            << std::setw(15) << stats.instructions
+            << std::fixed << std::setprecision(4)
+            << std::setw(12) << stats.inclusiveTicks * secondsPerTick
+            << std::setw(12) << stats.exclusiveTicks * secondsPerTick
+            << std::setprecision(1) << std::setw(9) << exclusivePercent
+            << std::setw(11) << stats.maxDepth << std::endl;
+        std::cout.unsetf(std::ios_base::floatfield);
+    }
+    std::cout.precision(oldPrecision);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include "Program.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace Peisik
+{
+    // Reads a cheap, monotonically increasing timestamp.
+    // On x86 this is the time stamp counter, elsewhere the steady clock in nanoseconds.
+    inline uint64_t ReadTimestamp()
+    {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+
+    // Collects per-function statistics: call counts, executed instructions,
+    // inclusive and exclusive time and the maximum recursion depth.
+    class Profiler
+    {
+    public:
+        Profiler(short functionCount);
+
+        // Records a call to the specified function.
+        void EnterFunction(short functionIndex);
+
+        // Records a return from the innermost function.
+        void LeaveFunction();
+
+        // Records an executed instruction in the specified function.
+        void CountInstruction(short functionIndex)
+        {
+            m_functions[functionIndex].instructions++;
+        }
+
+        // Leaves all functions still on the stack, for example after FailFast.
+        void Finish();
+
+        // Prints the statistics sorted by exclusive time.
+        void PrintReport(short mainFunctionIndex) const;
+
+    private:
+        struct FunctionStats
+        {
+            uint64_t calls;
+            uint64_t instructions;
+            uint64_t inclusiveTicks;
+            uint64_t exclusiveTicks;
+            int activeCount;
+            int maxDepth;
+        };
+
+        struct ActiveCall
+        {
+            short functionIndex;
+            uint64_t enterTicks;
+            uint64_t childTicks;
+        };
+
+        std::vector<FunctionStats> m_functions;
+        std::vector<ActiveCall> m_callStack;
+
+        // For converting ticks to seconds
+        uint64_t m_startTicks;
+        uint64_t m_endTicks;
+        std::chrono::steady_clock::time_point m_startTime;
+        std::chrono::steady_clock::time_point m_endTime;
+    };
+}
@@ -1,7 +1,12 @@
 #include "pch.h"
 #include "Bytecode.h"
+#include "CompactBytecode.h"
 #include "PeisikException.h"
+#include "Probes.h"
 #include "Program.h"
+#include <atomic>
+#include <deque>
+#include <thread>
 
 using namespace Peisik;
 
@@ -9,6 +14,12 @@ using namespace Peisik;
  * Function
  */
 
+Function::Function()
+    : m_packedBytecode(nullptr), m_packedCompactCode(nullptr), m_functionIndex(0), m_parameterCount(0),
+    m_returnType(PrimitiveType::Void), m_decoded(false), m_codeSizeBound(0)
+{
+}
+
 const std::vector<BytecodeOp>& Function::GetBytecode() const
 {
     return m_bytecode;
@@ -34,6 +45,74 @@ PrimitiveType Function::GetReturnType() const
     return m_returnType;
 }
 
+short Function::AddLocal(PrimitiveType type)
+{
+    if (m_localTypes.size() >= 32767)
+        throw std::range_error("Too many locals.");
+
+    m_localTypes.push_back(type);
+    UpdateFootprint();
+    return static_cast<short>(m_localTypes.size() - 1);
+}
+
+void Function::SetBytecode(std::vector<BytecodeOp> bytecode)
+{
+    m_bytecode = std::move(bytecode);
+    m_compactCode.clear();
+    m_packedBytecode = nullptr;
+    m_packedCompactCode = nullptr;
+    UpdateFootprint();
+}
+
+const std::vector<uint8_t>& Function::GetCompactCode() const
+{
+    return m_compactCode;
+}
+
+void Function::SetCompactCode(std::vector<uint8_t> code)
+{
+    m_compactCode = std::move(code);
+    m_packedBytecode = nullptr;
+    m_packedCompactCode = nullptr;
+    UpdateFootprint();
+}
+
+const BytecodeOp* Function::GetExecutableBytecode() const
+{
+    if (!m_compactCode.empty())
+        return nullptr;
+    return m_packedBytecode != nullptr ? m_packedBytecode : m_bytecode.data();
+}
+
+const uint8_t* Function::GetExecutableCompactCode() const
+{
+    if (m_compactCode.empty())
+        return nullptr;
+    return m_packedCompactCode != nullptr ? m_packedCompactCode : m_compactCode.data();
+}
+
+uint32_t Function::GetInstructionIndex(uint32_t programCounter) const
+{
+    if (m_compactCode.empty())
+        return programCounter;
+
+    // Only used for reports, so walking the code is fast enough
+    uint32_t index = 0;
+    uint32_t offset = 0;
+    while (offset < programCounter && offset < m_compactCode.size() - 1)
+    {
+        DecodeExecutableOp(m_compactCode.data(), offset);
+        index++;
+    }
+    return index;
+}
+
+void Function::UpdateFootprint()
+{
+    m_footprint.SetSize(m_bytecode.capacity() * sizeof(BytecodeOp) + m_compactCode.capacity()
+        + m_localTypes.capacity() * sizeof(PrimitiveType));
+}
+
 
 
 /*
@@ -55,6 +134,20 @@ short Program::GetConstantCount() const
     return static_cast<short>(m_constants.size());
 }
 
+short Program::AddConstant(const PObject& value)
+{
+    for (size_t i = 0; i < m_constants.size(); i++)
+    {
+        if (m_constants[i].IsIdenticalTo(value))
+            return static_cast<short>(i);
+    }
+
+    if (m_constants.size() >= 32767)
+        throw std::range_error("Too many constants.");
+    m_constants.push_back(value);
+    return static_cast<short>(m_constants.size() - 1);
+}
+
 const Function& Program::GetFunction(short index) const
 {
     if (index < 0 || index >= GetFunctionCount())
@@ -62,7 +155,23 @@ const Function& Program::GetFunction(short index) const
         throw std::range_error("Function index out of range.");
     }
 
-    return m_functions[index];
+    auto& function = m_functions[index];
+    if (!function.m_decoded)
+        DecodeLazily(index);
+    return function;
+}
+
+Function& Program::GetMutableFunction(short index)
+{
+    if (index < 0 || index >= GetFunctionCount())
+    {
+        throw std::range_error("Function index out of range.");
+    }
+
+    auto& function = m_functions[index];
+    if (!function.m_decoded)
+        DecodeLazily(index);
+    return function;
 }
 
 short Program::GetFunctionCount() const
@@ -75,66 +184,238 @@ short Program::GetMainFunctionIndex() const
     return m_mainFunctionIndex;
 }
 
+size_t Program::GetLongestFunctionLength() const
+{
+    size_t result = 0;
+    for (auto& function : m_functions)
+    {
+        result = std::max(result, function.m_decoded
+            ? function.m_bytecode.size() : static_cast<size_t>(function.m_codeSizeBound));
+    }
+    return result;
+}
+
+void Program::SetFunctionDecodedHandler(FunctionDecodedHandler handler)
+{
+    m_decodedHandler = handler;
+}
+
+uint64_t Program::GetIdentityHash() const
+{
+    // FNV-1a over the values, field by field so that the padding is not hashed
+    uint64_t hash = 14695981039346656037ULL;
+    auto add = [&hash](uint64_t value)
+    {
+        hash ^= value;
+        hash *= 1099511628211ULL;
+    };
+
+    add(static_cast<uint64_t>(m_mainFunctionIndex));
+    add(m_constants.size());
+    for (auto& constant : m_constants)
+    {
+        add(static_cast<uint64_t>(constant.GetType()));
+        add(static_cast<uint64_t>(constant.GetRawValue()));
+    }
+
+    add(m_functions.size());
+    for (short i = 0; i < GetFunctionCount(); i++)
+    {
+        auto& function = GetFunction(i);
+        add(static_cast<uint64_t>(function.GetReturnType()));
+        add(static_cast<uint64_t>(function.GetParameterCount()));
+        add(function.GetLocalTypes().size());
+        for (auto type : function.GetLocalTypes())
+            add(static_cast<uint64_t>(type));
+        add(function.GetBytecode().size());
+        for (auto& op : function.GetBytecode())
+            add(static_cast<uint64_t>(op.op) << 16 | static_cast<uint16_t>(op.param));
+        add(function.GetCompactCode().size());
+        for (auto byte : function.GetCompactCode())
+            add(byte);
+    }
+    return hash;
+}
+
 
 /*
- * Global namespace
+ * Code packing
  */
 
+// The executable code of the packed functions, in layout order
+struct Peisik::CodeArena
+{
+    std::vector<BytecodeOp, CountingAllocator<BytecodeOp, MemoryCategory::ProgramImage>> bytecode;
+    std::vector<uint8_t, CountingAllocator<uint8_t, MemoryCategory::ProgramImage>> compactCode;
+};
+
+// The alignment of each function in the compact code arena, so that a short function does not straddle cache lines
+static const size_t CompactCodeAlignment = 16;
+
+size_t Program::PackCode(const std::vector<short>& order)
+{
+    // The offset of each packed function in its arena
+    static const size_t NotPacked = SIZE_MAX;
+    std::vector<size_t> offsets(m_functions.size(), NotPacked);
+
+    auto arena = std::make_shared<CodeArena>();
+    for (auto index : order)
+    {
+        auto& function = GetFunction(index);
+        if (offsets[index] != NotPacked)
+            continue;
+
+        if (function.m_compactCode.empty())
+        {
+            offsets[index] = arena->bytecode.size();
+            arena->bytecode.insert(arena->bytecode.end(), function.m_bytecode.begin(), function.m_bytecode.end());
+        }
+        else
+        {
+            offsets[index] = arena->compactCode.size();
+            arena->compactCode.insert(arena->compactCode.end(), function.m_compactCode.begin(), function.m_compactCode.end());
+            arena->compactCode.resize((arena->compactCode.size() + CompactCodeAlignment - 1) & ~(CompactCodeAlignment - 1));
+        }
+    }
+    arena->bytecode.shrink_to_fit();
+    arena->compactCode.shrink_to_fit();
+
+    // Only now that the arena no longer moves. A previous arena is released, so no function may point into it.
+    for (size_t i = 0; i < m_functions.size(); i++)
+    {
+        auto& function = m_functions[i];
+        function.m_packedBytecode = nullptr;
+        function.m_packedCompactCode = nullptr;
+        if (offsets[i] == NotPacked)
+            continue;
+
+        if (function.m_compactCode.empty())
+            function.m_packedBytecode = arena->bytecode.data() + offsets[i];
+        else
+            function.m_packedCompactCode = arena->compactCode.data() + offsets[i];
+    }
+
+    m_codeArena = arena;
+    return arena->bytecode.size() * sizeof(BytecodeOp) + arena->compactCode.size();
+}
+
+
+/*
+ * Loading
+ */
+
+// The states of a function in the lazy function table
+static const int PredecodeEmpty = 0;
+static const int PredecodeBusy = 1;
+static const int PredecodeReady = 2;
+static const int PredecodeTaken = 3;
+
+struct PredecodedFunction
+{
+    std::atomic<int> state;
+    Function function;
+};
+
+// The contents of a module file
+typedef std::vector<char, CountingAllocator<char, MemoryCategory::ProgramImage>> ModuleImage;
+
+// The module image of a lazily loaded program and the functions decoded ahead of use
+struct Peisik::LazyFunctionTable
+{
+    LazyFunctionTable()
+        : compact(false), stopping(false)
+    {
+    }
+
+    ~LazyFunctionTable()
+    {
+        stopping = true;
+        if (predecoder.joinable())
+            predecoder.join();
+    }
+
+    ModuleImage image;
+    bool compact;
+    // The offset of each function record in the image
+    std::vector<size_t> offsets;
+    std::unique_ptr<PredecodedFunction[]> predecoded;
+    std::atomic<bool> stopping;
+    std::thread predecoder;
+};
+
 static void AssertValidType(short type)
 {
+    if (type <= (short)PrimitiveType::NoType || type > (short)PrimitiveType::RealArray)
+        throw std::invalid_argument("Invalid type.");
+}
+
+static void AssertValidConstantType(short type)
+{
+    // Arrays are only created at run time
     if (type <= (short)PrimitiveType::NoType || type > (short)PrimitiveType::Bool)
         throw std::invalid_argument("Invalid constant type.");
 }
 
+// Checks that the image has the specified number of bytes at the offset and advances the offset past them.
+static void Skip(const ModuleImage& image, size_t& offset, size_t size)
+{
+    if (image.size() - offset < size)
+        throw InterpreterException("Unexpected end of the program file.");
+    offset += size;
+}
+
 template <typename T>
-static void Read(T* to, std::istream& stream)
+static T Read(const ModuleImage& image, size_t& offset)
 {
-    stream.read(reinterpret_cast<char*>(to), sizeof(T));
+    T value;
+    auto start = offset;
+    Skip(image, offset, sizeof(T));
+    std::memcpy(&value, image.data() + start, sizeof(T));
+    return value;
 }
 
-Program Peisik::DeserializeProgram(std::istream& stream)
+Program Program::Load(std::istream& stream, bool lazy, bool predecode)
 {
-    // Make all errors throw
-    stream.exceptions(std::istream::badbit | std::istream::eofbit | std::istream::failbit);
+    // Reading the whole file at once is much faster than reading each field from the stream
+    auto table = std::make_shared<LazyFunctionTable>();
+    auto& image = table->image;
+    char buffer[1 << 16];
+    while (stream.read(buffer, sizeof(buffer)) || stream.gcount() > 0)
+        image.insert(image.end(), buffer, buffer + stream.gcount());
+    if (stream.bad())
+        throw InterpreterException("Could not read the program file.");
 
     Program result;
+    size_t offset = 0;
 
     // The header contains a magic number, bytecode version and the main function index
-    uint32_t magic = 0;
-    Read(&magic, stream);
-    if (magic != 0x53494550 /* PEIS (notice the endianness) */)
+    if (Read<uint32_t>(image, offset) != 0x53494550 /* PEIS (notice the endianness) */)
         throw InterpreterException("Not a compiled Peisik file.");
 
-    uint32_t bytecodeVersion = 0;
-    Read(&bytecodeVersion, stream);
-    if (bytecodeVersion != Program::BytecodeVersion)
+    auto bytecodeVersion = Read<uint32_t>(image, offset);
+    table->compact = (bytecodeVersion & Program::CompactEncodingFlag) != 0;
+    if ((bytecodeVersion & ~Program::CompactEncodingFlag) != Program::BytecodeVersion)
         throw InterpreterException("Wrong bytecode version.");
 
-    uint32_t mainIndex = 0;
-    Read(&mainIndex, stream);
-    result.m_mainFunctionIndex = static_cast<short>(mainIndex);
+    result.m_mainFunctionIndex = static_cast<short>(Read<uint32_t>(image, offset));
 
     // Then, the constants.
     // First, a 32-bit integer for their count and then each constant
-    int32_t constCount = -1;
-    Read(&constCount, stream);
+    auto constCount = Read<int32_t>(image, offset);
     if (constCount < 0)
         throw InterpreterException("Constant count less than 0.");
 
     for (int i = 0; i < constCount; i++)
     {
         // Type code
-        short type = 0;
-        Read(&type, stream);
-        AssertValidType(type);
+        auto type = Read<short>(image, offset);
+        AssertValidConstantType(type);
 
         // 6 bytes of UTF-8 encoded name as padding - ignore
-        char name[6];
-        stream.read(name, 6 * sizeof(char));
+        Skip(image, offset, 6);
 
         // Value
-        int64_t value = -1;
-        Read(&value, stream);
+        auto value = Read<int64_t>(image, offset);
 
         // Add the constant
         result.m_constants.push_back(PObject(static_cast<PrimitiveType>(type), value));
@@ -147,10 +428,11 @@ Program Peisik::DeserializeProgram(std::istream& stream)
     //   2. Parameter count (2 bytes)
     //   3. Parameter types, 2 bytes each
     //   (4. 2 bytes of padding if odd number of parameters)
-    //   5. Bytecode size (4 bytes)
+    //   5. Bytecode size (4 bytes), in bytes if the compact flag is set and in instructions otherwise
     //   6. Bytecode
-    int32_t functionCount = -1;
-    Read(&functionCount, stream);
+    //   (7. Padding to a multiple of 4 bytes if the compact flag is set)
+    // The records are only indexed here, and validated when they are decoded.
+    auto functionCount = Read<int32_t>(image, offset);
     if (functionCount < 0)
         throw InterpreterException("Function count less than 0.");
     if (functionCount > 32768)
@@ -158,62 +440,187 @@ Program Peisik::DeserializeProgram(std::istream& stream)
 
     for (int i = 0; i < functionCount; i++)
     {
-        Function func;
-        func.m_functionIndex = static_cast<short>(i);
-
-        // Return type
-        short returnType;
-        Read(&returnType, stream);
-        AssertValidType(returnType);
-        func.m_returnType = static_cast<PrimitiveType>(returnType);
-
-        // Parameter count
-        Read(&func.m_parameterCount, stream);
-        if (func.m_parameterCount < 0)
-            throw InterpreterException("Parameter count less than 0.");
+        table->offsets.push_back(offset);
 
-        // Locals
-        short localCount = -1;
-        Read(&localCount, stream);
+        Skip(image, offset, 2 * sizeof(short));
+        auto localCount = Read<short>(image, offset);
         if (localCount < 0)
             throw InterpreterException("Local count less than 0.");
-        func.m_localTypes.reserve(localCount);
+        Skip(image, offset, (static_cast<size_t>(localCount) + 1) / 2 * 2 * sizeof(short));
 
-        for (int localIdx = 0; localIdx < localCount; localIdx++)
-        {
-            short type = 0;
-            Read(&type, stream);
-            AssertValidType(type);
+        auto codeSize = Read<int32_t>(image, offset);
+        if (codeSize < 0)
+            throw InterpreterException("Code size less than 0.");
+        Skip(image, offset, table->compact
+            ? (static_cast<size_t>(codeSize) + 3) & ~static_cast<size_t>(3)
+            : static_cast<size_t>(codeSize) * 2 * sizeof(short));
+
+        Function function;
+        function.m_functionIndex = static_cast<short>(i);
+        function.m_decoded = false;
+        function.m_codeSizeBound = static_cast<uint32_t>(codeSize);
+        result.m_functions.push_back(function);
+    }
 
-            func.m_localTypes.push_back(static_cast<PrimitiveType>(type));
-        }
+    if (!lazy)
+    {
+        for (short i = 0; i < result.GetFunctionCount(); i++)
+            DecodeFunction(*table, i, result.m_functions[i]);
+        return result;
+    }
+
+    table->predecoded.reset(new PredecodedFunction[functionCount]);
+    for (int i = 0; i < functionCount; i++)
+        table->predecoded[i].state.store(PredecodeEmpty, std::memory_order_relaxed);
+    result.m_lazyFunctions = table;
+
+    if (predecode && result.m_mainFunctionIndex >= 0 && result.m_mainFunctionIndex < functionCount)
+        table->predecoder = std::thread(&Program::Predecode, std::ref(*table), result.m_mainFunctionIndex);
+
+    return result;
+}
+
+void Program::DecodeFunction(const LazyFunctionTable& table, short index, Function& function)
+{
+    auto& image = table.image;
+    size_t offset = table.offsets[index];
+    function.m_functionIndex = index;
+
+    // Return type
+    auto returnType = Read<short>(image, offset);
+    AssertValidType(returnType);
+    function.m_returnType = static_cast<PrimitiveType>(returnType);
+
+    // Parameter count
+    function.m_parameterCount = Read<short>(image, offset);
+    if (function.m_parameterCount < 0)
+        throw InterpreterException("Parameter count less than 0.");
+
+    // Locals
+    auto localCount = Read<short>(image, offset);
+    function.m_localTypes.clear();
+    function.m_localTypes.reserve(localCount);
+    for (int localIdx = 0; localIdx < localCount; localIdx++)
+    {
+        auto type = Read<short>(image, offset);
+        AssertValidType(type);
+
+        function.m_localTypes.push_back(static_cast<PrimitiveType>(type));
+    }
+
+    if (localCount % 2 == 1)
+        Skip(image, offset, sizeof(short));
 
-        if (localCount % 2 == 1)
+    // Bytecode
+    auto codeSize = Read<int32_t>(image, offset);
+    if (table.compact)
+    {
+        function.m_bytecode = DecodeCompactBytecode(reinterpret_cast<const uint8_t*>(image.data() + offset), codeSize);
+    }
+    else
+    {
+        function.m_bytecode.clear();
+        function.m_bytecode.reserve(codeSize);
+        for (int j = 0; j < codeSize; j++)
         {
-            short unused = 0;
-            Read(&unused, stream);
+            auto op = Read<short>(image, offset);
+            auto param = Read<short>(image, offset);
+
+            function.m_bytecode.push_back(BytecodeOp(static_cast<Opcode>(op), param));
         }
+    }
 
-        // Bytecode
-        int32_t codeSize = -1;
-        Read(&codeSize, stream);
-        if (codeSize < 0)
-            throw InterpreterException("Code size less than 0.");
+    function.m_compactCode.clear();
+    function.m_codeSizeBound = static_cast<uint32_t>(codeSize);
+    function.m_decoded = true;
+    function.UpdateFootprint();
+}
 
-        func.m_bytecode.reserve(codeSize);
-        for (int j = 0; j < codeSize; j++)
+void Program::Predecode(LazyFunctionTable& table, short mainIndex)
+{
+    // Breadth first from the main function, so that the functions called early are decoded early
+    std::vector<bool> queued(table.offsets.size());
+    std::deque<short> queue(1, mainIndex);
+    queued[mainIndex] = true;
+
+    while (!queue.empty() && !table.stopping.load(std::memory_order_relaxed))
+    {
+        auto index = queue.front();
+        queue.pop_front();
+
+        Function function;
+        try
         {
-            short op = -1;
-            Read(&op, stream);
+            DecodeFunction(table, index, function);
+        }
+        catch (std::exception&)
+        {
+            // Reported when the function is called
+            continue;
+        }
 
-            short param = -1;
-            Read(&param, stream);
+        for (auto& op : function.m_bytecode)
+        {
+            if ((op.op == Opcode::Call || op.op == Opcode::CallParallel) && op.param >= 0 &&
+                static_cast<size_t>(op.param) < queued.size() && !queued[op.param])
+            {
+                queued[op.param] = true;
+                queue.push_back(op.param);
+            }
+        }
 
-            func.m_bytecode.push_back(BytecodeOp(static_cast<Opcode>(op), param));
+        // The function may already have been taken or decoded on first use
+        auto& slot = table.predecoded[index];
+        int expected = PredecodeEmpty;
+        if (slot.state.compare_exchange_strong(expected, PredecodeBusy, std::memory_order_acquire))
+        {
+            slot.function = std::move(function);
+            slot.state.store(PredecodeReady, std::memory_order_release);
         }
+    }
+}
 
-        result.m_functions.push_back(func);
+void Program::DecodeLazily(short index) const
+{
+    auto& function = m_functions[index];
+    auto& slot = m_lazyFunctions->predecoded[index];
+
+    // Take the function decoded by the background thread, or decode it here if it is not ready.
+    // Copies of the program share the table, so the function may also have been taken by another copy.
+    int expected = PredecodeReady;
+    if (slot.state.compare_exchange_strong(expected, PredecodeTaken, std::memory_order_acquire))
+    {
+        function = std::move(slot.function);
+    }
+    else
+    {
+        // Keep the background thread from decoding the function later
+        expected = PredecodeEmpty;
+        slot.state.compare_exchange_strong(expected, PredecodeTaken, std::memory_order_relaxed);
+        DecodeFunction(*m_lazyFunctions, index, function);
     }
 
-    return result;
+    if (m_decodedHandler)
+        m_decodedHandler(const_cast<Program&>(*this), function);
+}
+
+
+/*
+ * Global namespace
+ */
+
+Program Peisik::DeserializeProgram(std::istream& stream)
+{
+    PEISIK_PROBE1(load__start, 0);
+    auto program = Program::Load(stream, false, false);
+    PEISIK_PROBE3(load__done, 0, program.GetFunctionCount(), program.GetMainFunctionIndex());
+    return program;
+}
+
+Program Peisik::DeserializeProgramLazily(std::istream& stream, bool predecode)
+{
+    PEISIK_PROBE1(load__start, 1);
+    auto program = Program::Load(stream, true, predecode);
+    PEISIK_PROBE3(load__done, 1, program.GetFunctionCount(), program.GetMainFunctionIndex());
+    return program;
 }
@@ -1,21 +1,35 @@
 #pragma once
 
 #include "Bytecode.h"
+#include "MemoryStatistics.h"
 #include "PObject.h"
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <vector>
 
 namespace Peisik
 {
     class Program;
+    struct CodeArena;
+    struct LazyFunctionTable;
+
     // Loads a program object from the specified stream.
     // The stream is expected to be a binary stream.
     Program DeserializeProgram(std::istream& stream);
 
+    // Loads a program, but only indexes its functions. Each function is decoded and validated when it is
+    // first accessed, so a corrupt function only throws when it is called. If predecode is set, a background
+    // thread decodes the functions reachable from the main function in call graph order ahead of their calls.
+    // A lazily loaded program must only be used by one thread at a time, apart from the background thread.
+    Program DeserializeProgramLazily(std::istream& stream, bool predecode);
+
     // Represents a single function.
     class Function
     {
     public:
+        Function();
+
         // Gets a reference to the bytecode vector.
         const std::vector<BytecodeOp>& GetBytecode() const;
 
@@ -31,14 +45,52 @@ namespace Peisik
         // Gets the type of the function return value.
         PrimitiveType GetReturnType() const;
 
+        // Adds a local of the specified type and returns its index.
+        // Used by the load-time optimizations.
+        short AddLocal(PrimitiveType type);
+
+        // Replaces the bytecode and discards the compact code. Used by the load-time optimizations.
+        void SetBytecode(std::vector<BytecodeOp> bytecode);
+
+        // Gets the executable compact code, or an empty vector if the function runs the wide bytecode.
+        const std::vector<uint8_t>& GetCompactCode() const;
+
+        // Sets the executable compact code, which must be equivalent to the bytecode.
+        // See EncodeExecutableBytecode.
+        void SetCompactCode(std::vector<uint8_t> code);
+
+        // Gets the wide bytecode the interpreter runs, or null if the function runs compact code.
+        // Points into the code arena of the program once the code has been packed, see Program::PackCode.
+        const BytecodeOp* GetExecutableBytecode() const;
+
+        // Gets the compact code the interpreter runs, or null if the function runs the wide bytecode.
+        // Points into the code arena of the program once the code has been packed.
+        const uint8_t* GetExecutableCompactCode() const;
+
+        // Returns the index of the first instruction at or after the program counter.
+        // For compact code the program counter is a byte offset, otherwise it is returned as is.
+        uint32_t GetInstructionIndex(uint32_t programCounter) const;
+
     private:
+        // Updates the program image memory counted for the code and locals
+        void UpdateFootprint();
+
         std::vector<BytecodeOp> m_bytecode;
+        std::vector<uint8_t> m_compactCode;
+        // The copy of the executable code in the code arena, or null if the code has not been packed
+        const BytecodeOp* m_packedBytecode;
+        const uint8_t* m_packedCompactCode;
         short m_functionIndex;
         std::vector<PrimitiveType> m_localTypes;
         short m_parameterCount;
         PrimitiveType m_returnType;
+        // False until a lazily loaded function has been decoded
+        bool m_decoded;
+        // The size of the code in the module, at least the instruction count
+        uint32_t m_codeSizeBound;
+        CountedBlock<MemoryCategory::ProgramImage> m_footprint;
 
-        friend Program DeserializeProgram(std::istream&);
+        friend class Program;
     };
 
     // Represents a complete compiled program.
@@ -52,23 +104,74 @@ namespace Peisik
         // Gets the number of constants in the constant table.
         short GetConstantCount() const;
 
-        // Gets the function with the specified index.
+        // Returns the index of a constant with the specified type and value, adding it if necessary.
+        // Used by the load-time optimizations.
+        short AddConstant(const PObject& value);
+
+        // Gets the function with the specified index, decoding it first if the program is loaded lazily.
         // If the index is higher than allowed or less than zero, an exception is thrown.
         const Function& GetFunction(short index) const;
 
         // Gets the number of functions in the function table.
         short GetFunctionCount() const;
 
+        // Gets the function with the specified index for modification by the load-time optimizations.
+        // If the index is higher than allowed or less than zero, an exception is thrown.
+        Function& GetMutableFunction(short index);
+
         // Gets the function table index of the program entry point.
         short GetMainFunctionIndex() const;
 
+        // Gets an upper bound for the instruction count of the longest function without decoding any functions.
+        size_t GetLongestFunctionLength() const;
+
+        // Called when a lazily loaded function has been decoded, for example to run the per-function
+        // load-time optimizations. The function may not access itself through the program.
+        typedef std::function<void(Program&, Function&)> FunctionDecodedHandler;
+
+        // Sets the handler for the functions decoded from now on.
+        void SetFunctionDecodedHandler(FunctionDecodedHandler handler);
+
+        // Copies the executable code of the functions into one contiguous arena in the specified order,
+        // so that the functions run together also share cache lines and pages. The functions not in the
+        // order keep running their own code, as do the functions whose code is replaced afterwards.
+        // The functions in the order are decoded first. Returns the size of the arena in bytes.
+        size_t PackCode(const std::vector<short>& order);
+
+        // Gets a hash of everything that determines how the program runs: the constants, the main function
+        // and the types and code of every function. Since the load-time passes change the code, the hash
+        // also identifies the options the program was loaded with. Decodes every function.
+        uint64_t GetIdentityHash() const;
+
+        // The bytecode version understood by DeserializeProgram.
+        static const int BytecodeVersion = 9;
+
+        // Set in the version field of files that store the bytecode in the compact encoding.
+        static const uint32_t CompactEncodingFlag = 0x10000;
+
     private:
+        // Reads the module, decoding all the functions unless lazy is set.
+        static Program Load(std::istream& stream, bool lazy, bool predecode);
+
+        // Decodes and validates the function record in the module image.
+        static void DecodeFunction(const LazyFunctionTable& table, short index, Function& function);
+
+        // Decodes the functions reachable from the main function on the background thread.
+        static void Predecode(LazyFunctionTable& table, short mainIndex);
+
+        // Decodes a lazily loaded function, which is logically const
+        void DecodeLazily(short index) const;
+
         short m_mainFunctionIndex;
-        std::vector<PObject> m_constants;
-        std::vector<Function> m_functions;
+        std::vector<PObject, CountingAllocator<PObject, MemoryCategory::ProgramImage>> m_constants;
+        mutable std::vector<Function, CountingAllocator<Function, MemoryCategory::ProgramImage>> m_functions;
+        // The module image of a lazily loaded program, shared by its copies
+        std::shared_ptr<LazyFunctionTable> m_lazyFunctions;
+        // The packed code, shared by the copies whose functions point into it
+        std::shared_ptr<const CodeArena> m_codeArena;
+        FunctionDecodedHandler m_decodedHandler;
 
         friend Program DeserializeProgram(std::istream&);
-
-        static const int BytecodeVersion = 6;
+        friend Program DeserializeProgramLazily(std::istream&, bool);
     };
 }
\ No newline at end of file
@@ -0,0 +1,58 @@
+#include "pch.h"
+#include "ProgramCache.h"
+#include <sys/stat.h>
+
+using namespace Peisik;
+
+ProgramCache::ProgramCache(size_t capacity, Loader loader)
+    : m_capacity(std::max<size_t>(capacity, 1)), m_loader(loader), m_hits(0), m_misses(0)
+{
+}
+
+std::shared_ptr<const Program> ProgramCache::Get(const std::string& path)
+{
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0)
+        throw std::runtime_error("Could not open the module " + path);
+
+    // Second resolution is too coarse for files that are rewritten right before running them
+#ifdef __linux__
+    int64_t modificationTime = static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+#else
+    int64_t modificationTime = static_cast<int64_t>(status.st_mtime);
+#endif
+    int64_t size = static_cast<int64_t>(status.st_size);
+
+    auto cached = m_index.find(path);
+    if (cached != m_index.end())
+    {
+        auto entry = cached->second;
+        if (entry->modificationTime == modificationTime && entry->size == size)
+        {
+            m_hits++;
+            m_entries.splice(m_entries.begin(), m_entries, entry);
+            return entry->program;
+        }
+
+        m_entries.erase(entry);
+        m_index.erase(cached);
+    }
+
+    m_misses++;
+    std::ifstream stream(path, std::ifstream::binary);
+    if (stream.fail())
+        throw std::runtime_error("Could not open the module " + path);
+
+    Entry entry = { path, modificationTime, size, std::make_shared<const Program>(m_loader(stream, path)) };
+    m_entries.push_front(entry);
+    m_index[path] = m_entries.begin();
+
+    if (m_entries.size() > m_capacity)
+    {
+        // Running interpreters keep their own reference to the program
+        m_index.erase(m_entries.back().path);
+        m_entries.pop_back();
+    }
+
+    return entry.program;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "Program.h"
+
+namespace Peisik
+{
+    // Keeps loaded programs by path, so that running a module again skips the loading.
+    // A program is loaded again if the modification time or the size of its file has changed.
+    // The least recently used program is evicted when the cache is full. Not thread-safe.
+    class ProgramCache
+    {
+    public:
+        // Loads a program from a module file, including the load-time optimizations.
+        // The path is that of the module file, for finding the files that go with it.
+        typedef std::function<Program(std::istream&, const std::string&)> Loader;
+
+        ProgramCache(size_t capacity, Loader loader);
+
+        // Gets the program in the module file, loading it if it is not cached or is out of date.
+        // Throws a std::runtime_error if the file cannot be opened, and passes on the exceptions of the loader.
+        std::shared_ptr<const Program> Get(const std::string& path);
+
+        // Gets the number of requests served from the cache.
+        uint64_t GetHitCount() const
+        {
+            return m_hits;
+        }
+
+        // Gets the number of requests that loaded the program.
+        uint64_t GetMissCount() const
+        {
+            return m_misses;
+        }
+
+    private:
+        struct Entry
+        {
+            std::string path;
+            int64_t modificationTime;
+            int64_t size;
+            std::shared_ptr<const Program> program;
+        };
+
+        size_t m_capacity;
+        Loader m_loader;
+        // The most recently used entry first
+        std::list<Entry> m_entries;
+        std::unordered_map<std::string, std::list<Entry>::iterator> m_index;
+        uint64_t m_hits;
+        uint64_t m_misses;
+    };
+}
@@ -0,0 +1,68 @@
+#include "pch.h"
+#include "PurityAnalysis.h"
+
+using namespace Peisik;
+
+bool Peisik::IsInternalFunctionPure(InternalFunction function)
+{
+    switch (function)
+    {
+    case InternalFunction::Print:
+    case InternalFunction::FailFast:
+        return false;
+    default:
+        return function > InternalFunction::Invalid && function <= InternalFunction::MathTan;
+    }
+}
+
+std::vector<bool> Peisik::FindPureFunctions(const Program& program)
+{
+    auto functionCount = program.GetFunctionCount();
+    std::vector<bool> pure(functionCount, true);
+
+    // First rule out the functions that have side effects themselves
+    for (short i = 0; i < functionCount; i++)
+    {
+        for (auto& op : program.GetFunction(i).GetBytecode())
+        {
+            bool internalCall = op.op >= Opcode::CallI0 && op.op <= Opcode::CallI7;
+            bool call = op.op == Opcode::Call || op.op == Opcode::CallFork;
+            bool invalidCall = call && (op.param < 0 || op.param >= functionCount);
+            // Arrays are mutable, so even reading an element depends on more than the parameters
+            bool arrayAccess = op.op == Opcode::NewArray || op.op == Opcode::LoadElement || op.op == Opcode::StoreElement;
+            // Parallel calls would nest thread pools when called from a parallel call
+            bool parallelCall = op.op == Opcode::CallParallel;
+
+            if ((internalCall && !IsInternalFunctionPure(static_cast<InternalFunction>(op.param))) || invalidCall ||
+                arrayAccess || parallelCall)
+            {
+                pure[i] = false;
+                break;
+            }
+        }
+    }
+
+    // Then propagate impurity to the callers until nothing changes
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (short i = 0; i < functionCount; i++)
+        {
+            if (!pure[i])
+                continue;
+
+            for (auto& op : program.GetFunction(i).GetBytecode())
+            {
+                if ((op.op == Opcode::Call || op.op == Opcode::CallFork) && !pure[op.param])
+                {
+                    pure[i] = false;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    return pure;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+#include "Program.h"
+
+namespace Peisik
+{
+    // Returns true if calling the internal function has no side effects and does not read arrays.
+    bool IsInternalFunctionPure(InternalFunction function);
+
+    // Determines which functions are pure, that is, their result only depends on the parameters
+    // and calling them has no side effects. A function is pure if it does not call impure internal
+    // functions (Print, FailFast, the array functions), does not access arrays, does not make parallel calls
+    // and only calls pure functions.
+    // Recursion does not make a function impure.
+    // The result is indexed by function index.
+    std::vector<bool> FindPureFunctions(const Program& program);
+}
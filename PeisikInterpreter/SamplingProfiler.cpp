@@ -0,0 +1,247 @@
+#include "pch.h"
+#include "Bytecode.h"
+#include "SamplingProfiler.h"
+
+#ifdef _WIN32
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#else
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+using namespace Peisik;
+
+// The number of samples that fit in the buffer before it is aggregated
+static const size_t BufferedSampleCount = 64;
+
+SamplingProfiler::SamplingProfiler(int frequency)
+    : m_samplePending(false), m_frequency(frequency), m_running(false),
+    m_frames(BufferedSampleCount * (MaxSampleDepth + 2)), m_frameCount(0), m_sampleStart(0),
+    m_sampleCount(0)
+{
+    if (frequency <= 0 || frequency > 1000000)
+        throw std::invalid_argument("The sampling frequency must be between 1 and 1000000 Hz.");
+}
+
+SamplingProfiler::~SamplingProfiler()
+{
+    if (m_running)
+        StopTimer();
+}
+
+void SamplingProfiler::Start()
+{
+    if (m_running)
+        return;
+    StartTimer();
+    m_running = true;
+}
+
+void SamplingProfiler::Stop()
+{
+    if (m_running)
+    {
+        StopTimer();
+        m_running = false;
+    }
+    m_samplePending.store(false, std::memory_order_relaxed);
+    DrainBuffer();
+}
+
+void SamplingProfiler::BeginSample(bool truncated)
+{
+    // Make sure that the deepest possible sample, its header and the truncation marker fit
+    if (m_frameCount + MaxSampleDepth + 2 > m_frames.size())
+        DrainBuffer();
+
+    m_sampleStart = m_frameCount;
+    SampleFrame header = { 0, 0 };
+    m_frames[m_frameCount++] = header;
+
+    if (truncated)
+        AddFrame(TruncatedFrame, 0);
+}
+
+void SamplingProfiler::EndSample()
+{
+    m_frames[m_sampleStart].programCounter = static_cast<uint32_t>(m_frameCount - m_sampleStart - 1);
+    m_sampleCount++;
+    m_samplePending.store(false, std::memory_order_relaxed);
+}
+
+void SamplingProfiler::DrainBuffer()
+{
+    size_t i = 0;
+    while (i < m_frameCount)
+    {
+        auto depth = m_frames[i].programCounter;
+        auto first = i + 1;
+        auto end = first + depth;
+
+        std::string stack;
+        for (auto j = first; j < end; j++)
+        {
+            if (j != first)
+                stack += ';';
+            if (m_frames[j].functionIndex == TruncatedFrame)
+                stack += "[truncated]";
+            else
+                stack += "f" + std::to_string(m_frames[j].functionIndex);
+        }
+        m_stackCounts[stack]++;
+
+        if (depth > 0 && m_frames[end - 1].functionIndex != TruncatedFrame)
+            m_instructionCounts[std::make_pair(m_frames[end - 1].functionIndex, m_frames[end - 1].programCounter)]++;
+
+        i = end;
+    }
+    m_frameCount = 0;
+}
+
+void SamplingProfiler::WriteFoldedStacks(std::ostream& stream) const
+{
+    for (auto& entry : m_stackCounts)
+    {
+        stream << entry.first << " " << entry.second << std::endl;
+    }
+}
+
+void SamplingProfiler::WriteInstructionHotness(std::ostream& stream, const Program& program) const
+{
+    // Sum the samples of each function
+    std::vector<uint64_t> functionSamples(program.GetFunctionCount(), 0);
+    for (auto& entry : m_instructionCounts)
+        functionSamples[entry.first.first] += entry.second;
+
+    std::vector<short> order;
+    for (short i = 0; i < program.GetFunctionCount(); i++)
+    {
+        if (functionSamples[i] > 0)
+            order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [&functionSamples](short a, short b)
+    {
+        return functionSamples[a] > functionSamples[b];
+    });
+
+    auto total = m_sampleCount > 0 ? m_sampleCount : 1;
+    stream << std::fixed << std::setprecision(1);
+    stream << "Samples: " << m_sampleCount << " at " << m_frequency << " Hz" << std::endl;
+
+    for (auto index : order)
+    {
+        stream << std::endl << "Function " << index
+            << (index == program.GetMainFunctionIndex() ? " (main)" : "")
+            << ": " << functionSamples[index] << " samples, "
+            << 100.0 * functionSamples[index] / total << " %" << std::endl;
+
+        auto& bytecode = program.GetFunction(index).GetBytecode();
+        for (uint32_t pc = 0; pc < bytecode.size(); pc++)
+        {
+            auto found = m_instructionCounts.find(std::make_pair(index, pc));
+            auto samples = (found != m_instructionCounts.end()) ? found->second : 0;
+
+            stream << std::right << std::setw(10) << samples
+                << std::setw(7) << 100.0 * samples / total << " %"
+                << std::setw(6) << pc << "  "
+                << std::left << std::setw(22) << OpcodeToString(bytecode[pc].op)
+                << bytecode[pc].param << std::endl;
+        }
+    }
+}
+
+/*
+ * Timer implementations
+ */
+
+#ifdef _WIN32
+
+// Windows has no profiling signal, so a thread raises the flag instead.
+struct SamplingProfiler::TimerThread
+{
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable stopped;
+    bool stopRequested;
+};
+
+void SamplingProfiler::StartTimer()
+{
+    m_timerThread.reset(new TimerThread());
+    m_timerThread->stopRequested = false;
+
+    auto timer = m_timerThread.get();
+    auto interval = std::chrono::microseconds(1000000 / m_frequency);
+    m_timerThread->thread = std::thread([this, timer, interval]()
+    {
+        std::unique_lock<std::mutex> lock(timer->mutex);
+        while (!timer->stopped.wait_for(lock, interval, [timer]() { return timer->stopRequested; }))
+        {
+            m_samplePending.store(true, std::memory_order_relaxed);
+        }
+    });
+}
+
+void SamplingProfiler::StopTimer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_timerThread->mutex);
+        m_timerThread->stopRequested = true;
+    }
+    m_timerThread->stopped.notify_one();
+    m_timerThread->thread.join();
+    m_timerThread.reset();
+}
+
+#else
+
+// The flag of the running profiler. Only one profiler can own the process-wide timer at a time.
+static std::atomic<std::atomic<bool>*> s_pendingFlag(nullptr);
+static struct sigaction s_previousAction;
+
+static void OnProfilingSignal(int)
+{
+    auto flag = s_pendingFlag.load(std::memory_order_relaxed);
+    if (flag != nullptr)
+        flag->store(true, std::memory_order_relaxed);
+}
+
+void SamplingProfiler::StartTimer()
+{
+    std::atomic<bool>* expected = nullptr;
+    if (!s_pendingFlag.compare_exchange_strong(expected, &m_samplePending))
+        throw std::logic_error("Another sampling profiler is already running.");
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = OnProfilingSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &s_previousAction);
+
+    // ITIMER_PROF counts the CPU time of the process, so idle time is not sampled
+    itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / m_frequency;
+    if (m_frequency == 1)
+    {
+        timer.it_interval.tv_sec = 1;
+        timer.it_interval.tv_usec = 0;
+    }
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+void SamplingProfiler::StopTimer()
+{
+    itimerval timer;
+    std::memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &s_previousAction, nullptr);
+
+    s_pendingFlag.store(nullptr, std::memory_order_relaxed);
+}
+
+#endif
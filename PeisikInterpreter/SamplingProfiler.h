@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Program.h"
+
+namespace Peisik
+{
+    // Periodically samples the interpreter call stack.
+    //
+    // A timer (SIGPROF on POSIX systems, a timer thread on Windows) only raises a flag.
+    // The interpreter polls the flag between instructions and copies its frames into a fixed-size
+    // buffer, so nothing is allocated or locked in the signal handler or on the sampling path.
+    // The buffer is aggregated into stack and instruction counts whenever it fills up.
+    // A sample is attributed to the instruction that starts after the timer fired.
+    class SamplingProfiler
+    {
+    public:
+        // Deeper stacks only keep their innermost frames.
+        static const size_t MaxSampleDepth = 256;
+
+        SamplingProfiler(int frequency);
+        ~SamplingProfiler();
+
+        SamplingProfiler(const SamplingProfiler&) = delete;
+        SamplingProfiler& operator=(const SamplingProfiler&) = delete;
+
+        // Starts the sampling timer.
+        void Start();
+
+        // Stops the sampling timer and aggregates the buffered samples.
+        void Stop();
+
+        // Returns true if the timer has requested a sample since the last one was taken.
+        bool IsSamplePending() const
+        {
+            return m_samplePending.load(std::memory_order_relaxed);
+        }
+
+        // Begins a new sample. The frames must then be added from the outermost to the innermost.
+        void BeginSample(bool truncated);
+
+        // Adds a frame to the current sample.
+        void AddFrame(short functionIndex, uint32_t programCounter)
+        {
+            SampleFrame frame = { functionIndex, programCounter };
+            m_frames[m_frameCount++] = frame;
+        }
+
+        // Completes the current sample.
+        void EndSample();
+
+        // Gets the number of samples taken so far.
+        uint64_t GetSampleCount() const
+        {
+            return m_sampleCount;
+        }
+
+        // Writes the samples in the folded stack format used by flame graph tools:
+        // one line per distinct stack, frames separated by semicolons, followed by the sample count.
+        void WriteFoldedStacks(std::ostream& stream) const;
+
+        // Writes the bytecode of each sampled function, annotated with the number of samples
+        // taken while the instruction was executing in the innermost frame.
+        void WriteInstructionHotness(std::ostream& stream, const Program& program) const;
+
+    private:
+        struct SampleFrame
+        {
+            short functionIndex;
+            uint32_t programCounter;
+        };
+
+        // Marks the outermost frame of a truncated sample
+        static const short TruncatedFrame = -1;
+
+        std::atomic<bool> m_samplePending;
+        int m_frequency;
+        bool m_running;
+
+        // Buffered samples: a header frame holding the depth, followed by the frames
+        std::vector<SampleFrame> m_frames;
+        size_t m_frameCount;
+        size_t m_sampleStart;
+
+        // Aggregated samples
+        uint64_t m_sampleCount;
+        std::map<std::string, uint64_t> m_stackCounts;
+        std::map<std::pair<short, uint32_t>, uint64_t> m_instructionCounts;
+
+        void DrainBuffer();
+        void StartTimer();
+        void StopTimer();
+
+#ifdef _WIN32
+        struct TimerThread;
+        std::unique_ptr<TimerThread> m_timerThread;
+#endif
+    };
+}
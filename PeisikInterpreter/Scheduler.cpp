@@ -0,0 +1,153 @@
+#include "pch.h"
+#include "Scheduler.h"
+
+using namespace Peisik;
+
+Scheduler::Scheduler(unsigned workerCount, uint64_t timeSlice)
+    : m_timeSlice(std::max<uint64_t>(timeSlice, 1)), m_nextWorker(0), m_sliceCount(0), m_stealCount(0),
+    m_queuedCount(0), m_pendingCount(0), m_stopping(false)
+{
+    if (workerCount == 0)
+        workerCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+    // Create all the queues before starting any worker, since the workers steal from each other
+    for (unsigned i = 0; i < workerCount; i++)
+        m_workers.emplace_back(new Worker());
+    for (size_t i = 0; i < m_workers.size(); i++)
+        m_workers[i]->thread = std::thread(&Scheduler::RunWorker, this, i);
+}
+
+Scheduler::~Scheduler()
+{
+    WaitAll();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_taskQueued.notify_all();
+
+    for (auto& worker : m_workers)
+        worker->thread.join();
+}
+
+void Scheduler::Submit(Interpreter& interpreter, CompletionHandler onCompletion)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pendingCount++;
+    }
+
+    Task task = { &interpreter, std::move(onCompletion) };
+    Push(m_nextWorker.fetch_add(1, std::memory_order_relaxed) % m_workers.size(), std::move(task), true);
+}
+
+void Scheduler::WaitAll()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_taskCompleted.wait(lock, [this] { return m_pendingCount == 0; });
+}
+
+
+/*
+ * Workers
+ */
+
+void Scheduler::RunWorker(size_t index)
+{
+    while (true)
+    {
+        Task task;
+        if (!TryTake(index, task))
+        {
+            // Another worker may take the queued task first, in which case this one just looks again
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_taskQueued.wait(lock, [this] { return m_queuedCount > 0 || m_stopping; });
+            if (m_queuedCount == 0)
+                return;
+            continue;
+        }
+
+        ExecutionStatus status;
+        std::exception_ptr error;
+        try
+        {
+            status = task.interpreter->Step(m_timeSlice);
+        }
+        catch (...)
+        {
+            status = ExecutionStatus::Failed;
+            error = std::current_exception();
+        }
+        m_sliceCount.fetch_add(1, std::memory_order_relaxed);
+
+        if (status == ExecutionStatus::Yielded)
+        {
+            Push(index, std::move(task), false);
+            continue;
+        }
+
+        task.onCompletion(*task.interpreter, status, error);
+
+        bool allCompleted;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            allCompleted = --m_pendingCount == 0;
+        }
+        if (allCompleted)
+            m_taskCompleted.notify_all();
+    }
+}
+
+void Scheduler::Push(size_t workerIndex, Task task, bool isNew)
+{
+    // A yielded task that is alone in its queue is taken again by its own worker,
+    // so waking an idle worker to steal it would only move it to another core
+    bool wakeIdle = isNew;
+    auto& worker = *m_workers[workerIndex];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.queue.push_back(std::move(task));
+        wakeIdle = wakeIdle || worker.queue.size() > 1;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queuedCount++;
+    }
+    if (wakeIdle)
+        m_taskQueued.notify_one();
+}
+
+bool Scheduler::TryTake(size_t workerIndex, Task& task)
+{
+    // The own queue is round-robin, while stealing takes the task that would run last
+    bool found = false;
+    for (size_t i = 0; i < m_workers.size() && !found; i++)
+    {
+        auto& worker = *m_workers[(workerIndex + i) % m_workers.size()];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.queue.empty())
+            continue;
+
+        if (i == 0)
+        {
+            task = std::move(worker.queue.front());
+            worker.queue.pop_front();
+        }
+        else
+        {
+            task = std::move(worker.queue.back());
+            worker.queue.pop_back();
+            m_stealCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        found = true;
+    }
+
+    if (found)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queuedCount--;
+    }
+    return found;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Interpreter.h"
+
+namespace Peisik
+{
+    // Runs many interpreters as green threads on a fixed set of worker threads.
+    //
+    // Each worker has a queue of interpreters. It takes the interpreter at the front of its own queue,
+    // runs a time slice of it with Interpreter::Step() and puts it back at the end of the queue unless
+    // the program has ended. A worker whose queue is empty steals from the end of the other queues.
+    // The interpreters must not share state, which means that the sampling profiler cannot be used.
+    class Scheduler
+    {
+    public:
+        // Called on a worker thread when a program ends, with the status of the program and the exception
+        // that stopped it, if any. The handler must not throw.
+        typedef std::function<void(Interpreter&, ExecutionStatus, std::exception_ptr)> CompletionHandler;
+
+        // Starts the worker threads, one per hardware thread if the count is zero.
+        // Each time slice runs about the specified number of instructions.
+        Scheduler(unsigned workerCount, uint64_t timeSlice);
+
+        // Waits for the submitted programs to end and stops the workers.
+        ~Scheduler();
+
+        Scheduler(const Scheduler&) = delete;
+        Scheduler& operator=(const Scheduler&) = delete;
+
+        // Schedules the program of the interpreter, which must stay alive until the handler is called.
+        void Submit(Interpreter& interpreter, CompletionHandler onCompletion);
+
+        // Waits until all the submitted programs have ended.
+        void WaitAll();
+
+        // Gets the number of worker threads.
+        size_t GetWorkerCount() const
+        {
+            return m_workers.size();
+        }
+
+        // Gets the number of time slices run so far.
+        uint64_t GetSliceCount() const
+        {
+            return m_sliceCount.load(std::memory_order_relaxed);
+        }
+
+        // Gets the number of interpreters taken from the queue of another worker so far.
+        uint64_t GetStealCount() const
+        {
+            return m_stealCount.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Task
+        {
+            Interpreter* interpreter;
+            CompletionHandler onCompletion;
+        };
+
+        struct Worker
+        {
+            std::mutex mutex;
+            std::deque<Task> queue;
+            std::thread thread;
+        };
+
+        void RunWorker(size_t index);
+        // Adds a newly submitted or a yielded task to the end of the queue of the worker
+        void Push(size_t workerIndex, Task task, bool isNew);
+        bool TryTake(size_t workerIndex, Task& task);
+
+        uint64_t m_timeSlice;
+        std::vector<std::unique_ptr<Worker>> m_workers;
+        std::atomic<size_t> m_nextWorker;
+        std::atomic<uint64_t> m_sliceCount;
+        std::atomic<uint64_t> m_stealCount;
+
+        // Guards the counts below, which the workers and WaitAll() wait on
+        std::mutex m_mutex;
+        std::condition_variable m_taskQueued;
+        std::condition_variable m_taskCompleted;
+        // The number of tasks in the queues
+        size_t m_queuedCount;
+        // The number of submitted tasks that have not ended
+        size_t m_pendingCount;
+        bool m_stopping;
+    };
+}
@@ -0,0 +1,357 @@
+#include "pch.h"
+#include "PeisikException.h"
+#include "Server.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PEISIK_SERVER_SOCKETS
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace Peisik;
+
+#ifdef PEISIK_SERVER_SOCKETS
+
+#ifndef MSG_NOSIGNAL
+// Set with SO_NOSIGPIPE on the socket instead
+#define MSG_NOSIGNAL 0
+#endif
+
+/*
+ * Protocol
+ */
+
+// Each message is a kind byte and a 32-bit payload length in the native byte order, followed by the payload.
+// The client sends a request, and the server answers with any number of output messages and an exit message.
+static const char RequestMessage = 'R';
+static const char OutputMessage = 'O';
+static const char ExitMessage = 'E';
+
+// Longer requests are rejected
+static const uint32_t MaxRequestSize = 4096;
+
+// A client that does not send its request in time is disconnected, since requests are read on the accepting thread
+static const int RequestTimeoutSeconds = 5;
+
+static bool SendAll(int socket, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        auto sent = send(socket, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+static bool ReceiveAll(int socket, char* data, size_t size)
+{
+    while (size > 0)
+    {
+        auto received = recv(socket, data, size, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        data += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+static bool SendMessage(int socket, char kind, const char* payload, uint32_t size)
+{
+    char header[1 + sizeof(uint32_t)];
+    header[0] = kind;
+    std::memcpy(header + 1, &size, sizeof(size));
+    return SendAll(socket, header, sizeof(header)) && SendAll(socket, payload, size);
+}
+
+static bool ReceiveMessage(int socket, char& kind, std::string& payload, uint32_t maxSize)
+{
+    char header[1 + sizeof(uint32_t)];
+    if (!ReceiveAll(socket, header, sizeof(header)))
+        return false;
+
+    uint32_t size;
+    kind = header[0];
+    std::memcpy(&size, header + 1, sizeof(size));
+    if (size > maxSize)
+        return false;
+
+    payload.resize(size);
+    return size == 0 || ReceiveAll(socket, &payload[0], size);
+}
+
+static sockaddr_un GetSocketAddress(const std::string& socketPath)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    if (socketPath.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("The socket path " + socketPath + " is too long.");
+
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+    return address;
+}
+
+static int CreateSocket()
+{
+    int result = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (result < 0)
+        throw std::runtime_error("Could not create a socket.");
+#ifdef SO_NOSIGPIPE
+    int enable = 1;
+    setsockopt(result, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+    return result;
+}
+
+// Writes the error of a request the way it is printed when running locally and returns the exit code.
+static int WriteError(std::exception_ptr error, std::ostream& output)
+{
+    try
+    {
+        std::rethrow_exception(error);
+    }
+    catch (ApplicationException& e)
+    {
+        output << "Error: " << e.what() << std::endl;
+    }
+    catch (std::exception& e)
+    {
+        output << "Interpreter error: " << e.what() << std::endl;
+    }
+    return -1;
+}
+
+
+/*
+ * Connections
+ */
+
+// Sends everything written to the stream as output messages, whenever the stream is flushed
+// or the buffer fills up. If the client disconnects, the rest of the output is discarded.
+class OutputBuffer : public std::streambuf
+{
+public:
+    OutputBuffer(int socket)
+        : m_socket(socket), m_connected(true)
+    {
+        setp(m_buffer, m_buffer + sizeof(m_buffer));
+    }
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        Send();
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override
+    {
+        Send();
+        return 0;
+    }
+
+private:
+    void Send()
+    {
+        auto size = static_cast<uint32_t>(pptr() - pbase());
+        if (size > 0 && m_connected)
+            m_connected = SendMessage(m_socket, OutputMessage, pbase(), size);
+        setp(m_buffer, m_buffer + sizeof(m_buffer));
+    }
+
+    int m_socket;
+    bool m_connected;
+    char m_buffer[4096];
+};
+
+// A request from a client, from reading it until its program has ended
+struct Connection
+{
+    Connection(int socket)
+        : socket(socket), buffer(socket), output(&buffer)
+    {
+    }
+
+    ~Connection()
+    {
+        close(socket);
+    }
+
+    // Sends the rest of the output and the exit code
+    void Finish(int exitCode)
+    {
+        output.flush();
+        int32_t code = exitCode;
+        SendMessage(socket, ExitMessage, reinterpret_cast<const char*>(&code), sizeof(code));
+    }
+
+    int socket;
+    OutputBuffer buffer;
+    std::ostream output;
+    std::unique_ptr<Interpreter> interpreter;
+};
+
+
+/*
+ * Server
+ */
+
+Server::Server(const std::string& socketPath, ProgramCache& cache, Scheduler& scheduler, Configurator configure)
+    : m_socketPath(socketPath), m_cache(cache), m_scheduler(scheduler), m_configure(configure), m_socket(-1)
+{
+    auto address = GetSocketAddress(socketPath);
+    m_socket = CreateSocket();
+
+    // A socket file left behind by a terminated server would make bind fail
+    unlink(socketPath.c_str());
+    if (bind(m_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(m_socket, SOMAXCONN) != 0)
+    {
+        close(m_socket);
+        throw std::runtime_error("Could not listen on the socket " + socketPath + ".");
+    }
+}
+
+Server::~Server()
+{
+    close(m_socket);
+    unlink(m_socketPath.c_str());
+}
+
+void Server::Run()
+{
+    while (true)
+    {
+        int connection = accept(m_socket, nullptr, nullptr);
+        if (connection < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            throw std::runtime_error("Could not accept a connection on the socket " + m_socketPath + ".");
+        }
+
+        StartRequest(connection);
+    }
+}
+
+void Server::StartRequest(int socket)
+{
+    auto connection = std::make_shared<Connection>(socket);
+
+    timeval timeout = { RequestTimeoutSeconds, 0 };
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+    int enable = 1;
+    setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+
+    char kind;
+    std::string modulePath;
+    if (!ReceiveMessage(socket, kind, modulePath, MaxRequestSize) || kind != RequestMessage)
+        return;
+
+    try
+    {
+        connection->interpreter.reset(new Interpreter(m_cache.Get(modulePath)));
+        m_configure(*connection->interpreter);
+        connection->interpreter->SetOutput(connection->output);
+    }
+    catch (...)
+    {
+        connection->Finish(WriteError(std::current_exception(), connection->output));
+        return;
+    }
+
+    // The handler keeps the connection alive until the program has ended
+    m_scheduler.Submit(*connection->interpreter,
+        [connection](Interpreter&, ExecutionStatus, std::exception_ptr error)
+    {
+        connection->Finish(error ? WriteError(error, connection->output) : 0);
+    });
+}
+
+int Peisik::RunOnServer(const std::string& socketPath, const std::string& modulePath, std::ostream& output)
+{
+    auto address = GetSocketAddress(socketPath);
+    int socket = CreateSocket();
+    if (connect(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        close(socket);
+        throw std::runtime_error("Could not connect to the server at " + socketPath + ".");
+    }
+
+    // The server has its own current directory
+    std::string absolutePath = modulePath;
+    char currentDirectory[PATH_MAX];
+    if (modulePath[0] != '/' && getcwd(currentDirectory, sizeof(currentDirectory)) != nullptr)
+        absolutePath = std::string(currentDirectory) + "/" + modulePath;
+
+    if (!SendMessage(socket, RequestMessage, absolutePath.c_str(), static_cast<uint32_t>(absolutePath.size())))
+    {
+        close(socket);
+        throw std::runtime_error("Could not send the request to the server.");
+    }
+
+    char kind;
+    std::string payload;
+    while (ReceiveMessage(socket, kind, payload, UINT32_MAX))
+    {
+        if (kind == OutputMessage)
+        {
+            output.write(payload.data(), payload.size());
+            output.flush();
+        }
+        else if (kind == ExitMessage && payload.size() == sizeof(int32_t))
+        {
+            int32_t code;
+            std::memcpy(&code, payload.data(), sizeof(code));
+            close(socket);
+            return code;
+        }
+    }
+
+    close(socket);
+    throw std::runtime_error("The server closed the connection before the module ended.");
+}
+
+#else
+
+Server::Server(const std::string& socketPath, ProgramCache& cache, Scheduler& scheduler, Configurator configure)
+    : m_socketPath(socketPath), m_cache(cache), m_scheduler(scheduler), m_configure(configure), m_socket(-1)
+{
+    throw std::runtime_error("The server is not supported on this platform.");
+}
+
+Server::~Server()
+{
+}
+
+void Server::Run()
+{
+}
+
+void Server::StartRequest(int connection)
+{
+}
+
+int Peisik::RunOnServer(const std::string& socketPath, const std::string& modulePath, std::ostream& output)
+{
+    throw std::runtime_error("The server is not supported on this platform.");
+}
+
+#endif
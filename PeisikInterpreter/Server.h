@@ -0,0 +1,55 @@
+#pragma once
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include "Interpreter.h"
+#include "ProgramCache.h"
+#include "Scheduler.h"
+
+namespace Peisik
+{
+    // Runs modules on behalf of clients connecting to a Unix domain socket, so that the clients
+    // pay neither for starting the interpreter nor for loading programs that are in the cache.
+    //
+    // A client sends the path of a module. The server loads it through the program cache and runs it
+    // on the scheduler, sending the output of the program back as it is flushed, and finally the exit
+    // code that running the module locally would have had. Requests are read and programs loaded
+    // on the thread calling Run(), so a cache miss delays the requests behind it.
+    //
+    // Only available on POSIX systems.
+    class Server
+    {
+    public:
+        // Prepares an interpreter for a request with the options of the server.
+        typedef std::function<void(Interpreter&)> Configurator;
+
+        // Listens on the socket path, replacing a stale socket file.
+        // Throws a std::runtime_error if the socket cannot be created.
+        Server(const std::string& socketPath, ProgramCache& cache, Scheduler& scheduler, Configurator configure);
+
+        // Closes the socket and removes the socket file. The requests that are running keep running.
+        ~Server();
+
+        Server(const Server&) = delete;
+        Server& operator=(const Server&) = delete;
+
+        // Accepts and starts requests until the process is terminated.
+        // Throws a std::runtime_error if accepting a connection fails.
+        void Run();
+
+    private:
+        void StartRequest(int connection);
+
+        std::string m_socketPath;
+        ProgramCache& m_cache;
+        Scheduler& m_scheduler;
+        Configurator m_configure;
+        int m_socket;
+    };
+
+    // Runs the module on the server listening on the socket path and writes its output to the stream.
+    // A relative module path is made absolute using the current directory.
+    // Returns the exit code of the module. Throws a std::runtime_error if the server cannot be reached.
+    int RunOnServer(const std::string& socketPath, const std::string& modulePath, std::ostream& output);
+}
@@ -0,0 +1,208 @@
+#include "pch.h"
+#include "PeisikException.h"
+#include "Snapshot.h"
+#include <iterator>
+
+using namespace Peisik;
+
+// PSNP (notice the endianness)
+static const uint32_t SnapshotMagic = 0x504E5350;
+
+/*
+ * Writing
+ */
+
+template <typename T>
+static void Write(std::ostream& stream, T value)
+{
+    stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// Assigns an index to each array referenced by the objects, in the order of the first reference
+static void CollectArrays(const std::vector<PObject>& objects, std::map<PArray*, int64_t>& indices, std::vector<PArray*>& arrays)
+{
+    for (auto& object : objects)
+    {
+        if (!IsArrayType(object.GetType()) || object.GetArrayValue() == nullptr)
+            continue;
+        if (indices.insert(std::make_pair(object.GetArrayValue(), static_cast<int64_t>(arrays.size()))).second)
+            arrays.push_back(object.GetArrayValue());
+    }
+}
+
+static void WriteObjects(std::ostream& stream, const std::vector<PObject>& objects, const std::map<PArray*, int64_t>& indices)
+{
+    Write(stream, static_cast<uint32_t>(objects.size()));
+    for (auto& object : objects)
+    {
+        Write(stream, static_cast<uint8_t>(object.GetType()));
+        if (!IsArrayType(object.GetType()))
+            Write(stream, object.GetRawValue());
+        else if (object.GetArrayValue() == nullptr)
+            Write(stream, int64_t(-1));
+        else
+            Write(stream, indices.at(object.GetArrayValue()));
+    }
+}
+
+void Peisik::SerializeSnapshot(std::ostream& stream, const InterpreterSnapshot& snapshot)
+{
+    std::map<PArray*, int64_t> indices;
+    std::vector<PArray*> arrays;
+    for (auto& frame : snapshot.frames)
+    {
+        CollectArrays(frame.locals, indices, arrays);
+        CollectArrays(frame.operands, indices, arrays);
+    }
+
+    Write(stream, SnapshotMagic);
+    Write(stream, SnapshotVersion);
+    Write(stream, snapshot.programHash);
+    Write(stream, static_cast<uint32_t>(snapshot.opCounts.size()));
+    for (auto count : snapshot.opCounts)
+        Write(stream, count);
+    Write(stream, snapshot.peakFrameDepth);
+
+    Write(stream, static_cast<uint32_t>(arrays.size()));
+    for (auto array : arrays)
+    {
+        Write(stream, static_cast<uint8_t>(array->GetType()));
+        Write(stream, static_cast<uint64_t>(array->GetLength()));
+        if (array->GetType() == PrimitiveType::IntArray)
+            stream.write(reinterpret_cast<const char*>(array->GetInts().data()), array->GetLength() * sizeof(int64_t));
+        else
+            stream.write(reinterpret_cast<const char*>(array->GetReals().data()), array->GetLength() * sizeof(double));
+    }
+
+    Write(stream, static_cast<uint32_t>(snapshot.frames.size()));
+    for (auto& frame : snapshot.frames)
+    {
+        Write(stream, frame.functionIndex);
+        Write(stream, frame.programCounter);
+        WriteObjects(stream, frame.locals, indices);
+        WriteObjects(stream, frame.operands, indices);
+    }
+}
+
+
+/*
+ * Reading
+ */
+
+// The whole snapshot, read at once so that the sizes can be checked before allocating
+struct SnapshotImage
+{
+    std::vector<char> data;
+    size_t offset;
+
+    // Checks that the image has the specified number of bytes left and returns a pointer to them
+    const char* Take(uint64_t size)
+    {
+        if (data.size() - offset < size)
+            throw InterpreterException("Unexpected end of the snapshot.");
+        auto start = data.data() + offset;
+        offset += static_cast<size_t>(size);
+        return start;
+    }
+
+    template <typename T>
+    T Read()
+    {
+        T value;
+        std::memcpy(&value, Take(sizeof(T)), sizeof(T));
+        return value;
+    }
+};
+
+static std::vector<PObject> ReadObjects(SnapshotImage& image, const std::vector<PArray*>& arrays)
+{
+    auto count = image.Read<uint32_t>();
+    std::vector<PObject> objects;
+    objects.reserve(std::min<size_t>(count, (image.data.size() - image.offset) / 9));
+    for (uint32_t i = 0; i < count; i++)
+    {
+        auto type = static_cast<PrimitiveType>(image.Read<uint8_t>());
+        auto value = image.Read<int64_t>();
+        switch (type)
+        {
+        case PrimitiveType::Int:
+        case PrimitiveType::Real:
+            objects.push_back(PObject(type, value));
+            break;
+        case PrimitiveType::Bool:
+            objects.push_back(ObjectFromBool(value != 0));
+            break;
+        case PrimitiveType::IntArray:
+        case PrimitiveType::RealArray:
+            if (value == -1)
+            {
+                objects.push_back(ObjectFromArray(type, nullptr));
+                break;
+            }
+            if (value < 0 || static_cast<uint64_t>(value) >= arrays.size() || arrays[value]->GetType() != type)
+                throw InterpreterException("Invalid array reference in the snapshot.");
+            objects.push_back(ObjectFromArray(type, arrays[value]));
+            break;
+        default:
+            throw InterpreterException("Invalid object type in the snapshot.");
+        }
+    }
+    return objects;
+}
+
+InterpreterSnapshot Peisik::DeserializeSnapshot(std::istream& stream, uint64_t programHash, ArrayHeap& heap)
+{
+    SnapshotImage image;
+    image.data.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    image.offset = 0;
+
+    if (image.data.size() < 8 || image.Read<uint32_t>() != SnapshotMagic)
+        throw InterpreterException("Not a Peisik snapshot.");
+    if (image.Read<uint32_t>() != SnapshotVersion)
+        throw InterpreterException("Unsupported snapshot version.");
+
+    InterpreterSnapshot snapshot;
+    snapshot.programHash = image.Read<uint64_t>();
+    if (snapshot.programHash != programHash)
+        throw InterpreterException("The snapshot was taken of a different program or with different load options.");
+
+    auto opcodeCount = image.Read<uint32_t>();
+    for (uint32_t i = 0; i < opcodeCount; i++)
+        snapshot.opCounts.push_back(image.Read<uint64_t>());
+    snapshot.peakFrameDepth = image.Read<uint64_t>();
+
+    auto arrayCount = image.Read<uint32_t>();
+    std::vector<PArray*> arrays;
+    for (uint32_t i = 0; i < arrayCount; i++)
+    {
+        auto type = static_cast<PrimitiveType>(image.Read<uint8_t>());
+        auto length = image.Read<uint64_t>();
+        if (!IsArrayType(type))
+            throw InterpreterException("Invalid array type in the snapshot.");
+        if (length > (image.data.size() - image.offset) / sizeof(int64_t))
+            throw InterpreterException("Unexpected end of the snapshot.");
+
+        auto array = heap.Allocate(type, static_cast<int64_t>(length));
+        auto elements = image.Take(length * sizeof(int64_t));
+        if (type == PrimitiveType::IntArray)
+            std::memcpy(array->GetInts().data(), elements, static_cast<size_t>(length) * sizeof(int64_t));
+        else
+            std::memcpy(array->GetReals().data(), elements, static_cast<size_t>(length) * sizeof(double));
+        arrays.push_back(array);
+    }
+
+    auto frameCount = image.Read<uint32_t>();
+    for (uint32_t i = 0; i < frameCount; i++)
+    {
+        SnapshotFrame frame;
+        frame.functionIndex = image.Read<short>();
+        frame.programCounter = image.Read<uint32_t>();
+        frame.locals = ReadObjects(image, arrays);
+        frame.operands = ReadObjects(image, arrays);
+        snapshot.frames.push_back(std::move(frame));
+    }
+
+    if (image.offset != image.data.size())
+        throw InterpreterException("Unexpected data at the end of the snapshot.");
+    return snapshot;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include "ArrayHeap.h"
+#include "PObject.h"
+
+namespace Peisik
+{
+    // A call frame of a paused interpreter.
+    struct SnapshotFrame
+    {
+        short functionIndex;
+        // The instruction index, or the byte offset if the function runs compact code
+        uint32_t programCounter;
+        std::vector<PObject> locals;
+        // The operand stack, bottom first
+        std::vector<PObject> operands;
+    };
+
+    // The state of a paused interpreter, see Interpreter::WriteSnapshot.
+    struct InterpreterSnapshot
+    {
+        // See Program::GetIdentityHash
+        uint64_t programHash;
+        // The executed instruction counts, indexed by opcode
+        std::vector<uint64_t> opCounts;
+        uint64_t peakFrameDepth;
+        // The call stack, outermost frame first
+        std::vector<SnapshotFrame> frames;
+    };
+
+    // The binary snapshot format is little-endian on the usual platforms, as it is the memory layout:
+    //   "PSNP", uint32 version, uint64 program hash,
+    //   uint32 opcode count, uint64 count per opcode, uint64 peak frame depth,
+    //   uint32 array count, per array: uint8 type, uint64 length, 8 bytes per element,
+    //   uint32 frame count, per frame: int16 function, uint32 program counter,
+    //     uint32 local count, locals, uint32 operand count, operands from the bottom.
+    // Each object is a uint8 type and the int64 raw value, or for an array the index in the array
+    // table, -1 if the array has not been created. An array referenced from several places is stored once.
+    const uint32_t SnapshotVersion = 1;
+
+    // Writes the snapshot in the binary snapshot format.
+    void SerializeSnapshot(std::ostream& stream, const InterpreterSnapshot& snapshot);
+
+    // Reads a snapshot written by SerializeSnapshot, creating its arrays on the heap.
+    // Throws an InterpreterException if the stream does not contain a snapshot, or if the snapshot
+    // was taken of a program with a different identity hash.
+    InterpreterSnapshot DeserializeSnapshot(std::istream& stream, uint64_t programHash, ArrayHeap& heap);
+}
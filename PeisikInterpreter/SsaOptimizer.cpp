@@ -0,0 +1,1702 @@
+#include "pch.h"
+#include "InternalFunctions.h"
+#include "PurityAnalysis.h"
+#include "SsaOptimizer.h"
+#include <list>
+#include <set>
+
+using namespace Peisik;
+
+// The maximum number of times the passes are repeated on a function
+static const int MaxRounds = 4;
+// The maximum number of loops hoisted from in one round, as each is hoisted from a fresh lift
+static const int MaxHoistedLoops = 64;
+
+/*
+ * Intermediate representation
+ */
+
+enum class SsaNodeKind
+{
+    Constant,
+    Local,
+    InternalCall,
+    Call,
+    // A value evaluated by an earlier Push statement and still on the stack
+    StackValue
+};
+
+// A node of an expression tree. The arguments are in evaluation order.
+struct SsaNode
+{
+    SsaNodeKind kind;
+    // The constant index, local index, internal function or function index
+    short param;
+    // The reaching definition of a local read, or -1 for a local added by the current pass
+    int definition;
+    std::vector<int> args;
+};
+
+enum class SsaStatementKind
+{
+    Assign,
+    // Leaves the value on the stack for a later statement, which reads it as a StackValue
+    Push,
+    // Calls a function without a return value
+    Evaluate,
+    Discard,
+    Branch,
+    Jump,
+    Return
+};
+
+struct SsaStatement
+{
+    SsaStatementKind kind;
+    // The root node, or -1 for Jump and Return without a value
+    int value;
+    // The assigned local and the definition created by Assign
+    short local;
+    int definition;
+    // The target block of Branch and Jump, which is also an instruction index while lifting
+    int64_t target;
+};
+
+typedef std::list<SsaStatement>::iterator StatementIterator;
+
+struct SsaBlock
+{
+    std::list<SsaStatement> statements;
+    std::vector<int> predecessors;
+    // The fall-through successor is first for Branch
+    std::vector<int> successors;
+    std::vector<int> phis;
+    std::vector<int> dominatedBlocks;
+    int dominator;
+    // The index in reverse postorder
+    int order;
+};
+
+// A value of a local. Every local has an entry definition, numbered by the local index.
+struct SsaDefinition
+{
+    short local;
+    int block;
+    bool isPhi;
+    // For phis, the reaching definition for each predecessor
+    std::vector<int> operands;
+};
+
+// The types known by the type inference. Real parameters may also hold an Int, since calls do not
+// convert the arguments, so reading them only gives a Numeric.
+enum class SsaType
+{
+    Unknown,
+    Int,
+    Real,
+    Bool,
+    Numeric
+};
+
+// The constant propagation lattice.
+struct SsaLattice
+{
+    enum class State
+    {
+        Undefined,
+        Constant,
+        Varying
+    };
+
+    State state;
+    PObject value;
+};
+
+// An expression available for reuse by the value numbering.
+struct SsaAvailable
+{
+    int node;
+    int block;
+    StatementIterator statement;
+    // Whether the expression can be computed before the rest of its statement
+    bool canMove;
+    // The local holding the value once it is reused
+    short local;
+};
+
+static SsaLattice Undefined()
+{
+    SsaLattice result = { SsaLattice::State::Undefined, PObject(PrimitiveType::NoType, 0) };
+    return result;
+}
+
+static SsaLattice Varying()
+{
+    SsaLattice result = { SsaLattice::State::Varying, PObject(PrimitiveType::NoType, 0) };
+    return result;
+}
+
+static SsaLattice ConstantValue(const PObject& value)
+{
+    SsaLattice result = { SsaLattice::State::Constant, value };
+    return result;
+}
+
+static SsaLattice Meet(const SsaLattice& a, const SsaLattice& b)
+{
+    if (a.state == SsaLattice::State::Undefined)
+        return b;
+    if (b.state == SsaLattice::State::Undefined)
+        return a;
+    if (a.state == SsaLattice::State::Constant && b.state == SsaLattice::State::Constant && a.value.IsIdenticalTo(b.value))
+        return a;
+    return Varying();
+}
+
+/*
+ * Type inference
+ */
+
+static SsaType ToSsaType(PrimitiveType type)
+{
+    switch (type)
+    {
+    case PrimitiveType::Int: return SsaType::Int;
+    case PrimitiveType::Real: return SsaType::Real;
+    case PrimitiveType::Bool: return SsaType::Bool;
+    default: return SsaType::Unknown;
+    }
+}
+
+static PrimitiveType ToPrimitiveType(SsaType type)
+{
+    switch (type)
+    {
+    case SsaType::Int: return PrimitiveType::Int;
+    case SsaType::Real: return PrimitiveType::Real;
+    case SsaType::Bool: return PrimitiveType::Bool;
+    default: return PrimitiveType::NoType;
+    }
+}
+
+static bool IsNumeric(SsaType type)
+{
+    return type == SsaType::Int || type == SsaType::Real || type == SsaType::Numeric;
+}
+
+// The result of +, - and *: Int if all the values are Int and Real if any of them is Real.
+static SsaType ArithmeticType(const std::vector<SsaType>& types)
+{
+    bool allInt = true;
+    bool anyReal = false;
+    for (auto type : types)
+    {
+        if (!IsNumeric(type))
+            return SsaType::Unknown;
+        allInt = allInt && type == SsaType::Int;
+        anyReal = anyReal || type == SsaType::Real;
+    }
+
+    if (allInt)
+        return SsaType::Int;
+    return anyReal ? SsaType::Real : SsaType::Numeric;
+}
+
+// Returns the result type of an internal function, or Unknown if the call could fail because of
+// the parameter types or count. Print and FailFast have no result.
+static SsaType InternalCallType(InternalFunction function, const std::vector<SsaType>& types)
+{
+    auto count = types.size();
+    bool numeric = std::all_of(types.begin(), types.end(), IsNumeric);
+    bool sameType = count == 2 && types[0] == types[1];
+
+    switch (function)
+    {
+    case InternalFunction::Plus:
+        return ArithmeticType(types);
+    case InternalFunction::Minus:
+        return (count == 1 || count == 2) ? ArithmeticType(types) : SsaType::Unknown;
+    case InternalFunction::Multiply:
+        return count == 2 ? ArithmeticType(types) : SsaType::Unknown;
+    case InternalFunction::Divide:
+    case InternalFunction::MathPow:
+        return (count == 2 && numeric) ? SsaType::Real : SsaType::Unknown;
+    case InternalFunction::FloorDivide:
+        return (count == 2 && numeric) ? SsaType::Int : SsaType::Unknown;
+    case InternalFunction::Mod:
+        return (sameType && types[0] == SsaType::Int) ? SsaType::Int : SsaType::Unknown;
+    case InternalFunction::Less:
+    case InternalFunction::LessEqual:
+    case InternalFunction::Greater:
+    case InternalFunction::GreaterEqual:
+        return (count == 2 && numeric) ? SsaType::Bool : SsaType::Unknown;
+    case InternalFunction::Equal:
+    case InternalFunction::NotEqual:
+        return (count == 2 && (numeric || (sameType && types[0] == SsaType::Bool))) ? SsaType::Bool : SsaType::Unknown;
+    case InternalFunction::And:
+    case InternalFunction::Or:
+    case InternalFunction::Xor:
+        return (sameType && (types[0] == SsaType::Bool || types[0] == SsaType::Int)) ? types[0] : SsaType::Unknown;
+    case InternalFunction::Not:
+        return (count == 1 && (types[0] == SsaType::Bool || types[0] == SsaType::Int)) ? types[0] : SsaType::Unknown;
+    case InternalFunction::MathAbs:
+        return (count == 1 && numeric) ? types[0] : SsaType::Unknown;
+    case InternalFunction::MathCeil:
+    case InternalFunction::MathFloor:
+    case InternalFunction::MathRound:
+        return (count == 1 && numeric) ? SsaType::Int : SsaType::Unknown;
+    case InternalFunction::MathAcos:
+    case InternalFunction::MathAsin:
+    case InternalFunction::MathAtan:
+    case InternalFunction::MathCos:
+    case InternalFunction::MathExp:
+    case InternalFunction::MathLog:
+    case InternalFunction::MathSin:
+    case InternalFunction::MathSqrt:
+    case InternalFunction::MathTan:
+        return (count == 1 && numeric) ? SsaType::Real : SsaType::Unknown;
+    default:
+        return SsaType::Unknown;
+    }
+}
+
+// Returns true if the function has array locals or handles arrays on the stack.
+static bool UsesArrays(const Function& function)
+{
+    if (IsArrayType(function.GetReturnType()))
+        return true;
+    for (auto type : function.GetLocalTypes())
+    {
+        if (IsArrayType(type))
+            return true;
+    }
+    for (auto& op : function.GetBytecode())
+    {
+        if (op.op == Opcode::NewArray || op.op == Opcode::LoadElement || op.op == Opcode::StoreElement)
+            return true;
+        if (op.op >= Opcode::CallI0 && op.op <= Opcode::CallI7 && IsArrayFunction(static_cast<InternalFunction>(op.param)))
+            return true;
+    }
+    return false;
+}
+
+// Returns true if the internal function may throw even with parameters of the right types.
+static bool MayFail(InternalFunction function)
+{
+    switch (function)
+    {
+    case InternalFunction::Divide:
+    case InternalFunction::FloorDivide:
+    case InternalFunction::Mod:
+    case InternalFunction::MathAcos:
+    case InternalFunction::MathAsin:
+    case InternalFunction::MathLog:
+    case InternalFunction::MathPow:
+    case InternalFunction::MathSqrt:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * SsaFunction
+ */
+
+class SsaFunction
+{
+public:
+    SsaFunction(Program& program, Function& function);
+
+    // Builds the blocks, statements and definitions from the bytecode.
+    // Returns false if the function is not supported.
+    bool Lift();
+
+    // Each pass returns the number of changes.
+    int PropagateConstants();
+    int RemoveDeadCode();
+    int NumberValues();
+    int HoistInvariants();
+
+    // Replaces the function bytecode. Returns false if a jump offset would not fit.
+    bool Lower();
+
+private:
+    bool LiftInstruction(const BytecodeOp& op, int64_t index, int block, std::vector<int>& stack);
+    bool LiftCall(SsaNodeKind kind, short param, size_t paramCount, bool isVoid, int block, std::vector<int>& stack);
+    int PopStatementValue(int block, std::vector<int>& stack);
+    void SpillStack(int block, std::vector<int>& stack);
+    int AddNode(SsaNodeKind kind, short param);
+    void AddStatement(int block, SsaStatementKind kind, int value, short local = 0, int64_t target = 0);
+    bool FallsThrough(int block) const;
+
+    void FindDominators();
+    bool Dominates(int dominator, int block) const;
+    void PlacePhis();
+    void LinkReads(int block, std::vector<std::vector<int>>& current);
+    void LinkReadsInTree(int node, const std::vector<std::vector<int>>& current);
+
+    SsaType InferType(int node) const;
+    bool IsPure(int node) const;
+    bool CanFail(int node) const;
+    bool OnlyFailsWithin(int root, int node) const;
+    bool IsCandidate(int node) const;
+    bool IsInvariant(int node, const std::vector<bool>& inLoop) const;
+    bool IsAssignmentSafe(short local, int value) const;
+    std::string GetKey(int node) const;
+    short MoveToNewLocal(int node, std::list<SsaStatement>& statements, StatementIterator position,
+        StatementIterator& inserted);
+    void ReplaceWithLocal(int node, short local);
+
+    SsaLattice Evaluate(int node);
+    bool LowerValue(int definition, const SsaLattice& value);
+    bool MarkEdge(int from, int to, std::vector<std::vector<bool>>& edges, std::vector<bool>& executable);
+    int FoldConstants(int node);
+
+    void NumberValuesInBlock(int block, std::map<std::string, SsaAvailable>& available);
+    void NumberValuesInTree(int block, StatementIterator statement, int node,
+        std::map<std::string, SsaAvailable>& available, std::vector<std::string>& added);
+    int HoistFromLoop(int header, const std::vector<int>& latches);
+    void HoistFromTree(int root, int node, bool canMoveFailing, const std::vector<bool>& inLoop,
+        std::list<SsaStatement>& preheader, std::map<std::string, short>& hoisted, int& count);
+
+    bool IsImmediate(int node) const;
+    void EmitNode(int node, std::vector<BytecodeOp>& code) const;
+
+    Program& m_program;
+    Function& m_function;
+    std::vector<SsaNode> m_nodes;
+    std::vector<SsaBlock> m_blocks;
+    // The blocks in code order. Block 0 is an empty entry block.
+    std::vector<int> m_layout;
+    // The blocks in reverse postorder
+    std::vector<int> m_order;
+    std::vector<SsaDefinition> m_definitions;
+    std::vector<SsaLattice> m_values;
+    std::vector<SsaLattice> m_nodeValues;
+    int m_changes;
+};
+
+SsaFunction::SsaFunction(Program& program, Function& function)
+    : m_program(program), m_function(function), m_changes(0)
+{
+}
+
+/*
+ * Lifting
+ */
+
+bool SsaFunction::Lift()
+{
+    auto& code = m_function.GetBytecode();
+    auto size = static_cast<int64_t>(code.size());
+    if (size == 0)
+        return false;
+
+    // The arrays are on the heap, which is not modeled
+    if (UsesArrays(m_function))
+        return false;
+
+    // Find the reachable instructions and the block leaders
+    std::vector<bool> reachable(code.size(), false);
+    std::vector<bool> leader(code.size() + 1, false);
+    std::vector<int64_t> worklist(1, 0);
+    leader[0] = true;
+    while (!worklist.empty())
+    {
+        auto i = worklist.back();
+        worklist.pop_back();
+        if (reachable[i])
+            continue;
+        reachable[i] = true;
+
+        auto& op = code[i];
+        if (IsJumpOpcode(op.op))
+        {
+            auto target = i + op.param;
+            if (target < 0 || target >= size)
+                return false;
+            leader[target] = true;
+            worklist.push_back(target);
+        }
+        if (IsJumpOpcode(op.op) || op.op == Opcode::Return)
+            leader[i + 1] = true;
+        if (op.op != Opcode::Jump && op.op != Opcode::Return)
+        {
+            // Running past the end would fail at run time
+            if (i + 1 >= size)
+                return false;
+            worklist.push_back(i + 1);
+        }
+    }
+
+    // Every local starts with an entry definition: the parameter value or zero
+    auto localCount = m_function.GetLocalTypes().size();
+    for (size_t i = 0; i < localCount; i++)
+    {
+        SsaDefinition definition = { static_cast<short>(i), 0, false, std::vector<int>() };
+        m_definitions.push_back(definition);
+    }
+
+    // Block 0 is empty, so that the first block can be a loop header
+    m_blocks.resize(1);
+    m_layout.push_back(0);
+    std::vector<int> blockAt(code.size(), -1);
+    std::vector<int> stack;
+    int current = -1;
+    for (int64_t i = 0; i < size; i++)
+    {
+        if (leader[i])
+        {
+            // Values must not be carried over to another block
+            if (!stack.empty())
+                return false;
+
+            current = -1;
+            if (reachable[i])
+            {
+                current = static_cast<int>(m_blocks.size());
+                blockAt[i] = current;
+                m_blocks.push_back(SsaBlock());
+                m_layout.push_back(current);
+            }
+        }
+
+        if (current >= 0 && !LiftInstruction(code[i], i, current, stack))
+            return false;
+    }
+
+    // Link the blocks
+    for (size_t position = 0; position < m_layout.size(); position++)
+    {
+        auto& block = m_blocks[m_layout[position]];
+        int next = position + 1 < m_layout.size() ? m_layout[position + 1] : -1;
+        auto kind = block.statements.empty() ? SsaStatementKind::Push : block.statements.back().kind;
+
+        if (kind == SsaStatementKind::Jump || kind == SsaStatementKind::Branch)
+            block.statements.back().target = blockAt[block.statements.back().target];
+
+        if (kind != SsaStatementKind::Jump && kind != SsaStatementKind::Return)
+        {
+            if (next < 0)
+                return false;
+            block.successors.push_back(next);
+        }
+        if (kind == SsaStatementKind::Jump || kind == SsaStatementKind::Branch)
+            block.successors.push_back(static_cast<int>(block.statements.back().target));
+    }
+    for (size_t b = 0; b < m_blocks.size(); b++)
+    {
+        for (auto successor : m_blocks[b].successors)
+            m_blocks[successor].predecessors.push_back(static_cast<int>(b));
+    }
+
+    FindDominators();
+    PlacePhis();
+    std::vector<std::vector<int>> reaching(localCount);
+    for (size_t i = 0; i < localCount; i++)
+        reaching[i].push_back(static_cast<int>(i));
+    LinkReads(0, reaching);
+    return true;
+}
+
+bool SsaFunction::LiftInstruction(const BytecodeOp& op, int64_t index, int block, std::vector<int>& stack)
+{
+    auto localCount = static_cast<short>(m_function.GetLocalTypes().size());
+
+    switch (op.op)
+    {
+    case Opcode::PushConst:
+        if (op.param < 0 || op.param >= m_program.GetConstantCount())
+            return false;
+        stack.push_back(AddNode(SsaNodeKind::Constant, op.param));
+        return true;
+    case Opcode::PushImm:
+        stack.push_back(AddNode(SsaNodeKind::Constant, m_program.AddConstant(ObjectFromInt(op.param))));
+        return true;
+    case Opcode::PlusImm:
+    case Opcode::MinusImm:
+    case Opcode::MultiplyImm:
+        // The immediate is the right operand
+        if (stack.empty())
+            return false;
+        stack.push_back(AddNode(SsaNodeKind::Constant, m_program.AddConstant(ObjectFromInt(op.param))));
+        return LiftCall(SsaNodeKind::InternalCall, static_cast<short>(GetFusedFunction(op.op)), 2, false, block, stack);
+    case Opcode::PushLocal:
+        if (op.param < 0 || op.param >= localCount)
+            return false;
+        stack.push_back(AddNode(SsaNodeKind::Local, op.param));
+        return true;
+    case Opcode::PopLocal:
+        if (op.param < 0 || op.param >= localCount || stack.empty())
+            return false;
+        AddStatement(block, SsaStatementKind::Assign, PopStatementValue(block, stack), op.param);
+        return true;
+    case Opcode::PopDiscard:
+        if (stack.empty())
+            return false;
+        AddStatement(block, SsaStatementKind::Discard, PopStatementValue(block, stack));
+        return true;
+    case Opcode::Call:
+    {
+        if (op.param < 0 || op.param >= m_program.GetFunctionCount())
+            return false;
+        auto& callee = m_program.GetFunction(op.param);
+        return LiftCall(SsaNodeKind::Call, op.param, callee.GetParameterCount(),
+            callee.GetReturnType() == PrimitiveType::Void, block, stack);
+    }
+    case Opcode::Jump:
+        if (!stack.empty())
+            return false;
+        AddStatement(block, SsaStatementKind::Jump, -1, 0, index + op.param);
+        return true;
+    case Opcode::JumpFalse:
+        if (stack.size() != 1)
+            return false;
+        AddStatement(block, SsaStatementKind::Branch, stack.back(), 0, index + op.param);
+        stack.clear();
+        return true;
+    case Opcode::JumpIfNotLess:
+    case Opcode::JumpIfNotLessEqual:
+    case Opcode::JumpIfNotGreater:
+    case Opcode::JumpIfNotGreaterEqual:
+    case Opcode::JumpIfNotEqual:
+    case Opcode::JumpIfEqual:
+        // Lifted as the comparison and a JumpFalse
+        if (stack.size() != 2)
+            return false;
+        LiftCall(SsaNodeKind::InternalCall, static_cast<short>(GetFusedFunction(op.op)), 2, false, block, stack);
+        AddStatement(block, SsaStatementKind::Branch, stack.back(), 0, index + op.param);
+        stack.clear();
+        return true;
+    case Opcode::Return:
+        if (stack.size() > 1)
+            return false;
+        AddStatement(block, SsaStatementKind::Return, stack.empty() ? -1 : stack.back());
+        stack.clear();
+        return true;
+    default:
+        if (op.op >= Opcode::CallI0 && op.op <= Opcode::CallI7)
+        {
+            auto function = static_cast<InternalFunction>(op.param);
+            bool isVoid = function == InternalFunction::Print || function == InternalFunction::FailFast;
+            auto paramCount = static_cast<size_t>(op.op) - static_cast<size_t>(Opcode::CallI0);
+            return LiftCall(SsaNodeKind::InternalCall, op.param, paramCount, isVoid, block, stack);
+        }
+        return false;
+    }
+}
+
+bool SsaFunction::LiftCall(SsaNodeKind kind, short param, size_t paramCount, bool isVoid, int block,
+    std::vector<int>& stack)
+{
+    if (stack.size() < paramCount)
+        return false;
+
+    auto node = AddNode(kind, param);
+    m_nodes[node].args.assign(stack.end() - paramCount, stack.end());
+    stack.resize(stack.size() - paramCount);
+
+    if (isVoid)
+    {
+        SpillStack(block, stack);
+        AddStatement(block, SsaStatementKind::Evaluate, node);
+    }
+    else
+    {
+        stack.push_back(node);
+    }
+    return true;
+}
+
+// Pops the value of a statement. The values below it were evaluated first, so they become Push statements.
+int SsaFunction::PopStatementValue(int block, std::vector<int>& stack)
+{
+    auto value = stack.back();
+    stack.pop_back();
+    SpillStack(block, stack);
+    return value;
+}
+
+void SsaFunction::SpillStack(int block, std::vector<int>& stack)
+{
+    for (auto& entry : stack)
+    {
+        if (m_nodes[entry].kind == SsaNodeKind::StackValue)
+            continue;
+        AddStatement(block, SsaStatementKind::Push, entry);
+        entry = AddNode(SsaNodeKind::StackValue, 0);
+    }
+}
+
+int SsaFunction::AddNode(SsaNodeKind kind, short param)
+{
+    SsaNode node = { kind, param, -1, std::vector<int>() };
+    m_nodes.push_back(node);
+    return static_cast<int>(m_nodes.size() - 1);
+}
+
+void SsaFunction::AddStatement(int block, SsaStatementKind kind, int value, short local, int64_t target)
+{
+    SsaStatement statement = { kind, value, local, -1, target };
+    if (kind == SsaStatementKind::Assign)
+    {
+        SsaDefinition definition = { local, block, false, std::vector<int>() };
+        m_definitions.push_back(definition);
+        statement.definition = static_cast<int>(m_definitions.size() - 1);
+    }
+    m_blocks[block].statements.push_back(statement);
+}
+
+bool SsaFunction::FallsThrough(int block) const
+{
+    auto& statements = m_blocks[block].statements;
+    return statements.empty() ||
+        (statements.back().kind != SsaStatementKind::Jump && statements.back().kind != SsaStatementKind::Return);
+}
+
+/*
+ * SSA construction
+ */
+
+// Computes the dominator tree with the algorithm of Cooper, Harvey and Kennedy.
+void SsaFunction::FindDominators()
+{
+    // Depth-first search for the reverse postorder
+    std::vector<int> postorder;
+    std::vector<bool> visited(m_blocks.size(), false);
+    std::vector<std::pair<int, size_t>> searchStack(1, std::make_pair(0, 0));
+    visited[0] = true;
+    while (!searchStack.empty())
+    {
+        auto block = searchStack.back().first;
+        auto& successors = m_blocks[block].successors;
+        if (searchStack.back().second < successors.size())
+        {
+            auto successor = successors[searchStack.back().second++];
+            if (!visited[successor])
+            {
+                visited[successor] = true;
+                searchStack.push_back(std::make_pair(successor, 0));
+            }
+        }
+        else
+        {
+            postorder.push_back(block);
+            searchStack.pop_back();
+        }
+    }
+    m_order.assign(postorder.rbegin(), postorder.rend());
+    for (size_t i = 0; i < m_order.size(); i++)
+    {
+        m_blocks[m_order[i]].order = static_cast<int>(i);
+        m_blocks[m_order[i]].dominator = -1;
+    }
+    m_blocks[0].dominator = 0;
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = 1; i < m_order.size(); i++)
+        {
+            auto& block = m_blocks[m_order[i]];
+            int dominator = -1;
+            for (auto predecessor : block.predecessors)
+            {
+                if (m_blocks[predecessor].dominator < 0)
+                    continue;
+                if (dominator < 0)
+                {
+                    dominator = predecessor;
+                    continue;
+                }
+
+                // Walk up from both blocks until they meet
+                auto other = predecessor;
+                while (other != dominator)
+                {
+                    while (m_blocks[other].order > m_blocks[dominator].order)
+                        other = m_blocks[other].dominator;
+                    while (m_blocks[dominator].order > m_blocks[other].order)
+                        dominator = m_blocks[dominator].dominator;
+                }
+            }
+
+            if (dominator != block.dominator)
+            {
+                block.dominator = dominator;
+                changed = true;
+            }
+        }
+    }
+
+    for (size_t i = 1; i < m_order.size(); i++)
+        m_blocks[m_blocks[m_order[i]].dominator].dominatedBlocks.push_back(m_order[i]);
+}
+
+bool SsaFunction::Dominates(int dominator, int block) const
+{
+    while (block != dominator)
+    {
+        if (block == 0)
+            return false;
+        block = m_blocks[block].dominator;
+    }
+    return true;
+}
+
+// Places the phis of each assigned local at the iterated dominance frontier of its assignments.
+void SsaFunction::PlacePhis()
+{
+    std::vector<std::set<int>> frontier(m_blocks.size());
+    for (size_t b = 0; b < m_blocks.size(); b++)
+    {
+        auto& block = m_blocks[b];
+        if (block.predecessors.size() < 2)
+            continue;
+        for (auto runner : block.predecessors)
+        {
+            while (runner != block.dominator)
+            {
+                frontier[runner].insert(static_cast<int>(b));
+                runner = m_blocks[runner].dominator;
+            }
+        }
+    }
+
+    std::vector<std::vector<int>> assignedIn(m_function.GetLocalTypes().size());
+    for (size_t b = 0; b < m_blocks.size(); b++)
+    {
+        for (auto& statement : m_blocks[b].statements)
+        {
+            if (statement.kind == SsaStatementKind::Assign)
+                assignedIn[statement.local].push_back(static_cast<int>(b));
+        }
+    }
+
+    for (size_t local = 0; local < assignedIn.size(); local++)
+    {
+        std::vector<bool> hasPhi(m_blocks.size(), false);
+        std::vector<bool> queued(m_blocks.size(), false);
+        std::vector<int> worklist;
+        for (auto block : assignedIn[local])
+        {
+            if (!queued[block])
+            {
+                queued[block] = true;
+                worklist.push_back(block);
+            }
+        }
+
+        while (!worklist.empty())
+        {
+            auto block = worklist.back();
+            worklist.pop_back();
+            for (auto target : frontier[block])
+            {
+                if (hasPhi[target])
+                    continue;
+                hasPhi[target] = true;
+
+                SsaDefinition phi = { static_cast<short>(local), target, true,
+                    std::vector<int>(m_blocks[target].predecessors.size(), -1) };
+                m_definitions.push_back(phi);
+                m_blocks[target].phis.push_back(static_cast<int>(m_definitions.size() - 1));
+                if (!queued[target])
+                {
+                    queued[target] = true;
+                    worklist.push_back(target);
+                }
+            }
+        }
+    }
+}
+
+// Links the local reads to their definitions, walking the dominator tree with the current definition of each local.
+void SsaFunction::LinkReads(int block, std::vector<std::vector<int>>& current)
+{
+    std::vector<short> defined;
+    for (auto phi : m_blocks[block].phis)
+    {
+        current[m_definitions[phi].local].push_back(phi);
+        defined.push_back(m_definitions[phi].local);
+    }
+
+    for (auto& statement : m_blocks[block].statements)
+    {
+        if (statement.value >= 0)
+            LinkReadsInTree(statement.value, current);
+        if (statement.kind == SsaStatementKind::Assign)
+        {
+            current[statement.local].push_back(statement.definition);
+            defined.push_back(statement.local);
+        }
+    }
+
+    for (auto successor : m_blocks[block].successors)
+    {
+        auto& predecessors = m_blocks[successor].predecessors;
+        for (size_t i = 0; i < predecessors.size(); i++)
+        {
+            if (predecessors[i] != block)
+                continue;
+            for (auto phi : m_blocks[successor].phis)
+                m_definitions[phi].operands[i] = current[m_definitions[phi].local].back();
+        }
+    }
+
+    for (auto child : m_blocks[block].dominatedBlocks)
+        LinkReads(child, current);
+
+    for (auto local : defined)
+        current[local].pop_back();
+}
+
+void SsaFunction::LinkReadsInTree(int node, const std::vector<std::vector<int>>& current)
+{
+    if (m_nodes[node].kind == SsaNodeKind::Local)
+        m_nodes[node].definition = current[m_nodes[node].param].back();
+    for (auto arg : m_nodes[node].args)
+        LinkReadsInTree(arg, current);
+}
+
+/*
+ * Expression properties
+ */
+
+SsaType SsaFunction::InferType(int node) const
+{
+    auto& n = m_nodes[node];
+    switch (n.kind)
+    {
+    case SsaNodeKind::Constant:
+        return ToSsaType(m_program.GetConstant(n.param).GetType());
+    case SsaNodeKind::Local:
+    {
+        auto type = m_function.GetLocalTypes()[n.param];
+        if (n.param < m_function.GetParameterCount() && type == PrimitiveType::Real)
+            return SsaType::Numeric;
+        return ToSsaType(type);
+    }
+    case SsaNodeKind::InternalCall:
+    {
+        std::vector<SsaType> types;
+        for (auto arg : n.args)
+            types.push_back(InferType(arg));
+        return InternalCallType(static_cast<InternalFunction>(n.param), types);
+    }
+    default:
+        return SsaType::Unknown;
+    }
+}
+
+// Returns true if the expression has no side effects and cannot fail because of the value types.
+bool SsaFunction::IsPure(int node) const
+{
+    auto& n = m_nodes[node];
+    switch (n.kind)
+    {
+    case SsaNodeKind::Constant:
+    case SsaNodeKind::Local:
+        return true;
+    case SsaNodeKind::InternalCall:
+        if (InferType(node) == SsaType::Unknown)
+            return false;
+        return std::all_of(n.args.begin(), n.args.end(), [this](int arg) { return IsPure(arg); });
+    default:
+        return false;
+    }
+}
+
+// Returns true if the expression contains a call that may fail for some values, such as a division.
+bool SsaFunction::CanFail(int node) const
+{
+    auto& n = m_nodes[node];
+    if (n.kind == SsaNodeKind::InternalCall && MayFail(static_cast<InternalFunction>(n.param)))
+        return true;
+    return std::any_of(n.args.begin(), n.args.end(), [this](int arg) { return CanFail(arg); });
+}
+
+// Returns true if nothing in the tree of root, outside the tree of node, can fail or have side effects
+// before the statement completes. Then node can fail first without changing the behavior.
+bool SsaFunction::OnlyFailsWithin(int root, int node) const
+{
+    if (root == node)
+        return true;
+
+    auto& n = m_nodes[root];
+    switch (n.kind)
+    {
+    case SsaNodeKind::Call:
+        return false;
+    case SsaNodeKind::InternalCall:
+    {
+        // Print only has an effect once all its parameters are evaluated
+        auto function = static_cast<InternalFunction>(n.param);
+        if (function != InternalFunction::Print && (MayFail(function) || InferType(root) == SsaType::Unknown))
+            return false;
+        return std::all_of(n.args.begin(), n.args.end(), [this, node](int arg) { return OnlyFailsWithin(arg, node); });
+    }
+    default:
+        return true;
+    }
+}
+
+// Returns true if the value of the internal call could be kept in a new local.
+bool SsaFunction::IsCandidate(int node) const
+{
+    if (m_nodes[node].kind != SsaNodeKind::InternalCall || !IsPure(node))
+        return false;
+    return ToPrimitiveType(InferType(node)) != PrimitiveType::NoType;
+}
+
+bool SsaFunction::IsInvariant(int node, const std::vector<bool>& inLoop) const
+{
+    auto& n = m_nodes[node];
+    switch (n.kind)
+    {
+    case SsaNodeKind::Constant:
+        return true;
+    case SsaNodeKind::Local:
+        return n.definition < 0 || !inLoop[m_definitions[n.definition].block];
+    case SsaNodeKind::InternalCall:
+        return std::all_of(n.args.begin(), n.args.end(), [this, &inLoop](int arg) { return IsInvariant(arg, inLoop); });
+    default:
+        return false;
+    }
+}
+
+// Returns true if storing the value cannot fail the type check of PopLocal.
+bool SsaFunction::IsAssignmentSafe(short local, int value) const
+{
+    auto type = m_function.GetLocalTypes()[local];
+    if (local < m_function.GetParameterCount() && type == PrimitiveType::Real)
+        return false;
+    return ToSsaType(type) == InferType(value);
+}
+
+// Returns a string that is equal for expressions that compute the same value.
+std::string SsaFunction::GetKey(int node) const
+{
+    auto& n = m_nodes[node];
+    switch (n.kind)
+    {
+    case SsaNodeKind::Constant:
+        return "c" + std::to_string(n.param);
+    case SsaNodeKind::Local:
+        if (n.definition < 0)
+            return "t" + std::to_string(n.param);
+        return "d" + std::to_string(n.definition);
+    default:
+    {
+        std::string key = "f" + std::to_string(n.param) + "(";
+        for (auto arg : n.args)
+            key += GetKey(arg) + ",";
+        return key + ")";
+    }
+    }
+}
+
+// Moves the expression into an assignment to a new local, inserted before the position,
+// and makes the node read the local instead.
+short SsaFunction::MoveToNewLocal(int node, std::list<SsaStatement>& statements, StatementIterator position,
+    StatementIterator& inserted)
+{
+    auto local = m_function.AddLocal(ToPrimitiveType(InferType(node)));
+    auto copy = AddNode(m_nodes[node].kind, m_nodes[node].param);
+    m_nodes[copy].args.swap(m_nodes[node].args);
+    ReplaceWithLocal(node, local);
+
+    SsaStatement assign = { SsaStatementKind::Assign, copy, local, -1, 0 };
+    inserted = statements.insert(position, assign);
+    return local;
+}
+
+void SsaFunction::ReplaceWithLocal(int node, short local)
+{
+    m_nodes[node].kind = SsaNodeKind::Local;
+    m_nodes[node].param = local;
+    m_nodes[node].definition = -1;
+    m_nodes[node].args.clear();
+}
+
+/*
+ * Constant propagation
+ */
+
+SsaLattice SsaFunction::Evaluate(int node)
+{
+    auto& n = m_nodes[node];
+    SsaLattice result = Varying();
+
+    switch (n.kind)
+    {
+    case SsaNodeKind::Constant:
+        result = ConstantValue(m_program.GetConstant(n.param));
+        break;
+    case SsaNodeKind::Local:
+        result = m_values[n.definition];
+        break;
+    case SsaNodeKind::InternalCall:
+    {
+        std::vector<SsaLattice> args;
+        for (auto arg : n.args)
+            args.push_back(Evaluate(arg));
+
+        auto function = static_cast<InternalFunction>(n.param);
+        if (!IsInternalFunctionPure(function))
+            break;
+        if (std::any_of(args.begin(), args.end(), [](const SsaLattice& a) { return a.state == SsaLattice::State::Varying; }))
+            break;
+        if (std::any_of(args.begin(), args.end(), [](const SsaLattice& a) { return a.state == SsaLattice::State::Undefined; }))
+        {
+            result = Undefined();
+            break;
+        }
+
+        // The first parameter is on top of the parameter stack
+        ParameterStack params;
+        for (auto arg = args.rbegin(); arg != args.rend(); ++arg)
+            params.push(arg->value);
+        try
+        {
+            auto value = InternalFunc::CallPureFunction(function, params);
+            if (value.GetType() != PrimitiveType::Void)
+                result = ConstantValue(value);
+        }
+        catch (std::exception&)
+        {
+            // The error is left to happen at run time
+        }
+        break;
+    }
+    default:
+        for (auto arg : n.args)
+            Evaluate(arg);
+        break;
+    }
+
+    m_nodeValues[node] = result;
+    return result;
+}
+
+bool SsaFunction::LowerValue(int definition, const SsaLattice& value)
+{
+    auto old = m_values[definition];
+    m_values[definition] = Meet(old, value);
+    return m_values[definition].state != old.state;
+}
+
+bool SsaFunction::MarkEdge(int from, int to, std::vector<std::vector<bool>>& edges, std::vector<bool>& executable)
+{
+    bool changed = false;
+    auto& predecessors = m_blocks[to].predecessors;
+    for (size_t i = 0; i < predecessors.size(); i++)
+    {
+        if (predecessors[i] == from && !edges[to][i])
+        {
+            edges[to][i] = true;
+            changed = true;
+        }
+    }
+    executable[to] = true;
+    return changed;
+}
+
+// Replaces the largest subtrees with a constant value by the constant. Returns the number of replaced trees.
+int SsaFunction::FoldConstants(int node)
+{
+    auto& value = m_nodeValues[node];
+    if (value.state == SsaLattice::State::Constant && m_nodes[node].kind != SsaNodeKind::Constant && IsPure(node))
+    {
+        auto index = m_program.AddConstant(value.value);
+        m_nodes[node].kind = SsaNodeKind::Constant;
+        m_nodes[node].param = index;
+        m_nodes[node].args.clear();
+        return 1;
+    }
+
+    int count = 0;
+    auto args = m_nodes[node].args;
+    for (auto arg : args)
+        count += FoldConstants(arg);
+    return count;
+}
+
+// Sparse conditional constant propagation: the values are only taken from the edges that can be executed,
+// assuming the constant conditions.
+int SsaFunction::PropagateConstants()
+{
+    auto localCount = m_function.GetLocalTypes().size();
+    m_values.assign(m_definitions.size(), Undefined());
+    for (size_t i = 0; i < localCount; i++)
+    {
+        if (static_cast<short>(i) < m_function.GetParameterCount())
+            m_values[i] = Varying();
+        else
+            m_values[i] = ConstantValue(PObject(m_function.GetLocalTypes()[i], 0));
+    }
+    m_nodeValues.assign(m_nodes.size(), Undefined());
+
+    std::vector<bool> executable(m_blocks.size(), false);
+    std::vector<std::vector<bool>> edges(m_blocks.size());
+    for (size_t b = 0; b < m_blocks.size(); b++)
+        edges[b].assign(m_blocks[b].predecessors.size(), false);
+    executable[0] = true;
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto b : m_order)
+        {
+            if (!executable[b])
+                continue;
+            auto& block = m_blocks[b];
+
+            for (auto phi : block.phis)
+            {
+                auto value = Undefined();
+                for (size_t i = 0; i < block.predecessors.size(); i++)
+                {
+                    if (edges[b][i])
+                        value = Meet(value, m_values[m_definitions[phi].operands[i]]);
+                }
+                changed = LowerValue(phi, value) || changed;
+            }
+
+            bool branchDecided = false;
+            for (auto& statement : block.statements)
+            {
+                auto value = statement.value >= 0 ? Evaluate(statement.value) : Undefined();
+                if (statement.kind == SsaStatementKind::Assign)
+                {
+                    changed = LowerValue(statement.definition, value) || changed;
+                }
+                else if (statement.kind == SsaStatementKind::Branch && value.state == SsaLattice::State::Constant &&
+                    value.value.GetType() == PrimitiveType::Bool && IsPure(statement.value))
+                {
+                    // The condition will be folded into a constant below.
+                    // JumpFalse jumps to the second successor
+                    auto successor = block.successors[value.value.GetBoolValue() ? 0 : 1];
+                    changed = MarkEdge(b, successor, edges, executable) || changed;
+                    branchDecided = true;
+                }
+            }
+
+            if (!branchDecided)
+            {
+                for (auto successor : block.successors)
+                    changed = MarkEdge(b, successor, edges, executable) || changed;
+            }
+        }
+    }
+
+    // Rewrite the constant expressions and branches
+    int folded = 0;
+    for (auto b : m_layout)
+    {
+        if (!executable[b])
+            continue;
+
+        auto& statements = m_blocks[b].statements;
+        for (auto statement = statements.begin(); statement != statements.end(); )
+        {
+            if (statement->value >= 0)
+                folded += FoldConstants(statement->value);
+
+            if (statement->kind == SsaStatementKind::Branch && m_nodes[statement->value].kind == SsaNodeKind::Constant)
+            {
+                auto condition = m_program.GetConstant(m_nodes[statement->value].param);
+                if (condition.GetType() == PrimitiveType::Bool)
+                {
+                    folded++;
+                    if (condition.GetBoolValue())
+                    {
+                        statement = statements.erase(statement);
+                        continue;
+                    }
+                    statement->kind = SsaStatementKind::Jump;
+                    statement->value = -1;
+                }
+            }
+            ++statement;
+        }
+    }
+
+    // Drop the blocks that cannot be reached any more. Their predecessors only jump past them.
+    m_layout.erase(std::remove_if(m_layout.begin(), m_layout.end(), [&executable](int b) { return !executable[b]; }),
+        m_layout.end());
+    return folded;
+}
+
+/*
+ * Dead code elimination
+ */
+
+int SsaFunction::RemoveDeadCode()
+{
+    int removed = 0;
+    while (true)
+    {
+        // Find the definitions that are read, directly or through phis
+        std::vector<bool> live(m_definitions.size(), false);
+        std::vector<int> worklist;
+        for (auto b : m_layout)
+        {
+            for (auto& statement : m_blocks[b].statements)
+            {
+                if (statement.value < 0)
+                    continue;
+                std::vector<int> nodes(1, statement.value);
+                while (!nodes.empty())
+                {
+                    auto& node = m_nodes[nodes.back()];
+                    nodes.pop_back();
+                    if (node.kind == SsaNodeKind::Local && node.definition >= 0)
+                        worklist.push_back(node.definition);
+                    nodes.insert(nodes.end(), node.args.begin(), node.args.end());
+                }
+            }
+        }
+        while (!worklist.empty())
+        {
+            auto definition = worklist.back();
+            worklist.pop_back();
+            if (definition < 0 || live[definition])
+                continue;
+            live[definition] = true;
+            if (m_definitions[definition].isPhi)
+                worklist.insert(worklist.end(), m_definitions[definition].operands.begin(), m_definitions[definition].operands.end());
+        }
+
+        int removedNow = 0;
+        for (auto b : m_layout)
+        {
+            auto& statements = m_blocks[b].statements;
+            for (auto statement = statements.begin(); statement != statements.end(); )
+            {
+                bool noEffect = statement->value >= 0 && IsPure(statement->value) && !CanFail(statement->value);
+                bool deadAssign = statement->kind == SsaStatementKind::Assign && !live[statement->definition] &&
+                    IsAssignmentSafe(statement->local, statement->value);
+                if (noEffect && (deadAssign || statement->kind == SsaStatementKind::Discard))
+                {
+                    statement = statements.erase(statement);
+                    removedNow++;
+                }
+                else
+                {
+                    ++statement;
+                }
+            }
+        }
+
+        if (removedNow == 0)
+            break;
+        removed += removedNow;
+    }
+    return removed;
+}
+
+/*
+ * Global value numbering
+ */
+
+int SsaFunction::NumberValues()
+{
+    std::map<std::string, SsaAvailable> available;
+    m_changes = 0;
+    NumberValuesInBlock(0, available);
+    return m_changes;
+}
+
+// The expressions of a block are available in the blocks it dominates.
+void SsaFunction::NumberValuesInBlock(int block, std::map<std::string, SsaAvailable>& available)
+{
+    std::vector<std::string> added;
+    auto& statements = m_blocks[block].statements;
+    for (auto statement = statements.begin(); statement != statements.end(); ++statement)
+    {
+        if (statement->value >= 0)
+            NumberValuesInTree(block, statement, statement->value, available, added);
+    }
+
+    for (auto child : m_blocks[block].dominatedBlocks)
+        NumberValuesInBlock(child, available);
+
+    for (auto& key : added)
+        available.erase(key);
+}
+
+void SsaFunction::NumberValuesInTree(int block, StatementIterator statement, int node,
+    std::map<std::string, SsaAvailable>& available, std::vector<std::string>& added)
+{
+    if (IsCandidate(node))
+    {
+        auto key = GetKey(node);
+        auto found = available.find(key);
+        if (found == available.end())
+        {
+            bool canMove = !CanFail(node) || OnlyFailsWithin(statement->value, node);
+            SsaAvailable entry = { node, block, statement, canMove, -1 };
+            available.emplace(key, entry);
+            added.push_back(key);
+        }
+        else if (found->second.canMove)
+        {
+            auto& first = found->second;
+            if (first.local < 0)
+            {
+                // Compute the first occurrence into a new local just before its statement
+                StatementIterator inserted;
+                first.local = MoveToNewLocal(first.node, m_blocks[first.block].statements, first.statement, inserted);
+
+                // The subexpressions of the first occurrence are now evaluated in the new statement
+                std::set<int> moved;
+                std::vector<int> nodes(1, inserted->value);
+                while (!nodes.empty())
+                {
+                    moved.insert(nodes.back());
+                    auto args = m_nodes[nodes.back()].args;
+                    nodes.pop_back();
+                    nodes.insert(nodes.end(), args.begin(), args.end());
+                }
+                for (auto& entry : available)
+                {
+                    if (moved.count(entry.second.node) > 0)
+                        entry.second.statement = inserted;
+                }
+            }
+
+            ReplaceWithLocal(node, first.local);
+            m_changes++;
+            return;
+        }
+    }
+
+    auto args = m_nodes[node].args;
+    for (auto arg : args)
+        NumberValuesInTree(block, statement, arg, available, added);
+}
+
+/*
+ * Loop-invariant code motion
+ */
+
+// Hoists the invariant expressions of the outermost loop with any. Returns the number of hoisted expressions.
+int SsaFunction::HoistInvariants()
+{
+    for (auto header : m_order)
+    {
+        // A back edge comes from a block dominated by the header
+        std::vector<int> latches;
+        for (auto predecessor : m_blocks[header].predecessors)
+        {
+            if (Dominates(header, predecessor))
+                latches.push_back(predecessor);
+        }
+
+        if (!latches.empty())
+        {
+            auto count = HoistFromLoop(header, latches);
+            if (count > 0)
+                return count;
+        }
+    }
+    return 0;
+}
+
+int SsaFunction::HoistFromLoop(int header, const std::vector<int>& latches)
+{
+    std::vector<bool> inLoop(m_blocks.size(), false);
+    inLoop[header] = true;
+    std::vector<int> worklist(latches);
+    while (!worklist.empty())
+    {
+        auto block = worklist.back();
+        worklist.pop_back();
+        if (inLoop[block])
+            continue;
+        inLoop[block] = true;
+        worklist.insert(worklist.end(), m_blocks[block].predecessors.begin(), m_blocks[block].predecessors.end());
+    }
+
+    // The new block is placed just before the header, so a loop block must not fall through into the header
+    auto position = std::find(m_layout.begin(), m_layout.end(), header) - m_layout.begin();
+    auto previous = m_layout[position - 1];
+    if (inLoop[previous] && FallsThrough(previous))
+        return 0;
+
+    std::list<SsaStatement> preheader;
+    std::map<std::string, short> hoisted;
+    int count = 0;
+    for (auto b : m_layout)
+    {
+        if (!inLoop[b])
+            continue;
+
+        // The first statement of the header runs whenever the loop is entered,
+        // so an expression that fails there would also fail before the loop
+        auto& statements = m_blocks[b].statements;
+        for (auto statement = statements.begin(); statement != statements.end(); ++statement)
+        {
+            bool canMoveFailing = (b == header && statement == statements.begin());
+            if (statement->value >= 0)
+                HoistFromTree(statement->value, statement->value, canMoveFailing, inLoop, preheader, hoisted, count);
+        }
+    }
+    if (count == 0)
+        return 0;
+
+    // Entries into the loop go through the new block, while the back edges still go to the header
+    auto preheaderIndex = static_cast<int>(m_blocks.size());
+    for (auto b : m_layout)
+    {
+        if (inLoop[b])
+            continue;
+        for (auto& statement : m_blocks[b].statements)
+        {
+            if ((statement.kind == SsaStatementKind::Jump || statement.kind == SsaStatementKind::Branch) &&
+                statement.target == header)
+                statement.target = preheaderIndex;
+        }
+    }
+
+    m_blocks.push_back(SsaBlock());
+    m_blocks.back().statements.swap(preheader);
+    m_layout.insert(m_layout.begin() + position, preheaderIndex);
+    return count;
+}
+
+void SsaFunction::HoistFromTree(int root, int node, bool canMoveFailing, const std::vector<bool>& inLoop,
+    std::list<SsaStatement>& preheader, std::map<std::string, short>& hoisted, int& count)
+{
+    if (IsCandidate(node) && IsInvariant(node, inLoop))
+    {
+        auto key = GetKey(node);
+        auto found = hoisted.find(key);
+        if (found != hoisted.end())
+        {
+            // The value was already computed before the loop without failing
+            ReplaceWithLocal(node, found->second);
+            count++;
+            return;
+        }
+        if (!CanFail(node) || (canMoveFailing && OnlyFailsWithin(root, node)))
+        {
+            StatementIterator inserted;
+            hoisted[key] = MoveToNewLocal(node, preheader, preheader.end(), inserted);
+            count++;
+            return;
+        }
+    }
+
+    auto args = m_nodes[node].args;
+    for (auto arg : args)
+        HoistFromTree(root, arg, canMoveFailing, inLoop, preheader, hoisted, count);
+}
+
+/*
+ * Lowering
+ */
+
+// Returns true if the node is an integer constant that fits in an instruction parameter.
+bool SsaFunction::IsImmediate(int node) const
+{
+    auto& n = m_nodes[node];
+    if (n.kind != SsaNodeKind::Constant)
+        return false;
+
+    auto constant = m_program.GetConstant(n.param);
+    return constant.GetType() == PrimitiveType::Int &&
+        constant.GetIntValue() >= SHRT_MIN && constant.GetIntValue() <= SHRT_MAX;
+}
+
+void SsaFunction::EmitNode(int node, std::vector<BytecodeOp>& code) const
+{
+    auto& n = m_nodes[node];
+    if (n.kind == SsaNodeKind::InternalCall && n.args.size() == 2 && IsImmediate(n.args[1]))
+    {
+        auto immediateOp = GetImmediateOpcode(static_cast<InternalFunction>(n.param));
+        if (immediateOp != Opcode::Invalid)
+        {
+            EmitNode(n.args[0], code);
+            code.push_back(BytecodeOp(immediateOp,
+                static_cast<short>(m_program.GetConstant(m_nodes[n.args[1]].param).GetIntValue())));
+            return;
+        }
+    }
+
+    for (auto arg : n.args)
+        EmitNode(arg, code);
+
+    switch (n.kind)
+    {
+    case SsaNodeKind::Constant:
+        if (IsImmediate(node))
+            code.push_back(BytecodeOp(Opcode::PushImm, static_cast<short>(m_program.GetConstant(n.param).GetIntValue())));
+        else
+            code.push_back(BytecodeOp(Opcode::PushConst, n.param));
+        break;
+    case SsaNodeKind::Local:
+        code.push_back(BytecodeOp(Opcode::PushLocal, n.param));
+        break;
+    case SsaNodeKind::InternalCall:
+        code.push_back(BytecodeOp(static_cast<Opcode>(static_cast<int>(Opcode::CallI0) + n.args.size()), n.param));
+        break;
+    case SsaNodeKind::Call:
+        code.push_back(BytecodeOp(Opcode::Call, n.param));
+        break;
+    case SsaNodeKind::StackValue:
+        // Already on the stack
+        break;
+    }
+}
+
+bool SsaFunction::Lower()
+{
+    std::vector<BytecodeOp> code;
+    std::vector<int64_t> blockStart(m_blocks.size(), -1);
+    std::vector<std::pair<size_t, int64_t>> jumps;
+
+    for (auto b : m_layout)
+    {
+        blockStart[b] = static_cast<int64_t>(code.size());
+        for (auto& statement : m_blocks[b].statements)
+        {
+            // A branch on a comparison becomes a compare-and-branch instruction
+            auto jumpOp = Opcode::JumpFalse;
+            if (statement.kind == SsaStatementKind::Branch && statement.value >= 0 &&
+                m_nodes[statement.value].kind == SsaNodeKind::InternalCall && m_nodes[statement.value].args.size() == 2)
+            {
+                jumpOp = GetFusedJumpOpcode(static_cast<InternalFunction>(m_nodes[statement.value].param));
+                if (jumpOp == Opcode::Invalid)
+                    jumpOp = Opcode::JumpFalse;
+            }
+
+            if (jumpOp != Opcode::JumpFalse)
+            {
+                for (auto arg : m_nodes[statement.value].args)
+                    EmitNode(arg, code);
+            }
+            else if (statement.value >= 0)
+            {
+                EmitNode(statement.value, code);
+            }
+
+            switch (statement.kind)
+            {
+            case SsaStatementKind::Assign:
+                code.push_back(BytecodeOp(Opcode::PopLocal, statement.local));
+                break;
+            case SsaStatementKind::Discard:
+                code.push_back(BytecodeOp(Opcode::PopDiscard, 0));
+                break;
+            case SsaStatementKind::Branch:
+                jumps.push_back(std::make_pair(code.size(), statement.target));
+                code.push_back(BytecodeOp(jumpOp, 0));
+                break;
+            case SsaStatementKind::Jump:
+                jumps.push_back(std::make_pair(code.size(), statement.target));
+                code.push_back(BytecodeOp(Opcode::Jump, 0));
+                break;
+            case SsaStatementKind::Return:
+                code.push_back(BytecodeOp(Opcode::Return, 0));
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    for (auto& jump : jumps)
+    {
+        if (blockStart[jump.second] < 0)
+            return false;
+        auto offset = blockStart[jump.second] - static_cast<int64_t>(jump.first);
+        if (offset < SHRT_MIN || offset > SHRT_MAX)
+            return false;
+        code[jump.first].param = static_cast<short>(offset);
+    }
+
+    m_function.SetBytecode(code);
+    return true;
+}
+
+/*
+ * Driver
+ */
+
+enum class SsaPass
+{
+    PropagateConstants,
+    RemoveDeadCode,
+    NumberValues,
+    HoistInvariants
+};
+
+// Runs a pass on a fresh lift of the current bytecode and keeps the result if anything changed.
+// Returns the number of changes.
+static int RunPass(Program& program, Function& function, SsaPass pass)
+{
+    SsaFunction ssa(program, function);
+    if (!ssa.Lift())
+        return 0;
+
+    int changes = 0;
+    switch (pass)
+    {
+    case SsaPass::PropagateConstants:
+        changes = ssa.PropagateConstants();
+        break;
+    case SsaPass::RemoveDeadCode:
+        changes = ssa.RemoveDeadCode();
+        break;
+    case SsaPass::NumberValues:
+        changes = ssa.NumberValues();
+        break;
+    case SsaPass::HoistInvariants:
+        changes = ssa.HoistInvariants();
+        break;
+    }
+
+    if (changes == 0 || !ssa.Lower())
+        return 0;
+    return changes;
+}
+
+SsaStatistics Peisik::OptimizeSsa(Program& program)
+{
+    SsaStatistics statistics = { 0, 0, 0, 0 };
+
+    for (short i = 0; i < program.GetFunctionCount(); i++)
+    {
+        auto& function = program.GetMutableFunction(i);
+        for (int round = 0; round < MaxRounds; round++)
+        {
+            auto folded = RunPass(program, function, SsaPass::PropagateConstants);
+            auto removed = RunPass(program, function, SsaPass::RemoveDeadCode);
+            auto reused = RunPass(program, function, SsaPass::NumberValues);
+
+            // Each run hoists from one loop
+            int hoisted = 0;
+            for (int loop = 0; loop < MaxHoistedLoops; loop++)
+            {
+                auto count = RunPass(program, function, SsaPass::HoistInvariants);
+                if (count == 0)
+                    break;
+                hoisted += count;
+            }
+
+            statistics.foldedExpressions += folded;
+            statistics.removedStatements += removed;
+            statistics.reusedExpressions += reused;
+            statistics.hoistedExpressions += hoisted;
+            if (folded + removed + reused + hoisted == 0)
+                break;
+        }
+    }
+
+    return statistics;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Program.h"
+
+namespace Peisik
+{
+    // Counts the changes made by OptimizeSsa.
+    struct SsaStatistics
+    {
+        int foldedExpressions;
+        int reusedExpressions;
+        int hoistedExpressions;
+        int removedStatements;
+    };
+
+    // Optimizes the bytecode of every function in SSA form after loading.
+    //
+    // The stack code is lifted into basic blocks of statements, each holding an expression tree,
+    // and every local read is linked to its reaching definition. The passes are:
+    //  - sparse conditional constant propagation, which also removes branches with constant conditions,
+    //  - global value numbering, which reuses the value of an equal expression in a dominating statement,
+    //  - loop-invariant code motion of expressions into a new block before the loop header,
+    //  - removal of unused assignments and discarded values without side effects.
+    // Reused and hoisted values are kept in new locals. Expressions that may fail, such as Math.Sqrt,
+    // are only moved if the error would still happen at the same point of execution.
+    // Functions that keep values on the stack across jumps or have reachable jumps out of bounds
+    // are left unchanged.
+    SsaStatistics OptimizeSsa(Program& program);
+}
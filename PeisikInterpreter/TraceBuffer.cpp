@@ -0,0 +1,132 @@
+#include "pch.h"
+#include "PeisikException.h"
+#include "TraceBuffer.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PEISIK_TRACE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace Peisik;
+
+static_assert(sizeof(TraceRecord) == 24, "The trace record layout is part of the file format.");
+static_assert(sizeof(TraceHeader) == 24, "The trace header layout is part of the file format.");
+
+static uint32_t RoundUpToPowerOfTwo(uint32_t value)
+{
+    uint32_t result = 1;
+    while (result < value && result < 0x80000000u)
+        result <<= 1;
+    return result;
+}
+
+// Returns the records in the ring, oldest first.
+static std::vector<TraceRecord> UnrollRing(const TraceRecord* ring, uint64_t capacity, uint64_t recordCount)
+{
+    uint64_t count = std::min(recordCount, capacity);
+    std::vector<TraceRecord> result;
+    result.reserve(static_cast<size_t>(count));
+    for (uint64_t i = recordCount - count; i < recordCount; i++)
+        result.push_back(ring[i & (capacity - 1)]);
+    return result;
+}
+
+TraceBuffer::TraceBuffer(const std::string& path, uint32_t capacity)
+    : m_path(path), m_header(nullptr), m_records(nullptr), m_mapping(nullptr), m_mappingSize(0)
+{
+    capacity = RoundUpToPowerOfTwo(capacity);
+    size_t size = sizeof(TraceHeader) + static_cast<size_t>(capacity) * sizeof(TraceRecord);
+
+#ifdef PEISIK_TRACE_MMAP
+    if (!path.empty())
+    {
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Could not create the trace file " + path + ".");
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+        {
+            close(fd);
+            throw std::runtime_error("Could not resize the trace file " + path + ".");
+        }
+
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+            throw std::runtime_error("Could not map the trace file " + path + ".");
+
+        m_mapping = mapping;
+        m_mappingSize = size;
+        m_header = static_cast<TraceHeader*>(mapping);
+        // The file is already written by the mapping
+        m_path.clear();
+    }
+#endif
+
+    if (m_header == nullptr)
+    {
+        m_memory.resize((size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+        m_header = reinterpret_cast<TraceHeader*>(m_memory.data());
+    }
+
+    m_header->magic = Magic;
+    m_header->version = Version;
+    m_header->recordSize = sizeof(TraceRecord);
+    m_header->capacity = capacity;
+    m_header->recordCount = 0;
+    m_records = reinterpret_cast<TraceRecord*>(m_header + 1);
+}
+
+TraceBuffer::~TraceBuffer()
+{
+#ifdef PEISIK_TRACE_MMAP
+    if (m_mapping != nullptr)
+        munmap(m_mapping, m_mappingSize);
+#endif
+
+    if (!m_path.empty())
+    {
+        std::ofstream stream(m_path, std::ofstream::binary);
+        Write(stream);
+    }
+}
+
+uint32_t TraceBuffer::GetCapacity() const
+{
+    return m_header->capacity;
+}
+
+uint64_t TraceBuffer::GetRecordCount() const
+{
+    return m_header->recordCount;
+}
+
+std::vector<TraceRecord> TraceBuffer::GetRecords() const
+{
+    return UnrollRing(m_records, m_header->capacity, m_header->recordCount);
+}
+
+void TraceBuffer::Write(std::ostream& stream) const
+{
+    stream.write(reinterpret_cast<const char*>(m_header),
+        sizeof(TraceHeader) + static_cast<size_t>(m_header->capacity) * sizeof(TraceRecord));
+}
+
+std::vector<TraceRecord> Peisik::ReadTrace(std::istream& stream, TraceHeader& header)
+{
+    stream.exceptions(std::istream::badbit | std::istream::eofbit | std::istream::failbit);
+
+    stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (header.magic != TraceBuffer::Magic)
+        throw InterpreterException("Not a Peisik trace file.");
+    if (header.version != TraceBuffer::Version || header.recordSize != sizeof(TraceRecord))
+        throw InterpreterException("Wrong trace version.");
+    if (header.capacity == 0 || (header.capacity & (header.capacity - 1)) != 0)
+        throw InterpreterException("Invalid trace capacity.");
+
+    std::vector<TraceRecord> ring(header.capacity);
+    stream.read(reinterpret_cast<char*>(ring.data()), ring.size() * sizeof(TraceRecord));
+
+    return UnrollRing(ring.data(), header.capacity, header.recordCount);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Bytecode.h"
+#include "PObject.h"
+
+namespace Peisik
+{
+    // A fixed-size record of one executed instruction.
+    struct TraceRecord
+    {
+        // The raw value of the topmost stack entry before the instruction was executed
+        int64_t topValue;
+        // The instruction index, or the byte offset if the TraceCompactCode flag is set
+        uint32_t programCounter;
+        short function;
+        short param;
+        uint8_t opcode;
+        // The PrimitiveType of the topmost stack entry, or NoType if the stack was empty
+        uint8_t topType;
+        uint8_t flags;
+        uint8_t reserved[5];
+    };
+
+    // Set in TraceRecord::flags if the function ran in the executable compact encoding.
+    // The program counter and jump offsets are then in bytes.
+    const uint8_t TraceCompactCode = 1;
+
+    // The header at the start of a trace file, followed by the records.
+    struct TraceHeader
+    {
+        // PTRC (notice the endianness)
+        uint32_t magic;
+        uint32_t version;
+        uint32_t recordSize;
+        // The number of records in the ring, always a power of two
+        uint32_t capacity;
+        // The number of records ever appended. The last min(recordCount, capacity) records are in the ring,
+        // the oldest one at index recordCount % capacity if the ring is full.
+        uint64_t recordCount;
+    };
+
+    // A ring buffer of the most recently executed instructions, either in memory or in a memory-mapped file.
+    // Appending a record is a few stores, so production-sized runs can be traced.
+    class TraceBuffer
+    {
+    public:
+        static const uint32_t Magic = 0x43525450;
+        static const uint32_t Version = 1;
+
+        // Creates a ring buffer holding at least the specified number of records.
+        // If the path is not empty, the buffer is mapped to the file so that it survives crashes.
+        // On platforms without mmap, the file is written when the buffer is destroyed.
+        // Throws a std::runtime_error if the file cannot be created.
+        TraceBuffer(const std::string& path, uint32_t capacity);
+        ~TraceBuffer();
+
+        TraceBuffer(const TraceBuffer&) = delete;
+        TraceBuffer& operator=(const TraceBuffer&) = delete;
+
+        // Appends a record. The top of the stack may be null if the stack is empty.
+        void Append(short function, uint32_t programCounter, const BytecodeOp& op, const PObject* top, uint8_t flags)
+        {
+            auto& record = m_records[m_header->recordCount & (m_header->capacity - 1)];
+            record.topValue = top != nullptr ? top->GetRawValue() : 0;
+            record.programCounter = programCounter;
+            record.function = function;
+            record.param = op.param;
+            record.opcode = static_cast<uint8_t>(op.op);
+            record.topType = static_cast<uint8_t>(top != nullptr ? top->GetType() : PrimitiveType::NoType);
+            record.flags = flags;
+            m_header->recordCount++;
+        }
+
+        // Gets the number of records the ring holds.
+        uint32_t GetCapacity() const;
+
+        // Gets the number of records ever appended.
+        uint64_t GetRecordCount() const;
+
+        // Gets the records in the ring, oldest first.
+        std::vector<TraceRecord> GetRecords() const;
+
+        // Writes the buffer in the trace file format.
+        void Write(std::ostream& stream) const;
+
+    private:
+        std::string m_path;
+        TraceHeader* m_header;
+        TraceRecord* m_records;
+        // The header and the records, unless the buffer is mapped
+        std::vector<uint64_t> m_memory;
+        void* m_mapping;
+        size_t m_mappingSize;
+    };
+
+    // Reads the records of a trace file, oldest first.
+    // Throws an InterpreterException if the file is not a valid trace.
+    std::vector<TraceRecord> ReadTrace(std::istream& stream, TraceHeader& header);
+}
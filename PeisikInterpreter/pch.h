@@ -4,11 +4,17 @@
 
 #include <algorithm>
 #include <chrono>
+#include <climits>
 #include <cmath>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <map>
+#include <memory>
+#include <sstream>
 #include <stack>
 #include <stdexcept>
 #include <string>
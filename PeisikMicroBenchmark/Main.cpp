@@ -0,0 +1,422 @@
+#include "pch.h"
+#include "CompactBytecode.h"
+#include "Interpreter.h"
+#include "PeisikException.h"
+#include "Program.h"
+#include "ProgramBuilder.h"
+#include "Scheduler.h"
+#include "Statistics.h"
+
+using namespace Peisik;
+using namespace Peisik::Benchmark;
+
+// Each benchmark body is repeated this many times within one loop iteration
+// to make the loop overhead small compared to the measured operations.
+static const int UnrollCount = 16;
+
+// The constant table layout shared by all loop programs
+static const short IterationsConstant = 0;
+static const short OneConstant = 1;
+static const short TrueConstant = 2;
+static const short FalseConstant = 3;
+
+// The local layout of the main function
+static const short CounterLocal = 0;
+static const short ScratchLocal = 1;
+
+// The function index of the callee in call benchmarks
+static const short CalleeFunction = 1;
+
+// Describes a benchmark that runs a sequence of instructions in a loop.
+struct LoopBenchmark
+{
+    std::string name;
+    std::vector<BytecodeOp> body;
+    // If non-negative, a void callee with this many locals is added to the program
+    short calleeLocals;
+};
+
+// Builds a program whose main function runs the body in a counted loop.
+// The body may only use the shared constants and locals.
+static Program BuildLoopProgram(const LoopBenchmark& benchmark, int iterations, bool compact)
+{
+    ProgramBuilder builder;
+    builder.AddIntConstant(iterations);
+    builder.AddIntConstant(1);
+    builder.AddBoolConstant(true);
+    builder.AddBoolConstant(false);
+
+    std::vector<BytecodeOp> code;
+    // while <(i, iterations)
+    code.push_back(BytecodeOp(Opcode::PushLocal, CounterLocal));
+    code.push_back(BytecodeOp(Opcode::PushConst, IterationsConstant));
+    code.push_back(BytecodeOp(Opcode::CallI2, static_cast<short>(InternalFunction::Less)));
+    auto exitJump = code.size();
+    code.push_back(BytecodeOp(Opcode::JumpFalse, 0));
+
+    for (int i = 0; i < UnrollCount; i++)
+        code.insert(code.end(), benchmark.body.begin(), benchmark.body.end());
+
+    // i = +(i, 1)
+    code.push_back(BytecodeOp(Opcode::PushLocal, CounterLocal));
+    code.push_back(BytecodeOp(Opcode::PushConst, OneConstant));
+    code.push_back(BytecodeOp(Opcode::CallI2, static_cast<short>(InternalFunction::Plus)));
+    code.push_back(BytecodeOp(Opcode::PopLocal, CounterLocal));
+    code.push_back(BytecodeOp(Opcode::Jump, static_cast<short>(-static_cast<int>(code.size()))));
+
+    code[exitJump].param = static_cast<short>(code.size() - exitJump);
+    code.push_back(BytecodeOp(Opcode::Return, 0));
+
+    auto main = builder.AddFunction(PrimitiveType::Void, 0,
+        std::vector<PrimitiveType>(2, PrimitiveType::Int), code);
+    builder.SetMainFunction(main);
+
+    if (benchmark.calleeLocals >= 0)
+    {
+        builder.AddFunction(PrimitiveType::Void, 0,
+            std::vector<PrimitiveType>(benchmark.calleeLocals, PrimitiveType::Int),
+            std::vector<BytecodeOp>(1, BytecodeOp(Opcode::Return, 0)));
+    }
+
+    std::stringstream stream;
+    builder.Serialize(stream);
+    auto program = DeserializeProgram(stream);
+    if (compact)
+        CompactProgram(program);
+    return program;
+}
+
+// Returns the median execution time of the program in seconds.
+static double TimeExecution(const Program& program, int runs)
+{
+    std::vector<double> samples;
+    for (int run = 0; run < runs; run++)
+    {
+        Interpreter interpreter(program);
+        auto start = std::chrono::high_resolution_clock::now();
+        interpreter.Execute();
+        auto end = std::chrono::high_resolution_clock::now();
+
+        samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9);
+    }
+    return Summarize(samples).median;
+}
+
+static std::vector<LoopBenchmark> GetLoopBenchmarks()
+{
+    std::vector<LoopBenchmark> result;
+    auto add = [&result](const std::string& name, std::vector<BytecodeOp> body, short calleeLocals)
+    {
+        LoopBenchmark benchmark = { name, body, calleeLocals };
+        result.push_back(benchmark);
+    };
+
+    // Single stack operations cannot be measured without their counterpart,
+    // so they are measured in balanced pairs
+    add("Jump", { BytecodeOp(Opcode::Jump, 1) }, -1);
+    add("PushConst + PopDiscard", { BytecodeOp(Opcode::PushConst, OneConstant), BytecodeOp(Opcode::PopDiscard, 0) }, -1);
+    add("PushConst + PopLocal", { BytecodeOp(Opcode::PushConst, OneConstant), BytecodeOp(Opcode::PopLocal, ScratchLocal) }, -1);
+    add("PushLocal + PopDiscard", { BytecodeOp(Opcode::PushLocal, ScratchLocal), BytecodeOp(Opcode::PopDiscard, 0) }, -1);
+    add("PushLocal + PopLocal", { BytecodeOp(Opcode::PushLocal, ScratchLocal), BytecodeOp(Opcode::PopLocal, ScratchLocal) }, -1);
+
+    // Both branch directions continue at the next instruction
+    add("PushConst + JumpFalse taken", { BytecodeOp(Opcode::PushConst, FalseConstant), BytecodeOp(Opcode::JumpFalse, 1) }, -1);
+    add("PushConst + JumpFalse not taken", { BytecodeOp(Opcode::PushConst, TrueConstant), BytecodeOp(Opcode::JumpFalse, 1) }, -1);
+
+    // The version 7 instructions, compared to the sequences they replace
+    add("PushImm + PopDiscard", { BytecodeOp(Opcode::PushImm, 1), BytecodeOp(Opcode::PopDiscard, 0) }, -1);
+    add("PushLocal + PlusImm + PopLocal", { BytecodeOp(Opcode::PushLocal, ScratchLocal),
+        BytecodeOp(Opcode::PlusImm, 1), BytecodeOp(Opcode::PopLocal, ScratchLocal) }, -1);
+    add("PushLocal + PushConst + Plus + PopLocal", { BytecodeOp(Opcode::PushLocal, ScratchLocal),
+        BytecodeOp(Opcode::PushConst, OneConstant), BytecodeOp(Opcode::CallI2, static_cast<short>(InternalFunction::Plus)),
+        BytecodeOp(Opcode::PopLocal, ScratchLocal) }, -1);
+    add("PushLocal + PushImm + JumpIfNotLess", { BytecodeOp(Opcode::PushLocal, ScratchLocal),
+        BytecodeOp(Opcode::PushImm, 1), BytecodeOp(Opcode::JumpIfNotLess, 1) }, -1);
+    add("PushLocal + PushConst + Less + JumpFalse", { BytecodeOp(Opcode::PushLocal, ScratchLocal),
+        BytecodeOp(Opcode::PushConst, OneConstant), BytecodeOp(Opcode::CallI2, static_cast<short>(InternalFunction::Less)),
+        BytecodeOp(Opcode::JumpFalse, 1) }, -1);
+
+    // Call and return, with PrepareFrameForFunction scaling by the local count
+    const short localCounts[] = { 0, 4, 16, 64 };
+    for (auto locals : localCounts)
+    {
+        add("Call + Return, " + std::to_string(locals) + " locals", { BytecodeOp(Opcode::Call, CalleeFunction) }, locals);
+    }
+
+    // Internal calls through DispatchInternalCall. Plus accepts any number of parameters in the interpreter.
+    // CallI0 is left out since the only parameterless internal function is FailFast.
+    for (int arity = 1; arity <= 7; arity++)
+    {
+        std::vector<BytecodeOp> body(arity, BytecodeOp(Opcode::PushConst, OneConstant));
+        body.push_back(BytecodeOp(static_cast<Opcode>(static_cast<int>(Opcode::CallI0) + arity),
+            static_cast<short>(InternalFunction::Plus)));
+        body.push_back(BytecodeOp(Opcode::PopDiscard, 0));
+
+        add("CallI" + std::to_string(arity) + " Plus, with pushes and pop", body, -1);
+    }
+
+    return result;
+}
+
+// Adds the specified number of void functions that store a constant in their locals.
+// Returns the instruction count of each function.
+static size_t AddModuleFunctions(ProgramBuilder& builder, int functionCount)
+{
+    const int localsPerFunction = 4;
+    const int opsPerFunction = 32;
+
+    std::vector<BytecodeOp> code;
+    for (int i = 0; i < opsPerFunction - 1; i += 2)
+    {
+        code.push_back(BytecodeOp(Opcode::PushConst, 0));
+        code.push_back(BytecodeOp(Opcode::PopLocal, static_cast<short>(i % localsPerFunction)));
+    }
+    code.push_back(BytecodeOp(Opcode::Return, 0));
+
+    for (int i = 0; i < functionCount; i++)
+    {
+        builder.AddFunction(PrimitiveType::Void, 0,
+            std::vector<PrimitiveType>(localsPerFunction, PrimitiveType::Int), code);
+    }
+
+    return code.size();
+}
+
+// Serializes a program with the specified number of functions for DeserializeProgram benchmarks.
+// Returns the total instruction count through the last parameter.
+static std::string BuildModuleImage(int functionCount, bool compact, size_t& instructionCount)
+{
+    ProgramBuilder builder;
+    builder.AddIntConstant(1);
+    builder.SetCompact(compact);
+    instructionCount = static_cast<size_t>(functionCount) * AddModuleFunctions(builder, functionCount);
+
+    std::stringstream stream;
+    builder.Serialize(stream);
+    return stream.str();
+}
+
+// Builds a program whose main function calls each of the specified number of functions once,
+// so that the executed code is larger than the caches for large function counts.
+// Returns the executed instruction count through the last parameter.
+static Program BuildCallSweepProgram(int functionCount, bool compact, size_t& instructionCount)
+{
+    ProgramBuilder builder;
+    builder.AddIntConstant(1);
+    auto functionSize = AddModuleFunctions(builder, functionCount);
+
+    std::vector<BytecodeOp> code;
+    for (int i = 0; i < functionCount; i++)
+        code.push_back(BytecodeOp(Opcode::Call, static_cast<short>(i)));
+    code.push_back(BytecodeOp(Opcode::Return, 0));
+    builder.SetMainFunction(builder.AddFunction(PrimitiveType::Void, 0, std::vector<PrimitiveType>(), code));
+
+    instructionCount = static_cast<size_t>(functionCount) * (functionSize + 1) + 1;
+
+    std::stringstream stream;
+    builder.Serialize(stream);
+    auto program = DeserializeProgram(stream);
+    if (compact)
+        CompactProgram(program);
+    return program;
+}
+
+// Returns the median time to run the program in the specified number of interpreters on the scheduler,
+// and the total executed instruction count through the last parameter.
+static double TimeScheduledExecution(const Program& program, int programCount, unsigned workers, int runs,
+    uint64_t& instructionCount)
+{
+    // Short slices, so that the switching cost is visible
+    const uint64_t TimeSlice = 1000;
+
+    std::vector<double> samples;
+    for (int run = 0; run < runs; run++)
+    {
+        std::vector<std::unique_ptr<Interpreter>> interpreters;
+        for (int i = 0; i < programCount; i++)
+            interpreters.emplace_back(new Interpreter(program));
+
+        Scheduler scheduler(workers, TimeSlice);
+        std::atomic<int> failures(0);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (auto& interpreter : interpreters)
+        {
+            scheduler.Submit(*interpreter, [&failures](Interpreter&, ExecutionStatus status, std::exception_ptr)
+            {
+                if (status != ExecutionStatus::Finished)
+                    failures++;
+            });
+        }
+        scheduler.WaitAll();
+        auto end = std::chrono::high_resolution_clock::now();
+
+        if (failures > 0)
+            throw InterpreterException("A scheduled program failed.");
+        instructionCount = 0;
+        for (auto& interpreter : interpreters)
+            instructionCount += interpreter->GetExecutedOpCount();
+        samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9);
+    }
+    return Summarize(samples).median;
+}
+
+static void PrintRow(const std::string& name, double nanosecondsPerOp)
+{
+    std::cout << std::left << std::setw(50) << name << std::right << std::fixed
+        << std::setprecision(2) << std::setw(10) << nanosecondsPerOp << std::endl;
+    std::cout.unsetf(std::ios_base::floatfield);
+}
+
+void PrintHelp()
+{
+    std::cout << "Peisik interpreter micro-benchmarks" << std::endl;
+    std::cout << "Usage: peisikmicro [parameters]" << std::endl;
+    std::cout << "Possible parameters:" << std::endl;
+    std::cout << " --compact         Run the loop benchmarks in the compact encoding." << std::endl;
+    std::cout << " --filter TEXT     Only run benchmarks whose name contains TEXT." << std::endl;
+    std::cout << " --help            Show this help." << std::endl;
+    std::cout << " --iterations N    Loop iterations per run (default: 100000)." << std::endl;
+    std::cout << " --runs N          Runs per benchmark, the median is reported (default: 5)." << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    // Parse the command line
+
+    bool compact = false;
+    std::string filter;
+    int iterations = 100000;
+    int runs = 5;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        bool hasValue = (i + 1 < argc);
+
+        if (arg == "--compact")
+        {
+            compact = true;
+        }
+        else if (arg == "--filter" && hasValue)
+        {
+            filter = argv[++i];
+        }
+        else if (arg == "--iterations" && hasValue)
+        {
+            iterations = std::atoi(argv[++i]);
+        }
+        else if (arg == "--runs" && hasValue)
+        {
+            runs = std::atoi(argv[++i]);
+        }
+        else
+        {
+            if (arg != "--help")
+                std::cout << "Unknown or incomplete parameter: " << arg << std::endl;
+            PrintHelp();
+            return 0;
+        }
+    }
+
+    if (iterations < 1 || runs < 1)
+    {
+        PrintHelp();
+        return 0;
+    }
+
+    try
+    {
+        std::cout << std::left << std::setw(50) << "Benchmark" << std::right << std::setw(10) << "ns/op" << std::endl;
+
+        // The loop itself is measured first and subtracted from the rest
+        LoopBenchmark empty = { "Empty loop", std::vector<BytecodeOp>(), -1 };
+        double loopTime = TimeExecution(BuildLoopProgram(empty, iterations, compact), runs);
+        PrintRow("Loop overhead per iteration", loopTime / iterations * 1e9);
+
+        for (auto& benchmark : GetLoopBenchmarks())
+        {
+            if (benchmark.name.find(filter) == std::string::npos)
+                continue;
+
+            double time = TimeExecution(BuildLoopProgram(benchmark, iterations, compact), runs);
+            PrintRow(benchmark.name, (time - loopTime) / (static_cast<double>(iterations) * UnrollCount) * 1e9);
+        }
+
+        // Module loading, reported per loaded instruction
+        const int functionCounts[] = { 10, 100, 1000, 10000 };
+        for (auto functionCount : functionCounts)
+        {
+            for (auto compactImage : { false, true })
+            {
+                for (auto lazy : { false, true })
+                {
+                    // The lazy rows only index the functions, which is what delays the first instruction
+                    auto name = std::string("DeserializeProgram") + (compactImage ? " compact" : "") + (lazy ? " lazy" : "")
+                        + ", " + std::to_string(functionCount) + " functions";
+                    if (name.find(filter) == std::string::npos)
+                        continue;
+
+                    size_t instructionCount = 0;
+                    auto image = BuildModuleImage(functionCount, compactImage, instructionCount);
+
+                    std::vector<double> samples;
+                    for (int run = 0; run < runs; run++)
+                    {
+                        std::istringstream stream(image);
+                        auto start = std::chrono::high_resolution_clock::now();
+                        auto program = lazy ? DeserializeProgramLazily(stream, false) : DeserializeProgram(stream);
+                        auto end = std::chrono::high_resolution_clock::now();
+
+                        if (program.GetFunctionCount() != functionCount)
+                            throw InterpreterException("Deserialized function count does not match.");
+                        samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9);
+                    }
+
+                    PrintRow(name, Summarize(samples).median / instructionCount * 1e9);
+                }
+            }
+        }
+
+        // Code footprint, reported per executed instruction
+        const int sweepFunctionCounts[] = { 1000, 30000 };
+        for (auto functionCount : sweepFunctionCounts)
+        {
+            for (auto compactCode : { false, true })
+            {
+                auto name = std::string("Call sweep") + (compactCode ? " compact" : "")
+                    + ", " + std::to_string(functionCount) + " functions";
+                if (name.find(filter) == std::string::npos)
+                    continue;
+
+                size_t instructionCount = 0;
+                auto program = BuildCallSweepProgram(functionCount, compactCode, instructionCount);
+                PrintRow(name, TimeExecution(program, runs) / instructionCount * 1e9);
+            }
+        }
+
+        // Green threads, reported per executed instruction of all the programs
+        const int ScheduledProgramCount = 1000;
+        std::vector<unsigned> workerCounts = { 1 };
+        if (std::thread::hardware_concurrency() > 1)
+            workerCounts.push_back(std::thread::hardware_concurrency());
+        for (auto workers : workerCounts)
+        {
+            auto name = "Scheduler, " + std::to_string(ScheduledProgramCount) + " programs, "
+                + std::to_string(workers) + (workers == 1 ? " worker" : " workers");
+            if (name.find(filter) == std::string::npos)
+                continue;
+
+            auto program = BuildLoopProgram(empty, std::max(iterations / 100, 1), compact);
+            uint64_t instructionCount = 0;
+            auto time = TimeScheduledExecution(program, ScheduledProgramCount, workers, runs, instructionCount);
+            PrintRow(name, time / instructionCount * 1e9);
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "pch.h"
+#include "CompactBytecode.h"
+#include "Program.h"
+#include "ProgramBuilder.h"
+
+using namespace Peisik;
+using namespace Peisik::Benchmark;
+
+ProgramBuilder::ProgramBuilder()
+    : m_mainFunctionIndex(0), m_compact(false)
+{
+}
+
+short ProgramBuilder::AddIntConstant(int64_t value)
+{
+    m_constants.push_back(std::make_pair(PrimitiveType::Int, value));
+    return static_cast<short>(m_constants.size() - 1);
+}
+
+short ProgramBuilder::AddBoolConstant(bool value)
+{
+    m_constants.push_back(std::make_pair(PrimitiveType::Bool, value ? 1 : 0));
+    return static_cast<short>(m_constants.size() - 1);
+}
+
+short ProgramBuilder::AddFunction(PrimitiveType returnType, short parameterCount,
+    const std::vector<PrimitiveType>& localTypes, const std::vector<BytecodeOp>& bytecode)
+{
+    FunctionEntry entry;
+    entry.returnType = returnType;
+    entry.parameterCount = parameterCount;
+    entry.localTypes = localTypes;
+    entry.bytecode = bytecode;
+
+    m_functions.push_back(entry);
+    return static_cast<short>(m_functions.size() - 1);
+}
+
+void ProgramBuilder::SetMainFunction(short index)
+{
+    m_mainFunctionIndex = index;
+}
+
+void ProgramBuilder::SetCompact(bool value)
+{
+    m_compact = value;
+}
+
+template <typename T>
+static void Write(T value, std::ostream& stream)
+{
+    stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void ProgramBuilder::Serialize(std::ostream& stream) const
+{
+    // See CompiledProgram.Serialize() in the compiler for the reference
+    Write<uint32_t>(0x53494550, stream);
+    Write<uint32_t>(Program::BytecodeVersion | (m_compact ? Program::CompactEncodingFlag : 0), stream);
+    Write<uint32_t>(m_mainFunctionIndex, stream);
+
+    Write<int32_t>(static_cast<int32_t>(m_constants.size()), stream);
+    for (auto& constant : m_constants)
+    {
+        Write<short>(static_cast<short>(constant.first), stream);
+        const char name[6] = { 0 };
+        stream.write(name, 6);
+        Write<int64_t>(constant.second, stream);
+    }
+
+    Write<int32_t>(static_cast<int32_t>(m_functions.size()), stream);
+    for (auto& function : m_functions)
+    {
+        Write<short>(static_cast<short>(function.returnType), stream);
+        Write<short>(function.parameterCount, stream);
+        Write<short>(static_cast<short>(function.localTypes.size()), stream);
+        for (auto type : function.localTypes)
+            Write<short>(static_cast<short>(type), stream);
+        if (function.localTypes.size() % 2 == 1)
+            Write<short>(0, stream);
+
+        if (m_compact)
+        {
+            std::vector<uint8_t> code;
+            EncodeCompactBytecode(function.bytecode, code);
+            Write<int32_t>(static_cast<int32_t>(code.size()), stream);
+            code.resize((code.size() + 3) & ~static_cast<size_t>(3));
+            stream.write(reinterpret_cast<const char*>(code.data()), code.size());
+        }
+        else
+        {
+            Write<int32_t>(static_cast<int32_t>(function.bytecode.size()), stream);
+            for (auto& op : function.bytecode)
+            {
+                Write<short>(static_cast<short>(op.op), stream);
+                Write<short>(op.param, stream);
+            }
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include "Bytecode.h"
+#include "PObject.h"
+
+namespace Peisik
+{
+    namespace Benchmark
+    {
+        // Builds synthetic programs in the compiled file format.
+        // This allows constructing benchmark programs without going through the compiler.
+        class ProgramBuilder
+        {
+        public:
+            ProgramBuilder();
+
+            // Adds an integer constant and returns its index.
+            short AddIntConstant(int64_t value);
+
+            // Adds a boolean constant and returns its index.
+            short AddBoolConstant(bool value);
+
+            // Adds a function and returns its index.
+            // The first parameterCount locals are the parameters.
+            short AddFunction(PrimitiveType returnType, short parameterCount,
+                const std::vector<PrimitiveType>& localTypes, const std::vector<BytecodeOp>& bytecode);
+
+            // Sets the entry point of the program.
+            void SetMainFunction(short index);
+
+            // Controls whether Serialize stores the bytecode in the compact encoding.
+            void SetCompact(bool value);
+
+            // Writes the program in the format expected by DeserializeProgram.
+            void Serialize(std::ostream& stream) const;
+
+        private:
+            struct FunctionEntry
+            {
+                PrimitiveType returnType;
+                short parameterCount;
+                std::vector<PrimitiveType> localTypes;
+                std::vector<BytecodeOp> bytecode;
+            };
+
+            std::vector<std::pair<PrimitiveType, int64_t>> m_constants;
+            std::vector<FunctionEntry> m_functions;
+            short m_mainFunctionIndex;
+            bool m_compact;
+        };
+    }
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// The precompiled header for the micro-benchmarks.
+// Includes everything the interpreter uses, plus some extras.
+
+#include "../PeisikInterpreter/pch.h"
+
+#include <cstdlib>
+#include <sstream>
@@ -0,0 +1,137 @@
+#include "pch.h"
+#include "Bytecode.h"
+#include "PeisikException.h"
+#include "PObject.h"
+#include "TraceBuffer.h"
+
+using namespace Peisik;
+
+static void PrintTopValue(const TraceRecord& record)
+{
+    PObject top(static_cast<PrimitiveType>(record.topType), record.topValue);
+    switch (top.GetType())
+    {
+    case PrimitiveType::Bool:
+        std::cout << "bool " << (top.GetBoolValue() ? "true" : "false");
+        break;
+    case PrimitiveType::Int:
+        std::cout << "int " << top.GetIntValue();
+        break;
+    case PrimitiveType::Real:
+        std::cout << "real " << top.GetRealValue();
+        break;
+    case PrimitiveType::IntArray:
+        // The elements are not in the trace
+        std::cout << "int[]";
+        break;
+    case PrimitiveType::RealArray:
+        std::cout << "real[]";
+        break;
+    default:
+        std::cout << "-";
+        break;
+    }
+}
+
+// Prints the record in the format of --trace, followed by the top of the stack.
+// Program counters in compact code are byte offsets and printed with a leading @.
+static void PrintRecord(uint64_t index, const TraceRecord& record)
+{
+    std::string programCounter = std::to_string(record.programCounter);
+    if (record.flags & TraceCompactCode)
+        programCounter = "@" + programCounter;
+
+    std::cout << std::right << std::setw(12) << index << " "
+        << std::setw(3) << record.function << ":"
+        << std::left << std::setw(5) << programCounter
+        << " " << std::setw(22) << OpcodeToString(static_cast<Opcode>(record.opcode))
+        << " " << std::setw(7) << record.param << " ";
+    PrintTopValue(record);
+    std::cout << std::endl;
+}
+
+void PrintHelp()
+{
+    std::cout << "Peisik binary trace decoder" << std::endl;
+    std::cout << "Usage: peisiktrace [trace file] [parameters]" << std::endl;
+    std::cout << "Prints the instructions recorded by peisik --bintrace, oldest first, with the index of" << std::endl;
+    std::cout << "each instruction in the whole run and the top of the stack before it was executed." << std::endl;
+    std::cout << "Possible parameters:" << std::endl;
+    std::cout << " --function N    Only print the instructions of function N." << std::endl;
+    std::cout << " --help          Show this help." << std::endl;
+    std::cout << " --last N        Only print the last N recorded instructions." << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    // Parse the command line
+
+    std::string path;
+    int function = -1;
+    uint64_t last = 0;
+    bool showHelp = (argc <= 1);
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+
+        if (arg == "--function" && i + 1 < argc)
+        {
+            function = std::atoi(argv[++i]);
+        }
+        else if (arg == "--last" && i + 1 < argc)
+        {
+            last = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--help" || arg.find("--") == 0 || !path.empty())
+        {
+            if (arg != "--help")
+                std::cout << "Unknown or incomplete parameter: " << arg << std::endl;
+            showHelp = true;
+        }
+        else
+        {
+            path = arg;
+        }
+    }
+
+    if (showHelp || path.empty())
+    {
+        PrintHelp();
+        return 0;
+    }
+
+    std::ifstream stream(path, std::ifstream::binary);
+    if (stream.fail())
+    {
+        std::cout << "Could not open the trace " << path << std::endl;
+        return -1;
+    }
+
+    try
+    {
+        TraceHeader header;
+        auto records = ReadTrace(stream, header);
+
+        // The index of the first record in the whole run
+        uint64_t firstIndex = header.recordCount - records.size();
+        size_t start = 0;
+        if (last > 0 && last < records.size())
+            start = records.size() - static_cast<size_t>(last);
+
+        std::cout << "-- " << header.recordCount << " instructions executed, " << records.size() << " recorded" << std::endl;
+        for (size_t i = start; i < records.size(); i++)
+        {
+            if (function >= 0 && records[i].function != function)
+                continue;
+            PrintRecord(firstIndex + i, records[i]);
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// The precompiled header for the trace decoder.
+// Includes everything the interpreter uses.
+
+#include "../PeisikInterpreter/pch.h"